@@ -1342,7 +1342,10 @@ app.definitions.Socket = L.Class.extend({
 					this.ReconnectCount = 0;
 					clearTimeout(this.timer);
 				}
-			} else if (info.id == 'start' || info.id == 'setvalue')
+			} else if (info.id == 'download')
+				this._map.showBusy(_('Downloading...') + ' ' + info.value + '%', true);
+
+			else if (info.id == 'start' || info.id == 'setvalue')
 				this._map.fire('statusindicator', info);
 
 			else if (info.id == 'finish') {
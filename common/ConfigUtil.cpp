@@ -92,6 +92,7 @@ static const std::unordered_map<std::string, std::string> DefAppConfig = {
 #endif
     { "fetch_update_check", "10" },
     { "fonts_missing.handling", "log" },
+    { "file_server_asset_pack", "" },
     { "file_server_root_path", "browser/.." },
 #if !MOBILEAPP
     { "help_url", HELP_URL },
@@ -155,6 +156,16 @@ static const std::unordered_map<std::string, std::string> DefAppConfig = {
     { "mount_jail_tree", "true" },
     { "net.connection_timeout_secs", "30" },
     { "net.content_security_policy", "" },
+    { "net.dns.cache_ttl_secs", "20" },
+    { "net.dns.negative_cache_ttl_secs", "5" },
+    { "net.dns.resolver_threads", "4" },
+    { "net.dns.stale_ttl_secs", "60" },
+    { "net.epoll", "false" },
+    { "net.file_compression.level", "6" },
+    { "net.file_compression.max_bytes", "67108864" },
+    { "net.file_compression.max_file_size", "16777216" },
+    { "net.file_compression.min_file_size", "1024" },
+    { "net.file_compression[@enable]", "true" },
     { "net.frame_ancestors", "" },
     { "net.listen", "any" },
     { "net.lok_allow.host", R"(192\.168\.[0-9]{1,3}\.[0-9]{1,3})" },
@@ -187,6 +198,10 @@ static const std::unordered_map<std::string, std::string> DefAppConfig = {
     { "net.proto", "all" },
     { "net.proxy_prefix", "false" },
     { "net.service_root", "" },
+    { "net.websocket_compression.level", "1" },
+    { "net.websocket_compression.min_size", "256" },
+    { "net.websocket_compression.window_bits", "15" },
+    { "net.websocket_compression[@enable]", "true" },
     { "num_prespawn_children", NUM_PRESPAWN_CHILDREN },
     { "overwrite_mode.enable", "false" },
     { "per_document.always_save_on_exit", "false" },
@@ -217,6 +232,10 @@ static const std::unordered_map<std::string, std::string> DefAppConfig = {
     { "per_document.min_time_between_uploads_ms", "5000" },
     { "per_document.pdf_resolution_dpi", "96" },
     { "per_document.redlining_as_comments", "false" },
+    { "per_document.speculative_tiles.lookahead_ms", "500" },
+    { "per_document.speculative_tiles.max_bytes", "1048576" },
+    { "per_document.speculative_tiles[@enable]", "true" },
+    { "per_document.tile_cache_eviction", "lru" },
     { "per_view.custom_os_info", "" },
     { "per_view.idle_timeout_secs", "900" },
     { "per_view.min_saved_message_timeout_secs", "6" },
@@ -263,6 +282,12 @@ static const std::unordered_map<std::string, std::string> DefAppConfig = {
     { "ssl.sts.max_age", "31536000" },
     { "ssl.termination", "false" },
     { "stop_on_config_change", "false" },
+    { "storage.connection_pool.idle_timeout_secs", "4" },
+    { "storage.connection_pool.max_idle", "64" },
+    { "storage.connection_pool.max_idle_per_host", "8" },
+    { "storage.delta_upload.chunk_size", "1048576" },
+    { "storage.delta_upload.max_file_size", "67108864" },
+    { "storage.delta_upload[@enable]", "true" },
     { "storage.filesystem[@allow]", "false" },
     { "storage.ssl.as_scheme", "true" },
     { "storage.ssl.ca_file_path", "" },
@@ -283,7 +308,9 @@ static const std::unordered_map<std::string, std::string> DefAppConfig = {
     { "trace.path[@snapshot]", "false" },
     { "trace[@enable]", "false" },
 #if !MOBILEAPP
+    { "trace_event.binary", "false" },
     { "trace_event.path", COOLWSD_TRACEEVENTFILE },
+    { "trace_event.sample_percent", "100" },
     { "trace_event[@enable]", "false" },
 #endif
     { "user_interface.mode", "default" },
@@ -364,12 +391,18 @@ std::map<std::string, std::string> extractAll(const Poco::Util::AbstractConfigur
     map.erase("logging.anonymize");
     map.erase("logging.file");
     map.erase("logging_ui_cmd.file");
+    map.erase("net.dns");
+    map.erase("net.file_compression");
     map.erase("net.lok_allow");
     map.erase("net.post_allow");
+    map.erase("net.websocket_compression");
     map.erase("per_document.cleanup");
+    map.erase("per_document.speculative_tiles");
     map.erase("ssl.hpkp");
     map.erase("ssl.hpkp.pins");
     map.erase("ssl.sts");
+    map.erase("storage.connection_pool");
+    map.erase("storage.delta_upload");
     map.erase("storage.filesystem");
     map.erase("storage.ssl");
     map.erase("storage.wopi");
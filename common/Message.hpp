@@ -17,6 +17,7 @@
 #include <vector>
 #include <functional>
 
+#include "Common.hpp"
 #include "Protocol.hpp"
 #include "StringVector.hpp"
 #include "Log.hpp"
@@ -38,8 +39,7 @@ public:
         _data(copyDataAfterOffset(message.data(), message.size(), _forwardToken.size())),
         _tokens(StringVector::tokenize(_data.data(), _data.size())),
         _id(makeId(dir)),
-        _type(detectType()),
-        _hash(0)
+        _type(detectType())
     {
         LOG_TRC("Message " << abbr());
     }
@@ -54,8 +54,7 @@ public:
         _data(copyDataAfterOffset(message.data(), message.size(), _forwardToken.size())),
         _tokens(StringVector::tokenize(message.data() + _forwardToken.size(), message.size() - _forwardToken.size())),
         _id(makeId(dir)),
-        _type(detectType()),
-        _hash(0)
+        _type(detectType())
     {
         _data.reserve(std::max(reserve, message.size()));
         LOG_TRC("Message " << abbr());
@@ -70,25 +69,37 @@ public:
         _data(copyDataAfterOffset(p, len, _forwardToken.size())),
         _tokens(StringVector::tokenize(_data.data(), _data.size())),
         _id(makeId(dir)),
-        _type(detectType()),
-        _hash(0)
+        _type(detectType())
     {
         LOG_TRC("Message " << abbr());
     }
 
+    /// Construct a message of a header, which must include the full
+    /// first-line, followed by immutable blobs, sent without copying them.
+    Message(const std::string& header, std::vector<Blob> blobs,
+            const enum Dir dir) :
+        _forwardToken(getForwardToken(header.data(), header.size())),
+        _data(copyDataAfterOffset(header.data(), header.size(), _forwardToken.size())),
+        _tokens(StringVector::tokenize(_data.data(), _data.size())),
+        _id(makeId(dir)),
+        _type(detectType()),
+        _blobs(std::move(blobs))
+    {
+        LOG_TRC("Message " << abbr() << " with " << _blobs.size() << " blobs");
+    }
+
     size_t size() const { return _data.size(); }
     const std::vector<char>& data() const { return _data; }
 
+    /// The data sent after data(), shared with their owner.
+    const std::vector<Blob>& blobs() const { return _blobs; }
+
     const StringVector& tokens() const { return _tokens; }
     const std::string& forwardToken() const { return _forwardToken; }
     std::string firstToken() const { return _tokens[0]; }
     bool firstTokenMatches(const std::string& target) const { return _tokens[0] == target; }
     std::string operator[](size_t index) const { return _tokens[index]; }
 
-    /// Allow a message to annotate a hash of its content for use later
-    uint32_t getHash() const { return _hash; }
-    void setHash(uint32_t hash) { _hash = hash; }
-
     /// Find a subarray in the raw message.
     int find(const char* sub, const std::size_t subLen) const
     {
@@ -228,7 +239,7 @@ private:
     const std::string _id;
     std::string _firstLine;
     const Type _type;
-    uint32_t _hash;
+    const std::vector<Blob> _blobs;
 };
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -53,10 +53,16 @@
 #include <png.h>
 #include <zlib.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include <cassert>
 #include <chrono>
+#include <cstring>
 #include <iomanip>
 #include <fstream>
+#include <vector>
 
 #include "Log.hpp"
 #include "TraceEvent.hpp"
@@ -224,6 +230,368 @@ inline bool impl_encodeSubBufferToPNG(unsigned char* pixmap, size_t startX, size
     return true;
 }
 
+/// (c * 255 + a / 2) / a, truncated to 8 bits as by unpremultiply_*_data(),
+/// for each alpha a and colour c, at [a * 256 + c]. Zero where a is zero.
+inline const uint8_t* getUnpremultiplyTable()
+{
+    static const std::vector<uint8_t> table = []()
+    {
+        std::vector<uint8_t> values(256 * 256, 0);
+        for (unsigned int a = 1; a < 256; ++a)
+            for (unsigned int c = 0; c < 256; ++c)
+                values[a * 256 + c] = static_cast<uint8_t>((c * 255 + a / 2) / a);
+        return values;
+    }();
+
+    return table.data();
+}
+
+/// Unpremultiplies a row of @width pixels into RGBA bytes, as the libpng transforms do.
+inline void unpremultiplyRow(const unsigned char* src, uint8_t* dst, int width,
+                             LibreOfficeKitTileMode mode)
+{
+    // Rows are typically opaque, which makes this a plain swizzle.
+    const size_t count = width;
+    size_t x = 0;
+    uint32_t alpha = 0xff000000;
+#if defined(__SSE2__)
+    __m128i alphas = _mm_set1_epi32(0xff000000);
+    for (; x + 4 <= count; x += 4)
+        alphas = _mm_and_si128(alphas,
+                               _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 4)));
+    alphas = _mm_and_si128(alphas, _mm_shuffle_epi32(alphas, _MM_SHUFFLE(1, 0, 3, 2)));
+    alphas = _mm_and_si128(alphas, _mm_shuffle_epi32(alphas, _MM_SHUFFLE(2, 3, 0, 1)));
+    alpha = _mm_cvtsi128_si32(alphas);
+#endif
+    for (; x < count; ++x)
+    {
+        uint32_t pix;
+        std::memcpy(&pix, src + x * 4, sizeof(uint32_t));
+        alpha &= pix;
+    }
+
+    if (alpha == 0xff000000)
+    {
+        if (mode == LOK_TILEMODE_RGBA)
+        {
+            std::memcpy(dst, src, width * 4);
+            return;
+        }
+
+        x = 0;
+#if defined(__SSE2__)
+        const __m128i greenAlpha = _mm_set1_epi32(0xff00ff00);
+        const __m128i low = _mm_set1_epi32(0xff);
+        for (; x + 4 <= count; x += 4)
+        {
+            const __m128i pix = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 4));
+            const __m128i swapped = _mm_or_si128(
+                _mm_and_si128(pix, greenAlpha),
+                _mm_or_si128(_mm_and_si128(_mm_srli_epi32(pix, 16), low),
+                             _mm_slli_epi32(_mm_and_si128(pix, low), 16)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 4), swapped);
+        }
+#endif
+        for (; x < count; ++x)
+        {
+            uint32_t pix;
+            std::memcpy(&pix, src + x * 4, sizeof(uint32_t));
+            pix = (pix & 0xff00ff00) | ((pix >> 16) & 0xff) | ((pix & 0xff) << 16);
+            std::memcpy(dst + x * 4, &pix, sizeof(uint32_t));
+        }
+        return;
+    }
+
+    const uint8_t* table = getUnpremultiplyTable();
+    const int red = mode == LOK_TILEMODE_BGRA ? 16 : 0;
+    const int blue = 16 - red;
+    for (x = 0; x < count; ++x)
+    {
+        uint32_t pix;
+        std::memcpy(&pix, src + x * 4, sizeof(uint32_t));
+        const uint32_t a = pix >> 24;
+        const uint8_t* row = table + a * 256;
+        dst[x * 4 + 0] = row[(pix >> red) & 0xff];
+        dst[x * 4 + 1] = row[(pix >> 8) & 0xff];
+        dst[x * 4 + 2] = row[(pix >> blue) & 0xff];
+        dst[x * 4 + 3] = a;
+    }
+}
+
+/// Writes the PNG filter type and the filtered bytes of @cur, with @prev
+/// the row above, into @out. Both rows are preceded by 4 zero bytes, the
+/// pixel left of the first. Of the five filters, picks the one with the
+/// smallest sum of absolute differences, as libpng does. @scratch holds
+/// 4 * @size bytes, for the candidates.
+inline void filterRow(const uint8_t* cur, const uint8_t* prev, size_t size, uint8_t* out,
+                      uint8_t* scratch)
+{
+    constexpr size_t bpp = 4;
+
+    // Compute all the candidates in one go, into consecutive rows of @scratch.
+    uint8_t* sub = scratch;
+    uint8_t* up = sub + size;
+    uint8_t* avg = up + size;
+    uint8_t* paeth = avg + size;
+    uint64_t sums[5] = { 0, 0, 0, 0, 0 };
+
+    size_t i = 0;
+#if defined(__SSE2__) && defined(__x86_64__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+    const auto load = [](const uint8_t* p)
+    { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); };
+    const auto store = [](uint8_t* p, __m128i v)
+    { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); };
+    // The sums of the absolute values of the residuals, as signed bytes.
+    const auto costs = [&](__m128i v)
+    { return _mm_sad_epu8(_mm_min_epu8(v, _mm_sub_epi8(zero, v)), zero); };
+    const auto abs16 = [&](__m128i v) { return _mm_max_epi16(v, _mm_sub_epi16(zero, v)); };
+    const auto select = [](__m128i mask, __m128i ifSet, __m128i ifClear)
+    { return _mm_or_si128(_mm_and_si128(mask, ifSet), _mm_andnot_si128(mask, ifClear)); };
+    const auto paethPredictor = [&](__m128i a, __m128i b, __m128i c)
+    {
+        const __m128i pa = abs16(_mm_sub_epi16(b, c));
+        const __m128i pb = abs16(_mm_sub_epi16(a, c));
+        const __m128i pc = abs16(_mm_sub_epi16(_mm_add_epi16(a, b), _mm_add_epi16(c, c)));
+        const __m128i notA = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+        return select(notA, select(_mm_cmpgt_epi16(pb, pc), c, b), a);
+    };
+
+    __m128i sumNone = zero, sumSub = zero, sumUp = zero, sumAvg = zero, sumPaeth = zero;
+    for (; i + 16 <= size; i += 16)
+    {
+        const __m128i c = load(cur + i);
+        const __m128i a = load(cur + i - bpp);
+        const __m128i b = load(prev + i);
+        const __m128i d = load(prev + i - bpp);
+
+        const __m128i vSub = _mm_sub_epi8(c, a);
+        const __m128i vUp = _mm_sub_epi8(c, b);
+        // _mm_avg_epu8 rounds up, PNG down.
+        const __m128i mean =
+            _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+        const __m128i vAvg = _mm_sub_epi8(c, mean);
+        const __m128i predictor = _mm_packus_epi16(
+            paethPredictor(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero),
+                           _mm_unpacklo_epi8(d, zero)),
+            paethPredictor(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero),
+                           _mm_unpackhi_epi8(d, zero)));
+        const __m128i vPaeth = _mm_sub_epi8(c, predictor);
+
+        store(sub + i, vSub);
+        store(up + i, vUp);
+        store(avg + i, vAvg);
+        store(paeth + i, vPaeth);
+
+        sumNone = _mm_add_epi64(sumNone, costs(c));
+        sumSub = _mm_add_epi64(sumSub, costs(vSub));
+        sumUp = _mm_add_epi64(sumUp, costs(vUp));
+        sumAvg = _mm_add_epi64(sumAvg, costs(vAvg));
+        sumPaeth = _mm_add_epi64(sumPaeth, costs(vPaeth));
+    }
+
+    const __m128i vSums[5] = { sumNone, sumSub, sumUp, sumAvg, sumPaeth };
+    for (int filter = 0; filter < 5; ++filter)
+        sums[filter] = _mm_cvtsi128_si64(vSums[filter]) +
+                       _mm_cvtsi128_si64(_mm_unpackhi_epi64(vSums[filter], vSums[filter]));
+#endif
+
+    const auto cost = [](uint8_t v) { return v < 128 ? v : 256 - v; };
+    for (; i < size; ++i)
+    {
+        const int c = cur[i];
+        const int a = cur[i - bpp];
+        const int b = prev[i];
+        const int d = prev[i - bpp];
+
+        const int p = a + b - d;
+        const int pa = std::abs(p - a);
+        const int pb = std::abs(p - b);
+        const int pc = std::abs(p - d);
+        const int predictor = (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : d);
+
+        sub[i] = c - a;
+        up[i] = c - b;
+        avg[i] = c - ((a + b) >> 1);
+        paeth[i] = c - predictor;
+
+        sums[0] += cost(c);
+        sums[1] += cost(sub[i]);
+        sums[2] += cost(up[i]);
+        sums[3] += cost(avg[i]);
+        sums[4] += cost(paeth[i]);
+    }
+
+    int best = 0;
+    for (int filter = 1; filter < 5; ++filter)
+    {
+        if (sums[filter] < sums[best])
+            best = filter;
+    }
+
+    out[0] = best;
+    std::memcpy(out + 1, best == 0 ? cur : scratch + (best - 1) * size, size);
+}
+
+/// The state of the PNG encoder of a thread, reused between images.
+class PngEncoderState final
+{
+    z_stream _stream;
+    bool _initialized;
+
+    PngEncoderState()
+        : _stream()
+        , _initialized(false)
+    {
+        // Filtered tiles are mostly runs of zeros, so only looking for runs
+        // is about three times faster than libpng's level 4, and the output
+        // only a few percent larger.
+        _initialized =
+            deflateInit2(&_stream, Z_BEST_SPEED, Z_DEFLATED, 15, 8, Z_RLE) == Z_OK;
+    }
+
+    ~PngEncoderState()
+    {
+        if (_initialized)
+            deflateEnd(&_stream);
+    }
+
+public:
+    /// The unpremultiplied current and previous rows.
+    std::vector<uint8_t> _rows;
+    /// The row filtered in each way.
+    std::vector<uint8_t> _candidates;
+    /// The filtered image, to deflate.
+    std::vector<uint8_t> _filtered;
+
+    static PngEncoderState& get()
+    {
+        static thread_local PngEncoderState state;
+        return state;
+    }
+
+    /// A deflate stream ready for a new image, or null.
+    z_stream* getStream()
+    {
+        if (!_initialized || deflateReset(&_stream) != Z_OK)
+            return nullptr;
+        return &_stream;
+    }
+};
+
+/// Appends a PNG chunk of @type, with up to @maxSize bytes of data written
+/// by @writeData, which returns how many it wrote, or -1 on failure.
+template <typename WriteData>
+inline bool appendPngChunk(std::vector<char>& output, const char* type, size_t maxSize,
+                           WriteData writeData)
+{
+    const size_t start = output.size();
+    output.resize(start + 8 + maxSize + 4);
+    const long size = writeData(reinterpret_cast<uint8_t*>(output.data() + start + 8));
+    if (size < 0 || static_cast<size_t>(size) > maxSize || size > 0x7fffffff)
+    {
+        output.resize(start);
+        return false;
+    }
+
+    uint8_t* chunk = reinterpret_cast<uint8_t*>(output.data() + start);
+    const uint32_t length = size;
+    chunk[0] = length >> 24;
+    chunk[1] = length >> 16;
+    chunk[2] = length >> 8;
+    chunk[3] = length;
+    std::memcpy(chunk + 4, type, 4);
+
+    const uint32_t crc = crc32(crc32(0, nullptr, 0), chunk + 4, 4 + size);
+    uint8_t* end = chunk + 8 + size;
+    end[0] = crc >> 24;
+    end[1] = crc >> 16;
+    end[2] = crc >> 8;
+    end[3] = crc;
+
+    output.resize(start + 8 + size + 4);
+    return true;
+}
+
+/// Encodes as impl_encodeSubBufferToPNG(), without libpng: the image decodes
+/// to the same RGBA pixels, but is filtered and deflated faster.
+inline bool impl_encodeSubBufferToPNGFast(const unsigned char* pixmap, size_t startX,
+                                          size_t startY, int width, int height,
+                                          int bufferWidth, int bufferHeight,
+                                          std::vector<char>& output,
+                                          LibreOfficeKitTileMode mode)
+{
+    if (bufferWidth < width || bufferHeight < height || width <= 0 || height <= 0)
+        return false;
+
+    PngEncoderState& state = PngEncoderState::get();
+    z_stream* stream = state.getStream();
+    if (!stream)
+        return false;
+
+    // Unpremultiply and filter, a row at a time, into the image to deflate.
+    // Both rows start with the zero pixel left of the first.
+    const size_t rowSize = static_cast<size_t>(width) * 4;
+    const size_t stride = rowSize + 4;
+    state._rows.assign(2 * stride, 0);
+    state._candidates.resize(4 * rowSize);
+    state._filtered.resize((rowSize + 1) * height);
+    uint8_t* prev = state._rows.data() + 4;
+    uint8_t* cur = prev + stride;
+    for (int y = 0; y < height; ++y)
+    {
+        const size_t position = ((startY + y) * bufferWidth * 4) + (startX * 4);
+        unpremultiplyRow(pixmap + position, cur, width, mode);
+        filterRow(cur, prev, rowSize, state._filtered.data() + y * (rowSize + 1),
+                  state._candidates.data());
+        std::swap(prev, cur);
+    }
+
+    const size_t start = output.size();
+
+    static const char signature[8] = { '\x89', 'P', 'N', 'G', '\r', '\n', '\x1a', '\n' };
+    output.insert(output.end(), signature, signature + sizeof(signature));
+
+    const bool written =
+        appendPngChunk(output, "IHDR", 13,
+                       [&](uint8_t* data)
+                       {
+                           const uint32_t dimensions[2] = { static_cast<uint32_t>(width),
+                                                            static_cast<uint32_t>(height) };
+                           for (int i = 0; i < 2; ++i)
+                           {
+                               data[i * 4 + 0] = dimensions[i] >> 24;
+                               data[i * 4 + 1] = dimensions[i] >> 16;
+                               data[i * 4 + 2] = dimensions[i] >> 8;
+                               data[i * 4 + 3] = dimensions[i];
+                           }
+                           data[8] = 8; // Bit depth.
+                           data[9] = 6; // RGBA.
+                           data[10] = 0; // Deflate.
+                           data[11] = 0; // Adaptive filtering.
+                           data[12] = 0; // Not interlaced.
+                           return 13;
+                       }) &&
+        appendPngChunk(output, "IDAT", deflateBound(stream, state._filtered.size()),
+                       [&](uint8_t* data)
+                       {
+                           stream->next_in = state._filtered.data();
+                           stream->avail_in = state._filtered.size();
+                           stream->next_out = data;
+                           stream->avail_out = deflateBound(stream, state._filtered.size());
+                           if (deflate(stream, Z_FINISH) != Z_STREAM_END)
+                               return -1L;
+                           return static_cast<long>(stream->total_out);
+                       }) &&
+        appendPngChunk(output, "IEND", 0, [](uint8_t*) { return 0L; });
+
+    if (!written)
+        output.resize(start);
+
+    return written;
+}
+
 /// Sadly, older libpng headers don't use const for the pixmap pointer parameter to
 /// png_write_row(), so can't use const here for pixmap.
 inline bool encodeSubBufferToPNG(unsigned char* pixmap, size_t startX, size_t startY, int width,
@@ -234,8 +602,8 @@ inline bool encodeSubBufferToPNG(unsigned char* pixmap, size_t startX, size_t st
 
     const auto start = std::chrono::steady_clock::now();
 
-    const bool res = impl_encodeSubBufferToPNG(pixmap, startX, startY, width, height, bufferWidth,
-                                               bufferHeight, output, mode);
+    const bool res = impl_encodeSubBufferToPNGFast(pixmap, startX, startY, width, height,
+                                                   bufferWidth, bufferHeight, output, mode);
     if (Log::traceEnabled())
     {
         const auto end = std::chrono::steady_clock::now();
@@ -28,6 +28,7 @@
 #include "Delta.hpp"
 #include "Rectangle.hpp"
 #include "TileDesc.hpp"
+#include "TraceEvent.hpp"
 
 namespace RenderTiles
 {
@@ -55,6 +56,35 @@ namespace RenderTiles
         unsigned char *data() { return _data; }
     };
 
+    /// Tile rows per painted band, all rows unless it is worth pipelining.
+    ///
+    /// Each band is another paintPartTile() call, whose fixed cost shows as a
+    /// lower MP/s in the "paintPartTile" debug line below when painting more
+    /// bands, against COOL_NO_RENDER_PIPELINE=1. What it buys is compressing a
+    /// band while painting the next, which shows as a higher "paintPartTile+comp"
+    /// MP/s and as the overlap in the doRender trace event. Compressing a band of
+    /// fewer tiles than the pool has threads, including ours helping in run(),
+    /// leaves it idle while the next band is painted: such bands add calls
+    /// without adding overlap. So bands have a tile per thread, and at least
+    /// MinBandTiles, and only combines of two such bands or more are split.
+    static size_t getBandTileRows(size_t tilesByY, size_t tileCount, const ThreadPool& pngPool)
+    {
+        static constexpr size_t MinBandTiles = 4;
+
+        const size_t allRows = std::max<size_t>(tilesByY, 1);
+        static const bool disabled = !!getenv("COOL_NO_RENDER_PIPELINE");
+        if (disabled || pngPool.threadCount() == 0 || tileCount == 0)
+            return allRows;
+
+        const size_t bandTiles = std::max(pngPool.threadCount() + 1, MinBandTiles);
+        if (tileCount < 2 * bandTiles)
+            return allRows;
+
+        // Combines may be sparse: go by the tiles per row on average.
+        const size_t bandRows = (bandTiles * allRows + tileCount - 1) / tileCount;
+        return bandRows * 2 > allRows ? allRows : bandRows;
+    }
+
     // FIXME: we should perhaps increment only on a plausible edit
     static TileWireId getCurrentWireId(bool increment = false)
     {
@@ -116,22 +146,23 @@ namespace RenderTiles
 
         RenderTiles::Buffer pixmap(pixmapWidth, pixmapHeight);
 
-        // Render the whole area
+        // Paint in bands of whole tile rows, queueing the compression of each
+        // band as soon as it is painted, so the pool compresses band N while
+        // we paint band N+1.
+        const size_t bandTileRows = getBandTileRows(tilesByY, tiles.size(), pngPool);
+        const size_t bandCount = (tilesByY + bandTileRows - 1) / bandTileRows;
+
+        std::vector<std::vector<size_t>> bandTiles(bandCount);
+        for (size_t i = 0; i < tileRecs.size(); ++i)
+        {
+            const size_t positionY = (tileRecs[i].getTop() - renderArea.getTop()) / tileCombined.getTileHeight();
+            bandTiles[positionY / bandTileRows].push_back(i);
+        }
+
         const double area = pixmapWidth * pixmapHeight;
         const auto start = std::chrono::steady_clock::now();
-        LOG_TRC("Calling paintPartTile(" << (void*)pixmap.data() << ')');
-        document->paintPartTile(pixmap.data(),
-                                tileCombined.getPart(),
-                                tileCombined.getEditMode(),
-                                pixmapWidth, pixmapHeight,
-                                renderArea.getLeft(), renderArea.getTop(),
-                                renderArea.getWidth(), renderArea.getHeight());
-        auto duration = std::chrono::steady_clock::now() - start;
-        const auto elapsedUs = std::chrono::duration_cast<std::chrono::microseconds>(duration);
-        LOG_DBG("paintPartTile      " << tileRecs.size() << " tiles at ("
-                << renderArea.getLeft() << ", " << renderArea.getTop() << "), ("
-                << renderArea.getWidth() << ", " << renderArea.getHeight() << ") "
-                << " took " << elapsedUs << " (" << area / elapsedUs.count() << " MP/s).");
+        std::chrono::microseconds paintUs(0);
+        std::atomic<int64_t> compressUs(0);
 
         const auto mode = static_cast<LibreOfficeKitTileMode>(document->getTileMode());
 
@@ -147,92 +178,151 @@ namespace RenderTiles
 
         std::mutex pngMutex;
 
-        for (const Util::Rectangle& tileRect : tileRecs)
+        for (size_t band = 0; band < bandCount; ++band)
         {
-            const size_t positionX = (tileRect.getLeft() - renderArea.getLeft()) / tileCombined.getTileWidth();
-            const size_t positionY = (tileRect.getTop() - renderArea.getTop()) / tileCombined.getTileHeight();
+            if (bandTiles[band].empty())
+                continue; // Nothing requested in these rows.
 
-            const int offsetX = positionX * pixelWidth;
-            const int offsetY = positionY * pixelHeight;
+            const size_t bandTop = band * bandTileRows;
+            const size_t bandRows = std::min(bandTileRows, tilesByY - bandTop);
+            const size_t bandPixelTop = bandTop * pixelHeight;
+            const int bandDocTop = renderArea.getTop() + bandTop * tileCombined.getTileHeight();
+            const int bandDocHeight = bandRows * tileCombined.getTileHeight();
 
-            // FIXME: should this be in the delta / compression thread ?
-            blendWatermark(pixmap.data(), offsetX, offsetY,
-                           pixmapWidth, pixmapHeight,
-                           pixelWidth, pixelHeight,
-                           mode);
+            // Render the whole band
+            const auto paintStart = std::chrono::steady_clock::now();
+            {
+                ProfileZone profileZone("RenderTiles::paintPartTile",
+                                        { { "band", std::to_string(band) },
+                                          { "tiles", std::to_string(bandTiles[band].size()) } });
+                LOG_TRC("Calling paintPartTile(" << (void*)pixmap.data() << ") for band " << band
+                                                 << " of " << bandCount);
+                document->paintPartTile(pixmap.data() + bandPixelTop * pixmapWidth * 4,
+                                        tileCombined.getPart(),
+                                        tileCombined.getEditMode(),
+                                        pixmapWidth, bandRows * pixelHeight,
+                                        renderArea.getLeft(), bandDocTop,
+                                        renderArea.getWidth(), bandDocHeight);
+            }
+            paintUs += std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - paintStart);
 
-            // FIXME: prettify this.
-            bool forceKeyframe = tiles[tileIndex].getOldWireId() == 0;
+            for (const size_t bandTileIndex : bandTiles[band])
+            {
+                const Util::Rectangle& tileRect = tileRecs[bandTileIndex];
+                const size_t positionX = (tileRect.getLeft() - renderArea.getLeft()) / tileCombined.getTileWidth();
+                const size_t positionY = (tileRect.getTop() - renderArea.getTop()) / tileCombined.getTileHeight();
 
-            // FIXME: share the same wireId for all tiles concurrently rendered.
-            TileWireId wireId = getCurrentWireId(true);
+                const int offsetX = positionX * pixelWidth;
+                const int offsetY = positionY * pixelHeight;
 
-            bool skipCompress = false;
-            if (!skipCompress)
-            {
-                renderingIds.push_back(wireId);
+                // FIXME: should this be in the delta / compression thread ?
+                blendWatermark(pixmap.data(), offsetX, offsetY,
+                               pixmapWidth, pixmapHeight,
+                               pixelWidth, pixelHeight,
+                               mode);
 
-                LOG_TRC("Queued encoding of tile #" << tileIndex << " at (" << positionX << ',' << positionY << ") with " <<
-                        (forceKeyframe?"force keyframe" : "allow delta") << ", wireId: " << wireId);
+                // FIXME: prettify this.
+                bool forceKeyframe = tiles[bandTileIndex].getOldWireId() == 0;
 
-                // Queue to be executed later in parallel inside 'run'
-                pngPool.pushWork([=,&output,&pixmap,&tiles,&renderedTiles,
-                                  &pngMutex,&deltaGen]()
-                    {
-                        std::vector< char > data;
-                        data.reserve(pixmapWidth * pixmapHeight * 1);
+                // FIXME: share the same wireId for all tiles concurrently rendered.
+                TileWireId wireId = getCurrentWireId(true);
 
-                        // FIXME: don't try to store & create deltas for read-only documents.
-                        if (!tiles[tileIndex].isPreview())
-                        {
-                            // Can we create a delta ?
-                            LOG_TRC("Compress new tile #" << tileIndex);
-                            assert(pixelWidth <= 256 && pixelHeight <= 256);
-                            deltaGen.compressOrDelta(pixmap.data(), offsetX, offsetY,
-                                                     pixelWidth, pixelHeight,
-                                                     pixmapWidth, pixmapHeight,
-                                                     TileLocation(
-                                                         tileRect.getLeft(),
-                                                         tileRect.getTop(),
-                                                         tileRect.getWidth(),
-                                                         tileCombined.getPart(),
-                                                         canonicalViewId,
-                                                         tileCombined.getEditMode()
-                                                         ),
-                                                     data, wireId, forceKeyframe, dumpTiles, mode);
-                        }
-                        else
+                bool skipCompress = false;
+                if (!skipCompress)
+                {
+                    renderingIds.push_back(wireId);
+
+                    LOG_TRC("Queued encoding of tile #" << bandTileIndex << " at (" << positionX << ',' << positionY << ") with " <<
+                            (forceKeyframe?"force keyframe" : "allow delta") << ", wireId: " << wireId);
+
+                    // Queued to be executed in parallel, finished inside 'run'
+                    pngPool.pushWork([=,&output,&pixmap,&tiles,&renderedTiles,
+                                      &pngMutex,&deltaGen,&compressUs]()
                         {
-                            // FIXME: write our own trivial PNG encoding code using deflate.
-                            LOG_TRC("Encode a new png for tile #" << tileIndex);
-                            if (!Png::encodeSubBufferToPNG(pixmap.data(), offsetX, offsetY, pixelWidth, pixelHeight,
-                                                           pixmapWidth, pixmapHeight, data, mode))
+                            ProfileZone profileZone("RenderTiles::compress");
+                            const auto compressStart = std::chrono::steady_clock::now();
+
+                            std::vector< char > data;
+                            data.reserve(pixmapWidth * pixmapHeight * 1);
+
+                            // FIXME: don't try to store & create deltas for read-only documents.
+                            if (!tiles[bandTileIndex].isPreview())
+                            {
+                                // Can we create a delta ?
+                                LOG_TRC("Compress new tile #" << bandTileIndex);
+                                assert(pixelWidth <= 256 && pixelHeight <= 256);
+                                deltaGen.compressOrDelta(pixmap.data(), offsetX, offsetY,
+                                                         pixelWidth, pixelHeight,
+                                                         pixmapWidth, pixmapHeight,
+                                                         TileLocation(
+                                                             tileRect.getLeft(),
+                                                             tileRect.getTop(),
+                                                             tileRect.getWidth(),
+                                                             tileCombined.getPart(),
+                                                             canonicalViewId,
+                                                             tileCombined.getEditMode()
+                                                             ),
+                                                         data, wireId, forceKeyframe, dumpTiles, mode);
+                            }
+                            else
                             {
-                                // FIXME: Return error.
-                                // sendTextFrameAndLogError("error: cmd=tile kind=failure");
-                                LOG_ERR("Failed to encode tile into PNG.");
-                                return;
+                                LOG_TRC("Encode a new png for tile #" << bandTileIndex);
+                                if (!Png::encodeSubBufferToPNG(pixmap.data(), offsetX, offsetY, pixelWidth, pixelHeight,
+                                                               pixmapWidth, pixmapHeight, data, mode))
+                                {
+                                    // FIXME: Return error.
+                                    // sendTextFrameAndLogError("error: cmd=tile kind=failure");
+                                    LOG_ERR("Failed to encode tile into PNG.");
+                                    return;
+                                }
                             }
-                        }
 
-                        LOG_TRC("Tile " << tileIndex << " is " << data.size() << " bytes.");
-                        std::unique_lock<std::mutex> pngLock(pngMutex);
-                        output.insert(output.end(), data.begin(), data.end());
-                        renderedTiles.pushRendered(tiles[tileIndex], wireId, data.size());
-                    });
+                            compressUs += std::chrono::duration_cast<std::chrono::microseconds>(
+                                              std::chrono::steady_clock::now() - compressStart)
+                                              .count();
+
+                            LOG_TRC("Tile " << bandTileIndex << " is " << data.size() << " bytes.");
+                            std::unique_lock<std::mutex> pngLock(pngMutex);
+                            output.insert(output.end(), data.begin(), data.end());
+                            renderedTiles.pushRendered(tiles[bandTileIndex], wireId, data.size());
+                        });
+                }
+                tileIndex++;
             }
-            tileIndex++;
         }
 
+        LOG_DBG("paintPartTile      " << tileRecs.size() << " tiles at ("
+                << renderArea.getLeft() << ", " << renderArea.getTop() << "), ("
+                << renderArea.getWidth() << ", " << renderArea.getHeight() << ") in "
+                << bandCount << " band(s) took " << paintUs << " ("
+                << area / std::max<int64_t>(paintUs.count(), 1) << " MP/s).");
+
         pngPool.run();
 
-        duration = std::chrono::steady_clock::now() - start;
+        const auto duration = std::chrono::steady_clock::now() - start;
         const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(duration);
         LOG_DBG("paintPartTile+comp " << tileRecs.size() << " tiles at ("
                 << renderArea.getLeft() << ", " << renderArea.getTop()
                 << "), (" << renderArea.getWidth() << ", "
                 << renderArea.getHeight() << ") "
-                << " took " << elapsed << " (" << area / elapsed.count() << " MP/s).");
+                << " took " << elapsed << " (" << area / std::max<int64_t>(elapsed.count(), 1) << " MP/s).");
+
+        if (TraceEvent::isRecordingOn())
+        {
+            // The overlap is the time saved by compressing while painting.
+            const int64_t overlapUs = paintUs.count() + compressUs.load() - elapsed.count();
+            TraceEvent::emitInstantEvent(
+                "RenderTiles::doRender",
+                { { "tiles", std::to_string(tileRecs.size()) },
+                  { "bands", std::to_string(bandCount) },
+                  { "paintUs", std::to_string(paintUs.count()) },
+                  { "paintMPs", std::to_string(area / std::max<int64_t>(paintUs.count(), 1)) },
+                  { "compressUs", std::to_string(compressUs.load()) },
+                  { "totalUs", std::to_string(elapsed.count()) },
+                  { "totalMPs", std::to_string(area / std::max<int64_t>(elapsed.count(), 1)) },
+                  { "overlapUs", std::to_string(std::max<int64_t>(overlapUs, 0)) } });
+        }
 
         if (tileIndex == 0)
             return false;
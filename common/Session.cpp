@@ -80,6 +80,20 @@ bool Session::sendBinaryFrame(const char *buffer, int length)
     return _protocol->sendBinaryMessage(buffer, length) >= length;
 }
 
+bool Session::sendSharedBinaryFrame(const char* buffer, int length, const std::vector<Blob>& blobs)
+{
+    if (!_protocol)
+    {
+        LOG_TRC("ERR - missing protocol " << getName() << ": Send: " << std::to_string(length)
+                                          << " binary bytes and " << blobs.size() << " blobs");
+        return false;
+    }
+
+    LOG_TRC("Send: " << std::to_string(length) << " binary bytes and " << blobs.size()
+                     << " blobs");
+    return _protocol->sendSharedBinaryMessage(buffer, length, blobs) >= length;
+}
+
 void Session::parseDocOptions(const StringVector& tokens, int& part, std::string& timestamp, std::string& doctemplate)
 {
     // First token is the "load" command itself.
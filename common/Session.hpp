@@ -129,6 +129,9 @@ public:
     virtual bool sendBinaryFrame(const char* buffer, int length);
     virtual bool sendTextFrame(const char* buffer, const int length);
 
+    /// Send a binary frame of buffer followed by blobs, shared rather than copied.
+    bool sendSharedBinaryFrame(const char* buffer, int length, const std::vector<Blob>& blobs);
+
     /// Get notified that the underlying transports disconnected
     void onDisconnect() override { /* ignore */ }
 
@@ -13,21 +13,29 @@
 
 #include <Simd.hpp>
 
-#if ENABLE_SIMD
+#if ENABLE_SIMD && defined(__x86_64__)
 #  include <immintrin.h>
 #endif
 
 namespace simd {
 
+bool HasSSE42 = false;
 bool HasAVX2 = false;
+bool HasAVX512 = false;
+bool HasNEON = false;
 
 bool init()
 {
-#if ENABLE_SIMD
+#if ENABLE_SIMD && defined(__x86_64__)
     __builtin_cpu_init();
+    HasSSE42 = __builtin_cpu_supports ("sse4.2");
     HasAVX2 = __builtin_cpu_supports ("avx2");
+    HasAVX512 = __builtin_cpu_supports ("avx512f");
+#elif ENABLE_SIMD && defined(__aarch64__)
+    // Advanced SIMD is mandatory on AArch64.
+    HasNEON = true;
 #endif
-    return HasAVX2;
+    return HasSSE42 || HasAVX2 || HasAVX512 || HasNEON;
 }
 
 };
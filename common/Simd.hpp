@@ -12,8 +12,12 @@
 #pragma once
 
 namespace simd {
+    /// Detects the CPU features, returns true if any are usable.
     bool init();
+    extern bool HasSSE42;
     extern bool HasAVX2;
+    extern bool HasAVX512;
+    extern bool HasNEON;
 };
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
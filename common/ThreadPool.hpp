@@ -11,36 +11,66 @@
 
 #pragma once
 
+#include <atomic>
 #include <cassert>
+#include <deque>
+#include <functional>
+#include <future>
 #include <memory>
-#include <queue>
 #include <thread>
 #include <condition_variable>
 #include <fstream>
 #include <unordered_map>
 #include <vector>
 
+#include <common/Log.hpp>
+#include <common/Util.hpp>
+
+/// A pool of persistent worker threads, each with its own deque of tasks.
+/// Workers pop their own tasks LIFO and steal from the others FIFO when idle.
+/// Work is either a batch, queued with pushWork() and completed by run(),
+/// in which the caller helps out, or fire-and-forget via post() and submit(),
+/// which can run concurrently with the caller, e.g. while it paints.
 class ThreadPool
 {
     friend class WhiteBoxTests;
 
+public:
+    typedef std::function<void()> ThreadFn;
+
+private:
+    /// The tasks of one thread. Queue 0 belongs to the run() caller.
+    struct WorkQueue
+    {
+        std::mutex _mutex;
+        std::deque<ThreadFn> _tasks;
+    };
+
+    /// Protects sleeping and waking up.
     std::mutex _mutex;
+    /// Signalled on new work, batch completion and shutdown.
     std::condition_variable _cond;
-    std::condition_variable _complete;
-    typedef std::function<void()> ThreadFn;
-    std::queue<ThreadFn> _work;
+    std::vector<std::unique_ptr<WorkQueue>> _queues;
     std::vector<std::thread> _threads;
-    size_t _working;
+    /// Number of tasks waiting in any of the queues.
+    std::atomic<size_t> _queued;
+    /// Number of tasks being executed.
+    std::atomic<size_t> _working;
+    /// Number of pushWork() tasks not yet completed.
+    std::atomic<size_t> _batch;
+    /// Round-robin queue selection for external submitters.
+    std::atomic<size_t> _nextQueue;
     int _maxConcurrency;
     bool _shutdown;
-    std::atomic<bool> _running;
 
 public:
     ThreadPool()
-        : _working(0)
+        : _queued(0)
+        , _working(0)
+        , _batch(0)
+        , _nextQueue(0)
         , _maxConcurrency(2)
         , _shutdown(false)
-        , _running(false)
     {
 #if WASMAPP
         // Leave it at that.
@@ -51,8 +81,14 @@ public:
         const char* max = getenv("MAX_CONCURRENCY");
         if (max)
             _maxConcurrency = atoi(max);
+        else
+            _maxConcurrency = std::max<int>(Util::getCpuCount(), 2);
 #endif
         LOG_TRC("PNG compression thread pool size " << _maxConcurrency);
+
+        for (int i = 0; i < std::max(_maxConcurrency, 1); ++i)
+            _queues.emplace_back(std::make_unique<WorkQueue>());
+
         start();
     }
 
@@ -62,48 +98,106 @@ public:
     {
         {
             std::unique_lock<std::mutex> lock(_mutex);
-            assert(!_running);
             assert(_working == 0);
             _shutdown = false;
         }
         for (int i = _threads.size(); i < _maxConcurrency - 1; ++i)
-            _threads.emplace_back(&ThreadPool::work, this);
+            _threads.emplace_back(&ThreadPool::work, this, i + 1);
     }
 
+    /// Joins the threads, after they completed all queued work.
     void stop()
     {
         {
             std::unique_lock<std::mutex> lock(_mutex);
-            assert(_working == 0);
             _shutdown = true;
         }
         _cond.notify_all();
         for (auto& it : _threads)
             it.join();
         _threads.clear();
+
+        // Complete anything queued since, so no future is left dangling.
+        while (runOne(0))
+        {
+        }
+
+        assert(_working == 0);
+        assert(_queued == 0);
     }
 
-    size_t count() const { return _work.size(); }
+    size_t count() const { return _queued; }
 
+    /// The number of worker threads, excluding the run() caller.
+    size_t threadCount() const { return _threads.size(); }
+
+    /// Queue a task of the current batch, which run() waits for.
+    /// Workers may start on it right away.
     void pushWork(const ThreadFn& fn)
     {
-        std::unique_lock<std::mutex> lock(_mutex);
-        assert(!_running);
-        assert(!_shutdown);
-        assert(_working == 0);
-        _work.push(fn);
+        ++_batch;
+        enqueue(0,
+                [this, fn]()
+                {
+                    execute(fn);
+                    if (--_batch == 0)
+                    {
+                        std::unique_lock<std::mutex> lock(_mutex);
+                        _cond.notify_all();
+                    }
+                });
     }
 
-    void runOne(std::unique_lock<std::mutex>& lock)
+    /// Complete all the tasks queued with pushWork(), helping out while waiting.
+    void run()
     {
-        assert(_running);
-        assert(!_work.empty());
+        while (_batch > 0)
+        {
+            if (runOne(0))
+                continue;
 
-        ThreadFn fn = _work.front();
-        _work.pop();
-        _working++;
-        lock.unlock();
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cond.wait(lock, [this]() { return _batch == 0 || _queued > 0; });
+        }
 
+        assert(_batch == 0);
+    }
+
+    /// Queue a fire-and-forget task.
+    /// Without worker threads the task is executed immediately.
+    void post(ThreadFn fn)
+    {
+        if (_threads.empty())
+        {
+            execute(fn);
+            return;
+        }
+
+        enqueue(_nextQueue++ % _queues.size(), std::move(fn));
+    }
+
+    /// Queue a task and return a future of its result.
+    template <typename Fn> auto submit(Fn&& fn) -> std::future<decltype(fn())>
+    {
+        auto task = std::make_shared<std::packaged_task<decltype(fn())()>>(std::forward<Fn>(fn));
+        auto future = task->get_future();
+        post([task]() { (*task)(); });
+        return future;
+    }
+
+    void dumpState(std::ostream& oss)
+    {
+        THREAD_UNSAFE_DUMP_BEGIN
+        oss << "\tthreadPool:"
+            << "\n\t\tshutdown: " << _shutdown << "\n\t\tworking: " << _working
+            << "\n\t\twork count: " << count() << "\n\t\tbatch: " << _batch
+            << "\n\t\tthread count " << _threads.size() << "\n";
+        THREAD_UNSAFE_DUMP_END
+    }
+
+private:
+    static void execute(const ThreadFn& fn)
+    {
         try
         {
             fn();
@@ -112,55 +206,80 @@ public:
         {
             LOG_ERR("Exception in thread pool execution.");
         }
-
-        lock.lock();
-        _working--;
-        if (_work.empty() && _working == 0)
-            _complete.notify_all();
     }
 
-    void run()
+    void enqueue(size_t index, ThreadFn fn)
     {
-        std::unique_lock<std::mutex> lock(_mutex);
-        assert(!_running);
-        assert(_working == 0);
-
-        _running = true;
+        {
+            WorkQueue& queue = *_queues[index];
+            std::unique_lock<std::mutex> lock(queue._mutex);
+            queue._tasks.push_back(std::move(fn));
+            ++_queued;
+        }
 
-        // Avoid notifying threads if we don't need to.
-        bool useThreads = _threads.size() > 1 && _work.size() > 1;
-        if (useThreads)
-            _cond.notify_all();
+        // Taking the lock orders us after a waiter's predicate check.
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+        }
+        _cond.notify_one();
+    }
 
-        while (!_work.empty())
-            runOne(lock);
+    /// Take a task, from the back of our own queue, or the front of another.
+    bool pop(size_t self, ThreadFn& fn)
+    {
+        if (_queued == 0)
+            return false;
 
-        if (useThreads && (_working > 0 || !_work.empty()))
-            _complete.wait(lock, [this]() { return _working == 0 && _work.empty(); });
+        for (size_t i = 0; i < _queues.size(); ++i)
+        {
+            const size_t index = (self + i) % _queues.size();
+            WorkQueue& queue = *_queues[index];
+            std::unique_lock<std::mutex> lock(queue._mutex);
+            if (!queue._tasks.empty())
+            {
+                if (index == self)
+                {
+                    fn = std::move(queue._tasks.back());
+                    queue._tasks.pop_back();
+                }
+                else
+                {
+                    fn = std::move(queue._tasks.front());
+                    queue._tasks.pop_front();
+                }
 
-        _running = false;
+                --_queued;
+                return true;
+            }
+        }
 
-        assert(_working == 0);
-        assert(_work.empty());
+        return false;
     }
 
-    void work()
+    /// Execute a single task, if any.
+    bool runOne(size_t self)
     {
-        std::unique_lock<std::mutex> lock(_mutex);
-        while (!_shutdown)
-        {
-            _cond.wait(lock);
-            while (!_shutdown && !_work.empty() && _running)
-                runOne(lock);
-        }
+        ThreadFn fn;
+        if (!pop(self, fn))
+            return false;
+
+        ++_working;
+        execute(fn);
+        --_working;
+        return true;
     }
 
-    void dumpState(std::ostream& oss)
+    void work(size_t self)
     {
-        THREAD_UNSAFE_DUMP_BEGIN
-        oss << "\tthreadPool:"
-            << "\n\t\tshutdown: " << _shutdown << "\n\t\tworking: " << _working
-            << "\n\t\twork count: " << count() << "\n\t\tthread count " << _threads.size() << "\n";
-        THREAD_UNSAFE_DUMP_END
+        while (true)
+        {
+            if (runOne(self))
+                continue;
+
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cond.wait(lock, [this]() { return _shutdown || _queued > 0; });
+            if (_shutdown && _queued == 0)
+                break;
+        }
     }
 };
@@ -0,0 +1,328 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// A Trace Event backend cheap enough to leave on: each thread appends
+/// fixed-size binary records, with interned names, to its own ring buffer,
+/// without locking or formatting anything. A single consumer drains them,
+/// in a binary stream which cooltraceconvert turns into Chrome Trace Event
+/// JSON offline. The stream is in the byte order of the machine recording.
+///
+/// The stream is a sequence of chunks, each starting with its type:
+/// 'P' <int32 pid>: the process of the following chunks.
+/// 'S' <uint32 id> <uint32 size> <bytes>: an interned name of that process.
+/// 'R' <Record> <bytes of args>: an event.
+/// 'D' <uint64 count>: events dropped as their ring was full.
+class TraceBuffer
+{
+public:
+    /// The start of a file of drained chunks.
+    static constexpr char Magic[8] = { 'C', 'O', 'O', 'L', 'T', 'R', 'C', '1' };
+
+    /// An event, followed in its ring by its JSON args, if any.
+    struct Record
+    {
+        int64_t _timestamp; ///< Microseconds since the epoch.
+        int64_t _duration; ///< Microseconds, for Complete events.
+        int32_t _tid;
+        uint32_t _name; ///< Interned.
+        uint32_t _argsSize;
+        char _phase; ///< 'X' for Complete, 'i' for Instant events.
+    };
+
+    /// The events and the bytes of their args each thread can hold until drained.
+    static constexpr std::size_t RecordCapacity = 4096;
+    static constexpr std::size_t ArgsCapacity = 64 * 1024;
+
+    /// Directs the events of this process to the ring buffers, keeping
+    /// @samplePercent of them.
+    static void enable(int samplePercent)
+    {
+        SamplePercent = std::max(1, std::min(samplePercent, 100));
+        Enabled = true;
+    }
+
+    static bool isEnabled() { return Enabled; }
+
+    /// Appends an event to the ring of the calling thread. It is dropped if
+    /// not sampled, or if the ring is full.
+    static void record(char phase, std::chrono::system_clock::time_point start,
+                       std::chrono::microseconds duration, int32_t tid, const std::string& name,
+                       const std::string& args)
+    {
+        if (SamplePercent < 100)
+        {
+            // Keep SamplePercent out of every 100.
+            SampleCredit += SamplePercent;
+            if (SampleCredit < 100)
+                return;
+            SampleCredit -= 100;
+        }
+
+        Ring& ring = getRing();
+        const uint64_t head = ring._head.load(std::memory_order_relaxed);
+        if (head - ring._tail.load(std::memory_order_acquire) >= RecordCapacity ||
+            ring._argsHead + args.size() - ring._argsTail.load(std::memory_order_acquire) >
+                ArgsCapacity)
+        {
+            ++Dropped;
+            return;
+        }
+
+        // The args, wrapping around the end of the ring.
+        const std::size_t offset = ring._argsHead % ArgsCapacity;
+        const std::size_t first = std::min(args.size(), ArgsCapacity - offset);
+        std::memcpy(ring._args.data() + offset, args.data(), first);
+        std::memcpy(ring._args.data(), args.data() + first, args.size() - first);
+        ring._argsHead += args.size();
+
+        Record& rec = ring._records[head % RecordCapacity];
+        rec._timestamp =
+            std::chrono::duration_cast<std::chrono::microseconds>(start.time_since_epoch()).count();
+        rec._duration = duration.count();
+        rec._tid = tid;
+        rec._name = intern(name);
+        rec._argsSize = args.size();
+        rec._phase = phase;
+
+        // Publish it to the consumer.
+        ring._head.store(head + 1, std::memory_order_release);
+    }
+
+    /// Appends the events recorded since the last call, by all threads, to
+    /// @out, preceded by the names they introduce. Returns the number of events.
+    static std::size_t drain(std::string& out, int pid)
+    {
+        std::lock_guard<std::mutex> lock(RingsMutex);
+        LastDrain = std::chrono::steady_clock::now();
+
+        // Collect the events before the names, which they were interned before.
+        std::string events;
+        std::size_t count = 0;
+        for (auto it = Rings.begin(); it != Rings.end();)
+        {
+            Ring& ring = **it;
+            const uint64_t head = ring._head.load(std::memory_order_acquire);
+            const uint64_t tail = ring._tail.load(std::memory_order_relaxed);
+            uint64_t argsTail = ring._argsTail.load(std::memory_order_relaxed);
+            for (uint64_t i = tail; i < head; ++i)
+            {
+                const Record& rec = ring._records[i % RecordCapacity];
+                events += 'R';
+                append(events, rec);
+                const std::size_t offset = argsTail % ArgsCapacity;
+                const std::size_t first = std::min<std::size_t>(rec._argsSize, ArgsCapacity - offset);
+                events.append(ring._args.data() + offset, first);
+                events.append(ring._args.data(), rec._argsSize - first);
+                argsTail += rec._argsSize;
+            }
+
+            count += head - tail;
+            ring._argsTail.store(argsTail, std::memory_order_release);
+            ring._tail.store(head, std::memory_order_release);
+
+            // Forget the rings of the threads that are gone.
+            if (it->use_count() == 1)
+                it = Rings.erase(it);
+            else
+                ++it;
+        }
+
+        out += 'P';
+        append(out, static_cast<int32_t>(pid));
+
+        {
+            std::lock_guard<std::mutex> stringsLock(StringsMutex);
+            for (; DrainedStrings < Strings.size(); ++DrainedStrings)
+            {
+                const std::string& name = Strings[DrainedStrings];
+                out += 'S';
+                append(out, static_cast<uint32_t>(DrainedStrings));
+                append(out, static_cast<uint32_t>(name.size()));
+                out += name;
+            }
+        }
+
+        out += events;
+
+        const uint64_t dropped = Dropped.exchange(0);
+        if (dropped)
+        {
+            out += 'D';
+            append(out, dropped);
+        }
+
+        return count;
+    }
+
+    /// Whether to drain: @interval has elapsed since the last time, or a
+    /// ring is half full.
+    static bool isDrainDue(std::chrono::steady_clock::time_point now,
+                           std::chrono::milliseconds interval)
+    {
+        std::lock_guard<std::mutex> lock(RingsMutex);
+        if (now - LastDrain >= interval)
+            return true;
+
+        for (const auto& ring : Rings)
+        {
+            if (ring->_head.load(std::memory_order_relaxed) -
+                    ring->_tail.load(std::memory_order_relaxed) >=
+                RecordCapacity / 2)
+                return true;
+        }
+
+        return false;
+    }
+
+    /// Calls @onEvent(pid, record, name, args) for each event of a stream of
+    /// chunks, and @onDropped(pid, count) for the dropped ones.
+    /// Returns false if it is truncated or corrupted.
+    template <typename OnEvent, typename OnDropped>
+    static bool read(const char* data, std::size_t size, OnEvent onEvent, OnDropped onDropped)
+    {
+        std::unordered_map<int32_t, std::vector<std::string>> strings;
+        int32_t pid = 0;
+        std::size_t pos = 0;
+        while (pos < size)
+        {
+            const char type = data[pos++];
+            if (type == 'P')
+            {
+                if (!extract(data, size, pos, pid))
+                    return false;
+            }
+            else if (type == 'S')
+            {
+                uint32_t id, length;
+                if (!extract(data, size, pos, id) || !extract(data, size, pos, length) ||
+                    size - pos < length)
+                    return false;
+
+                std::vector<std::string>& names = strings[pid];
+                if (names.size() <= id)
+                    names.resize(id + 1);
+                names[id].assign(data + pos, length);
+                pos += length;
+            }
+            else if (type == 'R')
+            {
+                Record rec;
+                if (!extract(data, size, pos, rec) || size - pos < rec._argsSize)
+                    return false;
+
+                const std::vector<std::string>& names = strings[pid];
+                if (rec._name >= names.size())
+                    return false;
+
+                onEvent(pid, rec, names[rec._name], std::string(data + pos, rec._argsSize));
+                pos += rec._argsSize;
+            }
+            else if (type == 'D')
+            {
+                uint64_t count;
+                if (!extract(data, size, pos, count))
+                    return false;
+                onDropped(pid, count);
+            }
+            else
+                return false;
+        }
+
+        return true;
+    }
+
+private:
+    /// The events of a thread, written by it, and read by the consumer.
+    struct Ring
+    {
+        std::array<Record, RecordCapacity> _records;
+        std::array<char, ArgsCapacity> _args;
+        std::atomic<uint64_t> _head{ 0 }; ///< Events published.
+        std::atomic<uint64_t> _tail{ 0 }; ///< Events consumed.
+        uint64_t _argsHead = 0; ///< Bytes of args written, by the producer only.
+        std::atomic<uint64_t> _argsTail{ 0 }; ///< Bytes of args consumed.
+    };
+
+    /// The ring of the calling thread, registered on first use.
+    static Ring& getRing()
+    {
+        static thread_local std::shared_ptr<Ring> ring;
+        if (!ring)
+        {
+            ring = std::make_shared<Ring>();
+            std::lock_guard<std::mutex> lock(RingsMutex);
+            Rings.push_back(ring);
+        }
+
+        return *ring;
+    }
+
+    /// Returns the id of @name, looked up in a cache of the thread first.
+    static uint32_t intern(const std::string& name)
+    {
+        static thread_local std::unordered_map<std::string, uint32_t> cache;
+        const auto it = cache.find(name);
+        if (it != cache.end())
+            return it->second;
+
+        std::lock_guard<std::mutex> lock(StringsMutex);
+        const auto result = StringIds.emplace(name, Strings.size());
+        if (result.second)
+            Strings.push_back(name);
+        cache.emplace(name, result.first->second);
+        return result.first->second;
+    }
+
+    template <typename T> static void append(std::string& out, const T& value)
+    {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    template <typename T>
+    static bool extract(const char* data, std::size_t size, std::size_t& pos, T& value)
+    {
+        if (size - pos < sizeof(value))
+            return false;
+        std::memcpy(&value, data + pos, sizeof(value));
+        pos += sizeof(value);
+        return true;
+    }
+
+    static inline std::atomic<bool> Enabled = false;
+    static inline std::atomic<int> SamplePercent = 100;
+    static inline thread_local int SampleCredit = 0;
+    static inline std::atomic<uint64_t> Dropped = 0;
+
+    static inline std::mutex RingsMutex;
+    static inline std::vector<std::shared_ptr<Ring>> Rings;
+    static inline std::chrono::steady_clock::time_point LastDrain;
+
+    static inline std::mutex StringsMutex;
+    static inline std::unordered_map<std::string, uint32_t> StringIds;
+    static inline std::vector<std::string> Strings;
+    static inline std::size_t DrainedStrings = 0;
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -14,6 +14,7 @@
 #include <mutex>
 #include <sstream>
 
+#include "TraceBuffer.hpp"
 #include "TraceEvent.hpp"
 
 std::atomic<bool> TraceEvent::recordingOn(false);
@@ -27,6 +28,13 @@ void TraceEvent::emitInstantEvent(const std::string& name, const std::string& ar
     if (!recordingOn)
         return;
 
+    if (TraceBuffer::isEnabled())
+    {
+        TraceBuffer::record('i', std::chrono::system_clock::now(), std::chrono::microseconds(0),
+                            getThreadId(), name, argsOrEmpty);
+        return;
+    }
+
     emitOneRecording("{"
                      "\"name\":\""
                      + name
@@ -66,6 +74,14 @@ void ProfileZone::emitRecording()
     // Generate a single "Complete Event" (type X)
     const auto duration = std::chrono::system_clock::now() - _createTime;
 
+    if (TraceBuffer::isEnabled())
+    {
+        TraceBuffer::record('X', _createTime,
+                            std::chrono::duration_cast<std::chrono::microseconds>(duration),
+                            getThreadId(), name(), args());
+        return;
+    }
+
     std::ostringstream oss;
     oss << "{"
            "\"name\":\""
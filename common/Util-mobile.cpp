@@ -24,6 +24,8 @@ size_t getTotalSystemMemoryKb() { return 0; }
 std::size_t getFromFile(const char* path) { return 0; }
 std::size_t getCGroupMemLimit() { return 0; }
 std::size_t getCGroupMemSoftLimit() { return 0; }
+std::size_t getCGroupCpuLimit() { return 0; }
+std::size_t getCpuCount() { return std::max<std::size_t>(std::thread::hardware_concurrency(), 1); }
 size_t getMemoryUsagePSS(const pid_t pid) { return 0; }
 size_t getMemoryUsageRSS(const pid_t pid) { return 0; }
 size_t getCurrentThreadCount() { return 0; }
@@ -16,6 +16,7 @@
 #include "Util.hpp"
 
 #ifdef __linux__
+#include <sched.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 #elif defined __FreeBSD__
@@ -162,10 +163,10 @@ std::size_t getTotalSystemMemoryKb()
     return totalMemKb;
 }
 
-std::size_t getFromCGroup(const std::string& group, const std::string& key)
+/// Returns the first line of the @key file of the control @group, or empty.
+/// The cgroup v2 unified hierarchy has an empty group name.
+static std::string readFromCGroup(const std::string& group, const std::string& key)
 {
-    std::size_t num = 0;
-
     std::string groupPath;
     FILE* cg = fopen("/proc/self/cgroup", "r");
     if (cg != nullptr)
@@ -173,6 +174,18 @@ std::size_t getFromCGroup(const std::string& group, const std::string& key)
         char line[4096] = { 0 };
         while (fgets(line, sizeof(line), cg))
         {
+            if (group.empty())
+            {
+                // The unified hierarchy is listed as "0::<path>".
+                if (strncmp(line, "0::", 3) == 0)
+                {
+                    groupPath = "/sys/fs/cgroup" + Util::trimmed(line + 3);
+                    break;
+                }
+
+                continue;
+            }
+
             StringVector bits = StringVector::tokenize(line, strlen(line), ':');
             if (bits.size() > 2 && bits[1] == group)
             {
@@ -185,20 +198,27 @@ std::size_t getFromCGroup(const std::string& group, const std::string& key)
     }
 
     if (groupPath.empty())
-        return 0;
+        return std::string();
 
     std::string path = groupPath + "/" + key;
     LOG_TRC("Read from " << path);
+    std::string value;
     FILE* file = fopen(path.c_str(), "r");
     if (file != nullptr)
     {
         char line[4096] = { 0 };
         if (fgets(line, sizeof(line), file))
-            num = atoll(line);
+            value = line;
         fclose(file);
     }
 
-    return num;
+    return value;
+}
+
+std::size_t getFromCGroup(const std::string& group, const std::string& key)
+{
+    const std::string value = readFromCGroup(group, key);
+    return value.empty() ? 0 : atoll(value.c_str());
 }
 
 std::size_t getCGroupMemLimit()
@@ -219,6 +239,51 @@ std::size_t getCGroupMemSoftLimit()
 #endif
 }
 
+std::size_t getCGroupCpuLimit()
+{
+#ifdef __linux__
+    // cgroup v2: "<quota> <period>", or "max <period>" when unlimited.
+    const std::string cpuMax = readFromCGroup(std::string(), "cpu.max");
+    if (!cpuMax.empty())
+    {
+        const StringVector tokens = StringVector::tokenize(cpuMax, ' ');
+        if (tokens.size() < 2 || tokens.equals(0, "max"))
+            return 0;
+
+        const long long quota = atoll(tokens[0].c_str());
+        const long long period = atoll(tokens[1].c_str());
+        return (quota > 0 && period > 0) ? (quota + period - 1) / period : 0;
+    }
+
+    // cgroup v1: a quota of -1 means unlimited.
+    const long long quota = atoll(readFromCGroup("cpu,cpuacct", "cpu.cfs_quota_us").c_str());
+    const long long period = atoll(readFromCGroup("cpu,cpuacct", "cpu.cfs_period_us").c_str());
+    if (quota > 0 && period > 0)
+        return (quota + period - 1) / period;
+#endif
+    return 0;
+}
+
+std::size_t getCpuCount()
+{
+    std::size_t cpus = std::thread::hardware_concurrency();
+#ifdef __linux__
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    if (sched_getaffinity(0, sizeof(cpuSet), &cpuSet) == 0)
+        cpus = CPU_COUNT(&cpuSet);
+#endif
+
+    const std::size_t limit = getCGroupCpuLimit();
+    if (limit > 0 && limit < cpus)
+    {
+        LOG_TRC("Limiting CPU count from " << cpus << " to cgroup quota of " << limit);
+        cpus = limit;
+    }
+
+    return std::max<std::size_t>(cpus, 1);
+}
+
 std::pair<std::size_t, std::size_t> getPssAndDirtyFromSMaps(FILE* file)
 {
     std::size_t numPSSKb = 0;
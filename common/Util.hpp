@@ -347,6 +347,12 @@ namespace Util
     /// Returns the cgroup's soft memory limit, or 0 if not available in bytes
     std::size_t getCGroupMemSoftLimit();
 
+    /// Returns the cgroup's CPU quota rounded up to whole CPUs, or 0 if unlimited or not available
+    std::size_t getCGroupCpuLimit();
+
+    /// Returns the number of CPUs we can use: the affinity mask capped by the cgroup quota
+    std::size_t getCpuCount();
+
     /// Returns the process PSS in KB (works only when we have perms for /proc/pid/smaps).
     size_t getMemoryUsagePSS(pid_t pid);
 
@@ -603,8 +609,7 @@ namespace Util
     }
 
     inline std::string dumpHex (const char *legend, const char *prefix,
-                                const std::vector<char>::iterator &startIt,
-                                const std::vector<char>::iterator &endIt,
+                                const char *startIt, const char *endIt,
                                 bool skipDup = true, const unsigned int width = 32)
     {
         std::ostringstream oss;
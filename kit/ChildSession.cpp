@@ -211,7 +211,12 @@ bool ChildSession::_handleInput(const char *buffer, int length)
     if (COOLProtocol::tokenIndicatesUserInteraction(tokens[0]))
     {
         // Keep track of timestamps of incoming client messages that indicate user activity.
+        const bool wasInactive = getInactivityMS() >= TilePriorityActivityMs;
         updateLastActivityTime();
+
+        // Interacting raises the priority of the tiles of the current part.
+        if (wasInactive && _docManager)
+            _docManager->reprioritizeTiles(getCanonicalViewId());
     }
 
     if (tokens.size() > 0 && tokens.equals(0, "useractive") && getLOKitDocument() != nullptr)
@@ -1252,8 +1257,15 @@ bool ChildSession::clientVisibleArea(const StringVector& tokens)
 
     getLOKitDocument()->setView(_viewId);
 
+    const Util::Rectangle oldVisibleArea = _clientVisibleArea;
     _clientVisibleArea = Util::Rectangle(x, y, width, height);
     getLOKitDocument()->setClientVisibleArea(x, y, width, height);
+
+    if (_docManager)
+    {
+        _docManager->reprioritizeTiles(getCanonicalViewId(), oldVisibleArea);
+        _docManager->reprioritizeTiles(getCanonicalViewId(), _clientVisibleArea);
+    }
     return true;
 }
 
@@ -1268,7 +1280,7 @@ float ChildSession::getTilePriority(const std::chrono::steady_clock::time_point
             score *= 2.0;
 
         // interacted with the keyboard/mouse recently ?
-        if (getInactivityMS(now) < 200 /* ms */) // typing etc.
+        if (getInactivityMS(now) < TilePriorityActivityMs) // typing etc.
             score *= 2.0;
 
         // pre-loading near the viewing area is also more important than far away
@@ -3015,6 +3027,8 @@ bool ChildSession::setClientPart(const StringVector& tokens)
     {
         getLOKitDocument()->setPart(part);
         _currentPart = part;
+        if (_docManager)
+            _docManager->reprioritizeTiles(getCanonicalViewId());
     }
 
     return true;
@@ -3501,8 +3515,12 @@ void ChildSession::loKitCallback(const int type, const std::string& payload)
         int part;
         StringVector tokens(StringVector::tokenize(payload, ','));
         if (getTokenInteger(tokens[1], "part", part) &&
-            getLOKitDocument()->getDocumentType() != LOK_DOCTYPE_TEXT)
+            getLOKitDocument()->getDocumentType() != LOK_DOCTYPE_TEXT && part != _currentPart)
+        {
             _currentPart = part;
+            if (_docManager)
+                _docManager->reprioritizeTiles(getCanonicalViewId());
+        }
 
         sendTextFrame("setpart: " + payload);
         break;
@@ -4077,7 +4095,15 @@ void ChildSession::updateCursorPosition(const std::string &rect)
 {
     Util::Rectangle r(rect);
     if (r.getWidth() != 0 && r.getHeight() != 0)
+    {
+        const Util::Rectangle oldPosition = _cursorPosition;
         _cursorPosition = r;
+        if (_docManager)
+        {
+            _docManager->reprioritizeTiles(getCanonicalViewId(), oldPosition);
+            _docManager->reprioritizeTiles(getCanonicalViewId(), _cursorPosition);
+        }
+    }
     // else 'EMPTY' eg.
 }
 
@@ -293,6 +293,9 @@ private:
     std::queue<std::chrono::steady_clock::time_point> _cursorInvalidatedEvent;
     static constexpr std::chrono::seconds EventStorageInterval{ 15 };
 
+    /// The tiles of the current part are prioritized for this long after interacting.
+    static constexpr double TilePriorityActivityMs = 200;
+
     /// View ID, returned by createView() or 0 by default.
     int _viewId;
 
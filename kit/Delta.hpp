@@ -13,6 +13,7 @@
 
 #include <vector>
 #include <memory>
+#include <unordered_map>
 #include <unordered_set>
 #include <fstream>
 #include <assert.h>
@@ -78,11 +79,79 @@ class DeltaGenerator {
 
     static constexpr size_t _rleMaskUnits = 256 / 64;
 
+    /// The zstd contexts of a thread, reused across tiles: allocating and
+    /// setting one up costs about as much as compressing a small delta.
+    class ZstdContexts final
+    {
+        ZSTD_CCtx* _cctx;
+        ZSTD_DCtx* _dctx;
+        /// Scratch space to compress into, grown as needed.
+        std::unique_ptr<char[]> _compressed;
+        size_t _compressedSize;
+
+        ZstdContexts()
+            : _cctx(ZSTD_createCCtx())
+            , _dctx(ZSTD_createDCtx())
+            , _compressedSize(0)
+        {
+            if (_cctx)
+                ZSTD_CCtx_setParameter(_cctx, ZSTD_c_compressionLevel, compressionLevel);
+        }
+
+        ~ZstdContexts()
+        {
+            ZSTD_freeCCtx(_cctx);
+            ZSTD_freeDCtx(_dctx);
+        }
+
+        static ZstdContexts& get()
+        {
+            static thread_local ZstdContexts contexts;
+            return contexts;
+        }
+
+    public:
+        /// A compression context with our parameters, ready for a new frame.
+        static ZSTD_CCtx* getCCtx()
+        {
+            ZSTD_CCtx* cctx = get()._cctx;
+            if (!cctx)
+                LOG_ERR("Failed to create a zstd compression context");
+            else
+                ZSTD_CCtx_reset(cctx, ZSTD_reset_session_only);
+            return cctx;
+        }
+
+        /// A decompression context, ready for a new frame.
+        static ZSTD_DCtx* getDCtx()
+        {
+            ZSTD_DCtx* dctx = get()._dctx;
+            if (!dctx)
+                LOG_ERR("Failed to create a zstd decompression context");
+            else
+                ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+            return dctx;
+        }
+
+        /// Scratch space of at least @size bytes.
+        static char* getCompressBuffer(size_t size)
+        {
+            ZstdContexts& contexts = get();
+            if (contexts._compressedSize < size)
+            {
+                contexts._compressed.reset(new (std::nothrow) char[size]);
+                contexts._compressedSize = contexts._compressed ? size : 0;
+            }
+            return contexts._compressed.get();
+        }
+    };
+
     /// Bitmap row with a CRC for quick vertical shift detection
     class DeltaBitmapRow final {
         size_t _rleSize;
         uint64_t _rleMask[_rleMaskUnits];
         uint32_t *_rleData;
+        uint32_t _rleCrc;
     public:
         class PixIterator final
         {
@@ -138,6 +207,7 @@ class DeltaGenerator {
         DeltaBitmapRow()
             : _rleSize(0)
             , _rleData(nullptr)
+            , _rleCrc(0)
         {
             memset(_rleMask, 0, sizeof(_rleMask));
         }
@@ -158,38 +228,45 @@ class DeltaGenerator {
         size_t packForNetwork(unsigned char *output,
                               LibreOfficeKitTileMode mode) const
         {
-            assert(_rleSize < 65536);
+            return packForNetwork(output, _rleSize, _rleMask, _rleData, mode);
+        }
+
+        static size_t packForNetwork(unsigned char *output, size_t rleSize,
+                                     const uint64_t *rleMask, const uint32_t *rleData,
+                                     LibreOfficeKitTileMode mode)
+        {
+            assert(rleSize < 65536);
+            constexpr size_t rleMaskBytes = DeltaGenerator::_rleMaskUnits * 8;
 
             // we can RLE larger tiles - but just give
             // up RLE'ing after 256 pixels
-            output[0] = _rleSize & 0xff;
-            output[1] = _rleSize >> 8;
+            output[0] = rleSize & 0xff;
+            output[1] = rleSize >> 8;
 
 #if __BYTE_ORDER != __BIG_ENDIAN || defined(IOS)
-            memcpy(output + 2, _rleMask, sizeof(_rleMask));
+            memcpy(output + 2, rleMask, rleMaskBytes);
 #else
             // rare machine: little-endianize the bitmask if necessary:
             uint64_t rleLE[DeltaGenerator::_rleMaskUnits];
             for (size_t i = 0; i < DeltaGenerator::_rleMaskUnits; ++i)
-                rleLE[i] = htole64(_rleMask[i]);
+                rleLE[i] = htole64(rleMask[i]);
             memcpy(output + 2, rleLE, sizeof(rleLE));
 #endif
-            if (_rleSize > 0)
-                copy_row(output + 2 + sizeof(_rleMask),
-                         reinterpret_cast<const unsigned char *>(_rleData),
-                         _rleSize, mode);
+            if (rleSize > 0)
+                copy_row(output + 2 + rleMaskBytes,
+                         reinterpret_cast<const unsigned char *>(rleData),
+                         rleSize, mode);
 
-            size_t size = 2 + sizeof(_rleMask) + _rleSize * 4;
+            size_t size = 2 + rleMaskBytes + rleSize * 4;
             LOGA_TRC(Pixel,"packed row of size " << size << " bytes "
                      << Util::dumpHex(std::string((char *)output, size)));
 
             return size;
         }
 
-    private:
-        void initPixRowCpu(const uint32_t *from, uint32_t *scratch,
-                           size_t *scratchLen, uint64_t *rleMaskBlock,
-                           unsigned int width)
+        static void initPixRowCpu(const uint32_t *from, uint32_t *scratch,
+                                  size_t *scratchLen, uint64_t *rleMaskBlock,
+                                  unsigned int width)
         {
             uint32_t lastPix = 0x00000000; // transparency
             unsigned int x = 0, outp = 0;
@@ -245,7 +322,7 @@ class DeltaGenerator {
             auto scratch = static_cast<uint32_t*>(alloca(sizeof(uint32_t) * width));
 
             bool done = false;
-            if (simd::HasAVX2 && width == 256)
+            if (width == 256)
             {
                 done = simd_initPixRowSimd(from, scratch, &_rleSize, _rleMask);
 
@@ -287,11 +364,19 @@ class DeltaGenerator {
             }
             else
                 _rleData = nullptr;
+
+            _rleCrc = simd_crcRow(_rleMask, _rleData, _rleSize);
+        }
+
+        /// A cheap digest of the row content, for de-duplicating whole bitmaps.
+        uint64_t hash() const
+        {
+            return (uint64_t(_rleSize) << 32) | _rleCrc;
         }
 
         bool identical(const DeltaBitmapRow &other) const
         {
-            if (_rleSize != other._rleSize)
+            if (_rleSize != other._rleSize || _rleCrc != other._rleCrc)
                 return false;
             if (memcmp(_rleMask, other._rleMask, sizeof(_rleMask)))
                 return false;
@@ -302,59 +387,149 @@ class DeltaGenerator {
             return !std::memcmp(_rleData, other._rleData, _rleSize * 4);
         }
 
+        /// Expand the unique pixels to @width pixels, zero padded to 256.
+        void expand(uint32_t *pixels, unsigned int width) const
+        {
+            uint32_t lastPix = 0x00000000; // transparency
+            const uint32_t *rlePtr = _rleData;
+            const uint32_t *endRleData = _rleData + _rleSize;
+            for (unsigned int x = 0; x < width; ++x)
+            {
+                if (!(_rleMask[x >> 6] & (uint64_t(1) << (x & 63))) && rlePtr != endRleData)
+                    lastPix = *(rlePtr++);
+                pixels[x] = lastPix;
+            }
+            for (unsigned int x = width; x < 256; ++x)
+                pixels[x] = 0;
+        }
+
+        /// The length of the run of set (or clear) bits in @mask from @x to at most @width.
+        static unsigned int runLength(const uint64_t *mask, unsigned int x, unsigned int width,
+                                      bool set)
+        {
+            const unsigned int start = x;
+            while (x < width)
+            {
+                const unsigned int shift = x & 63;
+                const uint64_t bits = (set ? mask[x >> 6] : ~mask[x >> 6]) >> shift;
+                // the shifted-in zeros stop the count at the end of the word.
+                const unsigned int run = ~bits ? __builtin_ctzll(~bits) : 64;
+                x += run;
+                if (run < 64 - shift)
+                    break;
+            }
+            return std::min(x, width) - start;
+        }
+
         // Create a diff from our state to new state in curRow
         void diffRowTo(const DeltaBitmapRow &curRow,
                        const int width, const int curY,
                        std::vector<uint8_t> &output,
                        LibreOfficeKitTileMode mode) const
         {
-            PixIterator oldPixels(*this);
-            PixIterator curPixels(curRow);
-            for (int x = 0; x < width;)
-            {
-                int same;
-                for (same = 0; same + x < width &&
-                         oldPixels.identical(curPixels);)
-                {
-                    oldPixels.next();
-                    curPixels.next();
-                    same++;
-                }
+            uint32_t oldPixels[256];
+            uint32_t curPixels[256];
+            expand(oldPixels, width);
+            curRow.expand(curPixels, width);
 
-                x += same;
+            uint64_t diffMask[_rleMaskUnits];
+            simd_diffRow(oldPixels, curPixels, diffMask);
 
-                uint32_t scratch[256];
+            const unsigned int end = width;
+            for (unsigned int x = 0; x < end;)
+            {
+                x += runLength(diffMask, x, end, false);
+                if (x >= end)
+                    break;
 
-                int diff;
-                for (diff = 0; diff + x < width &&
-                         (!oldPixels.identical(curPixels) || diff < 3)
-                         && diff < 254;)
+                // take at least 3 pixels, and at most 254 in one run.
+                unsigned int diff = std::min(3u, end - x);
+                while (x + diff < end && diff < 254)
                 {
-                    oldPixels.next();
-                    scratch[diff] = curPixels.getPixel();
-                    curPixels.next();
-                    ++diff;
+                    const unsigned int run = runLength(diffMask, x + diff, end, true);
+                    if (!run)
+                        break;
+                    diff = std::min(diff + run, 254u);
                 }
 
-                if (diff > 0)
-                {
-                    output.push_back('d');
-                    output.push_back(curY);
-                    output.push_back(x);
-                    output.push_back(diff);
+                output.push_back('d');
+                output.push_back(curY);
+                output.push_back(x);
+                output.push_back(diff);
 
-                    size_t dest = output.size();
-                    output.resize(dest + diff * 4);
+                size_t dest = output.size();
+                output.resize(dest + diff * 4);
 
-                    copy_row(reinterpret_cast<unsigned char *>(&output[dest]),
-                              (const unsigned char *)(scratch),
-                              diff, mode);
+                copy_row(reinterpret_cast<unsigned char *>(&output[dest]),
+                          (const unsigned char *)(curPixels + x),
+                          diff, mode);
 
-                    LOGA_TRC(Pixel, "row " << curY << " different " << diff << "pixels");
-                    x += diff;
-                }
+                LOGA_TRC(Pixel, "row " << curY << " different " << diff << "pixels");
+                x += diff;
+            }
+        }
+    };
+
+    /// The rows of a bitmap tile, shared between all tiles with the same content.
+    class DeltaBitmap final {
+        // no careless copying
+        DeltaBitmap(const DeltaBitmap&) = delete;
+        DeltaBitmap& operator=(const DeltaBitmap&) = delete;
+
+    public:
+        DeltaBitmap(unsigned char* pixmap, size_t startX, size_t startY, int width, int height,
+                    int bufferWidth)
+            : _width(width)
+            , _height(height)
+            , _rows(new DeltaBitmapRow[height])
+            , _hash(0)
+        {
+            for (int y = 0; y < height; ++y)
+            {
+                size_t position = ((startY + y) * bufferWidth * 4) + (startX * 4);
+                DeltaBitmapRow &row = _rows[y];
+                row.initRow(reinterpret_cast<uint32_t *>(pixmap + position), width);
+                _hash = (_hash ^ row.hash()) * 0x100000001b3; // FNV-1 style mixing
             }
         }
+
+        ~DeltaBitmap()
+        {
+            delete[] _rows;
+        }
+
+        int getWidth() const { return _width; }
+        int getHeight() const { return _height; }
+        uint64_t getHash() const { return _hash; }
+
+        const DeltaBitmapRow& getRow(int y) const
+        {
+            return _rows[y];
+        }
+
+        size_t sizeBytes() const
+        {
+            size_t total = sizeof(DeltaBitmap);
+            for (int i = 0; i < _height; ++i)
+                total += _rows[i].sizeBytes();
+            return total;
+        }
+
+        bool identical(const DeltaBitmap& other) const
+        {
+            if (_hash != other._hash || _width != other._width || _height != other._height)
+                return false;
+            for (int y = 0; y < _height; ++y)
+                if (!_rows[y].identical(other._rows[y]))
+                    return false;
+            return true;
+        }
+
+    private:
+        int _width;
+        int _height;
+        DeltaBitmapRow *_rows;
+        uint64_t _hash;
     };
 
     /// A bitmap tile with annotated rows and details on its location
@@ -369,11 +544,6 @@ class DeltaGenerator {
             : _loc(loc)
             , _inUse(false)
             , _wid(wid)
-            ,
-            // in Pixels
-            _width(width)
-            , _height(height)
-            , _rows(new DeltaBitmapRow[height])
         {
             assert (startX + width <= (size_t)bufferWidth);
             assert (startY + height <= (size_t)bufferHeight);
@@ -382,17 +552,8 @@ class DeltaGenerator {
                      << (width * height * 4) << " width " << width
                      << " height " << height);
 
-            for (int y = 0; y < height; ++y)
-            {
-                size_t position = ((startY + y) * bufferWidth * 4) + (startX * 4);
-                DeltaBitmapRow &row = _rows[y];
-                row.initRow(reinterpret_cast<uint32_t *>(pixmap + position), width);
-            }
-        }
-
-        ~DeltaData()
-        {
-            delete[] _rows;
+            _bitmap = std::make_shared<DeltaBitmap>(pixmap, startX, startY, width, height,
+                                                    bufferWidth);
         }
 
         void setWid(TileWireId wid)
@@ -405,37 +566,36 @@ class DeltaGenerator {
             return _wid;
         }
 
-        void setWidth(int width)
+        // in Pixels
+        int getWidth() const
         {
-            _width = width;
+            return _bitmap->getWidth();
         }
 
-        int getWidth() const
+        int getHeight() const
         {
-            return _width;
+            return _bitmap->getHeight();
         }
 
-        void setHeight(int height)
+        const DeltaBitmapRow& getRow(int y) const
         {
-            _height = height;
+            return _bitmap->getRow(y);
         }
 
-        int getHeight() const
+        const std::shared_ptr<DeltaBitmap>& getBitmap() const
         {
-            return _height;
+            return _bitmap;
         }
 
-        const DeltaBitmapRow& getRow(int y) const
+        /// Share the storage of a bitmap known to be identical to ours.
+        void shareBitmap(const std::shared_ptr<DeltaBitmap>& bitmap)
         {
-            return _rows[y];
+            _bitmap = bitmap;
         }
 
         size_t sizeBytes() const
         {
-            size_t total = sizeof(DeltaData);
-            for (int i = 0; i < _height; ++i)
-                total += _rows[i].sizeBytes();
-            return total;
+            return sizeof(DeltaData) + _bitmap->sizeBytes();
         }
 
         void replaceAndFree(std::shared_ptr<DeltaData> &repl)
@@ -447,11 +607,7 @@ class DeltaGenerator {
                 return;
             }
             _wid = repl->_wid;
-            _width = repl->_width;
-            _height = repl->_height;
-            delete[] _rows;
-            _rows = repl->_rows;
-            repl->_rows = nullptr;
+            _bitmap = std::move(repl->_bitmap);
             repl.reset();
         }
 
@@ -471,9 +627,7 @@ class DeltaGenerator {
     private:
         std::atomic<bool> _inUse; // thread debugging check.
         TileWireId _wid;
-        int _width;
-        int _height;
-        DeltaBitmapRow *_rows;
+        std::shared_ptr<DeltaBitmap> _bitmap;
     };
 
     struct DeltaHasher {
@@ -495,6 +649,57 @@ class DeltaGenerator {
     /// The last several bitmap entries as a cache
     std::unordered_set<std::shared_ptr<DeltaData>, DeltaHasher, DeltaCompare> _deltaEntries;
     size_t _maxEntries;
+    /// The bitmaps of the cache by content hash, to share them across views and locations
+    std::unordered_map<uint64_t, std::weak_ptr<DeltaBitmap>> _bitmaps;
+    size_t _dedupLookups;
+    size_t _dedupHits;
+    /// Bytes of bitmaps we didn't need to keep, as they were shared.
+    size_t _dedupBytesSaved;
+
+    /// Drop the bitmaps no longer used by any cache entry.
+    void pruneBitmapsT()
+    {
+        assert(!_deltaGuard.try_lock() && "Expected to have _deltaGuard lock taken");
+
+        for (auto it = _bitmaps.begin(); it != _bitmaps.end();)
+        {
+            if (it->second.expired())
+                it = _bitmaps.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    /// Share the bitmap of an identical tile we already hold, eg. for another canonical view.
+    void dedupBitmap(DeltaData& update)
+    {
+        const std::shared_ptr<DeltaBitmap> bitmap = update.getBitmap();
+        std::shared_ptr<DeltaBitmap> existing;
+        {
+            std::unique_lock<std::mutex> guard(_deltaGuard);
+            ++_dedupLookups;
+            auto it = _bitmaps.find(bitmap->getHash());
+            if (it != _bitmaps.end())
+                existing = it->second.lock();
+        }
+
+        // Bitmaps are immutable, so compare without holding the lock.
+        if (existing && existing->identical(*bitmap))
+        {
+            update.shareBitmap(existing);
+
+            std::unique_lock<std::mutex> guard(_deltaGuard);
+            ++_dedupHits;
+            _dedupBytesSaved += bitmap->sizeBytes();
+            return;
+        }
+
+        std::unique_lock<std::mutex> guard(_deltaGuard);
+        _bitmaps[bitmap->getHash()] = bitmap;
+        // replaced tiles leave their bitmaps behind.
+        if (_bitmaps.size() > _deltaEntries.size() * 2 + 64)
+            pruneBitmapsT();
+    }
 
     void rebalanceDeltasT(bool bDropAll = false)
     {
@@ -515,6 +720,9 @@ class DeltaGenerator {
                           });
             for (size_t i = 0; i < toRemove; ++i)
                 _deltaEntries.erase(entries[i]);
+            entries.clear();
+
+            pruneBitmapsT();
         }
     }
 
@@ -624,14 +832,15 @@ class DeltaGenerator {
         // terminating this delta so we can detect the next one.
         output.push_back('t');
 
-        // FIXME: avoid allocation & make this more efficient.
         size_t maxCompressed = ZSTD_COMPRESSBOUND(output.size());
-        std::unique_ptr<char, void (*)(void*)> compressed((char*)malloc(maxCompressed), free);
+        char* compressed = ZstdContexts::getCompressBuffer(maxCompressed);
+        ZSTD_CCtx* cctx = ZstdContexts::getCCtx();
+        if (!compressed || !cctx)
+            return false;
 
         // compress for speed, not size - and trust to deltas.
-        size_t compSize = ZSTD_compress(compressed.get(), maxCompressed,
-                                        output.data(), output.size(),
-                                        compressionLevel);
+        size_t compSize = ZSTD_compress2(cctx, compressed, maxCompressed,
+                                         output.data(), output.size());
         if (ZSTD_isError(compSize))
         {
             LOG_ERR("Failed to compress delta of size " << output.size() << " with " << ZSTD_getErrorName(compSize));
@@ -645,7 +854,7 @@ class DeltaGenerator {
         outStream.push_back('D');
         size_t oldSize = outStream.size();
         outStream.resize(oldSize + compSize);
-        memcpy(&outStream[oldSize], compressed.get(), compSize);
+        memcpy(&outStream[oldSize], compressed, compSize);
 
         return true;
     }
@@ -653,6 +862,9 @@ class DeltaGenerator {
   public:
     DeltaGenerator()
         : _maxEntries(0)
+        , _dedupLookups(0)
+        , _dedupHits(0)
+        , _dedupBytesSaved(0)
     {}
 
     /// Re-balances the cache size to fit the number of sessions
@@ -681,14 +893,23 @@ class DeltaGenerator {
         oss << "\tdelta generator with " << _deltaEntries.size() << " entries vs. max "
             << _maxEntries << '\n';
         size_t totalSize = 0;
+        std::unordered_set<const DeltaBitmap*> bitmaps;
         for (const auto& it : _deltaEntries)
         {
-            size_t size = it->sizeBytes();
+            // count shared bitmaps once.
+            size_t size = sizeof(DeltaData);
+            if (bitmaps.insert(it->getBitmap().get()).second)
+                size += it->getBitmap()->sizeBytes();
             oss << "\t\t" << it->_loc._size << ',' << it->_loc._part << ',' << it->_loc._left << ','
                 << it->_loc._top << " wid: " << it->getWid() << " size: " << size << '\n';
             totalSize += size;
         }
-        oss << "\tdelta generator consumes " << totalSize << " bytes\n";
+        oss << "\tdelta generator consumes " << totalSize << " bytes in "
+            << bitmaps.size() << " distinct bitmaps\n";
+        oss << "\tdelta generator bitmap dedup hits: " << _dedupHits << " of " << _dedupLookups;
+        if (_dedupLookups > 0)
+            oss << " (" << (_dedupHits * 100 / _dedupLookups) << "%)";
+        oss << " bytes saved: " << _dedupBytesSaved << '\n';
     }
 
     /**
@@ -728,6 +949,8 @@ class DeltaGenerator {
             wid, pixmap, startX, startY, width, height, loc, bufferWidth, bufferHeight));
         std::shared_ptr<DeltaData> cacheEntry;
 
+        dedupBitmap(*update);
+
         {
             // protect _deltaEntries
             std::unique_lock<std::mutex> guard(_deltaGuard);
@@ -748,7 +971,14 @@ class DeltaGenerator {
         assert (cacheEntry);
 
         bool delta = false;
-        if (!forceKeyframe)
+        if (!forceKeyframe && cacheEntry->getBitmap() == update->getBitmap())
+        {
+            // The same de-duplicated bitmap: nothing changed.
+            LOGA_TRC(Pixel, "Identical / un-changed tile");
+            output.push_back('D');
+            delta = true;
+        }
+        else if (!forceKeyframe)
             delta = makeDelta(*cacheEntry, *update, output, mode);
 
         // no two threads can be working on the same DeltaData.
@@ -827,19 +1057,19 @@ class DeltaGenerator {
             size_t rowSize = (size_t)width * 4 + spaceForBitmask + 2;
             size_t maxCompressed = ZSTD_COMPRESSBOUND(rowSize * height);
 
-            std::unique_ptr<char, void (*)(void*)> compressed((char*)malloc(maxCompressed), free);
+            char* compressed = ZstdContexts::getCompressBuffer(maxCompressed);
             if (!compressed)
             {
                 LOG_ERR("Failed to allocate buffer of size " << maxCompressed << " to compress into");
                 return 0;
             }
 
-            ZSTD_CCtx *cctx = ZSTD_createCCtx();
-
-            ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, compressionLevel);
+            ZSTD_CCtx *cctx = ZstdContexts::getCCtx();
+            if (!cctx)
+                return 0;
 
             ZSTD_outBuffer outb;
-            outb.dst = compressed.get();
+            outb.dst = compressed;
             outb.size = maxCompressed;
             outb.pos = 0;
 
@@ -863,13 +1093,10 @@ class DeltaGenerator {
                 if (ZSTD_isError(compSize))
                 {
                     LOG_ERR("failed to compress image: " << compSize << " is: " << ZSTD_getErrorName(compSize));
-                    ZSTD_freeCCtx(cctx);
                     return 0;
                 }
             }
 
-            ZSTD_freeCCtx(cctx);
-
             size_t compSize = outb.pos;
             LOGA_TRC(Pixel, "Compressed image of size " << (width * height * 4) << " to size " << compSize);
 //            << Util::dumpHex(std::string((char *)compressed, compSize)));
@@ -878,7 +1105,7 @@ class DeltaGenerator {
             output.push_back('Z');
             size_t oldSize = output.size();
             output.resize(oldSize + compSize);
-            memcpy(&output[oldSize], compressed.get(), compSize);
+            memcpy(&output[oldSize], compressed, compSize);
         }
         else
         {
@@ -901,71 +1128,233 @@ class DeltaGenerator {
         return output.size();
     }
 
-    // used only by test code
-    static Blob expand(const Blob &blob)
+    /// Decompress the zstd frames of a keyframe and of any deltas following it.
+    static bool decompress(const char *data, size_t size, std::vector<uint8_t> &output)
     {
-        Blob img = std::make_shared<BlobData>();
-        img->resize(1024*1024*4); // lots of extra space.
+        ZSTD_DCtx *dctx = ZstdContexts::getDCtx();
+        if (!dctx)
+            return false;
+
+        ZSTD_inBuffer inb;
+        inb.src = data;
+        inb.size = size;
+        inb.pos = 0;
 
-        size_t const dSize = ZSTD_decompress(img->data(), img->size(), blob->data(), blob->size());
-        if (ZSTD_isError(dSize))
+        // a keyframe unpacks to at most 256 rows of 256 unique pixels & a mask.
+        output.resize(256 * (2 + _rleMaskUnits * 8 + 256 * 4));
+        size_t outPos = 0;
+        size_t ret = 1;
+        while (inb.pos < inb.size || ret != 0)
         {
-            LOG_ERR("Failed to decompress blob of size " << blob->size() << " with " << ZSTD_getErrorName(dSize));
-            return Blob();
-        }
-        img->resize(dSize);
+            if (output.size() - outPos < ZSTD_DStreamOutSize())
+                output.resize(output.size() * 2);
+
+            ZSTD_outBuffer outb;
+            outb.dst = output.data();
+            outb.size = output.size();
+            outb.pos = outPos;
 
+            ret = ZSTD_decompressStream(dctx, &outb, &inb);
+            if (ZSTD_isError(ret))
+            {
+                LOG_ERR("Failed to decompress blob of size " << size << " with " << ZSTD_getErrorName(ret));
+                return false;
+            }
+            outPos = outb.pos;
 
-        // cf. CanvasTileLayer's _applyDelta
-        size_t offset = 0;
-        constexpr size_t width = 256;
-        constexpr size_t height = 256;
+            if (ret != 0 && inb.pos == inb.size && outb.pos < outb.size)
+            {
+                LOG_ERR("Truncated compressed blob of size " << size);
+                return false;
+            }
+        }
 
-        Blob result = std::make_shared<BlobData>();
-        result->resize(width * height * 4);
+        output.resize(outPos);
+        return true;
+    }
 
-        for (size_t y = 0; y < height; ++y)
+    /// Expand the @height run-length encoded rows of a keyframe into @pixels.
+    /// Returns the number of bytes used, or 0 if @data is truncated.
+    static size_t unrle(const uint8_t *data, size_t size,
+                        unsigned int width, unsigned int height, uint32_t *pixels)
+    {
+        // cf. CanvasTileUtils' unrle
+        constexpr size_t rleMaskSizeBytes = 256/8;
+        size_t offset = 0;
+        for (unsigned int y = 0; y < height; ++y)
         {
-            size_t rleSize = static_cast<unsigned char>((*img)[offset]) +
-                static_cast<unsigned char>((*img)[offset+1]) * 256;
+            if (offset + 2 + rleMaskSizeBytes > size)
+                return 0;
+
+            const size_t rleSize = data[offset] + data[offset + 1] * 256;
             offset += 2;
+
+            const uint8_t *rleMask = data + offset;
+            offset += rleMaskSizeBytes;
+
+            if (offset + rleSize * 4 > size)
+                return 0;
+            const uint8_t *uniquePixels = data + offset;
             LOGA_TRC(Pixel, "rle size " << rleSize);
 
-            size_t rleMask = offset;
-            constexpr int rleMaskSizeBytes = 256/8;
+            // leave pre-multiplied.
+            uint32_t lastPix = 0;
+            size_t pixSrc = 0;
+            uint32_t *dest = pixels + y * width;
+            for (unsigned int x = 0; x < width; ++x)
+            {
+                if (!(rleMask[x >> 3] & (1 << (x & 7))) && pixSrc < rleSize)
+                    memcpy(&lastPix, uniquePixels + 4 * pixSrc++, 4);
+                dest[x] = lastPix;
+            }
 
-            offset += rleMaskSizeBytes;
+            offset += rleSize * 4;
+        }
 
-            uint32_t uniquePixels[256];
-            if (rleSize > 0) // align
+        return offset;
+    }
+
+    /// Apply a single delta, up to and including its terminating 't', to @pixels.
+    /// Returns the number of bytes used, or 0 if @data is not a valid delta.
+    static size_t applyDelta(const uint8_t *data, size_t size,
+                             unsigned int width, unsigned int height,
+                             uint32_t *pixels, std::vector<uint32_t> &oldPixels)
+    {
+        // cf. CanvasTileLayer's _applyDeltaChunk: rows are copied from the previous frame.
+        oldPixels.assign(pixels, pixels + width * height);
+
+        for (size_t i = 0; i < size;)
+        {
+            switch (data[i])
+            {
+            case 'c': // copy row
+            {
+                if (i + 4 > size)
+                    return 0;
+                const unsigned int count = data[i + 1];
+                const unsigned int srcRow = data[i + 2];
+                const unsigned int destRow = data[i + 3];
+                if (srcRow + count > height || destRow + count > height)
+                    return 0;
+                memcpy(pixels + destRow * width, oldPixels.data() + srcRow * width,
+                       count * width * 4);
+                i += 4;
+                break;
+            }
+            case 'd': // new run
             {
-                // leave pre-multiplied.
-                memcpy(uniquePixels, img->data() + offset, rleSize * 4);
+                if (i + 4 > size)
+                    return 0;
+                const unsigned int destRow = data[i + 1];
+                const unsigned int destCol = data[i + 2];
+                const unsigned int span = data[i + 3];
+                i += 4;
+                if (destRow >= height || destCol + span > width || i + span * 4 > size)
+                    return 0;
+                memcpy(pixels + destRow * width + destCol, data + i, span * 4);
+                i += span * 4;
+                break;
+            }
+            case 't': // terminate delta new one next
+                return i + 1;
+            default:
+                LOG_WRN("Unknown delta code " << static_cast<int>(data[i]));
+                return 0;
             }
+        }
 
-            // It would be rather nice to have real 64bit types [!]
-            uint32_t lastPix = 0;
-            uint32_t lastMask = 0;
-            uint32_t bitToCheck = 256;
-            size_t rleMaskOffset = rleMask;
+        return 0; // unterminated
+    }
 
-            size_t pixOffset = y * width;
-            size_t pixSrc = 0;
+    /// Compress @pixels, already in wire order, as a keyframe without its 'Z'.
+    static bool compressKeyframe(const uint32_t *pixels, unsigned int width,
+                                 unsigned int height, std::vector<char> &output)
+    {
+        assert(width <= 256);
+        std::vector<unsigned char> packed(height * (2 + _rleMaskUnits * 8 + width * 4));
+        size_t packedSize = 0;
+        for (unsigned int y = 0; y < height; ++y)
+        {
+            uint32_t scratch[256];
+            size_t rleSize = 0;
+            uint64_t rleMask[_rleMaskUnits];
+            DeltaBitmapRow::initPixRowCpu(pixels + y * width, scratch, &rleSize, rleMask, width);
+            packedSize += DeltaBitmapRow::packForNetwork(packed.data() + packedSize, rleSize,
+                                                         rleMask, scratch, LOK_TILEMODE_RGBA);
+        }
+
+        ZSTD_CCtx* cctx = ZstdContexts::getCCtx();
+        if (!cctx)
+            return false;
 
-            for (size_t x = 0; x < width; ++x)
+        const size_t oldSize = output.size();
+        output.resize(oldSize + ZSTD_COMPRESSBOUND(packedSize));
+        const size_t compSize = ZSTD_compress2(cctx, output.data() + oldSize, output.size() - oldSize,
+                                               packed.data(), packedSize);
+        if (ZSTD_isError(compSize))
+        {
+            LOG_ERR("Failed to compress keyframe of size " << packedSize << " with " << ZSTD_getErrorName(compSize));
+            output.resize(oldSize);
+            return false;
+        }
+
+        output.resize(oldSize + compSize);
+        return true;
+    }
+
+    /// Merge a keyframe and the deltas stacked on it, compressed and without
+    /// their 'Z' and 'D' markers as the TileCache holds them, into one keyframe.
+    static bool compactDeltas(const char *data, size_t size, unsigned int width,
+                              unsigned int height, std::vector<char> &output)
+    {
+        if (width == 0 || width > 256 || height == 0 || height > 256)
+            return false;
+
+        std::vector<uint8_t> frames;
+        if (!decompress(data, size, frames))
+            return false;
+
+        std::vector<uint32_t> pixels(width * height);
+        size_t offset = unrle(frames.data(), frames.size(), width, height, pixels.data());
+        if (!offset)
+        {
+            LOG_WRN("Truncated keyframe of size " << frames.size());
+            return false;
+        }
+
+        std::vector<uint32_t> oldPixels;
+        while (offset < frames.size())
+        {
+            const size_t len = applyDelta(frames.data() + offset, frames.size() - offset,
+                                          width, height, pixels.data(), oldPixels);
+            if (!len)
             {
-                if (bitToCheck > 128)
-                {
-                    bitToCheck = 1;
-                    lastMask = (*img)[rleMaskOffset++];
-                }
-                if (!(lastMask & bitToCheck))
-                    lastPix = uniquePixels[pixSrc++];
-                bitToCheck = bitToCheck << 1;
-                (*result)[pixOffset++] = lastPix;
+                LOG_WRN("Invalid delta at offset " << offset << " of " << frames.size());
+                return false;
             }
+            offset += len;
+        }
 
-            offset += rleSize * 4;
+        return compressKeyframe(pixels.data(), width, height, output);
+    }
+
+    // used only by test code
+    static Blob expand(const Blob &blob)
+    {
+        std::vector<uint8_t> img;
+        if (!decompress(blob->data(), blob->size(), img))
+            return Blob();
+
+        constexpr size_t width = 256;
+        constexpr size_t height = 256;
+
+        Blob result = std::make_shared<BlobData>();
+        result->resize(width * height * 4);
+        if (!unrle(img.data(), img.size(), width, height,
+                   reinterpret_cast<uint32_t *>(result->data())))
+        {
+            LOG_ERR("Truncated keyframe of size " << img.size());
+            return Blob();
         }
 
         return result;
@@ -9,6 +9,10 @@
 // since compiling with different instruction set can generate
 // versions of inlined code that get injected outside of this
 // module by the linker.
+//
+// The file itself is built for the baseline architecture: each
+// accelerated kernel enables its instruction set with a target
+// attribute, and is only called if the CPU supports it.
 
 #include "config.h"
 
@@ -20,11 +24,121 @@
 
 #include "DeltaSimd.h"
 
-#if ENABLE_SIMD
+#if ENABLE_SIMD && defined(__x86_64__)
+#  define SIMD_X86 1
 #  include <immintrin.h>
+#elif ENABLE_SIMD && defined(__aarch64__)
+#  define SIMD_NEON 1
+#  include <arm_neon.h>
+#  if defined(__ARM_FEATURE_CRC32)
+#    include <arm_acle.h>
+#  endif
+#endif
 
 #define DEBUG_LUT 0
 
+typedef int (*InitPixRowFn)(const uint32_t *from, uint32_t *scratch, size_t *scratchLen,
+                            uint64_t *rleMask);
+typedef uint32_t (*CrcRowFn)(const uint64_t *rleMask, const uint32_t *rleData, size_t rleSize);
+typedef void (*DiffRowFn)(const uint32_t *a, const uint32_t *b, uint64_t *diffMask);
+
+static unsigned int supportedKernels = 1 << SIMD_DELTA_SCALAR;
+static enum SimdDeltaKernel currentKernel = SIMD_DELTA_SCALAR;
+
+static InitPixRowFn initPixRowKernel = NULL; // the C++ implementation
+static CrcRowFn crcRowKernel;
+static DiffRowFn diffRowKernel;
+
+// CRC32C (Castagnoli) as computed by the SSE4.2 and ARMv8 crc32c instructions,
+// so that all kernels agree on the CRC of a row. Sliced by 8 for speed.
+static uint32_t crc32c_lut[8][256];
+static int crc32c_lut_ready = 0;
+
+// pshufb / tbl control bytes to pack the pixels not set in a 4 bit mask.
+static uint8_t shuffle4_lut[16][16];
+
+static void init_crc32c_lut(void)
+{
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit)
+            crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+        crc32c_lut[0][i] = crc;
+    }
+
+    for (uint32_t i = 0; i < 256; ++i)
+        for (int slice = 1; slice < 8; ++slice)
+            crc32c_lut[slice][i] = (crc32c_lut[slice - 1][i] >> 8) ^
+                                   crc32c_lut[0][crc32c_lut[slice - 1][i] & 0xff];
+
+    crc32c_lut_ready = 1;
+}
+
+static void init_shuffle4_lut(void)
+{
+    for (unsigned int pattern = 0; pattern < 16; ++pattern)
+    {
+        unsigned int i = 0;
+        for (unsigned int src = 0; src < 4; ++src)
+        {
+            if (pattern & (1 << src)) // set bit is a duplicate -> ignore.
+                continue;
+            for (unsigned int byte = 0; byte < 4; ++byte)
+                shuffle4_lut[pattern][i++] = src * 4 + byte;
+        }
+        while (i < 16) // zero the padding
+            shuffle4_lut[pattern][i++] = 0x80;
+    }
+}
+
+static uint32_t crc32cBytes(uint32_t crc, const uint8_t *data, size_t len)
+{
+    while (len >= 8)
+    {
+        const uint32_t lo = crc ^ ((uint32_t)data[0] | (uint32_t)data[1] << 8 |
+                                   (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24);
+        const uint32_t hi = (uint32_t)data[4] | (uint32_t)data[5] << 8 |
+                            (uint32_t)data[6] << 16 | (uint32_t)data[7] << 24;
+        crc = crc32c_lut[7][lo & 0xff] ^ crc32c_lut[6][(lo >> 8) & 0xff] ^
+              crc32c_lut[5][(lo >> 16) & 0xff] ^ crc32c_lut[4][lo >> 24] ^
+              crc32c_lut[3][hi & 0xff] ^ crc32c_lut[2][(hi >> 8) & 0xff] ^
+              crc32c_lut[1][(hi >> 16) & 0xff] ^ crc32c_lut[0][hi >> 24];
+        data += 8;
+        len -= 8;
+    }
+
+    while (len--)
+        crc = crc32c_lut[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+
+    return crc;
+}
+
+static uint32_t crcRowScalar(const uint64_t *rleMask, const uint32_t *rleData, size_t rleSize)
+{
+    // simd_deltaInit() was never called: leave it to the full comparison.
+    if (!crc32c_lut_ready)
+        return 0;
+
+    uint32_t crc = 0xffffffff;
+    crc = crc32cBytes(crc, (const uint8_t *)rleMask, 4 * sizeof(uint64_t));
+    crc = crc32cBytes(crc, (const uint8_t *)rleData, rleSize * 4);
+    return ~crc;
+}
+
+static void diffRowScalar(const uint32_t *a, const uint32_t *b, uint64_t *diffMask)
+{
+    for (unsigned int w = 0; w < 4; ++w)
+    {
+        uint64_t mask = 0;
+        for (unsigned int i = 0; i < 64; ++i)
+            mask |= (uint64_t)(a[w * 64 + i] != b[w * 64 + i]) << i;
+        diffMask[w] = mask;
+    }
+}
+
+#if SIMD_X86
+
 // set of control data bytes for vperd
 static __m256i vpermd_lut[256];
 static __m256i vpermd_shift_left;
@@ -32,7 +146,8 @@ static __m256i vpermd_last_to_first;
 static __m256i low_pixel_mask;
 
 // Build table we can lookup bitmasks in to generate gather data
-void init_gather_lut()
+__attribute__((target("avx2")))
+static void init_gather_lut(void)
 {
     for (unsigned int pattern = 0; pattern < 256; ++pattern)
     {
@@ -77,34 +192,49 @@ void init_gather_lut()
         0, 0, 0, 0,  0xff, 0xff, 0xff, 0xff);
 }
 
-// non-intuitively we need to use the sign bit as
-// if floats to gather bits from 32bit words
-static uint64_t diffMask(__m256i prev, __m256i curr)
+// 4 pixels per cycle: compare with the previous pixel, pack with pshufb.
+__attribute__((target("sse4.2,popcnt")))
+static int initPixRowSSE42(const uint32_t *from, uint32_t *scratch, size_t *scratchLen,
+                           uint64_t *rleMaskBlockWide)
 {
-    __m256i res = _mm256_cmpeq_epi32(prev, curr);
-    __m256 m256 = _mm256_castsi256_ps(res);
-    return _mm256_movemask_ps(m256);
-}
+    uint32_t* dest = scratch;
+    uint64_t rleMask = 0;
+    __m128i prev = _mm_setzero_si128(); // transparent
 
-#endif
+    for (unsigned int x = 0; x < 256; x += 4)
+    {
+        __m128i curr = _mm_loadu_si128((const __m128i*)(from + x));
 
-void simd_deltaInit(void)
-{
-#if ENABLE_SIMD
-    init_gather_lut();
-#endif
+        // the last previous pixel followed by the first three current ones
+        __m128i shifted = _mm_alignr_epi8(curr, prev, 12);
+        unsigned int newMask =
+            _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(shifted, curr)));
+
+        rleMask |= (uint64_t)newMask << (x & 63);
+        if ((x & 63) == 60)
+        {
+            rleMaskBlockWide[x >> 6] = rleMask;
+            rleMask = 0;
+        }
+
+        __m128i control = _mm_loadu_si128((const __m128i*)shuffle4_lut[newMask]);
+
+        // over-store in dest: we are guaranteed enough space worst-case
+        _mm_storeu_si128((__m128i*)dest, _mm_shuffle_epi8(curr, control));
+        dest += 4 - _mm_popcnt_u32(newMask);
+
+        prev = curr;
+    }
+    *scratchLen = dest - scratch;
+
+    return 1;
 }
 
 // accelerated compression of a 256 pixel run
-int simd_initPixRowSimd(const uint32_t *from, uint32_t *scratch, size_t *scratchLen, uint64_t *rleMaskBlockWide)
+__attribute__((target("avx2,popcnt")))
+static int initPixRowAVX2(const uint32_t *from, uint32_t *scratch, size_t *scratchLen,
+                          uint64_t *rleMaskBlockWide)
 {
-#if !ENABLE_SIMD
-    // no fun.
-    (void)from; (void)scratch; (void)scratchLen; (void)rleMaskBlockWide;
-    return 0;
-
-#else // ENABLE_SIMD
-
     *scratchLen = 0;
     uint8_t *rleMaskBlock = (uint8_t *)rleMaskBlockWide;
     for (unsigned int x = 0; x < 256/8; ++x)
@@ -133,8 +263,10 @@ int simd_initPixRowSimd(const uint32_t *from, uint32_t *scratch, size_t *scratch
         // merge in the last pixel
         prev = _mm256_or_si256(prev, lastPix);
 
-        // turn that into a bit-mask.
-        uint64_t newMask = diffMask(prev, curr);
+        // turn that into a bit-mask: non-intuitively we need to use the
+        // sign bit as if floats to gather bits from 32bit words
+        __m256i res = _mm256_cmpeq_epi32(prev, curr);
+        uint64_t newMask = _mm256_movemask_ps(_mm256_castsi256_ps(res));
         assert (newMask < 256);
 
         // invert bitmask for counting non-same foo ... [!]
@@ -178,7 +310,318 @@ int simd_initPixRowSimd(const uint32_t *from, uint32_t *scratch, size_t *scratch
         rleMaskBlockWide[x] = htole64(rleMaskBlockWide[x]);
 
     return 1;
-#endif // ENABLE_SIMD
+}
+
+// 16 pixels per cycle: the mask compare and compress-store do all the work.
+__attribute__((target("avx512f,popcnt")))
+static int initPixRowAVX512(const uint32_t *from, uint32_t *scratch, size_t *scratchLen,
+                            uint64_t *rleMaskBlockWide)
+{
+    uint32_t* dest = scratch;
+    uint64_t rleMask = 0;
+    __m512i prev = _mm512_setzero_si512(); // transparent
+
+    for (unsigned int x = 0; x < 256; x += 16)
+    {
+        __m512i curr = _mm512_loadu_si512((const void*)(from + x));
+
+        // the last previous pixel followed by the first fifteen current ones
+        __m512i shifted = _mm512_alignr_epi32(curr, prev, 15);
+        __mmask16 newMask = _mm512_cmpeq_epi32_mask(shifted, curr);
+
+        rleMask |= (uint64_t)newMask << (x & 63);
+        if ((x & 63) == 48)
+        {
+            rleMaskBlockWide[x >> 6] = rleMask;
+            rleMask = 0;
+        }
+
+        _mm512_mask_compressstoreu_epi32(dest, (__mmask16)~newMask, curr);
+        dest += 16 - _mm_popcnt_u32(newMask);
+
+        prev = curr;
+    }
+    *scratchLen = dest - scratch;
+
+    return 1;
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t crcRowSSE42(const uint64_t *rleMask, const uint32_t *rleData, size_t rleSize)
+{
+    uint64_t crc = 0xffffffff;
+    for (unsigned int i = 0; i < 4; ++i)
+        crc = _mm_crc32_u64(crc, rleMask[i]);
+
+    size_t i = 0;
+    for (; i + 2 <= rleSize; i += 2)
+    {
+        uint64_t pixels;
+        memcpy(&pixels, rleData + i, sizeof(pixels));
+        crc = _mm_crc32_u64(crc, pixels);
+    }
+
+    uint32_t crc32 = (uint32_t)crc;
+    if (i < rleSize)
+        crc32 = _mm_crc32_u32(crc32, rleData[i]);
+
+    return ~crc32;
+}
+
+__attribute__((target("sse4.2")))
+static void diffRowSSE42(const uint32_t *a, const uint32_t *b, uint64_t *diffMask)
+{
+    for (unsigned int w = 0; w < 4; ++w)
+    {
+        uint64_t mask = 0;
+        for (unsigned int i = 0; i < 64; i += 4)
+        {
+            __m128i va = _mm_loadu_si128((const __m128i*)(a + w * 64 + i));
+            __m128i vb = _mm_loadu_si128((const __m128i*)(b + w * 64 + i));
+            uint64_t same = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(va, vb)));
+            mask |= (~same & 0xf) << i;
+        }
+        diffMask[w] = mask;
+    }
+}
+
+__attribute__((target("avx2")))
+static void diffRowAVX2(const uint32_t *a, const uint32_t *b, uint64_t *diffMask)
+{
+    for (unsigned int w = 0; w < 4; ++w)
+    {
+        uint64_t mask = 0;
+        for (unsigned int i = 0; i < 64; i += 8)
+        {
+            __m256i va = _mm256_loadu_si256((const __m256i_u*)(a + w * 64 + i));
+            __m256i vb = _mm256_loadu_si256((const __m256i_u*)(b + w * 64 + i));
+            uint64_t same = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(va, vb)));
+            mask |= (~same & 0xff) << i;
+        }
+        diffMask[w] = mask;
+    }
+}
+
+__attribute__((target("avx512f")))
+static void diffRowAVX512(const uint32_t *a, const uint32_t *b, uint64_t *diffMask)
+{
+    for (unsigned int w = 0; w < 4; ++w)
+    {
+        uint64_t mask = 0;
+        for (unsigned int i = 0; i < 64; i += 16)
+        {
+            __m512i va = _mm512_loadu_si512((const void*)(a + w * 64 + i));
+            __m512i vb = _mm512_loadu_si512((const void*)(b + w * 64 + i));
+            mask |= (uint64_t)_mm512_cmpneq_epi32_mask(va, vb) << i;
+        }
+        diffMask[w] = mask;
+    }
+}
+
+#endif // SIMD_X86
+
+#if SIMD_NEON
+
+// 4 pixels per cycle: compare with the previous pixel, pack with tbl.
+static int initPixRowNEON(const uint32_t *from, uint32_t *scratch, size_t *scratchLen,
+                          uint64_t *rleMaskBlockWide)
+{
+    static const uint32_t bits[4] = { 1, 2, 4, 8 };
+    const uint32x4_t bitValues = vld1q_u32(bits);
+
+    uint32_t* dest = scratch;
+    uint64_t rleMask = 0;
+    uint32x4_t prev = vdupq_n_u32(0); // transparent
+
+    for (unsigned int x = 0; x < 256; x += 4)
+    {
+        uint32x4_t curr = vld1q_u32(from + x);
+
+        // the last previous pixel followed by the first three current ones
+        uint32x4_t shifted = vextq_u32(prev, curr, 3);
+        unsigned int newMask = vaddvq_u32(vandq_u32(vceqq_u32(shifted, curr), bitValues));
+
+        rleMask |= (uint64_t)newMask << (x & 63);
+        if ((x & 63) == 60)
+        {
+            rleMaskBlockWide[x >> 6] = rleMask;
+            rleMask = 0;
+        }
+
+        uint8x16_t packed = vqtbl1q_u8(vreinterpretq_u8_u32(curr), vld1q_u8(shuffle4_lut[newMask]));
+
+        // over-store in dest: we are guaranteed enough space worst-case
+        vst1q_u32(dest, vreinterpretq_u32_u8(packed));
+        dest += 4 - __builtin_popcount(newMask);
+
+        prev = curr;
+    }
+    *scratchLen = dest - scratch;
+
+    return 1;
+}
+
+#if defined(__ARM_FEATURE_CRC32)
+static uint32_t crcRowNEON(const uint64_t *rleMask, const uint32_t *rleData, size_t rleSize)
+{
+    uint32_t crc = 0xffffffff;
+    for (unsigned int i = 0; i < 4; ++i)
+        crc = __crc32cd(crc, rleMask[i]);
+
+    size_t i = 0;
+    for (; i + 2 <= rleSize; i += 2)
+    {
+        uint64_t pixels;
+        memcpy(&pixels, rleData + i, sizeof(pixels));
+        crc = __crc32cd(crc, pixels);
+    }
+
+    if (i < rleSize)
+        crc = __crc32cw(crc, rleData[i]);
+
+    return ~crc;
+}
+#else
+#  define crcRowNEON crcRowScalar
+#endif
+
+static void diffRowNEON(const uint32_t *a, const uint32_t *b, uint64_t *diffMask)
+{
+    static const uint32_t bits[4] = { 1, 2, 4, 8 };
+    const uint32x4_t bitValues = vld1q_u32(bits);
+
+    for (unsigned int w = 0; w < 4; ++w)
+    {
+        uint64_t mask = 0;
+        for (unsigned int i = 0; i < 64; i += 4)
+        {
+            uint32x4_t differ = vmvnq_u32(vceqq_u32(vld1q_u32(a + w * 64 + i),
+                                                    vld1q_u32(b + w * 64 + i)));
+            mask |= (uint64_t)vaddvq_u32(vandq_u32(differ, bitValues)) << i;
+        }
+        diffMask[w] = mask;
+    }
+}
+
+#endif // SIMD_NEON
+
+void simd_deltaInit(int hasSSE42, int hasAVX2, int hasAVX512, int hasNEON)
+{
+    init_crc32c_lut();
+    init_shuffle4_lut();
+
+    supportedKernels = 1 << SIMD_DELTA_SCALAR;
+#if SIMD_X86
+    // Each of these implies the previous ones on real hardware.
+    if (hasSSE42)
+        supportedKernels |= 1 << SIMD_DELTA_SSE42;
+    if (hasSSE42 && hasAVX2)
+    {
+        init_gather_lut();
+        supportedKernels |= 1 << SIMD_DELTA_AVX2;
+    }
+    if (hasSSE42 && hasAVX512)
+        supportedKernels |= 1 << SIMD_DELTA_AVX512;
+#else
+    (void)hasSSE42; (void)hasAVX2; (void)hasAVX512;
+#endif
+#if SIMD_NEON
+    if (hasNEON)
+        supportedKernels |= 1 << SIMD_DELTA_NEON;
+#else
+    (void)hasNEON;
+#endif
+
+    // Pick the best.
+    for (int kernel = SIMD_DELTA_KERNEL_COUNT - 1; kernel >= 0; --kernel)
+    {
+        if (simd_deltaSetKernel((enum SimdDeltaKernel)kernel))
+            break;
+    }
+}
+
+int simd_deltaSetKernel(enum SimdDeltaKernel kernel)
+{
+    if (kernel >= SIMD_DELTA_KERNEL_COUNT || !(supportedKernels & (1 << kernel)))
+        return 0;
+
+    switch (kernel)
+    {
+#if SIMD_X86
+        case SIMD_DELTA_SSE42:
+            initPixRowKernel = initPixRowSSE42;
+            crcRowKernel = crcRowSSE42;
+            diffRowKernel = diffRowSSE42;
+            break;
+        case SIMD_DELTA_AVX2:
+            initPixRowKernel = initPixRowAVX2;
+            crcRowKernel = crcRowSSE42;
+            diffRowKernel = diffRowAVX2;
+            break;
+        case SIMD_DELTA_AVX512:
+            initPixRowKernel = initPixRowAVX512;
+            crcRowKernel = crcRowSSE42;
+            diffRowKernel = diffRowAVX512;
+            break;
+#endif
+#if SIMD_NEON
+        case SIMD_DELTA_NEON:
+            initPixRowKernel = initPixRowNEON;
+            crcRowKernel = crcRowNEON;
+            diffRowKernel = diffRowNEON;
+            break;
+#endif
+        default:
+            initPixRowKernel = NULL;
+            crcRowKernel = crcRowScalar;
+            diffRowKernel = diffRowScalar;
+            break;
+    }
+
+    currentKernel = kernel;
+    return 1;
+}
+
+enum SimdDeltaKernel simd_deltaGetKernel(void)
+{
+    return currentKernel;
+}
+
+const char *simd_deltaKernelName(enum SimdDeltaKernel kernel)
+{
+    switch (kernel)
+    {
+        case SIMD_DELTA_SCALAR: return "scalar";
+        case SIMD_DELTA_SSE42: return "sse4.2";
+        case SIMD_DELTA_NEON: return "neon";
+        case SIMD_DELTA_AVX2: return "avx2";
+        case SIMD_DELTA_AVX512: return "avx512";
+        default: return "unknown";
+    }
+}
+
+int simd_initPixRowSimd(const uint32_t *from, uint32_t *scratch, size_t *scratchLen, uint64_t *rleMaskBlockWide)
+{
+    if (!initPixRowKernel)
+        return 0; // no fun.
+
+    return initPixRowKernel(from, scratch, scratchLen, rleMaskBlockWide);
+}
+
+uint32_t simd_crcRow(const uint64_t *rleMask, const uint32_t *rleData, size_t rleSize)
+{
+    if (!crcRowKernel)
+        return crcRowScalar(rleMask, rleData, rleSize);
+
+    return crcRowKernel(rleMask, rleData, rleSize);
+}
+
+void simd_diffRow(const uint32_t *a, const uint32_t *b, uint64_t *diffMask)
+{
+    if (!diffRowKernel)
+        diffRowScalar(a, b, diffMask);
+    else
+        diffRowKernel(a, b, diffMask);
 }
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
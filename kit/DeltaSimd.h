@@ -18,10 +18,37 @@
 extern "C" {
 #endif
 
-void simd_deltaInit(void);
+/// The implementations of the delta pixel kernels, in increasing order of preference.
+enum SimdDeltaKernel
+{
+    SIMD_DELTA_SCALAR,
+    SIMD_DELTA_SSE42,
+    SIMD_DELTA_NEON,
+    SIMD_DELTA_AVX2,
+    SIMD_DELTA_AVX512,
+    SIMD_DELTA_KERNEL_COUNT
+};
 
+/// Builds the lookup tables and selects the best kernel the CPU supports,
+/// with the features as detected by simd::init().
+void simd_deltaInit(int hasSSE42, int hasAVX2, int hasAVX512, int hasNEON);
+
+/// Forces a kernel, eg. for benchmarking. Returns 0 if it is not supported here.
+int simd_deltaSetKernel(enum SimdDeltaKernel kernel);
+
+enum SimdDeltaKernel simd_deltaGetKernel(void);
+
+const char *simd_deltaKernelName(enum SimdDeltaKernel kernel);
+
+/// RLE a 256 pixel row. Returns 0 with the scalar kernel, to use the C++ implementation.
 int simd_initPixRowSimd(const uint32_t *from, uint32_t *scratch, size_t *scratchLen, uint64_t *rleMask);
 
+/// CRC32C of a run-length encoded row: its 256 bit mask and unique pixels.
+uint32_t simd_crcRow(const uint64_t *rleMask, const uint32_t *rleData, size_t rleSize);
+
+/// Sets a bit in @diffMask for each of the 256 pixels that differ between @a and @b.
+void simd_diffRow(const uint32_t *a, const uint32_t *b, uint64_t *diffMask);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -810,8 +810,8 @@ int forkit_main(int argc, char** argv)
 #endif
     }
 
-    if (simd::init())
-        simd_deltaInit();
+    simd::init();
+    simd_deltaInit(simd::HasSSE42, simd::HasAVX2, simd::HasAVX512, simd::HasNEON);
 
     if (!Util::isKitInProcess())
         Util::setApplicationPath(Poco::Path(argv[0]).parent().toString());
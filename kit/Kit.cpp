@@ -81,6 +81,7 @@
 #include "RenderTiles.hpp"
 #include "KitWebSocket.hpp"
 #include <common/ConfigUtil.hpp>
+#include <common/TraceBuffer.hpp>
 #include <common/TraceEvent.hpp>
 #include <common/Watchdog.hpp>
 #include <common/Uri.hpp>
@@ -753,6 +754,8 @@ Document::Document(const std::shared_ptr<lok::Office>& loKit, const std::string&
     , _editorId(-1)
     , _editorChangeWarning(false)
     , _lastMemTrimTime(std::chrono::steady_clock::now())
+    , _speculativeBudgetStart(std::chrono::steady_clock::now())
+    , _speculativeRenderTime(0)
     , _mobileAppDocId(mobileAppDocId)
     , _duringLoad(0)
 {
@@ -763,6 +766,13 @@ Document::Document(const std::shared_ptr<lok::Office>& loKit, const std::string&
 #if !MOBILEAPP
     assert(singletonDocument == nullptr);
     singletonDocument = this;
+
+    if (ConfigUtil::isInitialized() && ConfigUtil::getBool("trace_event[@enable]", false) &&
+        ConfigUtil::getBool("trace_event.binary", false))
+    {
+        TraceBuffer::enable(ConfigUtil::getInt("trace_event.sample_percent", 100));
+        LOG_INF("Buffering binary Trace Events");
+    }
 #endif
     // Open file for UI Logging
     if (Log::isLogUIEnabled())
@@ -1736,6 +1746,7 @@ void Document::invalidateCanonicalId(const std::string& sessionId)
     if (newCanonicalId == session->getCanonicalViewId())
         return;
     session->setCanonicalViewId(newCanonicalId);
+    reprioritizeTiles(newCanonicalId);
     const std::string viewRenderedState = session->getViewRenderState();
     std::string stateName;
     if (!viewRenderedState.empty())
@@ -2286,6 +2297,27 @@ void Document::checkIdle()
     ProcessToIdleDeadline = std::chrono::steady_clock::now() - std::chrono::milliseconds(10);
 }
 
+void Document::renderSpeculativeTiles()
+{
+    // Anything the clients asked for comes first.
+    if (hasQueueItems() || hasCallbacks() || canRenderTiles() || !canRenderSpeculativeTiles())
+        return;
+
+    const auto start = std::chrono::steady_clock::now();
+    if (start - _speculativeBudgetStart >= SpeculativeBudgetPeriod)
+    {
+        _speculativeBudgetStart = start;
+        _speculativeRenderTime = std::chrono::microseconds::zero();
+    }
+
+    TileCombined tileCombined = _queue->popSpeculativeTiles();
+    LOG_TRC("Rendering speculative tiles " << tileCombined.serialize());
+    renderTiles(tileCombined);
+
+    _speculativeRenderTime += std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+}
+
 bool Document::processInputEnabled() const
 {
     bool enabled = !_websocketHandler || _websocketHandler->processInputEnabled();
@@ -2556,7 +2588,7 @@ void Document::disableBgSave(const std::string &reason)
 /// Stops theads, flushes buffers, and exits the process.
 void Document::flushAndExit(int code)
 {
-    flushTraceEventRecordings();
+    flushTraceEventRecordings(true);
     _deltaPool.stop();
     if (!Util::isKitInProcess())
         Util::forcedExit(code);
@@ -2661,8 +2693,17 @@ void Document::dumpState(std::ostream& oss)
 static std::mutex traceEventLock;
 static std::vector<std::string> traceEventRecords[2];
 
-void flushTraceEventRecordings()
+void flushTraceEventRecordings(bool force)
 {
+    if (TraceBuffer::isEnabled() &&
+        (force || TraceBuffer::isDrainDue(std::chrono::steady_clock::now(),
+                                          std::chrono::seconds(1))))
+    {
+        std::string data = "tracebuffer:\n";
+        if (TraceBuffer::drain(data, getpid()))
+            singletonDocument->sendFrame(data.data(), data.size(), WSOpCode::Binary);
+    }
+
     std::unique_lock<std::mutex> lock(traceEventLock);
 
     for (size_t n = 0; n < 2; ++n)
@@ -2728,7 +2769,7 @@ void TraceEvent::emitOneRecording(const std::string &recording)
 
 #else
 
-void flushTraceEventRecordings()
+void flushTraceEventRecordings(bool)
 {
 }
 
@@ -2905,6 +2946,10 @@ int KitSocketPoll::kitPoll(int timeoutMicroS)
 
     drainQueue();
 
+    // Nothing happened: spend the time on what the clients may soon need.
+    if (_document && eventsSignalled == 0)
+        _document->renderSpeculativeTiles();
+
     if (_document)
         _document->trimAfterInactivity();
 
@@ -3766,7 +3811,7 @@ void lokit_main(
 #if !MOBILEAPP
 
     LOG_INF("Kit process for Jail [" << jailId << "] finished.");
-    flushTraceEventRecordings();
+    flushTraceEventRecordings(true);
     if (!Util::isKitInProcess())
         Util::forcedExit(EX_OK);
 
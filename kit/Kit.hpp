@@ -338,6 +338,18 @@ public:
 
     /// A new message from wsd for the queue
     void queueMessage(const std::string &msg) { _queue->put(msg); }
+    /// The priority of the queued tiles of a view near @area may have changed.
+    void reprioritizeTiles(int canonicalViewId, const Util::Rectangle& area)
+    {
+        if (_queue)
+            _queue->reprioritizeTiles(canonicalViewId, area);
+    }
+    /// The priority of all the queued tiles of a view may have changed.
+    void reprioritizeTiles(int canonicalViewId)
+    {
+        if (_queue)
+            _queue->reprioritizeTiles(canonicalViewId);
+    }
     /// Do we have incoming messages from wsd ?
     bool hasQueueItems() const { return _queue && !_queue->isEmpty(); }
     bool canRenderTiles() const {
@@ -346,6 +358,15 @@ public:
             _queue->getTileQueueSize() > 0;
     }
     bool hasCallbacks() const { return _queue && _queue->callbackSize() > 0; }
+    /// Have we speculative tiles to render, and the time for them?
+    bool canRenderSpeculativeTiles() const
+    {
+        if (!processInputEnabled() || isLoadOngoing() || isBackgroundSaveProcess() || !_queue ||
+            !_queue->hasSpeculativeTiles())
+            return false;
+        return _speculativeRenderTime < SpeculativeRenderBudget ||
+               std::chrono::steady_clock::now() - _speculativeBudgetStart >= SpeculativeBudgetPeriod;
+    }
 
     /// Should we get through the SocketPoll fast to process queus ?
     bool needsQuickPoll() const
@@ -355,13 +376,16 @@ public:
         // not processing input messages or tile renders
         if (!processInputEnabled())
             return false;
-        if (hasQueueItems() || canRenderTiles())
+        if (hasQueueItems() || canRenderTiles() || canRenderSpeculativeTiles())
             return true;
         return false;
     }
 
     // poll is idle, are we ?
     void checkIdle();
+    /// Render a few of the tiles WSD predicts the clients will scroll to,
+    /// if there is nothing else to do.
+    void renderSpeculativeTiles();
     void drainQueue();
     void drainCallbacks();
 
@@ -461,6 +485,13 @@ private:
     /// The timestamp of the last memory trimming.
     std::chrono::steady_clock::time_point _lastMemTrimTime;
 
+    /// Speculative rendering gets at most a quarter of our time.
+    static constexpr std::chrono::milliseconds SpeculativeBudgetPeriod{ 1000 };
+    static constexpr std::chrono::milliseconds SpeculativeRenderBudget{ 250 };
+    std::chrono::steady_clock::time_point _speculativeBudgetStart;
+    /// Time spent on speculative rendering since _speculativeBudgetStart.
+    std::chrono::microseconds _speculativeRenderTime;
+
     std::map<int, std::chrono::steady_clock::time_point> _lastUpdatedAt;
     std::map<int, int> _speedCount;
     /// For showing disconnected user info in the doc repair dialog.
@@ -506,7 +537,8 @@ bool isURPEnabled();
 /// Start a URP connection, checking if URP is enabled and there is not already an active URP session
 bool startURP(const std::shared_ptr<lok::Office>& LOKit, void** ppURPContext);
 
-/// Ensure all recorded traces hit the disk
-void flushTraceEventRecordings();
+/// Ensure all recorded traces hit the disk. The binary ones are sent only
+/// every so often, unless @force is set.
+void flushTraceEventRecordings(bool force = false);
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -55,6 +55,254 @@ namespace {
     }
 }
 
+void TilePriorityQueue::clear()
+{
+    _slots.clear();
+    _freeSlots.clear();
+    _heap.clear();
+    _index.clear();
+    _size = 0;
+}
+
+TilePriorityQueue::Group TilePriorityQueue::getGroup(const TileDesc& desc)
+{
+    return Group(desc.getNormalizedViewId(), desc.getPart(), desc.getEditMode(), desc.getWidth(),
+                 desc.getHeight(), desc.getTileWidth(), desc.getTileHeight());
+}
+
+std::vector<size_t> TilePriorityQueue::findTiles(const GroupIndex& index, long top, long bottom,
+                                                 long left, long right)
+{
+    const auto clamp = [](long value)
+    {
+        return static_cast<int>(std::clamp<long>(value, std::numeric_limits<int>::min(),
+                                                 std::numeric_limits<int>::max()));
+    };
+
+    std::vector<size_t> slots;
+    auto it = index.lower_bound({ clamp(top), clamp(left) });
+    while (it != index.end() && it->first.first <= bottom)
+    {
+        // Skip to the next row once past the right edge of this one.
+        const int y = it->first.first;
+        if (it->first.second > right)
+        {
+            it = index.upper_bound({ y, std::numeric_limits<int>::max() });
+            if (it != index.end())
+                it = index.lower_bound({ it->first.first, clamp(left) });
+            continue;
+        }
+
+        slots.insert(slots.end(), it->second.begin(), it->second.end());
+        ++it;
+    }
+
+    return slots;
+}
+
+void TilePriorityQueue::pushHeap(size_t slot)
+{
+    // Drop the outdated entries once they are the majority.
+    if (_heap.size() > 2 * _size + 64)
+    {
+        _heap.clear();
+        for (size_t i = 0; i < _slots.size(); ++i)
+        {
+            if (_slots[i]._queued && i != slot)
+                _heap.push_back({ _slots[i]._priority, _slots[i]._seq, i, _slots[i]._version });
+        }
+        std::make_heap(_heap.begin(), _heap.end());
+    }
+
+    const Slot& tile = _slots[slot];
+    _heap.push_back({ tile._priority, tile._seq, slot, tile._version });
+    std::push_heap(_heap.begin(), _heap.end());
+}
+
+void TilePriorityQueue::rescore(size_t slot, const std::chrono::steady_clock::time_point& now)
+{
+    Slot& tile = _slots[slot];
+    const float priority = _prio.getTilePriority(now, tile._desc);
+    if (priority != tile._priority)
+    {
+        tile._priority = priority;
+        ++tile._version;
+        pushHeap(slot);
+    }
+}
+
+void TilePriorityQueue::remove(size_t slot)
+{
+    Slot& tile = _slots[slot];
+    assert(tile._queued);
+
+    const auto groupIt = _index.find(getGroup(tile._desc));
+    assert(groupIt != _index.end());
+    GroupIndex& group = groupIt->second;
+    const auto posIt = group.find({ tile._desc.getTilePosY(), tile._desc.getTilePosX() });
+    assert(posIt != group.end());
+    std::erase(posIt->second, slot);
+    if (posIt->second.empty())
+    {
+        group.erase(posIt);
+        if (group.empty())
+            _index.erase(groupIt);
+    }
+
+    tile._queued = false;
+    _freeSlots.push_back(slot);
+    --_size;
+}
+
+void TilePriorityQueue::push(const TileDesc& desc, const std::chrono::steady_clock::time_point& now)
+{
+    std::vector<size_t>& samePosition =
+        _index[getGroup(desc)][{ desc.getTilePosY(), desc.getTilePosX() }];
+    for (const size_t slot : samePosition)
+    {
+        if (_slots[slot]._desc == desc)
+        {
+            LOG_TRC("Remove duplicate tile request: " << _slots[slot]._desc.serialize() << " -> "
+                                                      << desc.serialize());
+            remove(slot);
+            break;
+        }
+    }
+
+    size_t slot;
+    const Slot tile{ desc, _prio.getTilePriority(now, desc), _nextSeq++, 0, true };
+    if (!_freeSlots.empty())
+    {
+        slot = _freeSlots.back();
+        _freeSlots.pop_back();
+        const uint32_t version = _slots[slot]._version + 1;
+        _slots[slot] = tile;
+        _slots[slot]._version = version;
+    }
+    else
+    {
+        slot = _slots.size();
+        _slots.push_back(tile);
+    }
+
+    // Removing the duplicate may have dropped the group.
+    _index[getGroup(desc)][{ desc.getTilePosY(), desc.getTilePosX() }].push_back(slot);
+    ++_size;
+    pushHeap(slot);
+}
+
+std::vector<TileDesc> TilePriorityQueue::pop(const std::chrono::steady_clock::time_point& now,
+                                             float& priority)
+{
+    assert(!empty());
+
+    size_t top;
+    while (true)
+    {
+        assert(!_heap.empty());
+        std::pop_heap(_heap.begin(), _heap.end());
+        const HeapEntry entry = _heap.back();
+        _heap.pop_back();
+
+        Slot& tile = _slots[entry._slot];
+        if (!tile._queued || tile._version != entry._version)
+            continue;
+
+        // Its priority may have decayed since it was scored.
+        const float current = _prio.getTilePriority(now, tile._desc);
+        if (current < entry._priority)
+        {
+            tile._priority = current;
+            ++tile._version;
+            pushHeap(entry._slot);
+            continue;
+        }
+
+        priority = current;
+        top = entry._slot;
+        break;
+    }
+
+    const TileDesc desc = _slots[top]._desc;
+    remove(top);
+
+    std::vector<TileDesc> tiles;
+    tiles.push_back(desc);
+
+    // Combine with the tiles on the same row, give or take one, and up to 16 columns away.
+    const auto groupIt = _index.find(getGroup(desc));
+    if (groupIt != _index.end() && !desc.isPreview())
+    {
+        const long width = desc.getTileWidth();
+        const long height = desc.getTileHeight();
+        const long gridX = desc.getTilePosX() / width;
+        std::vector<size_t> slots =
+            findTiles(groupIt->second, desc.getTilePosY() - height, desc.getTilePosY() + height,
+                      (gridX - 17) * width, (gridX + 17) * width);
+        std::erase_if(slots, [this, &desc](size_t slot)
+                      { return !desc.canCombine(_slots[slot]._desc); });
+        std::sort(slots.begin(), slots.end(),
+                  [this](size_t lhs, size_t rhs) { return _slots[lhs]._seq < _slots[rhs]._seq; });
+
+        for (const size_t slot : slots)
+        {
+            LOG_TRC("Combining candidate: " << _slots[slot]._desc.serialize());
+            tiles.push_back(_slots[slot]._desc);
+            remove(slot);
+        }
+    }
+
+    return tiles;
+}
+
+void TilePriorityQueue::reprioritize(const std::chrono::steady_clock::time_point& now,
+                                     int normalizedViewId, const Util::Rectangle& area)
+{
+    if (!area.isValid())
+        return;
+
+    for (const auto& [group, index] : _index)
+    {
+        if (std::get<0>(group) != normalizedViewId)
+            continue;
+
+        // Those whose box, grown by its size in each direction, intersects the area.
+        const long width = std::get<5>(group);
+        const long height = std::get<6>(group);
+        for (const size_t slot : findTiles(index, area.getTop() - 2 * height,
+                                           area.getBottom() + height, area.getLeft() - 2 * width,
+                                           area.getRight() + width))
+            rescore(slot, now);
+    }
+}
+
+void TilePriorityQueue::reprioritize(const std::chrono::steady_clock::time_point& now,
+                                     int normalizedViewId)
+{
+    for (size_t slot = 0; slot < _slots.size(); ++slot)
+    {
+        if (_slots[slot]._queued && _slots[slot]._desc.getNormalizedViewId() == normalizedViewId)
+            rescore(slot, now);
+    }
+}
+
+void TilePriorityQueue::dumpState(std::ostream& oss) const
+{
+    std::vector<const Slot*> tiles;
+    for (const Slot& tile : _slots)
+    {
+        if (tile._queued)
+            tiles.push_back(&tile);
+    }
+    std::sort(tiles.begin(), tiles.end(),
+              [](const Slot* lhs, const Slot* rhs) { return lhs->_seq < rhs->_seq; });
+
+    size_t i = 0;
+    for (const Slot* tile : tiles)
+        oss << "\t\t" << i++ << ": " << tile->_desc.serialize() << " priority: " << tile->_priority
+            << "\n";
+}
+
 void KitQueue::put(const Payload& value)
 {
     if (value.empty())
@@ -70,6 +318,12 @@ void KitQueue::put(const Payload& value)
     else if (firstToken == "tile")
         pushTileQueue(value);
 
+    else if (firstToken == "speculativetiles")
+        pushSpeculativeTiles(value);
+
+    else if (firstToken == "prioritizetiles")
+        prioritizeSpeculativeTiles(value);
+
     else if (firstToken == "callback")
         assert(false && "callbacks should not come from the client");
 
@@ -89,21 +343,6 @@ void KitQueue::put(const Payload& value)
         _queue.emplace_back(value);
 }
 
-void KitQueue::removeTileDuplicate(const TileDesc &desc)
-{
-    for (size_t i = 0; i < _tileQueue.size(); ++i)
-    {
-        auto& it = _tileQueue[i];
-        if (it == desc)
-        {
-            LOG_TRC("Remove duplicate tile request: " << it.serialize() <<
-                    " -> " << desc.serialize());
-            _tileQueue.erase(_tileQueue.begin() + i);
-            break;
-        }
-    }
-}
-
 namespace {
 
 /// Read the viewId from the payload.
@@ -383,23 +622,6 @@ bool KitQueue::elideDuplicateCallback(int view, int type, const std::string &pay
     return false;
 }
 
-// FIXME: it's not that clear what good this does for us ...
-// we process all previews in the same batch of rendering
-void KitQueue::deprioritizePreviews()
-{
-    for (size_t i = 0; i < _tileQueue.size(); ++i)
-    {
-        const TileDesc front = _tileQueue.front();
-
-        // stop at the first non-tile or non-'id' (preview) message
-        if (!front.isPreview())
-            break;
-
-        _tileQueue.erase(_tileQueue.begin());
-        _tileQueue.push_back(front);
-    }
-}
-
 KitQueue::Payload KitQueue::pop()
 {
     if (_queue.empty())
@@ -419,68 +641,100 @@ TileCombined KitQueue::popTileQueue(float &priority)
 {
     assert(!_tileQueue.empty());
 
-    const auto now = std::chrono::steady_clock::now();
-
     LOG_TRC("KitQueue depth: " << _tileQueue.size());
 
-    TileDesc msg = _tileQueue.front();
+    // The highest priority tile, first the one at the cursor's position, if any,
+    // then as many tiles as possible to combine with it.
+    const std::vector<TileDesc> tiles = _tileQueue.pop(std::chrono::steady_clock::now(), priority);
 
-    // vector of tiles we will render
-    std::vector<TileDesc> tiles;
+    LOG_TRC("Combined " << tiles.size() << " tiles, leaving " << _tileQueue.size() << " in queue.");
 
-    // We are handling a tile; first try to find one that is at the cursor's
-    // position, otherwise handle the one that is at the front
-    int prioritized = 0;
-    float prioritySoFar = -1000.0;
-    for (size_t i = 0; i < _tileQueue.size(); ++i)
+    if (tiles.size() == 1)
     {
-        auto& prio = _tileQueue[i];
+        LOG_TRC("KitQueue res: " << tiles[0].serialize());
+        return TileCombined(tiles[0]);
+    }
 
-        const float p = _prio.getTilePriority(now, prio);
-        if (p > prioritySoFar)
-        {
-            prioritySoFar = p;
-            prioritized = i;
-            msg = prio;
-        }
+    TileCombined combined = TileCombined::create(tiles);
+    assert(!combined.hasDuplicates());
+    LOG_TRC("KitQueue res: " << combined.serialize());
+    return combined;
+}
+
+namespace {
+/// Don't keep rendering what the clients no longer need, if they keep scrolling.
+constexpr size_t MaxSpeculativeTiles = 256;
+/// Render a few at a time, so that a request can get through in between.
+constexpr size_t MaxSpeculativeBatch = 4;
+}
+
+void KitQueue::pushSpeculativeTiles(const Payload &value)
+{
+    assert(COOLProtocol::getFirstToken(value) == "speculativetiles");
+
+    const std::string msg = std::string(value.data(), value.size());
+    const TileCombined tileCombined = TileCombined::parse(msg);
+    for (const auto& tile : tileCombined.getTiles())
+    {
+        removeSpeculativeTile(tile);
+        _speculativeTiles.push_back(tile);
     }
 
-    // remove highest priority tile from the queue
-    _tileQueue.erase(_tileQueue.begin() + prioritized);
-    priority = prioritySoFar;
+    // Drop the oldest predictions.
+    if (_speculativeTiles.size() > MaxSpeculativeTiles)
+        _speculativeTiles.erase(_speculativeTiles.begin(),
+                                _speculativeTiles.end() - MaxSpeculativeTiles);
+}
 
-    // and add it to the render list
-    tiles.emplace_back(msg);
+void KitQueue::prioritizeSpeculativeTiles(const Payload &value)
+{
+    assert(COOLProtocol::getFirstToken(value) == "prioritizetiles");
 
-    // Combine as many tiles as possible with this tile.
-    for (size_t i = 0; i < _tileQueue.size(); )
+    const std::string msg = std::string(value.data(), value.size());
+    const TileCombined tileCombined = TileCombined::parse(msg);
+    const auto now = std::chrono::steady_clock::now();
+    for (const auto& tile : tileCombined.getTiles())
     {
-        auto& it = _tileQueue[i];
+        // The ones no longer queued are rendered, or being rendered, already.
+        const auto it = std::find(_speculativeTiles.begin(), _speculativeTiles.end(), tile);
+        if (it == _speculativeTiles.end())
+            continue;
+
+        // Keep the version WSD is waiting for.
+        _tileQueue.push(*it, now);
+        _speculativeTiles.erase(it);
+    }
+}
 
-        LOG_TRC("Combining candidate: " << it.serialize());
+TileCombined KitQueue::popSpeculativeTiles()
+{
+    assert(!_speculativeTiles.empty());
 
-        // Check if it's on the same row.
-        if (tiles[0].canCombine(it))
+    std::vector<TileDesc> tiles{ _speculativeTiles.back() };
+    _speculativeTiles.pop_back();
+    for (size_t i = _speculativeTiles.size(); i-- > 0 && tiles.size() < MaxSpeculativeBatch;)
+    {
+        if (tiles[0].canCombine(_speculativeTiles[i]))
         {
-            tiles.emplace_back(it);
-            _tileQueue.erase(_tileQueue.begin() + i);
+            tiles.push_back(_speculativeTiles[i]);
+            _speculativeTiles.erase(_speculativeTiles.begin() + i);
         }
-        else
-            ++i;
     }
 
-    LOG_TRC("Combined " << tiles.size() << " tiles, leaving " << _tileQueue.size() << " in queue.");
+    LOG_TRC("Combined " << tiles.size() << " speculative tiles, leaving "
+                        << _speculativeTiles.size());
 
     if (tiles.size() == 1)
-    {
-        LOG_TRC("KitQueue res: " << tiles[0].serialize());
         return TileCombined(tiles[0]);
-    }
 
-    TileCombined combined = TileCombined::create(tiles);
-    assert(!combined.hasDuplicates());
-    LOG_TRC("KitQueue res: " << combined.serialize());
-    return combined;
+    return TileCombined::create(tiles);
+}
+
+void KitQueue::removeSpeculativeTile(const TileDesc& desc)
+{
+    const auto it = std::find(_speculativeTiles.begin(), _speculativeTiles.end(), desc);
+    if (it != _speculativeTiles.end())
+        _speculativeTiles.erase(it);
 }
 
 std::string KitQueue::combineTextInput(const StringVector& tokens)
@@ -549,10 +803,11 @@ void KitQueue::pushTileCombineRequest(const Payload &value)
     // the tiles inside popTileQueue() again)
     const std::string msg = std::string(value.data(), value.size());
     const TileCombined tileCombined = TileCombined::parse(msg);
+    const auto now = std::chrono::steady_clock::now();
     for (const auto& tile : tileCombined.getTiles())
     {
-        removeTileDuplicate(tile);
-        _tileQueue.emplace_back(tile);
+        removeSpeculativeTile(tile);
+        _tileQueue.push(tile, now);
     }
 }
 
@@ -560,8 +815,8 @@ void KitQueue::pushTileQueue(const Payload &value)
 {
     const std::string msg = std::string(value.data(), value.size());
     const TileDesc desc = TileDesc::parse(msg);
-    removeTileDuplicate(desc);
-    _tileQueue.push_back(desc);
+    removeSpeculativeTile(desc);
+    _tileQueue.push(desc, std::chrono::steady_clock::now());
 }
 
 std::string KitQueue::combineRemoveText(const StringVector& tokens)
@@ -628,9 +883,9 @@ void KitQueue::dumpState(std::ostream& oss)
         oss << "\t\t" << i++ << ": " << COOLProtocol::getFirstLine(it) << "\n";
 
     oss << "\tTile Queue size: " << _tileQueue.size() << "\n";
-    i = 0;
-    for (TileDesc &it : _tileQueue)
-        oss << "\t\t" << i++ << ": " << it.serialize() << "\n";
+    _tileQueue.dumpState(oss);
+
+    oss << "\tSpeculative tiles: " << _speculativeTiles.size() << "\n";
 
     oss << "\tCallbacks size: " << _callbacks.size() << "\n";
     i = 0;
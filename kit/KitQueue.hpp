@@ -13,9 +13,11 @@
 
 #include <stdexcept>
 #include <algorithm>
+#include <chrono>
 #include <functional>
 #include <map>
 #include <string>
+#include <tuple>
 #include <vector>
 
 #include "Log.hpp"
@@ -29,16 +31,103 @@ public:
     virtual float getTilePriority(const std::chrono::steady_clock::time_point &, const TileDesc &) const { return 0.0; }
 };
 
+/// The queued tile requests: a max-heap by priority, ties in the order they were
+/// queued, with an index by position to find the tiles to combine with the popped
+/// one, and the tiles to re-prioritize when a view moves.
+/// Priorities only decay with time, so a tile's cached priority is an upper bound,
+/// re-checked when it reaches the top, but they can be raised by a view moving
+/// or a user interacting, which needs a reprioritize() call.
+class TilePriorityQueue
+{
+public:
+    explicit TilePriorityQueue(const TilePrioritizer& prio)
+        : _prio(prio)
+        , _size(0)
+        , _nextSeq(0)
+    {
+    }
+
+    bool empty() const { return _size == 0; }
+    size_t size() const { return _size; }
+    void clear();
+
+    /// Queues @desc, instead of an identical request, if any.
+    void push(const TileDesc& desc, const std::chrono::steady_clock::time_point& now);
+
+    /// Pops the highest priority tile, returned first with its @priority,
+    /// and the tiles it can be combined with, in the order they were queued.
+    std::vector<TileDesc> pop(const std::chrono::steady_clock::time_point& now, float& priority);
+
+    /// Re-scores the tiles of @normalizedViewId, on any part, which are near @area.
+    void reprioritize(const std::chrono::steady_clock::time_point& now, int normalizedViewId,
+                      const Util::Rectangle& area);
+
+    /// Re-scores all the tiles of @normalizedViewId.
+    void reprioritize(const std::chrono::steady_clock::time_point& now, int normalizedViewId);
+
+    void dumpState(std::ostream& oss) const;
+
+private:
+    /// The parameters of the tiles that can be combined: view, part,
+    /// mode, width, height, tile-width and tile-height.
+    typedef std::tuple<int, int, int, int, int, int, int> Group;
+    /// The tiles of a group, by position: y, then x.
+    typedef std::map<std::pair<int, int>, std::vector<size_t>> GroupIndex;
+
+    struct Slot
+    {
+        TileDesc _desc;
+        float _priority;
+        uint64_t _seq;
+        uint32_t _version; ///< Invalidates the older heap entries.
+        bool _queued;
+    };
+
+    struct HeapEntry
+    {
+        float _priority;
+        uint64_t _seq;
+        size_t _slot;
+        uint32_t _version;
+
+        /// Lower priority, or queued later.
+        bool operator<(const HeapEntry& other) const
+        {
+            return _priority < other._priority ||
+                   (_priority == other._priority && _seq > other._seq);
+        }
+    };
+
+    static Group getGroup(const TileDesc& desc);
+
+    /// Returns the tiles of @index from @top to @bottom and @left to @right.
+    static std::vector<size_t> findTiles(const GroupIndex& index, long top, long bottom,
+                                         long left, long right);
+
+    void pushHeap(size_t slot);
+    void rescore(size_t slot, const std::chrono::steady_clock::time_point& now);
+    void remove(size_t slot);
+
+private:
+    const TilePrioritizer& _prio;
+    std::vector<Slot> _slots;
+    std::vector<size_t> _freeSlots;
+    /// May have outdated entries, of removed or re-scored tiles.
+    std::vector<HeapEntry> _heap;
+    std::map<Group, GroupIndex> _index;
+    size_t _size;
+    uint64_t _nextSeq;
+};
+
 /// Queue for handling the Kit's messaging needs
 class KitQueue
 {
     friend class KitQueueTests;
 
-    const TilePrioritizer &_prio;
 public:
     typedef std::vector<char> Payload;
 
-    KitQueue(const TilePrioritizer &prio) : _prio(prio) { }
+    KitQueue(const TilePrioritizer &prio) : _tileQueue(prio) { }
     ~KitQueue() { }
 
     KitQueue(const KitQueue&) = delete;
@@ -84,7 +173,11 @@ public:
     Payload get() { return pop(); }
 
     /// Tiles are special manage a separate queue of them
-    void clearTileQueue() { _tileQueue.clear(); }
+    void clearTileQueue()
+    {
+        _tileQueue.clear();
+        _speculativeTiles.clear();
+    }
     void pushTileQueue(const Payload &value);
     void pushTileCombineRequest(const Payload &value);
     /// Pops the highest priority TileCombined from the
@@ -92,6 +185,29 @@ public:
     TileCombined popTileQueue(float &priority);
     size_t getTileQueueSize() const { return _tileQueue.size(); }
 
+    /// The priority of the queued tiles of a view near @area may have changed,
+    /// eg. as its visible area or cursor moved.
+    void reprioritizeTiles(int normalizedViewId, const Util::Rectangle& area)
+    {
+        _tileQueue.reprioritize(std::chrono::steady_clock::now(), normalizedViewId, area);
+    }
+
+    /// The priority of all the queued tiles of a view may have changed.
+    void reprioritizeTiles(int normalizedViewId)
+    {
+        _tileQueue.reprioritize(std::chrono::steady_clock::now(), normalizedViewId);
+    }
+
+    /// Queues the tiles of a speculativetiles request: the ones WSD predicts a
+    /// client will scroll to, to render only when there is nothing else to do.
+    void pushSpeculativeTiles(const Payload &value);
+    /// Moves the tiles of a prioritizetiles request, which a client now waits
+    /// for, from the speculative ones to the tile queue, if still there.
+    void prioritizeSpeculativeTiles(const Payload &value);
+    bool hasSpeculativeTiles() const { return !_speculativeTiles.empty(); }
+    /// Pops the most recently predicted tile, with a few it can be combined with.
+    TileCombined popSpeculativeTiles();
+
     /// Obtain the next callback
     Callback getCallback()
     {
@@ -153,8 +269,8 @@ protected:
     std::string combineRemoveText(const StringVector& tokens);
 
 private:
-    /// Search the queue for a duplicate tile and remove it (if present).
-    void removeTileDuplicate(const TileDesc &desc);
+    /// A client requested @desc, so it no longer needs rendering speculatively.
+    void removeSpeculativeTile(const TileDesc& desc);
 
     /// Search the queue for a duplicate callback and remove it (if present).
     ///
@@ -164,16 +280,15 @@ private:
     /// @return New message to put into the queue.  If empty, use what was in callbackMsg.
     std::string removeCallbackDuplicate(const std::string& callbackMsg);
 
-    /// De-prioritize the previews (tiles with 'id') - move them to the end of
-    /// the queue.
-    void deprioritizePreviews();
-
 private:
     /// Queue of incoming messages from coolwsd
     std::vector<Payload> _queue;
 
     /// Queue of incoming tile requests from coolwsd
-    std::vector<TileDesc> _tileQueue;
+    TilePriorityQueue _tileQueue;
+
+    /// The tiles to render when idle, the most recently predicted last.
+    std::vector<TileDesc> _speculativeTiles;
 
     /// Queue of callbacks from Kit to send out to coolwsd
     std::vector<Callback> _callbacks;
@@ -104,7 +104,7 @@ void KitWebSocketHandler::handleMessage(const std::vector<char>& data)
         if constexpr (!Util::isMobileApp())
         {
             LOG_INF("Terminating immediately due to parent 'exit' command.");
-            flushTraceEventRecordings();
+            flushTraceEventRecordings(true);
             // flushes logging
             if (_document)
                 _document->joinThreads();
@@ -129,6 +129,7 @@ void KitWebSocketHandler::handleMessage(const std::vector<char>& data)
         }
     }
     else if (tokens.equals(0, "tile") || tokens.equals(0, "tilecombine") ||
+             tokens.equals(0, "speculativetiles") || tokens.equals(0, "prioritizetiles") ||
              tokens.equals(0, "getslide") ||
              tokens.equals(0, "paintwindow") || tokens.equals(0, "resizewindow") ||
              COOLProtocol::getFirstToken(tokens[0], '-') == "child")
@@ -17,7 +17,6 @@
 
 #include "common/Common.hpp"
 #include "ChildSession.hpp"
-#include "DeltaSimd.h"
 
 void ChildSession::loKitCallback(const int /* type */, const std::string& /* payload */) {}
 void ChildSession::disconnect() {}
@@ -26,6 +25,4 @@ bool ChildSession::_handleInput(const char* /*buffer*/, int /*length*/) { return
 float ChildSession::getTilePriority(const std::chrono::steady_clock::time_point &, const TileDesc &) const { return 0; }
 ChildSession::~ChildSession() {}
 
-int simd_initPixRowSimd(const uint32_t *, uint32_t *, size_t *, uint64_t *) { return 0; }
-
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
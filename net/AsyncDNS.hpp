@@ -20,22 +20,28 @@
 #include <queue>
 #include <string>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include <NetUtil.hpp>
 
 namespace net
 {
 
-class DNSResolver;
 class HostEntry;
 
+/// Resolves host names on a few threads, so that a slow lookup doesn't
+/// hold up the others, while concurrent lookups of the same host wait
+/// for the same one. The results are cached with those of resolveDNS().
 class AsyncDNS
 {
 public:
-    AsyncDNS();
+    static constexpr std::size_t DefaultThreadCount = 4;
+
+    explicit AsyncDNS(std::size_t threadCount);
     ~AsyncDNS();
 
-    static void startAsyncDNS();
+    static void startAsyncDNS(std::size_t threadCount = DefaultThreadCount);
     static void stopAsyncDNS();
 
     static void dumpState(std::ostream& os);
@@ -48,30 +54,36 @@ public:
                        const DNSThreadFn& cb,
                        const DNSThreadDumpStateFn& dumpState);
 
+    /// Looks up an expired, cached, host name again in the background.
+    /// Returns false if there are no resolver threads to do it.
+    static bool refresh(const std::string& searchEntry, const std::string& port);
+
 private:
     std::atomic<bool> _exit;
-    std::unique_ptr<DNSResolver> _resolver;
-    std::unique_ptr<std::thread> _thread;
+    std::vector<std::thread> _threads;
     std::mutex _lock;
     std::condition_variable _condition;
     struct Lookup
     {
         std::string query;
         std::string port;
-        AsyncDNS::DNSThreadFn cb;
+        AsyncDNS::DNSThreadFn cb; /// Empty to refresh the cache.
         AsyncDNS::DNSThreadDumpStateFn dumpState;
     };
     std::queue<Lookup> _lookups;
-    Lookup _activeLookup;
+    /// The lookups being resolved, by thread.
+    std::vector<Lookup> _activeLookups;
+    /// The lookups waiting for one of the same host and port to be resolved.
+    std::unordered_map<std::string, std::vector<Lookup>> _waitingLookups;
 
-    void resolveDNS();
+    void resolveDNS(std::size_t index);
     void addLookup(const std::string& lookup,
                    const std::string& port,
                    const DNSThreadFn& cb,
                    const DNSThreadDumpStateFn& dumpState);
 
-    void startThread();
-    void joinThread();
+    void startThreads(std::size_t threadCount);
+    void joinThreads();
 
     void dumpQueueState(std::ostream& os) const;
 };
@@ -12,73 +12,149 @@
 #pragma once
 
 #include <assert.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
 #include <ostream>
 #include <vector>
 
+#include <Common.hpp>
 #include <Util.hpp>
 
-// Blocks -> we can share from client -> server ... etc.
-// headers / and a 'writeV' etc. =)
-
 /**
  * Encapsulate data we need to write.
+ * The data is kept in a queue of chunks, recycled per thread, so erasing
+ * what was consumed from the front never moves the rest. The first chunk
+ * is small, as most buffers only ever hold a short message, and each new
+ * one is twice as large, up to the chunk size.
+ * Besides its own copy of the data, it can hold immutable blobs by
+ * reference, shared with their owner, so they can be written out with
+ * writev() without copying: see appendShared().
+ * The std::vector-like accessors need the data contiguous, and move it
+ * into a single chunk first, if it isn't already.
  */
 class Buffer
 {
-    std::size_t _offset;  /// offset into _buffer of data
-    std::vector<char> _buffer;
+    /// A range of one of our chunks, or of a blob shared with its owner.
+    struct Segment
+    {
+        Blob _blob;
+        std::size_t _start;
+        std::size_t _end;
+        bool _owned;
+
+        char* data() const { return _blob->data() + _start; }
+        std::size_t size() const { return _end - _start; }
+    };
+
+    std::deque<Segment> _segments;
+    std::size_t _size; /// bytes in _segments
+    std::size_t _sharedCount; /// segments not owned
+    std::size_t _chunkSize; /// the largest chunk we recycle
+    std::size_t _nextChunkSize; /// of the next chunk, growing up to _chunkSize
+    Blob _tail; /// the chunk we append to
+    std::size_t _tailUsed; /// bytes of _tail in use
 
 public:
-    Buffer() : _offset(0)
+    /// Room for a few SSL records, of 16KB, which we typically read and write.
+    static constexpr std::size_t DefaultChunkSize = 64 * 1024;
+
+    /// What an idle connection, with a short message pending, holds on to.
+    static constexpr std::size_t InitialChunkSize = 4 * 1024;
+
+    explicit Buffer(std::size_t chunkSize = DefaultChunkSize)
+        : _size(0)
+        , _sharedCount(0)
+        , _chunkSize(chunkSize)
+        , _nextChunkSize(std::min(InitialChunkSize, chunkSize))
+        , _tailUsed(0)
     {
+        assert(_chunkSize > 0);
     }
 
-    typedef std::vector<char>::iterator iterator;
-    typedef std::vector<char>::const_iterator const_iterator;
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
 
-    std::size_t size() const { return _buffer.size() - _offset; }
-    std::size_t capacity() const { return _buffer.capacity(); }
-    bool empty() const { return _offset == _buffer.size(); }
+    ~Buffer() { clear(); }
 
+    typedef char* iterator;
+    typedef const char* const_iterator;
+
+    std::size_t size() const { return _size; }
+    /// The data and the free space after it, which needs no allocation.
+    std::size_t capacity() const { return _size + getTailSpace(); }
+    bool empty() const { return _size == 0; }
+    std::size_t getChunkSize() const { return _chunkSize; }
+
+    /// Returns true if some of the data is held by reference.
+    bool hasShared() const { return _sharedCount > 0; }
+
+    /// The first contiguous block of data.
     const char *getBlock() const
     {
-        if (!empty())
-            return &_buffer[_offset];
-        return nullptr;
+        return _segments.empty() ? nullptr : _segments.front().data();
     }
 
     std::size_t getBlockSize() const
     {
-        return size();
+        return _segments.empty() ? 0 : _segments.front().size();
     }
 
-    void eraseFirst(std::size_t len)
+    /// Fills @iov with up to @count blocks, of at most @maxSize bytes in total.
+    /// Returns the number of blocks filled.
+    int getIOVec(struct iovec *iov, int count, std::size_t maxSize) const
     {
-        if (len <= 0)
-            return;
+        int filled = 0;
+        for (const Segment& segment : _segments)
+        {
+            const std::size_t len = std::min(segment.size(), maxSize);
+            if (len == 0 || filled >= count)
+                break;
+            iov[filled].iov_base = segment.data();
+            iov[filled].iov_len = len;
+            ++filled;
+            maxSize -= len;
+        }
 
-        assert(_offset + len <= _buffer.size());
-        assert(_offset + size() == _buffer.size());
+        return filled;
+    }
 
-        len = std::min(len, size()); // Avoid accidental damage.
+    void eraseFirst(std::size_t len)
+    {
+        assert(len <= size());
 
-        // avoid regular shuffling down larger chunks of data
-        if (_buffer.size() > 16384 && // lots of queued data
-            len < size() &&           // not a complete erase
-            _offset < 16384 * 64 &&   // do cleanup a Mb at a time or so:
-            size() > 512)             // early cleanup if what remains is small.
+        while (len > 0 && !_segments.empty())
         {
-            _offset += len;
-            return;
+            Segment& segment = _segments.front();
+            const std::size_t erase = std::min(len, segment.size());
+            segment._start += erase;
+            _size -= erase;
+            len -= erase;
+            if (segment._start == segment._end)
+                popFront();
         }
 
-        _buffer.erase(_buffer.begin(), _buffer.begin() + _offset + len);
-        _offset = 0;
+        // Recycle the chunk of an idle buffer.
+        if (_segments.empty())
+            reset();
     }
 
     void append(const char *data, const int len)
     {
-        _buffer.insert(_buffer.end(), data, data + len);
+        std::size_t remaining = len;
+        while (remaining > 0)
+        {
+            if (getTailSpace() == 0)
+                newTail(std::min(remaining, _chunkSize));
+
+            const std::size_t chunk = std::min(remaining, getTailSpace());
+            std::memcpy(_tail->data() + _tailUsed, data, chunk);
+            commitAppend(chunk);
+            data += chunk;
+            remaining -= chunk;
+        }
     }
 
     void append(const std::string& s) { append(s.c_str(), s.size()); }
@@ -90,48 +166,278 @@ public:
         append(s, N - 1); // Minus null termination.
     }
 
-    void dumpHex(std::ostream &os, const char *legend, const char *prefix) const
+    /// Returns at least @len contiguous bytes of free space at the end, eg.
+    /// to read() into, of which commitAppend() appends what was filled.
+    char* prepareAppend(std::size_t len)
+    {
+        if (getTailSpace() < len && !compactTail(len))
+            newTail(len);
+
+        return _tail->data() + _tailUsed;
+    }
+
+    /// Append the first @len bytes of the space returned by prepareAppend().
+    void commitAppend(std::size_t len)
     {
-        if (size() > 0 || _offset > 0)
-            os << prefix << "Buffer size: " << size() << " offset: " << _offset << '\n';
-        if (_buffer.size() > 0)
-            Util::dumpHex(os, _buffer, legend, prefix);
+        assert(len <= getTailSpace());
+        if (len == 0)
+            return;
+
+        if (!_segments.empty() && _segments.back()._blob == _tail &&
+            _segments.back()._end == _tailUsed)
+        {
+            _segments.back()._end += len;
+        }
+        else
+            _segments.push_back({ _tail, _tailUsed, _tailUsed + len, true });
+
+        _tailUsed += len;
+        _size += len;
     }
 
-    // various std::vector API compatibility functions
+    /// Append @length bytes of @blob from @start without copying them.
+    /// The blob must not be modified until they are erased.
+    void appendShared(const Blob& blob, std::size_t start, std::size_t length)
+    {
+        assert(blob && start + length <= blob->size());
+        if (length == 0)
+            return;
 
-    void clear()
+        _segments.push_back({ blob, start, start + length, false });
+        ++_sharedCount;
+        _size += length;
+    }
+
+    void appendShared(const Blob& blob) { appendShared(blob, 0, blob->size()); }
+
+    void dumpHex(std::ostream &os, const char *legend, const char *prefix) const
     {
-        _buffer.clear();
-        _offset = 0;
+        if (size() > 0)
+        {
+            os << prefix << "Buffer size: " << size() << " in " << _segments.size()
+               << " blocks, shared: " << _sharedCount << '\n';
+            std::vector<char> data;
+            data.reserve(size());
+            for (const Segment& segment : _segments)
+                data.insert(data.end(), segment.data(), segment.data() + segment.size());
+            Util::dumpHex(os, data, legend, prefix);
+        }
     }
 
-    iterator begin() { return _buffer.begin() + _offset; }
+    // various std::vector API compatibility functions,
+    // which make the data contiguous, so are not const.
 
-    const_iterator begin() const { return _buffer.begin() + _offset; }
+    void clear()
+    {
+        while (!_segments.empty())
+            popFront();
+        _size = 0;
+        reset();
+    }
 
-    iterator end() { return _buffer.end(); }
+    iterator begin() { return data(); }
 
-    const_iterator end() const { return _buffer.end(); }
+    iterator end() { return data() + _size; }
 
-    char operator[](int index) const { return _buffer[_offset + index]; }
+    /// Reads a byte where it is, eg. to dump the data.
+    char operator[](int index) const
+    {
+        std::size_t offset = index;
+        for (const Segment& segment : _segments)
+        {
+            if (offset < segment.size())
+                return segment.data()[offset];
+            offset -= segment.size();
+        }
 
-    char& operator[](int index) { return _buffer[_offset + index]; }
+        assert(!"Out of bounds");
+        return 0;
+    }
 
-    const char* data() const { return _buffer.data() + _offset; }
+    char& operator[](int index) { return data()[index]; }
 
-    char* data() { return _buffer.data() + _offset; }
+    char* data()
+    {
+        // Shared blobs are immutable, so we need our own copy.
+        if (_segments.size() > 1 || hasShared())
+            linearize();
+        return _segments.empty() ? nullptr : _segments.front().data();
+    }
 
     iterator erase(iterator first, iterator last)
     {
         if (first == begin())
         {
-            eraseFirst(last - begin());
+            eraseFirst(last - first);
             return begin();
         }
-        iterator ret = _buffer.erase(first, last);
-        return ret;
+
+        // Contiguous and owned, as we have been given iterators.
+        assert(_segments.size() == 1 && !hasShared());
+        Segment& segment = _segments.front();
+        const std::size_t len = last - first;
+        std::memmove(first, last, end() - last);
+        if (segment._blob == _tail && segment._end == _tailUsed)
+            _tailUsed -= len;
+        segment._end -= len;
+        _size -= len;
+        return first;
     }
+
+private:
+    std::size_t getTailSpace() const { return _tail ? _tail->size() - _tailUsed : 0; }
+
+    /// Starts appending to a new chunk of at least @len bytes.
+    void newTail(std::size_t len)
+    {
+        releaseTail();
+        _tail = newChunk(len);
+    }
+
+    /// Returns a chunk of at least @len bytes, the next one as we grow if
+    /// it is large enough, so that it can be recycled.
+    Blob newChunk(std::size_t len)
+    {
+        std::size_t size = _nextChunkSize;
+        while (size < len && size < _chunkSize)
+            size *= 2;
+        size = std::min(size, _chunkSize);
+        if (size < len)
+            return std::make_shared<BlobData>(len);
+
+        _nextChunkSize = std::min(2 * size, _chunkSize);
+        return ChunkPool::acquire(size);
+    }
+
+    /// Starts over with a small chunk, once we are empty.
+    void reset()
+    {
+        releaseTail();
+        _nextChunkSize = std::min(InitialChunkSize, _chunkSize);
+    }
+
+    /// Makes room for @len bytes in the tail, by moving its data to the front,
+    /// when it is all we have and that is cheaper than filling a new chunk.
+    bool compactTail(std::size_t len)
+    {
+        if (_segments.size() != 1 || _segments.front()._blob != _tail)
+            return false;
+
+        Segment& segment = _segments.front();
+        if (segment._end != _tailUsed || segment._start < segment.size() ||
+            _tail->size() - segment.size() < len)
+            return false;
+
+        std::memmove(_tail->data(), segment.data(), segment.size());
+        segment._end = segment.size();
+        segment._start = 0;
+        _tailUsed = segment._end;
+        return true;
+    }
+
+    void releaseTail()
+    {
+        release(_tail);
+        _tailUsed = 0;
+    }
+
+    void popFront()
+    {
+        Segment& segment = _segments.front();
+        if (segment._owned)
+            release(segment._blob);
+        else
+            --_sharedCount;
+        _segments.pop_front();
+    }
+
+    /// Drop our reference to @chunk, recycling it once nothing else uses it.
+    void release(Blob& chunk)
+    {
+        if (chunk && chunk.use_count() == 1 && chunk->size() <= _chunkSize)
+            ChunkPool::release(std::move(chunk));
+        chunk.reset();
+    }
+
+    /// Moves all the data into a single chunk of our own.
+    /// It is twice as large as needed so that, when more is appended and
+    /// the data made contiguous again, the total copied stays linear.
+    void linearize()
+    {
+        Blob chunk = newChunk(2 * _size);
+
+        std::size_t position = 0;
+        for (const Segment& segment : _segments)
+        {
+            std::memcpy(chunk->data() + position, segment.data(), segment.size());
+            position += segment.size();
+        }
+        assert(position == _size);
+
+        while (!_segments.empty())
+            popFront();
+        releaseTail();
+
+        _tail = std::move(chunk);
+        _tailUsed = _size;
+        _segments.push_back({ _tail, 0, _size, true });
+    }
+
+    /// Recycles the chunks of the buffers of a thread, which are
+    /// typically emptied and refilled at a high rate by the sockets.
+    class ChunkPool
+    {
+        static constexpr std::size_t MaxChunks = 32;
+
+        std::vector<Blob> _chunks;
+
+        /// Not constructed (0), alive (1) or destroyed (2) in this thread.
+        static inline thread_local int State = 0;
+
+        ChunkPool() { State = 1; }
+        ~ChunkPool() { State = 2; }
+
+        /// Null once destroyed at the thread's exit.
+        static ChunkPool* get()
+        {
+            if (State == 2)
+                return nullptr;
+            static thread_local ChunkPool pool;
+            return &pool;
+        }
+
+    public:
+        static Blob acquire(std::size_t size)
+        {
+            ChunkPool* pool = get();
+            if (pool)
+            {
+                for (auto it = pool->_chunks.rbegin(); it != pool->_chunks.rend(); ++it)
+                {
+                    if ((*it)->size() == size)
+                    {
+                        Blob chunk = std::move(*it);
+                        pool->_chunks.erase(std::next(it).base());
+                        return chunk;
+                    }
+                }
+            }
+
+            return std::make_shared<BlobData>(size);
+        }
+
+        static void release(Blob&& chunk)
+        {
+            ChunkPool* pool = get();
+            if (!pool)
+                return;
+
+            // Make room by dropping the least recently used.
+            if (pool->_chunks.size() >= MaxChunks)
+                pool->_chunks.erase(pool->_chunks.begin());
+            pool->_chunks.push_back(std::move(chunk));
+        }
+    };
 };
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
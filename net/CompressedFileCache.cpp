@@ -0,0 +1,368 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <config.h>
+
+#include "CompressedFileCache.hpp"
+
+#include <common/FileUtil.hpp>
+#include <common/Log.hpp>
+#include <common/StringVector.hpp>
+#include <common/Util.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include <zlib.h>
+
+std::mutex CompressedFileCache::InstanceMutex;
+std::shared_ptr<CompressedFileCache> CompressedFileCache::Instance;
+
+std::atomic<uint64_t> CompressedFileCache::Hits(0);
+std::atomic<uint64_t> CompressedFileCache::Misses(0);
+std::atomic<uint64_t> CompressedFileCache::BytesSaved(0);
+std::atomic<uint64_t> CompressedFileCache::Evictions(0);
+
+namespace
+{
+/// The compressed variant must save at least this much of the file to be kept.
+constexpr double MinSavingRatio = 0.1;
+} // namespace
+
+//static
+void CompressedFileCache::initialize(bool enable, std::size_t maxBytes, std::size_t minFileSize,
+                                     std::size_t maxFileSize, int level)
+{
+    shutdown();
+
+    LOG_INF("Compressed file cache is " << (enable ? "enabled" : "disabled") << ", of "
+                                        << maxBytes << " bytes, for files of " << minFileSize
+                                        << " to " << maxFileSize << " bytes, level: " << level);
+    if (enable && maxBytes > 0)
+    {
+        std::shared_ptr<CompressedFileCache> instance(new CompressedFileCache(
+            maxBytes, minFileSize, std::min(maxFileSize, maxBytes), std::clamp(level, 1, 9)));
+
+        std::lock_guard<std::mutex> lock(InstanceMutex);
+        Instance = std::move(instance);
+    }
+}
+
+//static
+void CompressedFileCache::shutdown()
+{
+    std::shared_ptr<CompressedFileCache> instance;
+    {
+        std::lock_guard<std::mutex> lock(InstanceMutex);
+        instance = std::move(Instance);
+    }
+
+    // The thread is joined by the last user, outside of the lock.
+    instance.reset();
+}
+
+CompressedFileCache::CompressedFileCache(std::size_t maxBytes, std::size_t minFileSize,
+                                         std::size_t maxFileSize, int level)
+    : _maxBytes(maxBytes)
+    , _minFileSize(minFileSize)
+    , _maxFileSize(maxFileSize)
+    , _level(level)
+    , _exit(false)
+    , _bytes(0)
+{
+    _thread = std::thread(&CompressedFileCache::compressFiles, this);
+}
+
+CompressedFileCache::~CompressedFileCache()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _exit = true;
+    }
+
+    _condition.notify_all();
+    _thread.join();
+}
+
+//static
+bool CompressedFileCache::pickEncoding(const std::string& acceptEncoding, Encoding& encoding)
+{
+    bool gzip = false;
+    bool deflate = false;
+    const StringVector tokens = StringVector::tokenize(acceptEncoding, ',');
+    for (std::size_t i = 0; i < tokens.size(); ++i)
+    {
+        const StringVector params = StringVector::tokenize(tokens[i], ';');
+        if (params.empty())
+            continue;
+
+        // A quality of 0 means not acceptable.
+        bool acceptable = true;
+        for (std::size_t j = 1; j < params.size(); ++j)
+        {
+            const std::string param = Util::trimmed(params[j]);
+            if (param.starts_with("q=") && std::atof(param.c_str() + 2) <= 0)
+                acceptable = false;
+        }
+
+        const std::string name = Util::toLower(Util::trimmed(params[0]));
+        if (name == "gzip" || name == "x-gzip")
+            gzip = acceptable;
+        else if (name == "deflate")
+            deflate = acceptable;
+    }
+
+    // Gzip is the better supported: some clients expect raw deflate data.
+    if (gzip)
+        encoding = Encoding::Gzip;
+    else if (deflate)
+        encoding = Encoding::Deflate;
+
+    return gzip || deflate;
+}
+
+//static
+Blob CompressedFileCache::lookup(const std::string& path,
+                                 std::chrono::system_clock::time_point modifiedTime,
+                                 std::size_t size, Encoding encoding)
+{
+    const std::shared_ptr<CompressedFileCache> instance = get();
+    if (!instance || size < instance->_minFileSize || size > instance->_maxFileSize)
+        return nullptr;
+
+    return instance->find(path, modifiedTime, size, encoding);
+}
+
+Blob CompressedFileCache::find(const std::string& path,
+                               std::chrono::system_clock::time_point modifiedTime,
+                               std::size_t size, Encoding encoding)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto it = _entries.find(path);
+    if (it != _entries.end() &&
+        (it->second._modifiedTime != modifiedTime || it->second._size != size))
+    {
+        LOG_TRC("Compressed variants of [" << path << "] are stale");
+        erase(it);
+        it = _entries.end();
+    }
+
+    if (it == _entries.end())
+    {
+        if (_entries.size() >= MaxEntries)
+        {
+            erase(_entries.find(_lru.back()));
+            ++Evictions;
+        }
+
+        _lru.push_front(path);
+        Entry entry{ modifiedTime, size, {}, { false, false }, false, _lru.begin() };
+        it = _entries.emplace(path, std::move(entry)).first;
+    }
+    else
+        _lru.splice(_lru.begin(), _lru, it->second._lru);
+
+    Entry& entry = it->second;
+    if (entry._incompressible)
+        return nullptr;
+
+    const std::size_t index = static_cast<std::size_t>(encoding);
+    if (entry._variants[index])
+    {
+        ++Hits;
+        BytesSaved += size - entry._variants[index]->size();
+        return entry._variants[index];
+    }
+
+    ++Misses;
+    if (!entry._queued[index])
+    {
+        LOG_TRC("Queueing the " << contentEncoding(encoding) << " compression of [" << path
+                                << ']');
+        entry._queued[index] = true;
+        _jobs.push_back({ path, modifiedTime, size, encoding });
+        _condition.notify_one();
+    }
+
+    return nullptr;
+}
+
+void CompressedFileCache::compressFiles()
+{
+    Util::setThreadName("file_compress");
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (!_exit)
+    {
+        if (_jobs.empty())
+        {
+            _condition.wait(lock);
+            continue;
+        }
+
+        const Job job = std::move(_jobs.front());
+        _jobs.pop_front();
+
+        lock.unlock();
+        const Blob variant = compress(job);
+        lock.lock();
+
+        store(job, variant);
+    }
+}
+
+Blob CompressedFileCache::compress(const Job& job) const
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    std::ifstream file(job._path, std::ios::binary);
+    std::vector<char> data(job._size);
+    file.read(data.data(), data.size());
+    if (static_cast<std::size_t>(file.gcount()) != job._size)
+    {
+        LOG_DBG("Failed to read [" << job._path << "] to compress it");
+        return nullptr;
+    }
+
+    // Don't cache a version we weren't asked for.
+    const FileUtil::Stat st(job._path);
+    if (st.bad() || st.modifiedTimepoint() != job._modifiedTime || st.size() != job._size)
+    {
+        LOG_DBG("File [" << job._path << "] changed while compressing it");
+        return nullptr;
+    }
+
+    z_stream strm;
+    std::memset(&strm, 0, sizeof(strm));
+    // 16 more window bits for the gzip header and trailer, rather than zlib's.
+    const int windowBits = job._encoding == Encoding::Gzip ? MAX_WBITS + 16 : MAX_WBITS;
+    if (deflateInit2(&strm, _level, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        LOG_ERR("Failed to initialize the compression of [" << job._path << ']');
+        return nullptr;
+    }
+
+    auto variant = std::make_shared<BlobData>(deflateBound(&strm, data.size()));
+    strm.next_in = reinterpret_cast<Bytef*>(data.data());
+    strm.avail_in = data.size();
+    strm.next_out = reinterpret_cast<Bytef*>(variant->data());
+    strm.avail_out = variant->size();
+    const int result = deflate(&strm, Z_FINISH);
+    variant->resize(variant->size() - strm.avail_out);
+    deflateEnd(&strm);
+
+    if (result != Z_STREAM_END)
+    {
+        LOG_ERR("Failed to compress [" << job._path << "]: " << result);
+        return nullptr;
+    }
+
+    LOG_DBG("Compressed [" << job._path << "] with " << contentEncoding(job._encoding) << " from "
+                           << job._size << " to " << variant->size() << " bytes in "
+                           << std::chrono::duration_cast<std::chrono::milliseconds>(
+                                  std::chrono::steady_clock::now() - start));
+
+    if (variant->size() > job._size * (1 - MinSavingRatio))
+        return nullptr;
+
+    variant->shrink_to_fit();
+    return variant;
+}
+
+void CompressedFileCache::store(const Job& job, const Blob& variant)
+{
+    const auto it = _entries.find(job._path);
+    if (it == _entries.end() || it->second._modifiedTime != job._modifiedTime ||
+        it->second._size != job._size)
+    {
+        // Evicted or modified meanwhile.
+        return;
+    }
+
+    const std::size_t index = static_cast<std::size_t>(job._encoding);
+    it->second._queued[index] = false;
+    if (!variant)
+    {
+        // Serve it as it is, until it is modified.
+        it->second._incompressible = true;
+        return;
+    }
+
+    // Make room, starting with the least recently used.
+    while (_bytes + variant->size() > _maxBytes && _lru.back() != job._path)
+    {
+        erase(_entries.find(_lru.back()));
+        ++Evictions;
+    }
+
+    if (_bytes + variant->size() > _maxBytes)
+    {
+        LOG_DBG("No room for the compressed [" << job._path << ']');
+        return;
+    }
+
+    it->second._variants[index] = variant;
+    _bytes += variant->size();
+}
+
+void CompressedFileCache::erase(std::unordered_map<std::string, Entry>::iterator it)
+{
+    for (const Blob& variant : it->second._variants)
+    {
+        if (variant)
+            _bytes -= variant->size();
+    }
+
+    _lru.erase(it->second._lru);
+    _entries.erase(it);
+}
+
+//static
+void CompressedFileCache::printMetrics(std::ostream& os)
+{
+    std::size_t bytes = 0;
+    std::size_t entries = 0;
+    if (const std::shared_ptr<CompressedFileCache> instance = get())
+    {
+        std::lock_guard<std::mutex> lock(instance->_mutex);
+        bytes = instance->_bytes;
+        entries = instance->_entries.size();
+    }
+
+    os << "file_compression_cache_hits " << Hits << '\n';
+    os << "file_compression_cache_misses " << Misses << '\n';
+    os << "file_compression_cache_evictions " << Evictions << '\n';
+    os << "file_compression_cache_bytes_saved " << BytesSaved << '\n';
+    os << "file_compression_cache_bytes " << bytes << '\n';
+    os << "file_compression_cache_files " << entries << '\n';
+}
+
+//static
+void CompressedFileCache::dumpState(std::ostream& os)
+{
+    const std::shared_ptr<CompressedFileCache> instance = get();
+    if (!instance)
+        return;
+
+    THREAD_UNSAFE_DUMP_BEGIN
+    os << "CompressedFileCache:\n";
+    os << "  files: " << instance->_entries.size() << '\n';
+    os << "  bytes: " << instance->_bytes << " of " << instance->_maxBytes << '\n';
+    os << "  queued: " << instance->_jobs.size() << '\n';
+    os << "  hits: " << Hits << ", misses: " << Misses << ", evictions: " << Evictions << '\n';
+    THREAD_UNSAFE_DUMP_END
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
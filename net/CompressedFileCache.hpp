@@ -0,0 +1,151 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include <common/Common.hpp>
+#include <common/StateEnum.hpp>
+
+/// The compressed variants of the files we serve with HttpHelper::sendFile,
+/// kept in memory, within a budget, to send again without compressing.
+/// A file is compressed on a background thread the first time it is asked
+/// for, and served uncompressed meanwhile. The variants are keyed by path,
+/// and dropped as soon as the modification time or size of the file changes.
+class CompressedFileCache
+{
+public:
+    /// The HTTP Content-Encodings we compress to.
+    STATE_ENUM(Encoding, Gzip, Deflate);
+
+    /// The most files we keep track of, compressed or not.
+    static constexpr std::size_t MaxEntries = 4096;
+
+    /// Starts the compression thread. The variants take up to @maxBytes,
+    /// for files from @minFileSize to @maxFileSize bytes, compressed at @level.
+    static void initialize(bool enable, std::size_t maxBytes, std::size_t minFileSize,
+                           std::size_t maxFileSize, int level);
+
+    /// Stops the compression thread and frees the variants.
+    /// Safe while other threads serve files: they finish with the cache they have.
+    static void shutdown();
+
+    static bool isEnabled() { return get() != nullptr; }
+
+    /// Picks the encoding to send to a client with the @acceptEncoding
+    /// header. Returns false if it accepts none of ours.
+    static bool pickEncoding(const std::string& acceptEncoding, Encoding& encoding);
+
+    /// Returns the @encoding variant of the file at @path, with the
+    /// @modifiedTime and @size it has now, or nullptr if we don't have it.
+    /// Its compression is then queued, unless it isn't worth it.
+    static Blob lookup(const std::string& path,
+                       std::chrono::system_clock::time_point modifiedTime, std::size_t size,
+                       Encoding encoding);
+
+    /// The HTTP name of @encoding, for Content-Encoding.
+    static const char* contentEncoding(Encoding encoding)
+    {
+        return encoding == Encoding::Gzip ? "gzip" : "deflate";
+    }
+
+    /// Writes our counters in the format of the metrics.
+    static void printMetrics(std::ostream& os);
+
+    static void dumpState(std::ostream& os);
+
+    ~CompressedFileCache();
+
+private:
+    CompressedFileCache(std::size_t maxBytes, std::size_t minFileSize, std::size_t maxFileSize,
+                        int level);
+
+    /// The variants of a version of a file.
+    struct Entry
+    {
+        std::chrono::system_clock::time_point _modifiedTime;
+        std::size_t _size;
+        Blob _variants[2]; ///< By Encoding.
+        bool _queued[2]; ///< Being compressed, by Encoding.
+        bool _incompressible; ///< Not worth compressing.
+        std::list<std::string>::iterator _lru;
+    };
+
+    struct Job
+    {
+        std::string _path;
+        std::chrono::system_clock::time_point _modifiedTime;
+        std::size_t _size;
+        Encoding _encoding;
+    };
+
+    /// The cache, if enabled. It stays alive as long as the caller holds it.
+    static std::shared_ptr<CompressedFileCache> get()
+    {
+        std::lock_guard<std::mutex> lock(InstanceMutex);
+        return Instance;
+    }
+
+    Blob find(const std::string& path, std::chrono::system_clock::time_point modifiedTime,
+              std::size_t size, Encoding encoding);
+
+    /// Compresses the queued files, until we stop.
+    void compressFiles();
+
+    /// Returns the compressed file, or nullptr if it failed or didn't shrink much.
+    Blob compress(const Job& job) const;
+
+    /// Stores the result of @job, evicting the least recently used as needed.
+    void store(const Job& job, const Blob& variant);
+
+    /// Forgets the file of @it, with the lock held.
+    void erase(std::unordered_map<std::string, Entry>::iterator it);
+
+    const std::size_t _maxBytes;
+    const std::size_t _minFileSize;
+    const std::size_t _maxFileSize;
+    const int _level;
+
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    bool _exit;
+    std::unordered_map<std::string, Entry> _entries;
+    /// The paths, most recently used first.
+    std::list<std::string> _lru;
+    std::deque<Job> _jobs;
+    /// The bytes of all the variants.
+    std::size_t _bytes;
+    std::thread _thread;
+
+    /// Guards Instance, not its contents.
+    static std::mutex InstanceMutex;
+    static std::shared_ptr<CompressedFileCache> Instance;
+
+    static std::atomic<uint64_t> Hits;
+    static std::atomic<uint64_t> Misses;
+    static std::atomic<uint64_t> BytesSaved;
+    static std::atomic<uint64_t> Evictions;
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -15,65 +15,23 @@
 #include "HttpRequest.hpp"
 
 #include <algorithm>
+#include <fcntl.h>
 #include <string>
-#include <zlib.h>
 
 #include <Poco/Net/HTTPResponse.h>
 
 #include <common/Common.hpp>
 #include <common/FileUtil.hpp>
 #include <common/Util.hpp>
+#include <net/CompressedFileCache.hpp>
 #include <net/Socket.hpp>
 
 namespace HttpHelper
 {
-void sendUncompressedFileContent(const std::shared_ptr<StreamSocket>& socket,
-                                 const std::string& path, const int bufferSize)
-{
-    std::ifstream file(path, std::ios::binary);
-    std::unique_ptr<char[]> buf = std::make_unique<char[]>(bufferSize);
-    do
-    {
-        file.read(&buf[0], bufferSize);
-        const int size = file.gcount();
-        if (size > 0)
-            socket->send(&buf[0], size, true);
-        else
-            break;
-    } while (file);
-}
-
-void sendDeflatedFileContent(const std::shared_ptr<StreamSocket>& socket, const std::string& path,
-                             const int fileSize)
-{
-    // FIXME: Should compress once ahead of time
-    // compression of bundle.js takes significant time:
-    //   200's ms for level 9 (468k), 72ms for level 1(587k)
-    //   down from 2Mb.
-    if (fileSize > 0)
-    {
-        std::ifstream file(path, std::ios::binary);
-        std::unique_ptr<char[]> buf = std::make_unique<char[]>(fileSize);
-        file.read(&buf[0], fileSize);
-
-        static const unsigned int Level = 1;
-        const long unsigned int size = file.gcount();
-        long unsigned int compSize = compressBound(size);
-        std::unique_ptr<char[]> cbuf = std::make_unique<char[]>(compSize);
-        int result = compress2((Bytef*)&cbuf[0], &compSize, (Bytef*)&buf[0], size, Level);
-        if (result != Z_OK)
-        {
-             LOG_ERR("failed compress of: " << path << " result: " << result);
-             return;
-        }
-        if (size > 0)
-            socket->send(&cbuf[0], compSize, true);
-    }
-}
-
 static void sendFileImpl(const std::shared_ptr<StreamSocket>& socket, const std::string& path,
                          http::Response& response, const bool noCache,
-                         const bool deflate, const bool headerOnly, const bool closeSocket)
+                         const std::string& acceptEncoding, const bool headerOnly,
+                         const std::optional<std::string>& range, const bool closeSocket)
 {
     FileUtil::Stat st(path);
     if (st.bad())
@@ -100,36 +58,98 @@ static void sendFileImpl(const std::shared_ptr<StreamSocket>& socket, const std:
         response.header().setConnectionToken(http::Header::ConnectionToken::Close);
     }
 
-    int bufferSize = std::min<std::size_t>(st.size(), Socket::MaximumSendBufferSize);
+    // Large files are sent a socket buffer at a time, so make it as big as we can.
     if (static_cast<long>(st.size()) >= socket->getSendBufferSize())
+        socket->setSocketBufferSize(std::min<std::size_t>(st.size(), Socket::MaximumSendBufferSize));
+
+    uint64_t first = 0;
+    uint64_t length = st.size();
+    const http::ByteRange byteRange =
+        http::parseByteRange(range.value_or(std::string()), st.size(), first, length);
+
+#if !MOBILEAPP
+    // Send the compressed variant of the whole file, if we have it and the client takes it.
+    CompressedFileCache::Encoding encoding;
+    if (byteRange == http::ByteRange::Whole && CompressedFileCache::isEnabled())
     {
-        socket->setSocketBufferSize(bufferSize);
-        bufferSize = socket->getSendBufferSize();
+        response.set("Vary", "Accept-Encoding");
+        const Blob variant =
+            CompressedFileCache::pickEncoding(acceptEncoding, encoding)
+                ? CompressedFileCache::lookup(path, st.modifiedTimepoint(), st.size(), encoding)
+                : nullptr;
+        if (variant)
+        {
+            response.set("Content-Encoding", CompressedFileCache::contentEncoding(encoding));
+            if (!noCache)
+                response.set("ETag",
+                             getEncodedETag(response.get("ETag"),
+                                            CompressedFileCache::contentEncoding(encoding)));
+            response.setContentLength(variant->size());
+            LOG_TRC('#' << socket->getFD() << ": Sending " << (headerOnly ? "header for " : "")
+                        << CompressedFileCache::contentEncoding(encoding) << " compressed file ["
+                        << path << "], " << variant->size() << " bytes.");
+            socket->send(response);
+
+            // Shared with the cache, rather than copied.
+            if (!headerOnly)
+            {
+                socket->getOutBuffer().appendShared(variant);
+                socket->flush();
+            }
+
+            if (closeSocket)
+                socket->shutdown();
+            return;
+        }
     }
+#endif // !MOBILEAPP
 
-    // Disable deflate for now - until we can cache deflated data.
-    // FIXME: IE/Edge doesn't work well with deflate, so check with
-    // IE/Edge before enabling the deflate again
-    if (!deflate || true)
-    {
-        response.setContentLength(st.size());
-        LOG_TRC('#' << socket->getFD() << ": Sending " << (headerOnly ? "header for " : "")
-                    << " file [" << path << "].");
-        socket->send(response);
+    if (range)
+        response.set("Accept-Ranges", "bytes");
 
-        if (!headerOnly)
-            sendUncompressedFileContent(socket, path, bufferSize);
-    }
-    else
+    switch (byteRange)
     {
-        response.set("Content-Encoding", "deflate");
-        LOG_TRC('#' << socket->getFD() << ": Sending " << (headerOnly ? "header for " : "")
-                    << " file [" << path << "].");
-        socket->send(response);
+        case http::ByteRange::Whole:
+            break;
+        case http::ByteRange::Partial:
+            response.setStatusCode(http::StatusCode::PartialContent);
+            response.set("Content-Range", "bytes " + std::to_string(first) + '-' +
+                                              std::to_string(first + length - 1) + '/' +
+                                              std::to_string(st.size()));
+            break;
+        case http::ByteRange::Unsatisfiable:
+            response.setStatusCode(http::StatusCode::RangeNotSatisfiable);
+            response.set("Content-Range", "bytes */" + std::to_string(st.size()));
+            length = 0;
+            break;
+    }
 
-        if (!headerOnly)
-            sendDeflatedFileContent(socket, path, st.size());
+    // Open before sending the header, so we can still fail, and the
+    // file may be removed as soon as we return.
+    int fd = -1;
+    if (!headerOnly && length > 0)
+    {
+        fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            LOG_SYS('#' << socket->getFD() << ": Failed to open [" << path
+                        << "]. File will not be sent.");
+            throw Poco::FileNotFoundException("Failed to open [" + path +
+                                              "]. File will not be sent.");
+        }
     }
+
+    response.setContentLength(length);
+    LOG_TRC('#' << socket->getFD() << ": Sending " << (headerOnly ? "header for " : "")
+                << " file [" << path << "], " << length << " bytes from " << first << '.');
+    socket->send(response);
+
+    // Streamed as the socket drains, without holding it all in memory.
+    // The first request for a compressible file is also served this way,
+    // while it is compressed in the background.
+    if (fd >= 0)
+        socket->sendFile(fd, first, length);
+
     if(closeSocket) {
         socket->shutdown();
     }
@@ -137,16 +157,18 @@ static void sendFileImpl(const std::shared_ptr<StreamSocket>& socket, const std:
 
 void sendFile(const std::shared_ptr<StreamSocket>& socket, const std::string& path,
               http::Response& response, const bool noCache,
-              const bool deflate, const bool headerOnly)
+              const std::string& acceptEncoding, const bool headerOnly,
+              const std::optional<std::string>& range)
 {
-    sendFileImpl(socket, path, response, noCache, deflate, headerOnly, false);
+    sendFileImpl(socket, path, response, noCache, acceptEncoding, headerOnly, range, false);
 }
 
 void sendFileAndShutdown(const std::shared_ptr<StreamSocket>& socket, const std::string& path,
                          http::Response& response, const bool noCache,
-                         const bool deflate, const bool headerOnly)
+                         const std::string& acceptEncoding, const bool headerOnly,
+                         const std::optional<std::string>& range)
 {
-    sendFileImpl(socket, path, response, noCache, deflate, headerOnly, true);
+    sendFileImpl(socket, path, response, noCache, acceptEncoding, headerOnly, range, true);
 }
 
 } // namespace HttpHelper
@@ -15,6 +15,7 @@
 #include <HttpRequest.hpp>
 
 #include <memory>
+#include <optional>
 #include <string>
 
 class StreamSocket;
@@ -46,15 +47,34 @@ inline void sendErrorAndShutdown(http::StatusCode errorCode,
     socket->ignoreInput();
 }
 
+/// Returns the ETag of the @contentEncoding variant of the representation tagged @etag.
+/// The variants differ in bytes, so they mustn't share a strong ETag.
+inline std::string getEncodedETag(const std::string& etag, std::string_view contentEncoding)
+{
+    if (contentEncoding.empty() || etag.size() < 2 || etag.back() != '"')
+        return etag;
+
+    return etag.substr(0, etag.size() - 1) + '-' + std::string(contentEncoding) + '"';
+}
+
 /// Sends file as HTTP response and shutdown the socket.
+/// The file is streamed as the socket drains, so it can be removed once this returns.
+/// It is compressed, when cached so, if the client's @acceptEncoding header allows it.
+/// Ranges are honoured, and advertised, only when a @range header, even empty, is given.
 void sendFileAndShutdown(const std::shared_ptr<StreamSocket>& socket, const std::string& path,
-                         http::Response& response,
-                         const bool noCache = false, const bool deflate = false, const bool headerOnly = false);
+                         http::Response& response, const bool noCache = false,
+                         const std::string& acceptEncoding = std::string(),
+                         const bool headerOnly = false,
+                         const std::optional<std::string>& range = std::nullopt);
 
 /// Sends file as HTTP response.
+/// The file is streamed as the socket drains, so it can be removed once this returns.
+/// It is compressed, when cached so, if the client's @acceptEncoding header allows it.
+/// Ranges are honoured, and advertised, only when a @range header, even empty, is given.
 void sendFile(const std::shared_ptr<StreamSocket>& socket, const std::string& path,
-              http::Response& response,
-              const bool noCache = false, const bool deflate = false, const bool headerOnly = false);
+              http::Response& response, const bool noCache = false,
+              const std::string& acceptEncoding = std::string(), const bool headerOnly = false,
+              const std::optional<std::string>& range = std::nullopt);
 
 /// Verifies that the given WOPISrc is properly URI-encoded.
 /// Warns if it isn't and, in debug builds, closes the socket (if given) and returns false.
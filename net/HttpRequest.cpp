@@ -16,6 +16,7 @@
 #include <Poco/MemoryStream.h>
 #include <Poco/Net/HTTPResponse.h>
 
+#include <algorithm>
 #include <cstdint>
 #include <memory>
 #include <stdexcept>
@@ -688,6 +689,57 @@ std::shared_ptr<Session> Session::create(std::string host, Protocol protocol, in
     return std::shared_ptr<Session>(new Session(std::move(host), protocol, port));
 }
 
+ByteRange parseByteRange(const std::string& range, uint64_t size, uint64_t& first,
+                         uint64_t& length)
+{
+    // Only the "bytes=first-last", "bytes=first-" and "bytes=-suffix" forms.
+    // Anything else may be ignored by serving the whole (RFC 9110 14.2).
+    constexpr std::string_view Unit = "bytes=";
+    if (!range.starts_with(Unit) || range.find(',') != std::string::npos)
+        return ByteRange::Whole;
+
+    const std::string spec = Util::trimmed(range.substr(Unit.size()));
+    const std::size_t dash = spec.find('-');
+    if (dash == std::string::npos)
+        return ByteRange::Whole;
+
+    const std::string firstStr = Util::trimmed(spec.substr(0, dash));
+    const std::string lastStr = Util::trimmed(spec.substr(dash + 1));
+    const auto isNumber = [](const std::string& str)
+    {
+        return !str.empty() && str.size() < 20 &&
+               std::all_of(str.begin(), str.end(), [](char c) { return c >= '0' && c <= '9'; });
+    };
+
+    if (firstStr.empty())
+    {
+        // The last bytes.
+        if (!isNumber(lastStr))
+            return ByteRange::Whole;
+
+        const uint64_t suffix = std::stoull(lastStr);
+        if (suffix == 0 || size == 0)
+            return ByteRange::Unsatisfiable;
+
+        length = std::min(suffix, size);
+        first = size - length;
+        return ByteRange::Partial;
+    }
+
+    if (!isNumber(firstStr) || (!lastStr.empty() && !isNumber(lastStr)))
+        return ByteRange::Whole;
+
+    first = std::stoull(firstStr);
+    const uint64_t last = lastStr.empty() ? UINT64_MAX : std::stoull(lastStr);
+    if (last < first)
+        return ByteRange::Whole;
+    if (first >= size)
+        return ByteRange::Unsatisfiable;
+
+    length = std::min(last, size - 1) - first + 1;
+    return ByteRange::Partial;
+}
+
 } // namespace http
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -22,6 +22,7 @@
 #include <iostream>
 #include <fstream>
 #include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
 #include <netdb.h>
@@ -327,6 +328,18 @@ static inline const char* getReasonPhraseForCode(StatusCode statusCode)
 std::string getAgentString();
 std::string getServerString();
 
+/// How a Range request header applies to a representation.
+STATE_ENUM(ByteRange,
+           Whole, ///< No range, or one we ignore, such as multiple ranges.
+           Partial, ///< A single satisfiable range.
+           Unsatisfiable ///< Starts past the end: 416 Range Not Satisfiable.
+);
+
+/// Parses the @range header for a representation of @size bytes.
+/// When Partial, sets the @first byte and the @length of the range.
+ByteRange parseByteRange(const std::string& range, uint64_t size, uint64_t& first,
+                         uint64_t& length);
+
 /// The callback signature for handling IO writes.
 /// Returns the number of bytes read from the buffer,
 /// -1 for error (terminates the transfer).
@@ -931,6 +944,9 @@ public:
     const StatusLine& statusLine() const { return _statusLine; }
     StatusCode statusCode() const { return _statusLine.statusCode(); }
 
+    /// Set the Status Code of an outgoing response.
+    void setStatusCode(StatusCode statusCode) { _statusLine = StatusLine(statusCode); }
+
     Header& header() { return _header; }
     const Header& header() const { return _header; }
 
@@ -952,21 +968,31 @@ public:
         return _header.get(key, def);
     }
 
+    /// Called as the body is written to file, with the number of bytes
+    /// received so far, and the Content-Length, or -1 when unknown.
+    using ProgressCallback = std::function<void(int64_t received, int64_t expected)>;
+
     /// Redirect the response body, if any, to a file.
     /// If the server responds with a non-success status code (i.e. not 2xx)
     /// the body is redirected to memory to be read via getBody().
     /// Check the statusLine().statusCategory() for the status code.
-    void saveBodyToFile(const std::string& path)
+    void saveBodyToFile(const std::string& path, ProgressCallback onProgress = nullptr)
     {
         _bodyFile.open(path, std::ios_base::out | std::ios_base::binary);
         if (!_bodyFile.good())
             LOG_ERR("Unable to open [" << path << "] for saveBodyToFile");
-        _onBodyWriteCb = [this](const char* p, int64_t len)
+        _onBodyWriteCb = [this, onProgress = std::move(onProgress)](const char* p, int64_t len)
         {
             LOG_TRC("Writing " << len << " bytes");
             if (_bodyFile.good())
                 _bodyFile.write(p, len);
-            return _bodyFile.good() ? len : -1;
+            if (!_bodyFile.good())
+                return static_cast<int64_t>(-1);
+
+            if (onProgress)
+                onProgress(_recvBodySize + len,
+                           _header.hasContentLength() ? _header.getContentLength() : -1);
+            return len;
         };
     }
 
@@ -1117,7 +1143,10 @@ private:
         , _fd(-1)
         , _handshakeSslVerifyFailure(0)
         , _timeout(getDefaultTimeout())
+        , _handshakeDuration(std::chrono::microseconds::zero())
+        , _handshakeResumed(false)
         , _connected(false)
+        , _keepIdleConnection(false)
         , _result(net::AsyncConnectResult::Ok)
     {
         assert(!_host.empty() && portNumber > 0 && !_port.empty() &&
@@ -1243,6 +1272,39 @@ public:
 
     void setConnectFailHandler(ConnectFailCallback onConnectFail) { _onConnectFail = std::move(onConnectFail); }
 
+    /// Keep the connection open once a request has completed, out of any
+    /// SocketPoll, so that the next request can be made on it from any poll.
+    /// This is for connection pools, which must disable it to close the
+    /// connection, as the idle socket and this Session reference each other.
+    void setKeepIdleConnection(bool keep)
+    {
+        std::shared_ptr<StreamSocket> socket;
+        {
+            std::lock_guard<std::mutex> lock(_idleMutex);
+            _keepIdleConnection = keep;
+            if (!keep)
+                socket = std::move(_idleSocket);
+        }
+
+        if (socket)
+            closeIdleSocket(socket);
+    }
+
+    /// Returns true iff the connection is idle and still open.
+    bool hasIdleConnection() const
+    {
+        std::lock_guard<std::mutex> lock(_idleMutex);
+        return _idleSocket && isIdleSocketOpen(*_idleSocket);
+    }
+
+    /// Returns the duration of the TLS handshake, and whether it was @resumed,
+    /// of a connection made since the last call, or zero.
+    std::chrono::microseconds takeHandshakeDuration(bool& resumed)
+    {
+        resumed = _handshakeResumed;
+        return std::exchange(_handshakeDuration, std::chrono::microseconds::zero());
+    }
+
     /// Make a synchronous request to download a file to the given path.
     /// Note: when the server returns an error, the response body,
     /// if any, will be stored in memory and can be read via getBody().
@@ -1271,6 +1333,21 @@ public:
         return syncDownload(req, saveToFilePath, poller);
     }
 
+    /// Start an asynchronous request to download a file to the given path,
+    /// streaming the body to disk as it arrives, on the given SocketPoll.
+    /// @onProgress, if set, is called from the SocketPoll as the body arrives.
+    /// The same notes as for syncDownload() and asyncRequest() apply.
+    void asyncDownload(const Request& req, const std::string& saveToFilePath, SocketPoll& poll,
+                       Response::ProgressCallback onProgress = nullptr)
+    {
+        LOG_TRC("new asyncDownload: " << req.getVerb() << ' ' << host() << ':' << port() << ' '
+                                      << req.getUrl());
+
+        newRequest(req);
+        _response->saveBodyToFile(saveToFilePath, std::move(onProgress));
+        startAsyncRequest(req, poll);
+    }
+
     /// Make a synchronous request.
     /// The payload body of the response, if any, can be read via getBody().
     const std::shared_ptr<const Response> syncRequest(const Request& req, SocketPoll& poller)
@@ -1321,22 +1398,7 @@ public:
                                      << req.getUrl());
 
         newRequest(req);
-
-        if (!isConnected())
-        {
-            asyncConnect(poll);
-        }
-        else
-        {
-            // Technically, there is a race here. The socket can
-            // get disconnected and removed right after isConnected.
-            // In that case, we will timeout and no request will be sent.
-            poll.wakeup();
-        }
-
-        LOG_DBG("starting asyncRequest: " << req.getVerb() << ' ' << host() << ':' << port() << ' '
-                                          << req.getUrl());
-
+        startAsyncRequest(req, poll);
     }
 
     void asyncShutdown()
@@ -1426,7 +1488,12 @@ private:
 
         assert(!!_response && "Response must be set!");
 
-        if (!isConnected())
+        if (std::shared_ptr<StreamSocket> socket = takeIdleSocket())
+        {
+            LOG_TRC("Reusing the idle connection");
+            poller.insertNewSocket(std::move(socket));
+        }
+        else if (!isConnected())
         {
             std::shared_ptr<StreamSocket> socket = connect();
             if (!socket)
@@ -1480,6 +1547,30 @@ private:
         }
     }
 
+    /// Sends the request made by newRequest() on the given SocketPoll.
+    void startAsyncRequest(const Request& req, SocketPoll& poll)
+    {
+        if (std::shared_ptr<StreamSocket> socket = takeIdleSocket())
+        {
+            LOG_TRC("Reusing the idle connection");
+            poll.insertNewSocket(std::move(socket));
+        }
+        else if (!isConnected())
+        {
+            asyncConnect(poll);
+        }
+        else
+        {
+            // Technically, there is a race here. The socket can
+            // get disconnected and removed right after isConnected.
+            // In that case, we will timeout and no request will be sent.
+            poll.wakeup();
+        }
+
+        LOG_DBG("starting asyncRequest: " << req.getVerb() << ' ' << host() << ':' << port() << ' '
+                                          << req.getUrl());
+    }
+
     /// Set up a new request and response.
     void newRequest(const Request& req)
     {
@@ -1596,6 +1687,10 @@ private:
                 // Remove consumed data.
                 if (read)
                     data.eraseFirst(read);
+
+                // Unless onFinished has made a new request already.
+                if (_response->done() && data.empty())
+                    keepIdleConnection(disposition);
                 return;
             }
         }
@@ -1672,6 +1767,92 @@ private:
         callOnConnectFail();
     }
 
+    void onHandshakeDone(bool resumed) override
+    {
+        _handshakeDuration = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - _connectTime);
+        _handshakeResumed = resumed;
+        LOG_TRC("Handshake done in " << _handshakeDuration << (resumed ? ", resumed" : ""));
+    }
+
+    /// Moves the connection out of its poll when the response is complete,
+    /// if we are to keep it idle and the server hasn't closed it.
+    void keepIdleConnection(SocketDisposition& disposition)
+    {
+        if (!isConnected() || _response->state() != Response::State::Complete)
+            return;
+
+        std::lock_guard<std::mutex> lock(_idleMutex);
+        if (!_keepIdleConnection)
+            return;
+
+        disposition.setMove(
+            [this](const std::shared_ptr<Socket>& moved)
+            {
+                auto socket = std::static_pointer_cast<StreamSocket>(moved);
+                {
+                    std::lock_guard<std::mutex> idleLock(_idleMutex);
+                    if (_keepIdleConnection)
+                    {
+                        LOG_TRC("Keeping the connection idle");
+                        _idleSocket = std::move(socket);
+                        return;
+                    }
+                }
+
+                // Disabled meanwhile.
+                closeIdleSocket(socket);
+            });
+    }
+
+    /// Returns the idle connection to make a new request on, unless the
+    /// server has closed it meanwhile, in which case we need a new one.
+    std::shared_ptr<StreamSocket> takeIdleSocket()
+    {
+        std::shared_ptr<StreamSocket> socket;
+        {
+            std::lock_guard<std::mutex> lock(_idleMutex);
+            socket = std::move(_idleSocket);
+        }
+
+        if (socket && !isIdleSocketOpen(*socket))
+        {
+            LOG_DBG("The idle connection was closed by the server");
+            closeIdleSocket(socket);
+            socket.reset();
+        }
+
+        return socket;
+    }
+
+    /// Returns true iff the server hasn't closed or written to the idle @socket.
+    static bool isIdleSocketOpen(const StreamSocket& socket)
+    {
+        if (socket.isClosed())
+            return false;
+
+#if !MOBILEAPP
+        char byte;
+        const ssize_t size = ::recv(socket.getFD(), &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+        return size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+#else
+        return true;
+#endif
+    }
+
+    /// Closes the idle @socket, which is in no poll, without an onDisconnect.
+    /// Note that this may be the last reference to us, via the handler.
+    void closeIdleSocket(const std::shared_ptr<StreamSocket>& socket)
+    {
+        LOG_TRC("Closing the idle connection");
+        _connected = false;
+        _fd = -1;
+        _socket.reset();
+
+        socket->closeConnection();
+        socket->resetHandler(); // Must be last.
+    }
+
     void onDisconnect() override
     {
         // Make sure the socket is disconnected and released.
@@ -1694,6 +1875,7 @@ private:
     std::shared_ptr<StreamSocket> connect()
     {
         _socket.reset(); // Reset to make sure we are disconnected.
+        _connectTime = std::chrono::steady_clock::now();
         std::shared_ptr<StreamSocket> socket =
             net::connect(_host, _port, isSecure(), shared_from_this());
         assert((!socket || _fd == socket->getFD()) &&
@@ -1732,6 +1914,7 @@ private:
     void asyncConnect(SocketPoll& poll)
     {
         _socket.reset(); // Reset to make sure we are disconnected.
+        _connectTime = std::chrono::steady_clock::now();
 
         auto pushConnectCompleteToPoll = [this, &poll](std::shared_ptr<StreamSocket> socket, net::AsyncConnectResult result ) {
             poll.addCallback([selfLifecycle = shared_from_this(), this, &poll, socket=std::move(socket), result]() {
@@ -1782,11 +1965,18 @@ private:
     long _handshakeSslVerifyFailure; ///< Save SslVerityResult at onHandshakeFail
     std::chrono::microseconds _timeout;
     std::chrono::steady_clock::time_point _startTime;
+    std::chrono::steady_clock::time_point _connectTime;
+    std::chrono::microseconds _handshakeDuration; ///< Of the last TLS handshake.
+    bool _handshakeResumed; ///< Whether the last TLS handshake resumed a session.
     bool _connected;
     Request _request;
     FinishedCallback _onFinished;
     ConnectFailCallback _onConnectFail;
     std::shared_ptr<Response> _response;
+    /// The connection, out of any poll, between requests when we keep it.
+    std::shared_ptr<StreamSocket> _idleSocket;
+    bool _keepIdleConnection;
+    mutable std::mutex _idleMutex;
     std::weak_ptr<StreamSocket> _socket; ///< Must be the last member.
     net::AsyncConnectResult _result; // last connection tentative result
 };
@@ -2035,6 +2225,12 @@ private:
                                     std::to_string(_size));
 
                 socket->send(httpResponse);
+
+                // The socket streams it from here, without copying it through us.
+                if (_fd >= 0)
+                    socket->sendFile(_fd, getStart(), std::max(getSendSize(), 0));
+                _fd = -1;
+                socket->shutdown();
                 return;
             }
 
@@ -2069,10 +2265,8 @@ private:
     int getPollEvents(std::chrono::steady_clock::time_point /*now*/,
                       int64_t& /*timeoutMaxMicroS*/) override
     {
-        int events = POLLIN;
-        if (_fd >= 0 || _pos >= 0)
-            events |= POLLOUT;
-        return events;
+        // The socket asks to write while it has the file to send.
+        return POLLIN;
     }
 
     void handleIncomingMessage(SocketDisposition& /*disposition*/) override
@@ -2090,45 +2284,7 @@ private:
 
     void performWrites(std::size_t capacity) override
     {
-        // We may get called after disconnecting and freeing the Socket instance.
-        if (_socket)
-        {
-            const Buffer& out = _socket->getOutBuffer();
-            LOG_TRC("performWrites: " << out.size() << " bytes, capacity: " << capacity);
-
-            while (_fd >= 0 && capacity > 0)
-            {
-                //FIXME: replace with in-place read into the output buffer.
-                char buffer[64 * 1024];
-                const auto size = std::min({sizeof(buffer), capacity, (size_t)(getEnd() - _pos)});
-                int n;
-                while ((n = ::read(_fd, buffer, size)) < 0 && errno == EINTR)
-                    LOG_TRC("EINTR reading from " << _data);
-
-                if (n <= 0 || _pos >= getEnd())
-                {
-                    if (n >= 0)
-                    {
-                        LOG_TRC("performWrites finished uploading");
-                    }
-                    else
-                    {
-                        LOG_SYS("Failed to upload file");
-                    }
-
-                    close(_fd);
-                    _fd = -1;
-                    onDisconnect();
-                    break;
-                }
-
-                _socket->send(buffer, n);
-                _pos += n;
-                LOG_ASSERT(static_cast<std::size_t>(n) <= capacity);
-                capacity -= n;
-                LOG_TRC("performWrites wrote " << n << " bytes, capacity: " << capacity);
-            }
-        }
+        LOG_TRC("performWrites: capacity: " << capacity);
     }
 
     void onDisconnect() override
@@ -27,6 +27,11 @@
 
 #include <netdb.h>
 
+#include <condition_variable>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
 #include <Poco/Net/SocketAddress.h>
 
 namespace net
@@ -126,56 +131,176 @@ HostEntry::~HostEntry() = default;
 
 #if !MOBILEAPP
 
-struct DNSCacheEntry
+namespace
 {
-    std::string queryAddress;
-    std::string queryPort;
-    HostEntry hostEntry;
-    std::chrono::steady_clock::time_point lookupTime;
-};
+/// The lookups of all the threads, with those of AsyncDNS. Concurrent lookups
+/// of the same host and port wait for the one in progress.
+class DNSCache
+{
+    struct Entry
+    {
+        HostEntry _hostEntry;
+        /// When it needs to be looked up again.
+        std::chrono::steady_clock::time_point _expiry;
+        /// When it can no longer be used, while it is looked up again.
+        std::chrono::steady_clock::time_point _staleExpiry;
+        bool _refreshing;
+    };
 
-static HostEntry resolveDNS(const std::string& addressToCheck,
-                            const std::string& port,
-                            std::vector<DNSCacheEntry>& querycache)
-{
-    const auto now = std::chrono::steady_clock::now();
-
-    // remove entries >= 20 seconds old
-    std::erase_if(querycache, [now](const auto& entry)->bool {
-                                 auto ageMS = std::chrono::duration_cast<std::chrono::milliseconds>(now - entry.lookupTime).count();
-                                 return ageMS > 20000;
-                              });
-
-    // search for hit
-    auto findIt = std::find_if(querycache.begin(), querycache.end(),
-                               [&addressToCheck, &port](const auto& entry)->bool {
-                                 return entry.queryAddress == addressToCheck &&
-                                        entry.queryPort == port;
-                               });
-    if (findIt != querycache.end())
-        return findIt->hostEntry;
-
-    // lookup and cache
-    HostEntry hostEntry(addressToCheck, !port.empty() ? port.c_str() : nullptr);
-    querycache.push_back(DNSCacheEntry{addressToCheck, port, hostEntry, now});
-    return hostEntry;
-}
+    static constexpr std::size_t MaxEntries = 1024;
+
+    std::mutex _mutex;
+    std::condition_variable _lookupDone;
+    std::unordered_map<std::string, Entry> _entries;
+    std::unordered_set<std::string> _inFlight;
+    DNSLookupFn _lookupFn;
+    std::chrono::seconds _ttl;
+    std::chrono::seconds _negativeTtl;
+    std::chrono::seconds _staleTtl;
 
-class DNSResolver
-{
-private:
-    std::vector<DNSCacheEntry> _querycache;
 public:
-    HostEntry resolveDNS(const std::string& addressToCheck, const std::string& port)
+    DNSCache()
+        : _ttl(20)
+        , _negativeTtl(5)
+        , _staleTtl(60)
+    {
+    }
+
+    static std::string getKey(const std::string& host, const std::string& port)
+    {
+        return host + ' ' + port;
+    }
+
+    void setTTL(std::chrono::seconds ttl, std::chrono::seconds negativeTtl,
+                std::chrono::seconds staleTtl)
     {
-        return net::resolveDNS(addressToCheck, port, _querycache);
+        std::lock_guard<std::mutex> lock(_mutex);
+        _ttl = ttl;
+        _negativeTtl = negativeTtl;
+        _staleTtl = staleTtl;
+    }
+
+    void setLookup(DNSLookupFn lookup)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _lookupFn = std::move(lookup);
+        _entries.clear();
+    }
+
+    HostEntry resolve(const std::string& host, const std::string& port)
+    {
+        const std::string key = getKey(host, port);
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true)
+        {
+            const auto now = std::chrono::steady_clock::now();
+            const auto it = _entries.find(key);
+            if (it != _entries.end() && now < it->second._expiry)
+                return it->second._hostEntry;
+
+            if (it != _entries.end() && now < it->second._staleExpiry)
+            {
+                Entry& entry = it->second;
+                if (entry._refreshing || _inFlight.contains(key))
+                    return entry._hostEntry;
+
+                entry._refreshing = true;
+                HostEntry stale = entry._hostEntry;
+                lock.unlock();
+                if (AsyncDNS::refresh(host, port))
+                {
+                    LOG_TRC("Refreshing DNS entry of [" << host << "] in the background");
+                    return stale;
+                }
+
+                // Without background threads, look it up now.
+                lock.lock();
+                const auto again = _entries.find(key);
+                if (again != _entries.end())
+                    again->second._refreshing = false;
+            }
+
+            if (!_inFlight.contains(key))
+                break;
+
+            _lookupDone.wait(lock);
+        }
+
+        return lookup(key, host, port, lock);
+    }
+
+    /// Looks up @host again, unless that's already in progress.
+    void refresh(const std::string& host, const std::string& port)
+    {
+        const std::string key = getKey(host, port);
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (!_inFlight.contains(key))
+            lookup(key, host, port, lock);
+    }
+
+private:
+    HostEntry lookup(const std::string& key, const std::string& host, const std::string& port,
+                     std::unique_lock<std::mutex>& lock)
+    {
+        _inFlight.insert(key);
+        const DNSLookupFn lookupFn = _lookupFn;
+        lock.unlock();
+
+        HostEntry hostEntry = lookupFn ? lookupFn(host, port)
+                                       : HostEntry(host, !port.empty() ? port.c_str() : nullptr);
+
+        lock.lock();
+        _inFlight.erase(key);
+
+        const auto now = std::chrono::steady_clock::now();
+        const auto it = _entries.find(key);
+        if (!hostEntry.good() && it != _entries.end() && it->second._hostEntry.good() &&
+            now < it->second._staleExpiry)
+        {
+            // Keep using the last good result, until it's stale.
+            LOG_DBG("Failed to refresh DNS entry " << hostEntry.errorMessage());
+            it->second._refreshing = false;
+            hostEntry = it->second._hostEntry;
+        }
+        else
+        {
+            if (it == _entries.end() && _entries.size() >= MaxEntries)
+            {
+                std::erase_if(_entries, [now](const auto& pair)
+                              { return pair.second._staleExpiry <= now; });
+                if (_entries.size() >= MaxEntries)
+                    _entries.clear();
+            }
+
+            const auto expiry = now + (hostEntry.good() ? _ttl : _negativeTtl);
+            _entries.insert_or_assign(
+                key,
+                Entry{ hostEntry, expiry, hostEntry.good() ? expiry + _staleTtl : expiry, false });
+        }
+        lock.unlock();
+
+        _lookupDone.notify_all();
+        return hostEntry;
     }
 };
 
+DNSCache SharedDNSCache;
+} // namespace
+
 HostEntry resolveDNS(const std::string& addressToCheck)
 {
-    thread_local DNSResolver resolver;
-    return resolver.resolveDNS(addressToCheck, std::string());
+    return SharedDNSCache.resolve(addressToCheck, std::string());
+}
+
+void setDNSCacheTTL(std::chrono::seconds ttl, std::chrono::seconds negativeTtl,
+                    std::chrono::seconds staleTtl)
+{
+    SharedDNSCache.setTTL(ttl, negativeTtl, staleTtl);
+}
+
+void setDNSLookup(DNSLookupFn lookup)
+{
+    SharedDNSCache.setLookup(std::move(lookup));
 }
 
 std::string canonicalHostName(const std::string& addressToCheck)
@@ -251,57 +376,64 @@ bool isLocalhost(const std::string& targetHost)
     return resolveDNS(targetHost).isLocalhost();
 }
 
-void AsyncDNS::startThread()
+void AsyncDNS::startThreads(std::size_t threadCount)
 {
-    assert(!_thread);
+    assert(_threads.empty());
     _exit = false;
-    _thread.reset(new std::thread(&AsyncDNS::resolveDNS, this));
+    _activeLookups.resize(threadCount);
+    for (std::size_t index = 0; index < threadCount; ++index)
+        _threads.emplace_back(&AsyncDNS::resolveDNS, this, index);
 }
 
-void AsyncDNS::joinThread()
+void AsyncDNS::joinThreads()
 {
     _exit = true;
     _condition.notify_all();
-    _thread->join();
-    _thread.reset();
+    for (std::thread& thread : _threads)
+        thread.join();
+    _threads.clear();
 }
 
 void AsyncDNS::dumpQueueState(std::ostream& os) const
 {
     THREAD_UNSAFE_DUMP_BEGIN
     // NOT thread-safe
-    Lookup activeLookup = _activeLookup;
+    const std::vector<Lookup> activeLookups = _activeLookups;
     std::queue<Lookup> lookups = _lookups;
-    os << "  active lookup: " << (activeLookup.cb ? "true" : "false") << '\n';
-    if (activeLookup.cb)
+    os << "  threads: " << activeLookups.size() << '\n';
+    for (const Lookup& activeLookup : activeLookups)
     {
-        os << "    lookup: " << activeLookup.query << '\n';
-        os << "    callback: " << activeLookup.dumpState() << '\n';
+        if (activeLookup.query.empty())
+            continue;
+        os << "  active lookup: " << activeLookup.query << '\n';
+        if (activeLookup.cb)
+            os << "    callback: " << activeLookup.dumpState() << '\n';
     }
     os << "  queued lookups: " << lookups.size() << '\n';
     while (!lookups.empty())
     {
         os << "    lookup: " << lookups.front().query << '\n';
-        os << "    callback: " << lookups.front().dumpState() << '\n';
+        if (lookups.front().cb)
+            os << "    callback: " << lookups.front().dumpState() << '\n';
         lookups.pop();
     }
+    os << "  hosts with waiting lookups: " << _waitingLookups.size() << '\n';
     THREAD_UNSAFE_DUMP_END
 }
 
-AsyncDNS::AsyncDNS()
-    : _resolver(std::make_unique<DNSResolver>())
+AsyncDNS::AsyncDNS(std::size_t threadCount)
 {
-    startThread();
+    startThreads(std::max<std::size_t>(threadCount, 1));
 }
 
 AsyncDNS::~AsyncDNS()
 {
-    joinThread();
+    joinThreads();
 }
 
-void AsyncDNS::resolveDNS()
+void AsyncDNS::resolveDNS(std::size_t index)
 {
-    Util::setThreadName("asyncdns");
+    Util::setThreadName("asyncdns_" + std::to_string(index));
     std::unique_lock<std::mutex> guard(_lock);
     while (true)
     {
@@ -311,17 +443,39 @@ void AsyncDNS::resolveDNS()
         if (_exit)
             break;
 
-        _activeLookup = _lookups.front();
+        Lookup current = _lookups.front();
         _lookups.pop();
+        _activeLookups[index] = current;
 
         // Unlock to allow entries to queue up in _lookups while resolving
-        _lock.unlock();
+        guard.unlock();
+
+        if (!current.cb)
+        {
+            SharedDNSCache.refresh(current.query, current.port);
+            guard.lock();
+            _activeLookups[index] = {};
+            continue;
+        }
 
-        _activeLookup.cb(_resolver->resolveDNS(_activeLookup.query, _activeLookup.port));
+        const HostEntry hostEntry = SharedDNSCache.resolve(current.query, current.port);
 
-        _activeLookup = {};
+        guard.lock();
+        _activeLookups[index] = {};
+        std::vector<Lookup> waiting;
+        const auto it = _waitingLookups.find(DNSCache::getKey(current.query, current.port));
+        if (it != _waitingLookups.end())
+        {
+            waiting = std::move(it->second);
+            _waitingLookups.erase(it);
+        }
+        guard.unlock();
+
+        current.cb(hostEntry);
+        for (const Lookup& waiter : waiting)
+            waiter.cb(hostEntry);
 
-        _lock.lock();
+        guard.lock();
     }
 }
 
@@ -331,6 +485,19 @@ void AsyncDNS::addLookup(const std::string& lookup,
                          const DNSThreadDumpStateFn& dumpState)
 {
     std::unique_lock<std::mutex> guard(_lock);
+    if (cb)
+    {
+        // Wait for the result of the same lookup, if one is already queued or in progress.
+        const auto [it, inserted] =
+            _waitingLookups.try_emplace(DNSCache::getKey(lookup, port), std::vector<Lookup>());
+        if (!inserted)
+        {
+            LOG_TRC("Waiting for the lookup of [" << lookup << "] in progress");
+            it->second.emplace_back(Lookup({lookup, port, cb, dumpState}));
+            return;
+        }
+    }
+
     _lookups.emplace(Lookup({lookup, port, cb, dumpState}));
     guard.unlock();
     _condition.notify_one();
@@ -339,9 +506,9 @@ void AsyncDNS::addLookup(const std::string& lookup,
 static std::unique_ptr<AsyncDNS> AsyncDNSThread;
 
 //static
-void AsyncDNS::startAsyncDNS()
+void AsyncDNS::startAsyncDNS(std::size_t threadCount)
 {
-    AsyncDNSThread = std::make_unique<AsyncDNS>();
+    AsyncDNSThread = std::make_unique<AsyncDNS>(threadCount);
 }
 
 //static
@@ -373,6 +540,16 @@ void AsyncDNS::lookup(const std::string& searchEntry,
     AsyncDNSThread->addLookup(searchEntry, port, cb, dumpState);
 }
 
+//static
+bool AsyncDNS::refresh(const std::string& searchEntry, const std::string& port)
+{
+    if (!AsyncDNSThread)
+        return false;
+
+    AsyncDNSThread->addLookup(searchEntry, port, nullptr, nullptr);
+    return true;
+}
+
 void
 asyncConnect(const std::string& host, const std::string& port, const bool isSSL,
              const std::shared_ptr<ProtocolHandlerInterface>& protocolHandler,
@@ -431,8 +608,8 @@ asyncConnect(const std::string& host, const std::string& port, const bool isSSL,
 #if ENABLE_SSL
                         if (isSSL)
                         {
-                            socket = StreamSocket::create<SslStreamSocket>(host, fd, type, true,
-                                                                           hostType, protocolHandler);
+                            socket = SslStreamSocket::createClient(host, port, fd, type, hostType,
+                                                                   protocolHandler);
                         }
 #endif
                         if (!socket && !isSSL)
@@ -531,8 +708,8 @@ connect(const std::string& host, const std::string& port, const bool isSSL,
 #if ENABLE_SSL
                     if (isSSL)
                     {
-                        socket = StreamSocket::create<SslStreamSocket>(host, fd, type, true,
-                                                                       hostType, protocolHandler);
+                        socket = SslStreamSocket::createClient(host, port, fd, type, hostType,
+                                                               protocolHandler);
                     }
 #endif
                     if (!socket && !isSSL)
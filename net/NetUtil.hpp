@@ -83,6 +83,18 @@ std::string canonicalHostName(const std::string& addressToCheck);
 /// Returns a vector containing the IPAddresses for the host.
 std::vector<std::string> resolveAddresses(const std::string& addressToCheck);
 
+/// Sets how long later lookups are cached: successful ones for @ttl and failed ones for
+/// @negativeTtl. Successful ones are then used for up to @staleTtl more, while they
+/// are looked up again in the background by AsyncDNS.
+void setDNSCacheTTL(std::chrono::seconds ttl, std::chrono::seconds negativeTtl,
+                    std::chrono::seconds staleTtl);
+
+typedef std::function<HostEntry(const std::string& host, const std::string& port)> DNSLookupFn;
+
+/// Replaces getaddrinfo() for the lookups, eg. with a fake in tests,
+/// or restores it when @lookup is empty. Clears the cache.
+void setDNSLookup(DNSLookupFn lookup);
+
 #endif
 
 /// Connect to an end-point at the given host and port and return StreamSocket.
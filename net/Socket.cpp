@@ -15,6 +15,7 @@
 #include "TraceEvent.hpp"
 #include "Util.hpp"
 
+#include <algorithm>
 #include <cerrno>
 #include <chrono>
 #include <cstring>
@@ -34,6 +35,9 @@
 #ifdef __FreeBSD__
 #include <sys/ucred.h>
 #endif
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 
 #include <Poco/MemoryStream.h>
 #include <Poco/Net/HTTPRequest.h>
@@ -296,6 +300,11 @@ namespace {
 SocketPoll::SocketPoll(std::string threadName)
     : _name(std::move(threadName)),
       _pollStartIndex(0),
+      _pollBackend(PollBackend::Poll),
+#ifdef HAVE_EPOLL
+      _epollFd(-1),
+      _epollGeneration(0),
+#endif
       _stop(false),
       _threadStarted(0),
       _threadFinished(false),
@@ -331,6 +340,10 @@ SocketPoll::~SocketPoll()
     joinThread();
 
     removeFromWakeupArray();
+
+#ifdef HAVE_EPOLL
+    closeEpoll();
+#endif
 }
 
 void SocketPoll::checkAndReThread()
@@ -349,6 +362,199 @@ void SocketPoll::checkAndReThread()
     // _newSockets are adapted as they are inserted.
 }
 
+void SocketPoll::setPollBackend([[maybe_unused]] PollBackend backend)
+{
+    assert(!_threadStarted && "Poll backend must be set before starting the thread");
+
+#ifdef HAVE_EPOLL
+    _pollBackend = backend;
+#else
+    if (backend != PollBackend::Poll)
+        LOG_WRN("epoll is not supported, SocketPoll [" << _name << "] will use poll");
+#endif
+
+    LOG_DBG("SocketPoll [" << _name << "] using " << nameShort(_pollBackend) << " backend");
+}
+
+#ifdef HAVE_EPOLL
+
+// poll(2) and epoll(7) share the event bits, so we can pass them through unchanged.
+static_assert(POLLIN == EPOLLIN && POLLPRI == EPOLLPRI && POLLOUT == EPOLLOUT &&
+                  POLLERR == EPOLLERR && POLLHUP == EPOLLHUP && POLLRDHUP == EPOLLRDHUP,
+              "poll and epoll event bits must match");
+
+void SocketPoll::updateEpollInterest()
+{
+    if (_epollFd < 0)
+    {
+        _epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+        if (_epollFd < 0)
+        {
+            LOG_SYS("Failed to create epoll instance for SocketPoll [" << _name
+                                                                       << "], falling back to poll");
+            _pollBackend = PollBackend::Poll;
+            return;
+        }
+
+        // The wakeup pipe is always registered and never changes.
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = _wakeup[0];
+        if (::epoll_ctl(_epollFd, EPOLL_CTL_ADD, _wakeup[0], &ev) < 0)
+            LOG_SYS("Failed to register wakeup pipe #" << _wakeup[0] << " with epoll");
+    }
+
+    ++_epollGeneration;
+
+    const std::size_t size = _pollSockets.size();
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        const int fd = _pollFds[i].fd;
+        const int events = _pollFds[i].events;
+        if (fd < 0)
+            continue;
+
+        if (static_cast<std::size_t>(fd) >= _epollEntries.size())
+            _epollEntries.resize(fd + 1, EpollEntry{ nullptr, 0, 0, 0 });
+
+        EpollEntry& entry = _epollEntries[fd];
+
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.fd = fd;
+
+        if (entry._socket != _pollSockets[i].get())
+        {
+            if (entry._socket)
+            {
+                // The fd was reused by a new socket before we noticed the old one is gone.
+                ::epoll_ctl(_epollFd, EPOLL_CTL_DEL, fd, nullptr);
+            }
+            else
+                _epollFds.push_back(fd);
+
+            // The kernel may still have a registration of a closed socket's dup.
+            if (::epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &ev) < 0 &&
+                (errno != EEXIST || ::epoll_ctl(_epollFd, EPOLL_CTL_MOD, fd, &ev) < 0))
+            {
+                LOG_SYS('#' << fd << ": Failed to register with epoll of " << _name);
+            }
+
+            entry._socket = _pollSockets[i].get();
+            entry._events = events;
+        }
+        else if (entry._events != events)
+        {
+            LOGA_TRC(Socket, '#' << fd << ": epoll events change 0x" << std::hex << entry._events
+                                 << " -> 0x" << events << std::dec);
+            // The kernel drops the registration when the fd is closed; re-add if so.
+            if (::epoll_ctl(_epollFd, EPOLL_CTL_MOD, fd, &ev) < 0 &&
+                (errno != ENOENT || ::epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &ev) < 0))
+            {
+                LOG_SYS('#' << fd << ": Failed to modify epoll registration of " << _name);
+            }
+
+            entry._events = events;
+        }
+
+        entry._generation = _epollGeneration;
+        entry._index = i;
+    }
+
+    // Unregister the sockets that are no longer ours.
+    for (std::size_t i = 0; i < _epollFds.size();)
+    {
+        const int fd = _epollFds[i];
+        EpollEntry& entry = _epollEntries[fd];
+        if (entry._generation != _epollGeneration)
+        {
+            // Fails harmlessly if the fd was closed, which unregisters implicitly.
+            ::epoll_ctl(_epollFd, EPOLL_CTL_DEL, fd, nullptr);
+            entry._socket = nullptr;
+            _epollFds[i] = _epollFds.back();
+            _epollFds.pop_back();
+        }
+        else
+            ++i;
+    }
+}
+
+int SocketPoll::epollWait(int64_t timeoutMaxMicroS)
+{
+    const std::size_t size = _pollSockets.size();
+    const int timeoutMaxMs = std::max<int64_t>((timeoutMaxMicroS + 999) / 1000, 0);
+    LOGA_TRC(Socket, "epoll_wait start, timeoutMs: " << timeoutMaxMs << " size " << size);
+
+    _epollEvents.resize(size + 1);
+
+    int rc;
+    do
+    {
+        rc = ::epoll_wait(_epollFd, _epollEvents.data(), static_cast<int>(_epollEvents.size()),
+                          timeoutMaxMs);
+    } while (rc < 0 && errno == EINTR);
+
+    for (int i = 0; i < rc; ++i)
+    {
+        const int fd = _epollEvents[i].data.fd;
+        const int revents = _epollEvents[i].events;
+        if (fd == _wakeup[0])
+        {
+            _pollFds[size].revents = revents;
+            continue;
+        }
+
+        if (static_cast<std::size_t>(fd) < _epollEntries.size())
+        {
+            const EpollEntry& entry = _epollEntries[fd];
+            if (entry._socket && entry._generation == _epollGeneration && entry._index < size &&
+                _pollFds[entry._index].fd == fd)
+            {
+                _pollFds[entry._index].revents = revents;
+                continue;
+            }
+        }
+
+        LOG_DBG('#' << fd << ": Ignoring epoll events 0x" << std::hex << revents << std::dec
+                    << " of unknown fd in " << _name);
+    }
+
+    return rc;
+}
+
+void SocketPoll::forgetEpollEntry(int fd)
+{
+    if (fd < 0 || static_cast<std::size_t>(fd) >= _epollEntries.size() ||
+        !_epollEntries[fd]._socket)
+        return;
+
+    // Fails harmlessly if the fd was closed, which unregisters implicitly.
+    if (_epollFd >= 0)
+        ::epoll_ctl(_epollFd, EPOLL_CTL_DEL, fd, nullptr);
+
+    _epollEntries[fd]._socket = nullptr;
+    const auto it = std::find(_epollFds.begin(), _epollFds.end(), fd);
+    if (it != _epollFds.end())
+    {
+        *it = _epollFds.back();
+        _epollFds.pop_back();
+    }
+}
+
+void SocketPoll::closeEpoll()
+{
+    if (_epollFd >= 0)
+    {
+        ::close(_epollFd);
+        _epollFd = -1;
+    }
+
+    _epollEntries.clear();
+    _epollFds.clear();
+}
+
+#endif // HAVE_EPOLL
+
 void SocketPoll::removeFromWakeupArray()
 {
     {
@@ -494,32 +700,44 @@ int SocketPoll::poll(int64_t timeoutMaxMicroS)
     setupPollFds(now, timeoutMaxMicroS);
     const size_t size = _pollSockets.size();
 
+#ifdef HAVE_EPOLL
+    if (_pollBackend == PollBackend::Epoll)
+        updateEpollInterest();
+#endif
+
     // disable watchdog - it's good to sleep
     disableWatchdog();
 
     int rc;
-    do
+#ifdef HAVE_EPOLL
+    if (_pollBackend == PollBackend::Epoll)
+        rc = epollWait(timeoutMaxMicroS);
+    else
+#endif
     {
+        do
+        {
 #if !MOBILEAPP
 #  if HAVE_PPOLL
-        LOGA_TRC(Socket, "ppoll start, timeoutMicroS: " << timeoutMaxMicroS << " size " << size);
-        timeoutMaxMicroS = std::max(timeoutMaxMicroS, (int64_t)0);
-        struct timespec timeout;
-        timeout.tv_sec = timeoutMaxMicroS / (1000 * 1000);
-        timeout.tv_nsec = (timeoutMaxMicroS % (1000 * 1000)) * 1000;
-        rc = ::ppoll(&_pollFds[0], size + 1, &timeout, nullptr);
+            LOGA_TRC(Socket, "ppoll start, timeoutMicroS: " << timeoutMaxMicroS << " size " << size);
+            timeoutMaxMicroS = std::max(timeoutMaxMicroS, (int64_t)0);
+            struct timespec timeout;
+            timeout.tv_sec = timeoutMaxMicroS / (1000 * 1000);
+            timeout.tv_nsec = (timeoutMaxMicroS % (1000 * 1000)) * 1000;
+            rc = ::ppoll(&_pollFds[0], size + 1, &timeout, nullptr);
 #  else
-        int timeoutMaxMs = (timeoutMaxMicroS + 999) / 1000;
-        LOG_TRC("Legacy Poll start, timeoutMs: " << timeoutMaxMs);
-        rc = ::poll(&_pollFds[0], size + 1, std::max(timeoutMaxMs,0));
+            int timeoutMaxMs = (timeoutMaxMicroS + 999) / 1000;
+            LOG_TRC("Legacy Poll start, timeoutMs: " << timeoutMaxMs);
+            rc = ::poll(&_pollFds[0], size + 1, std::max(timeoutMaxMs,0));
 #  endif
 #else
-        LOG_TRC("SocketPoll Poll");
-        int timeoutMaxMs = (timeoutMaxMicroS + 999) / 1000;
-        rc = fakeSocketPoll(&_pollFds[0], size + 1, std::max(timeoutMaxMs,0));
+            LOG_TRC("SocketPoll Poll");
+            int timeoutMaxMs = (timeoutMaxMicroS + 999) / 1000;
+            rc = fakeSocketPoll(&_pollFds[0], size + 1, std::max(timeoutMaxMs,0));
 #endif
+        }
+        while (rc < 0 && errno == EINTR);
     }
-    while (rc < 0 && errno == EINTR);
     LOGA_TRC(Socket, "Poll completed with " << rc << " live polls max (" <<
              timeoutMaxMicroS << "us)" << ((rc==0) ? "(timedout)" : ""));
 
@@ -624,6 +842,9 @@ int SocketPoll::poll(int64_t timeoutMaxMicroS)
             {
                 // removed in a callback
                 ++itemsErased;
+#ifdef HAVE_EPOLL
+                forgetEpollEntry(_pollFds[i].fd);
+#endif
             }
             else if (_pollFds[i].fd == _pollSockets[i]->getFD())
             {
@@ -650,6 +871,9 @@ int SocketPoll::poll(int64_t timeoutMaxMicroS)
                     LOGA_TRC(Socket, '#' << _pollFds[i].fd << ": Removing socket (at " << i
                              << " of " << _pollSockets.size() << ") from " << _name);
                     _pollSockets[i] = nullptr;
+#ifdef HAVE_EPOLL
+                    forgetEpollEntry(_pollFds[i].fd);
+#endif
                 }
 
                 disposition.execute();
@@ -700,6 +924,12 @@ void SocketPoll::closeAllSockets()
     checkAndReThread();
 
     removeFromWakeupArray();
+
+#ifdef HAVE_EPOLL
+    // The epoll instance is shared with the parent, never touch its registrations.
+    closeEpoll();
+#endif
+
     for (std::shared_ptr<Socket> &it : _pollSockets)
     {
         // first close the underlying socket
@@ -737,6 +967,9 @@ void SocketPoll::takeSocket(const std::shared_ptr<SocketPoll> &fromPoll,
             // Erasing messes up the tracking of poll results in 'poll'
             // leave to be added to toErase and cleaned later.
             *it = nullptr;
+#ifdef HAVE_EPOLL
+            fromPoll->forgetEpollEntry(socket->getFD());
+#endif
         }
         else
             LOG_WRN("Trying to move socket out of the wrong poll");
@@ -798,6 +1031,9 @@ void SocketPoll::removeSockets()
         LOG_DBG("Removing socket #" << socket->getFD() << " from " << _name);
         ASSERT_CORRECT_SOCKET_THREAD(socket);
         socket->resetThreadOwner();
+#ifdef HAVE_EPOLL
+        forgetEpollEntry(socket->getFD());
+#endif
 
         _pollSockets.pop_back();
     }
@@ -908,7 +1144,7 @@ bool SocketPoll::insertNewUnixSocket(
     {
         Buffer buf;
         req.writeData(buf, INT_MAX); // Write the whole request.
-        socket->sendFDs(buf.getBlock(), buf.getBlockSize(), *shareFDs);
+        socket->sendFDs(buf.data(), buf.size(), *shareFDs);
     }
 
     std::static_pointer_cast<ProtocolHandlerInterface>(websocketHandler)->onConnect(socket);
@@ -995,6 +1231,8 @@ void WebSocketHandler::dumpState(std::ostream& os, const std::string& indent) co
     os << (_shuttingDown ? "shutd " : "alive ");
 #if !MOBILEAPP
     os << std::setw(5) << _pingTimeUs/1000. << "ms ";
+    if (_deflate)
+        os << "deflate ";
 #endif
     if (_wsPayload.size() > 0)
         Util::dumpHex(os, _wsPayload, "\t\tws queued payload:\n", "\t\t");
@@ -1061,6 +1299,135 @@ bool StreamSocket::sendAndShutdown(http::Response& response)
     return false;
 }
 
+void StreamSocket::sendFile(int fd, off_t offset, std::size_t length)
+{
+    ASSERT_CORRECT_SOCKET_THREAD(this);
+    assert(!isSendingFile() && "Already sending a file");
+
+    if (length == 0)
+    {
+        ::close(fd);
+        return;
+    }
+
+    LOG_TRC("Sending " << length << " bytes of file #" << fd << " from offset " << offset);
+    _sendFileFd = fd;
+    _sendFileOffset = offset;
+    _sendFileRemaining = length;
+
+    // Start right away, as send() does, the poll does the rest.
+    if (_outBuffer.empty())
+        writeFileData();
+}
+
+int StreamSocket::writeFileData()
+{
+    ASSERT_CORRECT_SOCKET_THREAD(this);
+    assert(isSendingFile() && _outBuffer.empty());
+
+#if defined(__linux__) && !MOBILEAPP
+    if (!_sendFileBuffered)
+    {
+        // Writing much more than we can absorb in the kernel keeps others waiting.
+        const std::size_t size =
+            std::min<std::size_t>(_sendFileRemaining, std::max(getSendBufferSize(), 1));
+        ssize_t len;
+        while ((len = ::sendfile(getFD(), _sendFileFd, &_sendFileOffset, size)) < 0 &&
+               errno == EINTR)
+        {
+        }
+
+        if (len < 0 && (errno == EINVAL || errno == ENOSYS))
+        {
+            // Not supported for this file or socket.
+            LOG_DBG("Cannot sendfile #" << _sendFileFd << " (" << Util::symbolicErrno(errno)
+                                        << "), will buffer it instead");
+            _sendFileBuffered = true;
+            return bufferFileData();
+        }
+
+        if (len > 0)
+        {
+            notifyBytesSent(len);
+            _sendFileRemaining -= len;
+            LOGA_TRC(Socket, "Sent " << len << " bytes of file, " << _sendFileRemaining
+                                     << " remaining");
+            if (_sendFileRemaining == 0)
+                closeSendFile();
+        }
+        else if (len == 0)
+        {
+            // Truncated: we can't send the Content-Length we promised.
+            LOG_ERR("File #" << _sendFileFd << " ended with " << _sendFileRemaining
+                             << " bytes left to send, closing");
+            closeSendFile();
+            shutdown();
+        }
+        else if (errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            const int last_errno = errno;
+            LOG_SYS("Failed to sendfile");
+            if (last_errno != EPIPE && last_errno != ECONNRESET)
+            {
+                // Not retryable, and not a disconnection the poll would close on.
+                closeSendFile();
+                shutdown();
+            }
+
+            errno = last_errno;
+        }
+
+        return len;
+    }
+#endif
+
+    return bufferFileData();
+}
+
+int StreamSocket::bufferFileData()
+{
+    assert(isSendingFile() && _outBuffer.empty());
+
+    // Only as much as the socket can absorb, to keep our memory flat.
+    char buffer[64 * 1024];
+    const std::size_t size = std::min({ sizeof(buffer), _sendFileRemaining,
+                                        static_cast<std::size_t>(std::max(getSendBufferSize(), 1)) });
+    ssize_t len;
+    while ((len = ::pread(_sendFileFd, buffer, size, _sendFileOffset)) < 0 && errno == EINTR)
+    {
+    }
+
+    if (len <= 0)
+    {
+        if (len < 0)
+            LOG_SYS("Failed to read file #" << _sendFileFd << " to send");
+        else
+            LOG_ERR("File #" << _sendFileFd << " ended with " << _sendFileRemaining
+                             << " bytes left to send, closing");
+        closeSendFile();
+        shutdown();
+        return 0;
+    }
+
+    _sendFileOffset += len;
+    _sendFileRemaining -= len;
+    if (_sendFileRemaining == 0)
+        closeSendFile();
+
+    _outBuffer.append(buffer, len);
+    return writeOutgoingData();
+}
+
+void StreamSocket::closeSendFile()
+{
+    if (_sendFileFd >= 0)
+    {
+        ::close(_sendFileFd);
+        _sendFileFd = -1;
+        _sendFileRemaining = 0;
+    }
+}
+
 void SocketPoll::dumpState(std::ostream& os) const
 {
     THREAD_UNSAFE_DUMP_BEGIN
@@ -1069,7 +1436,7 @@ void SocketPoll::dumpState(std::ostream& os) const
 
     os << "\n  SocketPoll [" << name() << "] with " << pollSockets.size() << " socket"
        << (pollSockets.size() == 1 ? "" : "s") << " - wakeup rfd: " << _wakeup[0]
-       << " wfd: " << _wakeup[1] << '\n';
+       << " wfd: " << _wakeup[1] << " backend: " << nameShort(_pollBackend) << '\n';
     const auto callbacks = _newCallbacks.size();
     if (callbacks > 0)
         os << "\tcallbacks: " << callbacks << '\n';
@@ -15,6 +15,7 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 
@@ -30,6 +31,7 @@
 #include <memory>
 #include <mutex>
 #include <thread>
+#include <vector>
 
 #include <common/StateEnum.hpp>
 #include "Log.hpp"
@@ -44,6 +46,11 @@
 #define HAVE_ABSTRACT_UNIX_SOCKETS
 #endif
 
+#if defined(__linux__) && !MOBILEAPP
+#define HAVE_EPOLL
+#include <sys/epoll.h>
+#endif
+
 // Enable to dump socket traffic as hex in logs.
 // #define LOG_SOCKET_DATA ENABLE_DEBUG
 
@@ -567,6 +574,10 @@ public:
     /// Called when the SSL Handshake fails.
     virtual void onHandshakeFail() {}
 
+    /// Called when the SSL Handshake succeeds, @resumed when it
+    /// resumed an earlier session rather than making a new one.
+    virtual void onHandshakeDone(bool /* resumed */) {}
+
     /// Called when the socket is disconnected and will be destroyed.
     /// Will be called exactly once.
     virtual void onDisconnect() {}
@@ -599,6 +610,18 @@ public:
     /// 0 for closed/invalid socket, and -1 for other errors.
     virtual int sendBinaryMessage(const char *data, const size_t len, bool flush = false) const = 0;
 
+    /// Sends a binary message of data followed by blobs, which are shared
+    /// rather than copied where the protocol allows: they must not be modified.
+    /// Returns as sendBinaryMessage().
+    virtual int sendSharedBinaryMessage(const char* data, const size_t len,
+                                        const std::vector<Blob>& blobs, bool flush = false) const
+    {
+        std::vector<char> message(data, data + len);
+        for (const Blob& blob : blobs)
+            message.insert(message.end(), blob->begin(), blob->end());
+        return sendBinaryMessage(message.data(), message.size(), flush);
+    }
+
     /// Shutdown the socket and specify if the endpoint is going away or not (useful for WS).
     /// Optionally provide a message sent in the close frame (useful for WS).
     virtual void shutdown(bool goingAway = false,
@@ -716,9 +739,14 @@ private:
 /// hundred users on same document to suffer poll(2)'s
 /// scalability limit. Meanwhile, epoll(2)'s high
 /// overhead to adding/removing sockets is not helpful.
+/// Polls that are WSD-wide, and so can hold thousands of
+/// sockets, can opt into epoll(7) via setPollBackend().
 class SocketPoll
 {
 public:
+    /// The kernel interface used to wait for socket events.
+    STATE_ENUM(PollBackend, Poll, Epoll);
+
     /// Create a socket poll, called rather infrequently.
     explicit SocketPoll(std::string threadName);
     virtual ~SocketPoll();
@@ -923,6 +951,15 @@ public:
     void disableWatchdog();
     void enableWatchdog();
 
+    /// Selects the kernel interface used to wait for events.
+    /// Must be called before polling starts, i.e. before startThread().
+    /// Epoll keeps the registrations in the kernel between iterations
+    /// and only updates them when a socket's poll events change.
+    /// Falls back to poll(2) where epoll isn't available.
+    void setPollBackend(PollBackend backend);
+
+    PollBackend getPollBackend() const { return _pollBackend; }
+
 protected:
     bool isStop() const
     {
@@ -987,6 +1024,23 @@ private:
         _pollFds[size].revents = 0;
     }
 
+#ifdef HAVE_EPOLL
+    /// Sync the kernel epoll interest with the freshly setup _pollFds.
+    /// Only sockets that are new, or whose events changed, cost a syscall.
+    void updateEpollInterest();
+
+    /// Wait on the epoll instance and scatter the results into _pollFds.
+    /// Returns the number of ready sockets, like poll(2).
+    int epollWait(int64_t timeoutMaxMicroS);
+
+    /// Unregister @fd, of a socket that is no longer ours, so that
+    /// a new socket reusing the fd, even at the same address, is added.
+    void forgetEpollEntry(int fd);
+
+    /// Drop the epoll instance (and so all registrations).
+    void closeEpoll();
+#endif
+
     std::string logInfo() const {
         std::ostringstream os;
         os << "SocketPoll[this " << std::hex << this << std::dec
@@ -1018,6 +1072,29 @@ private:
     /// The fds to poll.
     std::vector<pollfd> _pollFds;
 
+    PollBackend _pollBackend;
+#ifdef HAVE_EPOLL
+    /// An fd's registration in our epoll instance.
+    struct EpollEntry
+    {
+        const Socket* _socket; ///< The registered socket, nullptr if not registered.
+        uint64_t _generation; ///< The last setup that saw the socket.
+        std::size_t _index; ///< The socket's index in _pollFds at the last setup.
+        int _events; ///< The currently registered events.
+    };
+
+    /// The epoll instance, created lazily, -1 when not in use.
+    int _epollFd;
+    /// Incremented on every setup, to find the sockets that went away.
+    uint64_t _epollGeneration;
+    /// The registrations, indexed by fd.
+    std::vector<EpollEntry> _epollEntries;
+    /// The fds currently registered, excluding the wakeup pipe.
+    std::vector<int> _epollFds;
+    /// The results of epoll_wait.
+    std::vector<epoll_event> _epollEvents;
+#endif
+
     /// Flag the thread to stop.
     std::atomic<bool> _stop;
     /// The polling thread.
@@ -1056,6 +1133,9 @@ class StreamSocket : public Socket,
 public:
     STATE_ENUM(ReadType, NormalRead, UseRecvmsgExpectFD);
 
+    /// The most blocks of the output buffer we gather in one write.
+    static constexpr int MaxIOVecs = 64;
+
     /// Create a StreamSocket from native FD.
     StreamSocket(std::string host, const int fd, Type type, bool isClient,
                  HostType hostType, ReadType readType = ReadType::NormalRead,
@@ -1068,7 +1148,11 @@ public:
         _sentHTTPContinue(false),
         _shutdownSignalled(false),
         _readType(readType),
-        _inputProcessingEnabled(true)
+        _inputProcessingEnabled(true),
+        _sendFileFd(-1),
+        _sendFileOffset(0),
+        _sendFileRemaining(0),
+        _sendFileBuffered(Util::isMobileApp())
     {
         LOG_TRC("StreamSocket ctor");
         if (isExternalCountedConnection())
@@ -1093,6 +1177,8 @@ public:
             _shutdownSignalled = true;
             StreamSocket::closeConnection();
         }
+
+        closeSendFile();
         if (isExternalCountedConnection())
             --ExternalConnectionCount;
     }
@@ -1135,14 +1221,14 @@ public:
         // cf. SslSocket::getPollEvents
         ASSERT_CORRECT_SOCKET_THREAD(this);
         int events = _socketHandler->getPollEvents(now, timeoutMaxMicroS);
-        if (!_outBuffer.empty() || _shutdownSignalled)
+        if (!_outBuffer.empty() || isSendingFile() || _shutdownSignalled)
             events |= POLLOUT;
         return events;
     }
 
     bool hasBuffered() const override
     {
-        return !_outBuffer.empty() || !_inBuffer.empty();
+        return !_outBuffer.empty() || !_inBuffer.empty() || isSendingFile();
     }
 
     /// Create a pair of connected stream sockets
@@ -1168,6 +1254,16 @@ public:
         send(str.data(), str.size(), doFlush);
     }
 
+    /// Send @length bytes of the file @fd, from @offset, after what is
+    /// already buffered, taking ownership of @fd.
+    /// It is streamed as the socket drains, a socket buffer at a time, with
+    /// sendfile(2) when possible. Input isn't processed meanwhile, so any
+    /// later response can't overtake it.
+    void sendFile(int fd, off_t offset, std::size_t length);
+
+    /// True while a file given to sendFile() is being sent.
+    bool isSendingFile() const { return _sendFileFd >= 0; }
+
     /// Send an http::Request and flush.
     /// Does not add any fields to the header.
     /// Will shutdown the socket upon error and return false.
@@ -1256,17 +1352,20 @@ public:
         if constexpr (!Util::isMobileApp())
         {
             // SSL decodes blocks of 16Kb, so for efficiency we use the same.
-            char buf[16 * 1024];
+            constexpr ssize_t ReadSize = 16 * 1024;
             int last_errno = 0;
             do
             {
+                // Read directly into the free space of the buffer.
+                char* buf = _inBuffer.prepareAppend(ReadSize);
+
                 // Drain the read buffer.
                 // Note: we read as much as possible as
                 // we are typically capped by hardware buffer
                 // size anyway, and better to drain it fast.
                 do
                 {
-                    len = readData(buf, sizeof(buf));
+                    len = readData(buf, ReadSize);
                     if (len < 0)
                         last_errno = errno; // Save only on error.
 
@@ -1306,13 +1405,16 @@ public:
 
                 if (len > 0)
                 {
-                    LOG_ASSERT_MSG(len <= ssize_t(sizeof(buf)),
-                                   "Read more data than the buffer size");
+                    LOG_ASSERT_MSG(len <= ReadSize, "Read more data than the buffer size");
                     notifyBytesRcvd(len);
-                    _inBuffer.append(&buf[0], len);
+                    _inBuffer.commitAppend(len);
                 }
                 // else poll will handle errors.
-            } while (len == static_cast<ssize_t>(sizeof(buf)));
+            } while (len == ReadSize);
+
+            // Recycle the space we didn't read into.
+            if (_inBuffer.empty())
+                _inBuffer.clear();
 
             // Restore errno from the read call.
             errno = last_errno;
@@ -1519,33 +1621,45 @@ public:
         }
 
         // If we have data, allow the app to consume.
-        size_t oldSize = 0;
-        while (!_inBuffer.empty() && oldSize != _inBuffer.size() && processInputEnabled())
+        // Returns false when the socket was moved or transferred.
+        const auto processInput = [this, &disposition]()
         {
-            oldSize = _inBuffer.size();
-
-            try
+            size_t oldSize = 0;
+            while (!_inBuffer.empty() && oldSize != _inBuffer.size() && processInputEnabled() &&
+                   !isSendingFile())
             {
-                // Keep the current handler alive, while the incoming message is handled.
-                std::shared_ptr<ProtocolHandlerInterface> socketHandler(_socketHandler);
+                oldSize = _inBuffer.size();
 
-                _socketHandler->handleIncomingMessage(disposition);
-            }
-            catch (const std::exception& exception)
-            {
-                LOG_ERR("Error during handleIncomingMessage: " << exception.what());
-                disposition.setClosed();
-            }
-            catch (...)
-            {
-                LOG_ERR("Error during handleIncomingMessage.");
-                disposition.setClosed();
+                try
+                {
+                    // Keep the current handler alive, while the incoming message is handled.
+                    std::shared_ptr<ProtocolHandlerInterface> socketHandler(_socketHandler);
+
+                    _socketHandler->handleIncomingMessage(disposition);
+                }
+                catch (const std::exception& exception)
+                {
+                    LOG_ERR("Error during handleIncomingMessage: " << exception.what());
+                    disposition.setClosed();
+                }
+                catch (...)
+                {
+                    LOG_ERR("Error during handleIncomingMessage.");
+                    disposition.setClosed();
+                }
+
+                if (disposition.isMove() || disposition.isTransfer())
+                    return false;
             }
 
-            if (disposition.isMove() || disposition.isTransfer())
-                return;
-        }
+            return true;
+        };
+
+        if (!processInput())
+            return;
 
+        const bool wasSendingFile = isSendingFile();
+        size_t oldSize = 0;
         do
         {
             // If we have space for writing and that was requested
@@ -1558,7 +1672,7 @@ public:
             }
 
             // perform the shutdown if we have sent everything.
-            if (_shutdownSignalled && _outBuffer.empty())
+            if (_shutdownSignalled && _outBuffer.empty() && !isSendingFile())
             {
                 LOG_TRC("Shutdown Signaled. Close Connection.");
                 closeConnection();
@@ -1568,10 +1682,11 @@ public:
 
             oldSize = _outBuffer.size();
 
-            // Write if we can and have data to write.
-            if ((events & POLLOUT) && !_outBuffer.empty())
+            // Write if we can and have data to write, then the file being sent.
+            // The latter leaves the buffer empty: one socket buffer per poll.
+            if ((events & POLLOUT) && (!_outBuffer.empty() || isSendingFile()))
             {
-                if (writeOutgoingData() < 0)
+                if ((!_outBuffer.empty() ? writeOutgoingData() : writeFileData()) < 0)
                 {
                     const int last_errno = errno;
                     if (last_errno == EPIPE || last_errno == ECONNRESET)
@@ -1586,6 +1701,10 @@ public:
             }
         } while (oldSize != _outBuffer.size());
 
+        // The input held back while the file was sent may not see another POLLIN.
+        if (wasSendingFile && !isSendingFile() && !closed && !processInput())
+            return;
+
         if (closed)
         {
             LOG_TRC("Closed. Firing onDisconnect.");
@@ -1614,7 +1733,15 @@ public:
                 if (size == 0)
                     break;
 
-                len = writeData(_outBuffer.getBlock(), size);
+                if (_outBuffer.hasShared() && size < getSendBufferSize())
+                {
+                    // Gather the blocks, rather than a write for each.
+                    struct iovec iov[MaxIOVecs];
+                    const int count = _outBuffer.getIOVec(iov, MaxIOVecs, getSendBufferSize());
+                    len = writeDataV(iov, count);
+                }
+                else
+                    len = writeData(_outBuffer.getBlock(), size);
                 if (len < 0)
                     last_errno = errno; // Save only on error.
 
@@ -1628,7 +1755,8 @@ public:
                 else // Success.
                     LOGA_TRC(Socket, "Wrote " << len << " bytes of " << _outBuffer.size() << " buffered data"
 #ifdef LOG_SOCKET_DATA
-                            << (len ? Util::dumpHex(std::string(_outBuffer.getBlock(), len), ":\n")
+                            << (len ? Util::dumpHex(std::string(_outBuffer.getBlock(),
+                                                                std::min<std::size_t>(len, _outBuffer.getBlockSize())), ":\n")
                                     : std::string())
 #endif
                     );
@@ -1655,6 +1783,10 @@ public:
         return len;
     }
 
+    /// Writes the next part of the file being sent, once the buffer is empty.
+    /// Returns the last return from the write, like writeOutgoingData().
+    virtual int writeFileData();
+
     /// Does it look like we have some TLS / SSL where we don't expect it ?
     bool sniffSSL() const;
 
@@ -1669,6 +1801,12 @@ protected:
             _socketHandler->onHandshakeFail();
     }
 
+    void handshakeDone(bool resumed)
+    {
+        if (_socketHandler)
+            _socketHandler->onHandshakeDone(resumed);
+    }
+
     /// Reads data with file descriptors as control data if received.
     /// Can be used only with Unix sockets.
     int readFDs(char* buf, int len, std::vector<int>& fds)
@@ -1752,6 +1890,31 @@ protected:
 #endif
     }
 
+    /// Override to handle writing scattered data to socket differently.
+    virtual int writeDataV(const struct iovec* iov, const int iovcnt)
+    {
+        ASSERT_CORRECT_SOCKET_THREAD(this);
+        assert(iovcnt > 0);
+#if !MOBILEAPP
+#if ENABLE_DEBUG
+        if (simulateSocketError(false))
+            return -1;
+#endif
+        return ::writev(getFD(), iov, iovcnt);
+#else
+        // Each write is a message: never split one.
+        (void)iovcnt;
+        return writeData(static_cast<const char*>(iov[0].iov_base), iov[0].iov_len);
+#endif
+    }
+
+    /// Reads the next part of the file being sent into the buffer, no more
+    /// than a socket buffer, and writes it: for when it can't be sent directly.
+    int bufferFileData();
+
+    /// Closes the file given to sendFile(), when sent or abandoned.
+    void closeSendFile();
+
     void setShutdownSignalled()
     {
         _shutdownSignalled = true;
@@ -1796,6 +1959,15 @@ private:
     ReadType _readType;
     std::atomic_bool _inputProcessingEnabled;
 
+    /// The file being sent by sendFile(), or -1.
+    int _sendFileFd;
+    /// The position of the next byte of the file to send.
+    off_t _sendFileOffset;
+    /// The bytes of the file left to send.
+    std::size_t _sendFileRemaining;
+    /// Read the file into the buffer, as sendfile(2) can't be used.
+    bool _sendFileBuffered;
+
     bool isExternalCountedConnection() const { return !_isClient && isIPType(); }
     static std::atomic<size_t> ExternalConnectionCount; // accepted external TCP IPv4/IPv6 socket count
 };
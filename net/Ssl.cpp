@@ -220,6 +220,9 @@ SslContext::SslContext(const std::string& certFilePath, const std::string& keyFi
 
 SslContext::~SslContext()
 {
+    for (const auto& pair : _sessions)
+        SSL_SESSION_free(pair.second);
+
     SSL_CTX_free(_ctx);
     EVP_cleanup();
     ERR_free_strings();
@@ -229,6 +232,49 @@ SslContext::~SslContext()
     CONF_modules_free();
 }
 
+void SslContext::enableSessionResumption()
+{
+    // We keep the sessions ourselves, as OpenSSL's client cache isn't looked up.
+    SSL_CTX_set_app_data(_ctx, this);
+    SSL_CTX_set_session_cache_mode(_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(_ctx, &SslContext::newSessionCallback);
+}
+
+void SslContext::resumeSession(SSL* ssl, const std::string& key)
+{
+    // The same host can serve different sites on different ports.
+    SSL_set_app_data(ssl, const_cast<std::string*>(&key));
+
+    std::lock_guard<std::mutex> lock(_sessionsMutex);
+    const auto it = _sessions.find(key);
+    if (it != _sessions.end() && SSL_set_session(ssl, it->second) == 1)
+        LOG_TRC("Resuming the TLS session of [" << key << ']');
+}
+
+int SslContext::newSessionCallback(SSL* ssl, SSL_SESSION* session)
+{
+    const auto key = static_cast<const std::string*>(SSL_get_app_data(ssl));
+    auto context = static_cast<SslContext*>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+    if (!key || !context)
+        return 0; // Not ours to keep.
+
+    // There is one per storage or proxy host, but don't grow without bounds.
+    constexpr std::size_t MaxSessions = 1024;
+
+    std::lock_guard<std::mutex> lock(context->_sessionsMutex);
+    SSL_SESSION*& entry = context->_sessions[*key];
+    if (entry)
+        SSL_SESSION_free(entry);
+    else if (context->_sessions.size() > MaxSessions)
+    {
+        context->_sessions.erase(*key);
+        return 0;
+    }
+
+    entry = session;
+    return 1; // We own the reference now.
+}
+
 unsigned long SslContext::id()
 {
 #ifdef __linux__
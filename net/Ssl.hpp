@@ -15,7 +15,9 @@
 
 #include <cassert>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 
 #include <openssl/ssl.h>
 #include <openssl/rand.h>
@@ -49,7 +51,19 @@ public:
 
     ssl::CertificateVerification verification() const { return _verification; }
 
+    /// Remember the sessions of the servers we connect to, by host and port, so
+    /// that the next connection to them can resume one with an abbreviated handshake.
+    void enableSessionResumption();
+
+    /// Offer the last session of the server @key, its host and port, if any,
+    /// to resume with @ssl, and keep the new one under @key, which must
+    /// outlive @ssl.
+    void resumeSession(SSL* ssl, const std::string& key);
+
 private:
+    /// Called by OpenSSL with a new session, which we take ownership of.
+    static int newSessionCallback(SSL* ssl, SSL_SESSION* session);
+
     void initDH();
     void initECDH();
     void shutdown();
@@ -66,6 +80,10 @@ private:
 private:
     SSL_CTX* _ctx;
     const ssl::CertificateVerification _verification;
+
+    /// The last session of each host and port, for resumption.
+    std::unordered_map<std::string, SSL_SESSION*> _sessions;
+    std::mutex _sessionsMutex;
 };
 
 namespace ssl
@@ -107,6 +125,15 @@ public:
                "Cannot initialize the client context more than once");
         ClientInstance = std::make_unique<SslContext>(certFilePath, keyFilePath, caFilePath,
                                                       cipherList, verification);
+        ClientInstance->enableSessionResumption();
+    }
+
+    /// Offer the last session of the server @key, its host and port, if any,
+    /// to resume with the client @ssl.
+    static void resumeClientSession(SSL* ssl, const std::string& key)
+    {
+        assert(isClientContextInitialized() && "Client SslContext is not initialized");
+        ClientInstance->resumeSession(ssl, key);
     }
 
     static ssl::CertificateVerification getClientVerification()
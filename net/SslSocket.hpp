@@ -35,8 +35,10 @@ class SslStreamSocket final : public StreamSocket
 public:
     SslStreamSocket(const std::string& host, const int fd, Type type, bool isClient,
                     HostType hostType, ReadType readType = ReadType::NormalRead,
-                    std::chrono::steady_clock::time_point creationTime = std::chrono::steady_clock::now())
+                    std::chrono::steady_clock::time_point creationTime = std::chrono::steady_clock::now(),
+                    const std::string& port = std::string())
         : StreamSocket(host, fd, type, isClient, hostType, readType, creationTime)
+        , _sessionKey(port.empty() ? std::string() : host + ':' + port)
         , _bio(nullptr)
         , _ssl(nullptr)
         , _sslWantsTo(SslWantsTo::Neither)
@@ -67,6 +69,9 @@ public:
                 LOG_WRN("Failed to set hostname for Server Name Indication [" << hostname() << ']');
             else
                 LOG_TRC("Set [" << hostname() << "] as TLS hostname.");
+
+            if (isClient && !_sessionKey.empty())
+                ssl::Manager::resumeClientSession(_ssl, _sessionKey);
         }
 
         SSL_set_bio(_ssl, _bio, _bio);
@@ -86,6 +91,19 @@ public:
         }
     }
 
+    /// Creates a client socket, connecting to @port of @host, which resumes
+    /// the last TLS session with that server, if any.
+    static std::shared_ptr<SslStreamSocket>
+    createClient(const std::string& host, const std::string& port, int fd, Type type,
+                 HostType hostType, std::shared_ptr<ProtocolHandlerInterface> handler)
+    {
+        auto socket = std::make_shared<SslStreamSocket>(host, fd, type, true, hostType,
+                                                        ReadType::NormalRead,
+                                                        std::chrono::steady_clock::now(), port);
+        socket->setHandler(std::move(handler));
+        return socket;
+    }
+
     long getSslVerifyResult() override
     {
         return SSL_get_verify_result(_ssl);
@@ -174,6 +192,13 @@ public:
         return StreamSocket::writeOutgoingData();
     }
 
+    /// The data is encrypted in user space, so sendfile(2) can't be used.
+    int writeFileData() override
+    {
+        ASSERT_CORRECT_SOCKET_THREAD(this);
+        return bufferFileData();
+    }
+
     virtual int readData(char* buf, int len) override
     {
         ASSERT_CORRECT_SOCKET_THREAD(this);
@@ -202,6 +227,27 @@ public:
         return handleSslState(SSL_write(_ssl, buf, len), "write");
     }
 
+    /// TLS has no scatter-gather: the data is copied when encrypted anyway,
+    /// so coalesce the blocks into a record rather than sending tiny ones.
+    int writeDataV(const struct iovec* iov, const int iovcnt) override
+    {
+        ASSERT_CORRECT_SOCKET_THREAD(this);
+
+        char record[16384];
+        if (iovcnt == 1 || iov[0].iov_len >= sizeof(record))
+            return writeData(static_cast<const char*>(iov[0].iov_base), iov[0].iov_len);
+
+        std::size_t len = 0;
+        for (int i = 0; i < iovcnt && len < sizeof(record); ++i)
+        {
+            const std::size_t size = std::min(iov[i].iov_len, sizeof(record) - len);
+            std::memcpy(record + len, iov[i].iov_base, size);
+            len += size;
+        }
+
+        return writeData(record, len);
+    }
+
     int getPollEvents(std::chrono::steady_clock::time_point now,
                       int64_t & timeoutMaxMicroS) override
     {
@@ -280,6 +326,8 @@ private:
                     closeConnection();
                     return 0; // Connection is closed.
                 }
+
+                handshakeDone(SSL_session_reused(_ssl) == 1);
             }
             else
             {
@@ -531,6 +579,9 @@ private:
     }
 
 private:
+    /// The host and port of the server, to resume its TLS sessions.
+    /// Outlives _ssl, which refers to it.
+    const std::string _sessionKey;
     BIO* _bio;
     SSL* _ssl;
     ssl::CertificateVerification _verification; ///< The certificate verification requirement.
@@ -0,0 +1,296 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <config.h>
+
+#include "WebSocketDeflate.hpp"
+
+#include <common/Log.hpp>
+#include <common/StringVector.hpp>
+#include <common/Util.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <set>
+
+bool WebSocketDeflate::Enabled = false;
+std::size_t WebSocketDeflate::MinSize = 256;
+int WebSocketDeflate::WindowBits = WebSocketDeflate::MaxWindowBits;
+int WebSocketDeflate::Level = Z_BEST_SPEED;
+
+std::atomic<uint64_t> WebSocketDeflate::MessagesCompressed(0);
+std::atomic<uint64_t> WebSocketDeflate::MessagesUncompressed(0);
+std::atomic<uint64_t> WebSocketDeflate::BytesBeforeCompression(0);
+std::atomic<uint64_t> WebSocketDeflate::BytesAfterCompression(0);
+std::atomic<uint64_t> WebSocketDeflate::BytesInflated(0);
+std::array<std::atomic<uint64_t>, WebSocketDeflate::DurationBucketsUs.size() + 1>
+    WebSocketDeflate::DurationCounts{};
+std::atomic<uint64_t> WebSocketDeflate::DurationSumUs(0);
+
+namespace
+{
+/// What a flushed deflate block ends with, which is not sent (RFC 7692 7.2.1).
+constexpr char FlushTrailer[] = { '\x00', '\x00', '\xff', '\xff' };
+
+/// The size of the output we grow the inflated message by.
+constexpr std::size_t InflateChunkSize = 16 * 1024;
+} // namespace
+
+void WebSocketDeflate::initialize(bool enable, std::size_t minSize, int windowBits, int level)
+{
+    Enabled = enable;
+    MinSize = minSize;
+    // Raw deflate can't use a window of 8 bits: zlib makes it 9.
+    WindowBits = std::clamp(windowBits, 9, MaxWindowBits);
+    Level = std::clamp(level, 1, 9);
+
+    LOG_INF("WebSocket permessage-deflate is " << (Enabled ? "enabled" : "disabled")
+                                               << ", for text messages of at least " << MinSize
+                                               << " bytes, window bits: " << WindowBits
+                                               << ", level: " << Level);
+}
+
+std::string WebSocketDeflate::negotiate(const std::string& extensions, Params& params)
+{
+    const StringVector offers = StringVector::tokenize(extensions, ',');
+    for (std::size_t i = 0; i < offers.size(); ++i)
+    {
+        const StringVector tokens = StringVector::tokenize(offers[i], ';');
+        if (tokens.empty() || Util::trimmed(tokens[0]) != "permessage-deflate")
+            continue;
+
+        Params offer;
+        offer._serverMaxWindowBits = WindowBits;
+        std::set<std::string> seen;
+        bool acceptable = true;
+        for (std::size_t j = 1; j < tokens.size() && acceptable; ++j)
+        {
+            const std::string param = Util::trimmed(tokens[j]);
+            const std::size_t equals = param.find('=');
+            const std::string name = Util::trimmed(param.substr(0, equals));
+            std::string value =
+                equals == std::string::npos ? std::string() : Util::trimmed(param.substr(equals + 1));
+            if (value.size() >= 2 && value.front() == '"' && value.back() == '"')
+                value = value.substr(1, value.size() - 2);
+
+            // Each parameter may be given only once.
+            if (!seen.insert(name).second)
+                acceptable = false;
+            else if (name == "server_no_context_takeover" && value.empty())
+                offer._serverNoContextTakeover = true;
+            else if (name == "client_no_context_takeover" && value.empty())
+            {
+                // Only a hint: we inflate with a window either way.
+            }
+            else if (name == "server_max_window_bits")
+            {
+                // We can't compress with a window of 8 bits.
+                const int bits = std::atoi(value.c_str());
+                if (bits < 9 || bits > MaxWindowBits)
+                    acceptable = false;
+                else
+                    offer._serverMaxWindowBits = std::min(bits, WindowBits);
+            }
+            else if (name == "client_max_window_bits")
+            {
+                // We inflate with the largest window, which works with any.
+                const int bits = value.empty() ? MaxWindowBits : std::atoi(value.c_str());
+                if (bits < 8 || bits > MaxWindowBits)
+                    acceptable = false;
+            }
+            else
+                acceptable = false;
+        }
+
+        if (!acceptable)
+        {
+            LOG_DBG("Declining WebSocket extension offer [" << offers[i] << ']');
+            continue;
+        }
+
+        params = offer;
+        std::string response = "permessage-deflate";
+        if (params._serverNoContextTakeover)
+            response += "; server_no_context_takeover";
+        if (params._serverMaxWindowBits < MaxWindowBits)
+            response += "; server_max_window_bits=" + std::to_string(params._serverMaxWindowBits);
+        return response;
+    }
+
+    return std::string();
+}
+
+std::unique_ptr<WebSocketDeflate> WebSocketDeflate::create(const Params& params)
+{
+    std::unique_ptr<WebSocketDeflate> deflate(new WebSocketDeflate(params));
+    if (!deflate->_deflateInitialized || !deflate->_inflateInitialized)
+    {
+        LOG_ERR("Failed to initialize the permessage-deflate streams");
+        return nullptr;
+    }
+
+    return deflate;
+}
+
+WebSocketDeflate::WebSocketDeflate(const Params& params)
+    : _deflateInitialized(false)
+    , _inflateInitialized(false)
+    , _noContextTakeover(params._serverNoContextTakeover)
+{
+    std::memset(&_deflate, 0, sizeof(_deflate));
+    std::memset(&_inflate, 0, sizeof(_inflate));
+
+    // Negative window bits for raw deflate, without zlib header or trailer.
+    _deflateInitialized = deflateInit2(&_deflate, Level, Z_DEFLATED, -params._serverMaxWindowBits,
+                                       8, Z_DEFAULT_STRATEGY) == Z_OK;
+    _inflateInitialized = inflateInit2(&_inflate, -MaxWindowBits) == Z_OK;
+}
+
+WebSocketDeflate::~WebSocketDeflate()
+{
+    if (_deflateInitialized)
+        deflateEnd(&_deflate);
+    if (_inflateInitialized)
+        inflateEnd(&_inflate);
+}
+
+bool WebSocketDeflate::compress(const char* data, std::size_t len, std::vector<char>& out)
+{
+    if (len < MinSize)
+    {
+        ++MessagesUncompressed;
+        return false;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+
+    // Room for the whole message at once, as it rarely grows.
+    out.resize(deflateBound(&_deflate, len) + sizeof(FlushTrailer));
+    _deflate.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    _deflate.avail_in = len;
+    _deflate.next_out = reinterpret_cast<Bytef*>(out.data());
+    _deflate.avail_out = out.size();
+
+    int result;
+    while ((result = deflate(&_deflate, Z_SYNC_FLUSH)) == Z_OK && _deflate.avail_out == 0)
+    {
+        const std::size_t used = out.size();
+        out.resize(used * 2);
+        _deflate.next_out = reinterpret_cast<Bytef*>(out.data() + used);
+        _deflate.avail_out = out.size() - used;
+    }
+
+    out.resize(out.size() - _deflate.avail_out);
+    if (result != Z_OK || _deflate.avail_in != 0 || out.size() < sizeof(FlushTrailer) ||
+        std::memcmp(out.data() + out.size() - sizeof(FlushTrailer), FlushTrailer,
+                    sizeof(FlushTrailer)) != 0)
+    {
+        // Forgetting the previous messages is always safe: the client only
+        // keeps them for us to refer to.
+        LOG_ERR("Failed to deflate a WebSocket message of " << len << " bytes: " << result);
+        deflateReset(&_deflate);
+        ++MessagesUncompressed;
+        return false;
+    }
+
+    out.resize(out.size() - sizeof(FlushTrailer));
+    if (_noContextTakeover)
+        deflateReset(&_deflate);
+
+    ++MessagesCompressed;
+    BytesBeforeCompression += len;
+    BytesAfterCompression += out.size();
+    recordDuration(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start));
+    return true;
+}
+
+bool WebSocketDeflate::decompress(const char* data, std::size_t len, std::vector<char>& out)
+{
+    out.clear();
+
+    // Inflate the message, then the trailer the client stripped.
+    for (const auto& [input, size] : { std::make_pair(data, len),
+                                       std::make_pair(FlushTrailer, sizeof(FlushTrailer)) })
+    {
+        _inflate.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input));
+        _inflate.avail_in = size;
+        // Until the input is consumed and the output flushed.
+        do
+        {
+            if (out.size() >= MaxInflatedSize)
+            {
+                LOG_ERR("Inflated WebSocket message exceeds " << MaxInflatedSize << " bytes");
+                inflateReset(&_inflate);
+                return false;
+            }
+
+            const std::size_t used = out.size();
+            out.resize(used + InflateChunkSize);
+            _inflate.next_out = reinterpret_cast<Bytef*>(out.data() + used);
+            _inflate.avail_out = InflateChunkSize;
+
+            const int result = inflate(&_inflate, Z_SYNC_FLUSH);
+            out.resize(out.size() - _inflate.avail_out);
+            if (result == Z_STREAM_END)
+            {
+                // The client ended the stream: the next message starts a new one.
+                inflateReset(&_inflate);
+                break;
+            }
+
+            if (result != Z_OK && result != Z_BUF_ERROR)
+            {
+                LOG_ERR("Failed to inflate a WebSocket message of " << len << " bytes: " << result);
+                inflateReset(&_inflate);
+                return false;
+            }
+        } while (_inflate.avail_in > 0 || _inflate.avail_out == 0);
+    }
+
+    BytesInflated += out.size();
+    return true;
+}
+
+void WebSocketDeflate::recordDuration(std::chrono::microseconds duration)
+{
+    const auto it =
+        std::lower_bound(DurationBucketsUs.begin(), DurationBucketsUs.end(), duration.count());
+    ++DurationCounts[it - DurationBucketsUs.begin()];
+    DurationSumUs += duration.count();
+}
+
+void WebSocketDeflate::printMetrics(std::ostream& os)
+{
+    const uint64_t before = BytesBeforeCompression;
+    const uint64_t after = BytesAfterCompression;
+    os << "websocket_deflate_messages_compressed " << MessagesCompressed << '\n';
+    os << "websocket_deflate_messages_uncompressed " << MessagesUncompressed << '\n';
+    os << "websocket_deflate_bytes_before " << before << '\n';
+    os << "websocket_deflate_bytes_after " << after << '\n';
+    os << "websocket_deflate_ratio " << (after ? static_cast<double>(before) / after : 0) << '\n';
+    os << "websocket_inflate_bytes " << BytesInflated << '\n';
+
+    // Cumulative, as Prometheus histograms are.
+    uint64_t count = 0;
+    for (std::size_t i = 0; i < DurationBucketsUs.size(); ++i)
+    {
+        count += DurationCounts[i];
+        os << "websocket_deflate_duration_microseconds_bucket{le=\"" << DurationBucketsUs[i]
+           << "\"} " << count << '\n';
+    }
+    count += DurationCounts.back();
+    os << "websocket_deflate_duration_microseconds_bucket{le=\"+Inf\"} " << count << '\n';
+    os << "websocket_deflate_duration_microseconds_sum " << DurationSumUs << '\n';
+    os << "websocket_deflate_duration_microseconds_count " << count << '\n';
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
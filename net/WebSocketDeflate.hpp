@@ -0,0 +1,111 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+/// The permessage-deflate extension (RFC 7692) of a WebSocket:
+/// compresses the text messages we send, with a sliding window shared
+/// across the messages of the connection, and inflates those we receive.
+class WebSocketDeflate final
+{
+public:
+    /// The parameters agreed with the client during the upgrade.
+    struct Params
+    {
+        Params()
+            : _serverNoContextTakeover(false)
+            , _serverMaxWindowBits(MaxWindowBits)
+        {
+        }
+
+        /// Compress every message on its own, without the previous ones.
+        bool _serverNoContextTakeover;
+        /// The size of our compression window.
+        int _serverMaxWindowBits;
+    };
+
+    /// The largest window, 32KB, which the client can always inflate.
+    static constexpr int MaxWindowBits = 15;
+    /// Guards against decompression bombs.
+    static constexpr std::size_t MaxInflatedSize = 256 * 1024 * 1024;
+
+    /// Sets up the extension, which we don't offer until it is enabled.
+    /// Text messages smaller than @minSize bytes are sent uncompressed.
+    static void initialize(bool enable, std::size_t minSize, int windowBits, int level);
+
+    static bool isEnabled() { return Enabled; }
+
+    /// Picks the first permessage-deflate offer of a Sec-WebSocket-Extensions
+    /// header that we can accept, and sets @params accordingly.
+    /// Returns the header of our response, or empty to decline them all.
+    static std::string negotiate(const std::string& extensions, Params& params);
+
+    /// Returns nullptr if zlib fails to set up the streams.
+    static std::unique_ptr<WebSocketDeflate> create(const Params& params);
+
+    ~WebSocketDeflate();
+
+    /// Compresses a message of @len bytes into @out, unless it is too small
+    /// to be worth it. Returns true if it is to be sent compressed.
+    bool compress(const char* data, std::size_t len, std::vector<char>& out);
+
+    /// Inflates a message of @len bytes into @out.
+    /// Returns false if it is corrupted or too large.
+    bool decompress(const char* data, std::size_t len, std::vector<char>& out);
+
+    /// Writes our counters and the histogram of the time spent compressing,
+    /// process-wide, in the format of the metrics.
+    static void printMetrics(std::ostream& os);
+
+private:
+    explicit WebSocketDeflate(const Params& params);
+
+    /// Adds the time a compression took to the histogram.
+    static void recordDuration(std::chrono::microseconds duration);
+
+    z_stream _deflate;
+    z_stream _inflate;
+    bool _deflateInitialized;
+    bool _inflateInitialized;
+    const bool _noContextTakeover;
+
+    static bool Enabled;
+    static std::size_t MinSize;
+    static int WindowBits;
+    static int Level;
+
+    /// Upper bounds of the buckets of the duration histogram, in microseconds.
+    static constexpr std::array<int64_t, 7> DurationBucketsUs = { 10,   25,   50,  100,
+                                                                   250, 1000, 5000 };
+
+    static std::atomic<uint64_t> MessagesCompressed;
+    static std::atomic<uint64_t> MessagesUncompressed;
+    static std::atomic<uint64_t> BytesBeforeCompression;
+    static std::atomic<uint64_t> BytesAfterCompression;
+    static std::atomic<uint64_t> BytesInflated;
+    /// Counts per bucket, plus one for the larger durations.
+    static std::array<std::atomic<uint64_t>, DurationBucketsUs.size() + 1> DurationCounts;
+    static std::atomic<uint64_t> DurationSumUs;
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
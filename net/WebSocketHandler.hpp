@@ -19,14 +19,24 @@
 #include "common/Util.hpp"
 #include <limits>
 #include <net/HttpRequest.hpp>
+#if !MOBILEAPP
+#include <net/WebSocketDeflate.hpp>
+#endif
 
 #include <Poco/Net/HTTPResponse.h>
 
 #include <chrono>
+#include <cstring>
 #include <memory>
 #include <string>
 #include <vector>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 class WebSocketHandler : public ProtocolHandlerInterface
 {
 private:
@@ -41,6 +51,9 @@ private:
     /// The security key. Meaningful only for clients.
     const std::string _key;
     unsigned char _lastFlags; ///< The flags in the last frame.
+    /// Set when permessage-deflate was negotiated.
+    std::unique_ptr<WebSocketDeflate> _deflate;
+    bool _inCompressed; ///< The message being received is compressed.
 #endif
 
     std::vector<char> _wsPayload;
@@ -57,6 +70,7 @@ protected:
     struct WSFrameMask
     {
         static constexpr unsigned char Fin = 0x80;
+        static constexpr unsigned char Rsv1 = 0x40; ///< Compressed, with permessage-deflate.
         static constexpr unsigned char Mask = 0x80;
     };
 
@@ -80,6 +94,7 @@ public:
         , _inFragmentBlock(false)
         , _key(isClient ? generateKey() : std::string())
         , _lastFlags(0)
+        , _inCompressed(false)
         ,
 #endif
         _shuttingDown(false)
@@ -295,6 +310,7 @@ private:
         _wsPayload.clear();
 #if !MOBILEAPP
         _inFragmentBlock = false;
+        _inCompressed = false;
 #endif
         _shuttingDown = false;
     }
@@ -318,6 +334,7 @@ private:
         unsigned char *p = reinterpret_cast<unsigned char*>(socket->getInBuffer().data());
         _lastFlags = p[0];
         const bool fin = _lastFlags & 0x80;
+        const bool compressed = _lastFlags & WSFrameMask::Rsv1;
         const WSOpCode code = static_cast<WSOpCode>(_lastFlags & 0x0f);
         const bool hasMask = p[1] & 0x80;
         size_t payloadLen = p[1] & 0x7f;
@@ -378,13 +395,17 @@ private:
 
         unsigned char *data = p + headerLen;
 
+        // The frame is complete, and erased once handled: unmask it in place.
+        if (mask)
+            applyMask(data, data, payloadLen, mask);
+
         if (isControlFrame(code))
         {
             //Process control frames
 
             std::vector<char> ctrlPayload;
 
-            readPayload(data, payloadLen, mask, ctrlPayload);
+            readPayload(data, payloadLen, ctrlPayload);
             socket->getInBuffer().eraseFirst(headerLen + payloadLen);
             LOGA_TRC(WebSocket, "Incoming WebSocket frame code "
                     << static_cast<unsigned>(code) << ", fin? " << fin << ", mask? " << hasMask
@@ -392,6 +413,12 @@ private:
                     << ", residual socket data: " << socket->getInBuffer().size() << " bytes");
 
             // All control frames MUST NOT be fragmented and MUST have a payload length of 125 bytes or less
+            if (compressed)
+            {
+                LOG_ERR("A control frame cannot be compressed");
+                shutdown(StatusCodes::PROTOCOL_ERROR);
+                return true;
+            }
             if (!fin)
             {
                 LOG_ERR("A control frame cannot be fragmented");
@@ -480,8 +507,34 @@ private:
             return true;
         }
 
+        // Only the first fragment flags the whole message as compressed.
+        if (compressed && (_inFragmentBlock || !_deflate))
+        {
+            LOG_ERR("Unexpected compressed frame, permessage-deflate "
+                    << (_deflate ? "flags only the first fragment" : "was not negotiated"));
+            shutdown(StatusCodes::PROTOCOL_ERROR);
+            return true;
+        }
+
+        if (!_inFragmentBlock)
+            _inCompressed = compressed;
+
         //Process data frame
-        readPayload(data, payloadLen, mask, _wsPayload);
+        if (_inCompressed && fin && !_inFragmentBlock)
+        {
+            // A whole compressed message: inflate it straight from the input buffer.
+            std::vector<char> message;
+            if (!_deflate->decompress(reinterpret_cast<char*>(data), payloadLen, message))
+            {
+                shutdown(StatusCodes::MALFORMED_PAYLOAD);
+                return true;
+            }
+
+            _wsPayload.swap(message);
+            _inCompressed = false;
+        }
+        else
+            readPayload(data, payloadLen, _wsPayload);
 #else
         unsigned char * const p = reinterpret_cast<unsigned char*>(socket->getInBuffer().data());
         _wsPayload.insert(_wsPayload.end(), p, p + len);
@@ -504,6 +557,19 @@ private:
         {
             // If is final fragment then process the accumulated message.
 
+            if (_inCompressed)
+            {
+                std::vector<char> message;
+                if (!_deflate->decompress(_wsPayload.data(), _wsPayload.size(), message))
+                {
+                    shutdown(StatusCodes::MALFORMED_PAYLOAD);
+                    return true;
+                }
+
+                _wsPayload.swap(message);
+                _inCompressed = false;
+            }
+
             try
             {
                 handleMessage(_wsPayload);
@@ -704,6 +770,23 @@ public:
         return sendMessage(data, len, WSOpCode::Binary, flush);
     }
 
+    /// Implementation of the ProtocolHandlerInterface.
+    int sendSharedBinaryMessage(const char* data, const size_t len,
+                                const std::vector<Blob>& blobs, bool flush = false) const override
+    {
+#if !MOBILEAPP
+        // Masking rewrites the payload, and unit-tests filter whole messages.
+        if (!_isMasking && !(UnitBase::isUnitTesting() && !Util::isFuzzing()))
+        {
+            std::shared_ptr<StreamSocket> socket = _socket.lock();
+            return sendFrame(socket, data, len, blobs,
+                             WSFrameMask::Fin | static_cast<unsigned char>(WSOpCode::Binary), flush);
+        }
+#endif
+
+        return ProtocolHandlerInterface::sendSharedBinaryMessage(data, len, blobs, flush);
+    }
+
     /// Sends a WebSocket message of WPOpCode type.
     /// Returns the number of bytes written (including frame overhead) on success,
     /// 0 for closed socket, and -1 for other errors.
@@ -719,6 +802,20 @@ public:
         //TODO: Support fragmented messages.
 
         std::shared_ptr<StreamSocket> socket = _socket.lock();
+
+#if !MOBILEAPP
+        // Tiles and other binary messages are compressed already.
+        if (_deflate && code == WSOpCode::Text && socket && !socket->isClosed())
+        {
+            std::vector<char> compressed;
+            if (_deflate->compress(data, len, compressed))
+                return sendFrame(socket, compressed.data(), compressed.size(),
+                                 WSFrameMask::Fin | WSFrameMask::Rsv1 |
+                                     static_cast<unsigned char>(code),
+                                 flush);
+        }
+#endif
+
         return sendFrame(socket, data, len, WSFrameMask::Fin | static_cast<unsigned char>(code), flush);
     }
 
@@ -741,9 +838,9 @@ public:
 protected:
 
 #if !MOBILEAPP
-    /// Builds a websocket frame based on data and flags received as parameters.
-    /// The frame is output in 'out' parameter
-    void buildFrame(const char* data, const uint64_t len, unsigned char flags, Buffer &out) const
+    /// Builds the header of a websocket frame of a payload of 'len' bytes.
+    /// The header is output in 'out' parameter
+    void buildFrameHeader(const uint64_t len, unsigned char flags, Buffer &out) const
     {
         int slen = 0;
         char scratch[16];
@@ -777,6 +874,13 @@ protected:
 
         assert(slen <= static_cast<int>(sizeof(scratch)));
         out.append(scratch, slen);
+    }
+
+    /// Builds a websocket frame based on data and flags received as parameters.
+    /// The frame is output in 'out' parameter
+    void buildFrame(const char* data, const uint64_t len, unsigned char flags, Buffer &out) const
+    {
+        buildFrameHeader(len, flags, out);
 
         if (_isMasking)
         { // flip some top bits - perhaps it helps.
@@ -788,18 +892,12 @@ protected:
             mask[3] = static_cast<char>(0x76);
             out.append(mask, 4);
 
-            // copy and mask the data
-            char copy[16384];
-            ssize_t i = 0, toSend;
-            while (true)
-            {
-                toSend = std::min(sizeof(copy), len - i);
-                if (toSend == 0)
-                    break;
-                for (ssize_t j = 0; j < toSend; ++j, ++i)
-                    copy[j] = data[i] ^ mask[i%4];
-                out.append(copy, toSend);
-            }
+            // Mask the data straight into the output buffer.
+            char* masked = out.prepareAppend(len);
+            applyMask(reinterpret_cast<unsigned char*>(masked),
+                      reinterpret_cast<const unsigned char*>(data), len,
+                      reinterpret_cast<const unsigned char*>(mask));
+            out.commitAppend(len);
         }
         else
         {
@@ -891,6 +989,61 @@ protected:
 
         assert(size >= len && "Expected to have data in outBuffer to send");
 
+        writeFrame(socket, flush);
+
+        return size;
+    }
+
+#if !MOBILEAPP
+    /// Sends a WebSocket frame of data followed by blobs, which are queued by
+    /// reference, rather than copied, until written out.
+    /// Returns as sendFrame() above.
+    int sendFrame(const std::shared_ptr<StreamSocket>& socket, const char* data, const uint64_t len,
+                  const std::vector<Blob>& blobs, unsigned char flags, bool flush = true) const
+    {
+        if (!socket || data == nullptr || len == 0)
+        {
+            LOG_DBG("Socket or data missing. Cannot send WS frame");
+            return -1;
+        }
+
+        if (socket->isClosed())
+        {
+            LOG_DBG("Socket is closed. Cannot send WS frame");
+            return 0;
+        }
+
+        ASSERT_CORRECT_SOCKET_THREAD(socket);
+        assert(!_isMasking && "Cannot share masked payloads");
+        Buffer& out = socket->getOutBuffer();
+
+        uint64_t payloadLen = len;
+        for (const Blob& blob : blobs)
+            payloadLen += blob->size();
+
+        LOGA_TRC(WebSocket, "WebSocketHandler: Writing " << payloadLen << " bytes, of which "
+                 << payloadLen - len << " shared, to #" << socket->getFD()
+                 << " in addition to " << out.size() << " bytes buffered");
+
+        const size_t oldSize = out.size();
+
+        buildFrameHeader(payloadLen, flags, out);
+        out.append(data, len);
+        for (const Blob& blob : blobs)
+            out.appendShared(blob);
+
+        const size_t size = out.size() - oldSize;
+
+        writeFrame(socket, flush);
+
+        return size;
+    }
+#endif
+
+    /// Writes out the frames buffered, if asked to or shutting down.
+    void writeFrame(const std::shared_ptr<StreamSocket>& socket, bool flush) const
+    {
+        Buffer& out = socket->getOutBuffer();
         if (flush || _shuttingDown)
         {
             socket->writeOutgoingData();
@@ -906,7 +1059,8 @@ protected:
             // So, a common scenario is when we want to shutdown all clients. The stack
             // trace looks like this:
             //
-            // WebSocketHandler::sendFrame at ./net/WebSocketHandler.hpp:678 (this function)
+            // WebSocketHandler::writeFrame at ./net/WebSocketHandler.hpp (this function)
+            // WebSocketHandler::sendFrame at ./net/WebSocketHandler.hpp:678
             // WebSocketHandler::sendCloseFrame at ./net/WebSocketHandler.hpp:149
             // WebSocketHandler::shutdown at ./net/WebSocketHandler.hpp:175
             // WebSocketHandler::shutdown at ./net/WebSocketHandler.hpp:155
@@ -933,32 +1087,55 @@ protected:
                 }
             }
         }
-
-        return size;
     }
 
     bool isControlFrame(WSOpCode code) const { return code >= WSOpCode::Close; }
 
-    void readPayload(unsigned char *data, size_t dataLen, unsigned char* mask, std::vector<char>& payload)
+    /// Appends the unmasked payload of a frame.
+    void readPayload(const unsigned char* data, size_t dataLen, std::vector<char>& payload)
     {
-        if (dataLen == 0)
-            return;
+        payload.insert(payload.end(), data, data + dataLen);
+    }
 
-        if (mask)
+public:
+    /// XORs @len bytes of @src with the 4-byte @mask of a frame into @dst,
+    /// which may be @src itself: sixteen, then eight, bytes at a time.
+    static void applyMask(unsigned char* dst, const unsigned char* src, size_t len,
+                          const unsigned char* mask)
+    {
+        uint32_t mask32;
+        std::memcpy(&mask32, mask, sizeof(mask32));
+
+        // Whole words keep the mask in phase with the offset.
+        size_t i = 0;
+#if defined(__SSE2__)
+        const __m128i mask128 = _mm_set1_epi32(mask32);
+        for (; i + 16 <= len; i += 16)
         {
-            size_t end = payload.size();
-            payload.resize(end + dataLen);
-            if (dataLen > 0)
-            {
-                char* wsData = &payload[end];
-                for (size_t i = 0; i < dataLen; ++i)
-                    *wsData++ = data[i] ^ mask[i % 4];
-            }
+            const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(block, mask128));
         }
-        else
-            payload.insert(payload.end(), data, data + dataLen);
+#elif defined(__ARM_NEON)
+        const uint8x16_t mask128 = vreinterpretq_u8_u32(vdupq_n_u32(mask32));
+        for (; i + 16 <= len; i += 16)
+            vst1q_u8(dst + i, veorq_u8(vld1q_u8(src + i), mask128));
+#endif
+
+        const uint64_t mask64 = (static_cast<uint64_t>(mask32) << 32) | mask32;
+        for (; i + 8 <= len; i += 8)
+        {
+            uint64_t word;
+            std::memcpy(&word, src + i, sizeof(word));
+            word ^= mask64;
+            std::memcpy(dst + i, &word, sizeof(word));
+        }
+
+        for (; i < len; ++i)
+            dst[i] = src[i] ^ mask[i % 4];
     }
 
+protected:
+
     /// To be overridden to handle the websocket messages the way you need.
     virtual void handleMessage(const std::vector<char> &data)
     {
@@ -1012,6 +1189,23 @@ protected:
         httpResponse.set("Upgrade", "websocket");
         httpResponse.header().setConnectionToken(http::Header::ConnectionToken::Upgrade);
         httpResponse.set("Sec-WebSocket-Accept", computeAccept(wsKey));
+
+        const std::string wsExtensions = req.get("Sec-WebSocket-Extensions", "");
+        if (WebSocketDeflate::isEnabled() && !wsExtensions.empty())
+        {
+            WebSocketDeflate::Params params;
+            const std::string accepted = WebSocketDeflate::negotiate(wsExtensions, params);
+            if (!accepted.empty())
+            {
+                _deflate = WebSocketDeflate::create(params);
+                if (_deflate)
+                {
+                    LOG_DBG("WebSocket extensions: [" << wsExtensions << "], accepted: ["
+                                                      << accepted << ']');
+                    httpResponse.set("Sec-WebSocket-Extensions", accepted);
+                }
+            }
+        }
         LOGA_TRC(WebSocket, "Sending WS Upgrade response: " << httpResponse.header().toString());
         socket->send(httpResponse);
 #endif
@@ -14,6 +14,7 @@
 #include <test/lokassert.hpp>
 
 #include <random>
+#include <sstream>
 
 #include <Delta.hpp>
 #include <Util.hpp>
@@ -35,6 +36,10 @@ class DeltaTests : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testDeltaSequence);
     CPPUNIT_TEST(testRandomDeltas);
     CPPUNIT_TEST(testDeltaCopyOutOfBounds);
+    CPPUNIT_TEST(testDeltaDedupViews);
+    CPPUNIT_TEST(testDeltaCompaction);
+    CPPUNIT_TEST(testPngEncoding);
+    CPPUNIT_TEST(testSimdKernels);
 
     CPPUNIT_TEST_SUITE_END();
 
@@ -45,6 +50,10 @@ class DeltaTests : public CPPUNIT_NS::TestFixture
     void testDeltaSequence();
     void testRandomDeltas();
     void testDeltaCopyOutOfBounds();
+    void testDeltaDedupViews();
+    void testDeltaCompaction();
+    void testPngEncoding();
+    void testSimdKernels();
 
     std::vector<char> applyDelta(
         const std::vector<char> &pixmap,
@@ -502,6 +511,290 @@ void DeltaTests::testDeltaCopyOutOfBounds()
     assertEqual(reText2, text2, width, height, testname);
 }
 
+void DeltaTests::testDeltaDedupViews()
+{
+    constexpr auto testname = __func__;
+
+    DeltaGenerator gen;
+
+    uint32_t height, width, rowBytes;
+    std::vector<char> text =
+        Png::loadPng(TDOC "/delta-text.png", height, width, rowBytes);
+    LOK_ASSERT(height == 256 && width == 256 && rowBytes == 256*4);
+
+    std::vector<char> text2 =
+        Png::loadPng(TDOC "/delta-text2.png", height, width, rowBytes);
+    LOK_ASSERT(height == 256 && width == 256 && rowBytes == 256*4);
+
+    std::vector<char> delta;
+    std::shared_ptr<DeltaGenerator::DeltaData> rleData;
+
+    // The same tile in two canonical views.
+    const TileLocation view1(1, 2, 3, 0, 1, 0);
+    const TileLocation view2(1, 2, 3, 0, 2, 0);
+    LOK_ASSERT(gen.createDelta(
+                       reinterpret_cast<unsigned char *>(text.data()),
+                       0, 0, width, height, width, height,
+                       view1, delta, 1, false, LOK_TILEMODE_RGBA, rleData) == false);
+    LOK_ASSERT(gen.createDelta(
+                       reinterpret_cast<unsigned char *>(text.data()),
+                       0, 0, width, height, width, height,
+                       view2, delta, 2, false, LOK_TILEMODE_RGBA, rleData) == false);
+    LOK_ASSERT(delta.empty());
+
+    // Stored once.
+    LOK_ASSERT_EQUAL(size_t(2), gen._deltaEntries.size());
+    LOK_ASSERT_EQUAL(size_t(2), gen._dedupLookups);
+    LOK_ASSERT_EQUAL(size_t(1), gen._dedupHits);
+    LOK_ASSERT(gen._dedupBytesSaved > size_t(256 * 4));
+    LOK_ASSERT((*gen._deltaEntries.begin())->getBitmap() ==
+               (*std::next(gen._deltaEntries.begin()))->getBitmap());
+
+    // Changing one view leaves the other alone.
+    LOK_ASSERT(gen.createDelta(
+                       reinterpret_cast<unsigned char *>(text2.data()),
+                       0, 0, width, height, width, height,
+                       view2, delta, 3, false, LOK_TILEMODE_RGBA, rleData) == true);
+    checkzDelta(delta, "text to text2 in view 2");
+    std::vector<char> reText2 = applyDelta(text, width, height, delta, testname);
+    assertEqual(reText2, text2, width, height, testname);
+
+    // And the unchanged view has a trivial delta.
+    delta.clear();
+    LOK_ASSERT(gen.createDelta(
+                       reinterpret_cast<unsigned char *>(text.data()),
+                       0, 0, width, height, width, height,
+                       view1, delta, 4, false, LOK_TILEMODE_RGBA, rleData) == true);
+    LOK_ASSERT_EQUAL(size_t(1), delta.size());
+    LOK_ASSERT_EQUAL('D', delta[0]);
+}
+
+void DeltaTests::testDeltaCompaction()
+{
+    constexpr auto testname = __func__;
+
+    DeltaGenerator gen;
+
+    uint32_t height, width, rowBytes;
+    std::vector<char> text =
+        Png::loadPng(TDOC "/delta-text.png", height, width, rowBytes);
+    LOK_ASSERT(height == 256 && width == 256 && rowBytes == 256*4);
+    std::vector<char> text2 =
+        Png::loadPng(TDOC "/delta-text2.png", height, width, rowBytes);
+    LOK_ASSERT(height == 256 && width == 256 && rowBytes == 256*4);
+
+    // A keyframe and deltas flipping between the two, as the TileCache holds them.
+    const TileLocation loc(1, 2, 3, 0, 1, 0);
+    std::vector<char> chain;
+    for (TileWireId wid = 1; wid <= 4; ++wid)
+    {
+        std::vector<char>& pixels = (wid % 2) ? text : text2;
+        std::vector<char> output;
+        gen.compressOrDelta(reinterpret_cast<unsigned char*>(pixels.data()), 0, 0, width, height,
+                            width, height, loc, output, wid, false, false, LOK_TILEMODE_RGBA);
+        LOK_ASSERT_EQUAL(wid == 1 ? 'Z' : 'D', output[0]);
+        chain.insert(chain.end(), output.begin() + 1, output.end());
+    }
+
+    std::vector<char> keyframe;
+    LOK_ASSERT(DeltaGenerator::compactDeltas(chain.data(), chain.size(), width, height, keyframe));
+
+    Blob img = DeltaGenerator::expand(std::make_shared<BlobData>(keyframe));
+    LOK_ASSERT(img);
+    assertEqual(*img, text2, width, height, testname);
+
+    // The same pixels as a freshly rendered keyframe.
+    DeltaGenerator fresh;
+    std::vector<char> output;
+    fresh.compressOrDelta(reinterpret_cast<unsigned char*>(text2.data()), 0, 0, width, height,
+                          width, height, loc, output, 5, false, false, LOK_TILEMODE_RGBA);
+    Blob freshImg = DeltaGenerator::expand(std::make_shared<BlobData>(output.begin() + 1, output.end()));
+    LOK_ASSERT(freshImg);
+    assertEqual(*img, *freshImg, width, height, testname);
+
+    // A truncated chain is refused.
+    keyframe.clear();
+    LOK_ASSERT(!DeltaGenerator::compactDeltas(chain.data(), chain.size() - 1, width, height, keyframe));
+}
+
+void DeltaTests::testPngEncoding()
+{
+    constexpr auto testname = __func__;
+
+    const auto decode = [](const std::vector<char>& png)
+    {
+        std::stringstream stream(std::string(png.begin(), png.end()));
+        png_uint_32 height, width, rowBytes;
+        std::vector<png_bytep> rows = Png::decodePNG(stream, height, width, rowBytes);
+        std::vector<char> pixels;
+        for (png_uint_32 y = 0; y < height; ++y)
+            pixels.insert(pixels.end(), rows[y], rows[y] + rowBytes);
+        return pixels;
+    };
+
+    uint32_t height, width, rowBytes;
+    std::vector<std::vector<char>> images;
+    for (const char* name : { "/delta-text.png", "/delta-graphic.png" })
+    {
+        images.push_back(Png::loadPng((std::string(TDOC) + name).c_str(), height, width, rowBytes));
+        LOK_ASSERT(height == 256 && width == 256 && rowBytes == 256*4);
+    }
+
+    // Translucent pixels, including invalid ones, with colours above the alpha.
+    std::mt19937 rng(42);
+    std::vector<char> translucent(256 * 256 * 4);
+    for (size_t i = 0; i < translucent.size(); i += 4)
+    {
+        const unsigned int alpha = (i / 4) % 3 ? 255 : rng() % 256;
+        for (size_t c = 0; c < 3; ++c)
+            translucent[i + c] = (i / 4) % 11 ? (rng() % 256) * alpha / 255 : rng() % 256;
+        translucent[i + 3] = alpha;
+    }
+    images.push_back(std::move(translucent));
+
+    // The fast encoder decodes to the same pixels as libpng's, whole and in parts.
+    for (std::vector<char>& image : images)
+    {
+        unsigned char* pixmap = reinterpret_cast<unsigned char*>(image.data());
+        for (const LibreOfficeKitTileMode mode : { LOK_TILEMODE_RGBA, LOK_TILEMODE_BGRA })
+        {
+            std::vector<char> expected, actual;
+            LOK_ASSERT(Png::impl_encodeSubBufferToPNG(pixmap, 0, 0, 256, 256, 256, 256,
+                                                      expected, mode));
+            LOK_ASSERT(Png::impl_encodeSubBufferToPNGFast(pixmap, 0, 0, 256, 256, 256, 256,
+                                                          actual, mode));
+            LOK_ASSERT(decode(expected) == decode(actual));
+
+            expected.clear();
+            actual.clear();
+            LOK_ASSERT(Png::impl_encodeSubBufferToPNG(pixmap, 13, 7, 101, 50, 256, 256,
+                                                      expected, mode));
+            LOK_ASSERT(Png::impl_encodeSubBufferToPNGFast(pixmap, 13, 7, 101, 50, 256, 256,
+                                                          actual, mode));
+            LOK_ASSERT(decode(expected) == decode(actual));
+        }
+    }
+
+    std::vector<char> output;
+    LOK_ASSERT(!Png::impl_encodeSubBufferToPNGFast(
+        reinterpret_cast<unsigned char*>(images[0].data()), 0, 0, 257, 256, 256, 256, output,
+        LOK_TILEMODE_RGBA));
+    LOK_ASSERT(output.empty());
+}
+
+void DeltaTests::testSimdKernels()
+{
+    constexpr auto testname = __func__;
+
+    simd::init();
+    simd_deltaInit(simd::HasSSE42, simd::HasAVX2, simd::HasAVX512, simd::HasNEON);
+    const SimdDeltaKernel bestKernel = simd_deltaGetKernel();
+
+    // Rows of 256 pixels, with runs ending around the 64 pixel words of the mask.
+    std::mt19937 random(42);
+    std::vector<std::vector<uint32_t>> rows;
+    rows.emplace_back(256, 0); // All transparent: nothing to keep.
+    rows.emplace_back(256, 0xff00ff00); // One pixel.
+    for (unsigned int run : { 1, 2, 3, 4, 5, 7, 8, 15, 16, 17, 63, 64, 65, 255 })
+    {
+        std::vector<uint32_t> row(256);
+        for (unsigned int x = 0; x < 256; ++x)
+            row[x] = (x / run) % 2 ? 0x12345678 : (x / run) * 0x01010101;
+        rows.push_back(std::move(row));
+    }
+    for (int i = 0; i < 200; ++i)
+    {
+        // Few colors, so that there are runs of random lengths.
+        std::vector<uint32_t> row(256);
+        const unsigned int colors = 1 + random() % 8;
+        for (uint32_t& pixel : row)
+            pixel = (random() % colors) * 0x11111111;
+        rows.push_back(std::move(row));
+    }
+    for (int i = 0; i < 50; ++i)
+    {
+        std::vector<uint32_t> row(256);
+        for (uint32_t& pixel : row)
+            pixel = random();
+        rows.push_back(std::move(row));
+    }
+
+    // The scalar results.
+    LOK_ASSERT(simd_deltaSetKernel(SIMD_DELTA_SCALAR));
+    struct Rle
+    {
+        uint64_t _mask[DeltaGenerator::_rleMaskUnits];
+        uint32_t _data[256];
+        size_t _size;
+        uint32_t _crc;
+    };
+    std::vector<Rle> expected(rows.size());
+    for (std::size_t i = 0; i < rows.size(); ++i)
+    {
+        Rle& rle = expected[i];
+        LOK_ASSERT_EQUAL(0, simd_initPixRowSimd(rows[i].data(), rle._data, &rle._size, rle._mask));
+        DeltaGenerator::DeltaBitmapRow::initPixRowCpu(rows[i].data(), rle._data, &rle._size,
+                                                      rle._mask, 256);
+        rle._crc = simd_crcRow(rle._mask, rle._data, rle._size);
+    }
+
+    // And of every length of unique pixels, odd ones included.
+    std::vector<uint32_t> crcs;
+    for (size_t size = 0; size <= 256; ++size)
+        crcs.push_back(simd_crcRow(expected.back()._mask, expected.back()._data, size));
+
+    std::vector<uint64_t> diffs;
+    for (std::size_t i = 0; i + 1 < rows.size(); ++i)
+    {
+        uint64_t diffMask[DeltaGenerator::_rleMaskUnits];
+        simd_diffRow(rows[i].data(), rows[i + 1].data(), diffMask);
+        for (unsigned int x = 0; x < 256; ++x)
+        {
+            const bool differ = rows[i][x] != rows[i + 1][x];
+            LOK_ASSERT_EQUAL(differ, bool(diffMask[x >> 6] & (uint64_t(1) << (x & 63))));
+        }
+        diffs.insert(diffs.end(), diffMask, diffMask + DeltaGenerator::_rleMaskUnits);
+    }
+
+    for (int kernel = 0; kernel < SIMD_DELTA_KERNEL_COUNT; ++kernel)
+    {
+        if (!simd_deltaSetKernel(static_cast<SimdDeltaKernel>(kernel)))
+            continue;
+
+        const std::string name = simd_deltaKernelName(static_cast<SimdDeltaKernel>(kernel));
+        for (std::size_t i = 0; i < rows.size(); ++i)
+        {
+            Rle rle;
+            if (simd_initPixRowSimd(rows[i].data(), rle._data, &rle._size, rle._mask))
+            {
+                LOK_ASSERT_EQUAL_MESSAGE(name, expected[i]._size, rle._size);
+                LOK_ASSERT_MESSAGE(name, !memcmp(expected[i]._mask, rle._mask, sizeof(rle._mask)));
+                LOK_ASSERT_MESSAGE(name,
+                                   !memcmp(expected[i]._data, rle._data, rle._size * 4));
+            }
+
+            LOK_ASSERT_EQUAL_MESSAGE(name, expected[i]._crc,
+                                     simd_crcRow(expected[i]._mask, expected[i]._data,
+                                                 expected[i]._size));
+        }
+
+        for (size_t size = 0; size <= 256; ++size)
+            LOK_ASSERT_EQUAL_MESSAGE(
+                name, crcs[size],
+                simd_crcRow(expected.back()._mask, expected.back()._data, size));
+
+        for (std::size_t i = 0; i + 1 < rows.size(); ++i)
+        {
+            uint64_t diffMask[DeltaGenerator::_rleMaskUnits];
+            simd_diffRow(rows[i].data(), rows[i + 1].data(), diffMask);
+            LOK_ASSERT_MESSAGE(name, !memcmp(diffs.data() + i * DeltaGenerator::_rleMaskUnits,
+                                             diffMask, sizeof(diffMask)));
+        }
+    }
+
+    simd_deltaSetKernel(bestKernel);
+}
+
 CPPUNIT_TEST_SUITE_REGISTRATION(DeltaTests);
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
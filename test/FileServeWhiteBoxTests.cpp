@@ -11,8 +11,12 @@
 
 #include <config.h>
 
+#include <wsd/AssetPack.hpp>
 #include <wsd/FileServer.hpp>
+#include <net/CompressedFileCache.hpp>
+#include <net/HttpHelper.hpp>
 #include <common/FileUtil.hpp>
+#include <common/Util.hpp>
 #include <test/lokassert.hpp>
 
 #include <Poco/String.h>
@@ -20,8 +24,12 @@
 #include <cppunit/TestAssert.h>
 #include <cppunit/extensions/HelperMacros.h>
 
+#include <chrono>
 #include <cstddef>
+#include <fstream>
 #include <memory>
+#include <sstream>
+#include <thread>
 #include <unordered_map>
 
 /// File-Serve White-Box unit-tests.
@@ -33,6 +41,9 @@ class FileServeTests : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testPreProcessedFile);
     CPPUNIT_TEST(testPreProcessedFileRoundtrip);
     CPPUNIT_TEST(testPreProcessedFileSubstitution);
+    CPPUNIT_TEST(testAssetPack);
+    CPPUNIT_TEST(testCompressedFileCacheEncoding);
+    CPPUNIT_TEST(testCompressedFileCache);
     CPPUNIT_TEST_SUITE_END();
 
     void testUIDefaults();
@@ -40,6 +51,9 @@ class FileServeTests : public CPPUNIT_NS::TestFixture
     void testPreProcessedFile();
     void testPreProcessedFileRoundtrip();
     void testPreProcessedFileSubstitution();
+    void testAssetPack();
+    void testCompressedFileCacheEncoding();
+    void testCompressedFileCache();
 
     void preProcessedFileSubstitution(const std::string& testname,
                                       std::unordered_map<std::string, std::string> variables);
@@ -442,6 +456,250 @@ void FileServeTests::testPreProcessedFileSubstitution()
                                  std::unordered_map<std::string, std::string>());
 }
 
+void FileServeTests::testAssetPack()
+{
+    constexpr auto testname = __func__;
+
+    const std::string path = FileUtil::getSysTempDirectoryPath() + "/test_asset_pack";
+
+    AssetPack::Builder builder;
+    builder.add("/browser/dist/cool.html", AssetPack::getContentType("cool.html"), "\"1\"",
+                "<html></html>", std::string(), std::string());
+    builder.add("/browser/dist/bundle.js", AssetPack::getContentType("bundle.js"), "\"2\"",
+                "var a;", "gzip", "brotli");
+    builder.add("/browser/dist/empty.css", AssetPack::getContentType("empty.css"), "\"3\"",
+                std::string(), std::string(), std::string());
+    LOK_ASSERT(builder.write(path, "1234"));
+
+    // Only for the version it was built for.
+    LOK_ASSERT(!AssetPack::open(path, "5678"));
+    LOK_ASSERT(!AssetPack::open(path + "_missing", "1234"));
+
+    const std::unique_ptr<AssetPack> pack = AssetPack::open(path, "1234");
+    LOK_ASSERT(pack != nullptr);
+    LOK_ASSERT_EQUAL(std::size_t(3), pack->count());
+
+    AssetPack::Asset asset;
+    LOK_ASSERT(pack->find("/browser/dist/bundle.js", asset));
+    LOK_ASSERT_EQUAL(std::string("application/javascript"), std::string(asset._contentType));
+    LOK_ASSERT_EQUAL(std::string("\"2\""), std::string(asset._etag));
+    LOK_ASSERT_EQUAL(std::string("var a;"), std::string(asset._raw));
+    LOK_ASSERT_EQUAL(std::string("gzip"), std::string(asset._gzip));
+    LOK_ASSERT_EQUAL(std::string("brotli"), std::string(asset._brotli));
+
+    LOK_ASSERT(pack->find("/browser/dist/cool.html", asset));
+    LOK_ASSERT_EQUAL(std::string("text/html"), std::string(asset._contentType));
+    LOK_ASSERT_EQUAL(std::string("<html></html>"), std::string(asset._raw));
+    LOK_ASSERT(asset._gzip.empty());
+
+    LOK_ASSERT(pack->find("/browser/dist/empty.css", asset));
+    LOK_ASSERT(asset._raw.empty());
+
+    LOK_ASSERT(!pack->find("/browser/dist/bundle", asset));
+    LOK_ASSERT(!pack->find("/browser/dist/zzz.js", asset));
+    LOK_ASSERT(!pack->find(std::string_view(), asset));
+
+    // The encoded variants are tagged apart from the file.
+    LOK_ASSERT(pack->find("/browser/dist/bundle.js", asset));
+    const std::string etag(asset._etag);
+    LOK_ASSERT_EQUAL(etag, HttpHelper::getEncodedETag(etag, std::string_view()));
+    LOK_ASSERT_EQUAL(std::string("\"2-gzip\""), HttpHelper::getEncodedETag(etag, "gzip"));
+    LOK_ASSERT_EQUAL(std::string("\"2-br\""), HttpHelper::getEncodedETag(etag, "br"));
+
+    // Rebuilding it replaces the file, leaving the mapped one intact.
+    AssetPack::Builder rebuilder;
+    rebuilder.add("/browser/dist/bundle.js", AssetPack::getContentType("bundle.js"), "\"4\"",
+                  "var b;", std::string(), std::string());
+    LOK_ASSERT(rebuilder.write(path, "1234"));
+    LOK_ASSERT(!FileUtil::Stat(path + ".tmp").exists());
+
+    LOK_ASSERT(pack->find("/browser/dist/bundle.js", asset));
+    LOK_ASSERT_EQUAL(std::string("var a;"), std::string(asset._raw));
+
+    const std::unique_ptr<AssetPack> rebuilt = AssetPack::open(path, "1234");
+    LOK_ASSERT(rebuilt != nullptr);
+    LOK_ASSERT_EQUAL(std::size_t(1), rebuilt->count());
+    LOK_ASSERT(rebuilt->find("/browser/dist/bundle.js", asset));
+    LOK_ASSERT_EQUAL(std::string("var b;"), std::string(asset._raw));
+
+    FileUtil::removeFile(path);
+}
+
+void FileServeTests::testCompressedFileCacheEncoding()
+{
+    constexpr auto testname = __func__;
+
+    CompressedFileCache::Encoding encoding = CompressedFileCache::Encoding::Deflate;
+    LOK_ASSERT(CompressedFileCache::pickEncoding("gzip, deflate, br", encoding));
+    LOK_ASSERT_EQUAL(CompressedFileCache::Encoding::Gzip, encoding);
+
+    LOK_ASSERT(CompressedFileCache::pickEncoding("deflate", encoding));
+    LOK_ASSERT_EQUAL(CompressedFileCache::Encoding::Deflate, encoding);
+
+    // Gzip is preferred, whatever the order and the q-values.
+    LOK_ASSERT(CompressedFileCache::pickEncoding("deflate;q=1.0, x-gzip;q=0.5", encoding));
+    LOK_ASSERT_EQUAL(CompressedFileCache::Encoding::Gzip, encoding);
+    LOK_ASSERT(CompressedFileCache::pickEncoding(" GZip ; q=0.8", encoding));
+    LOK_ASSERT_EQUAL(CompressedFileCache::Encoding::Gzip, encoding);
+
+    // We don't compress with brotli: gzip it is, when also accepted.
+    LOK_ASSERT(CompressedFileCache::pickEncoding("br;q=1.0, gzip;q=0.1", encoding));
+    LOK_ASSERT_EQUAL(CompressedFileCache::Encoding::Gzip, encoding);
+    LOK_ASSERT(!CompressedFileCache::pickEncoding("br", encoding));
+
+    // A q-value of 0 refuses the encoding.
+    LOK_ASSERT(CompressedFileCache::pickEncoding("gzip;q=0, deflate", encoding));
+    LOK_ASSERT_EQUAL(CompressedFileCache::Encoding::Deflate, encoding);
+    LOK_ASSERT(!CompressedFileCache::pickEncoding("gzip;q=0.0, deflate;q=0", encoding));
+
+    LOK_ASSERT(!CompressedFileCache::pickEncoding("identity", encoding));
+    LOK_ASSERT(!CompressedFileCache::pickEncoding("identity;q=1, br;q=0.5", encoding));
+    LOK_ASSERT(!CompressedFileCache::pickEncoding(std::string(), encoding));
+}
+
+namespace
+{
+/// Returns the value of the @name metric of the CompressedFileCache.
+uint64_t getCompressedFileCacheMetric(const std::string& name)
+{
+    std::ostringstream oss;
+    CompressedFileCache::printMetrics(oss);
+
+    std::istringstream iss(oss.str());
+    std::string key;
+    uint64_t value = 0;
+    while (iss >> key >> value)
+    {
+        if (key == name)
+            return value;
+    }
+
+    return 0;
+}
+
+void writeTestFile(const std::string& path, const std::string& data)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(data.data(), data.size());
+}
+
+/// Looks up the file at @path, as it is now, until its @encoding variant is compressed.
+Blob waitCompressed(const std::string& path, CompressedFileCache::Encoding encoding)
+{
+    const FileUtil::Stat st(path);
+    for (int i = 0; i < 500; ++i)
+    {
+        if (Blob variant =
+                CompressedFileCache::lookup(path, st.modifiedTimepoint(), st.size(), encoding))
+            return variant;
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    return nullptr;
+}
+} // namespace
+
+void FileServeTests::testCompressedFileCache()
+{
+    constexpr auto testname = __func__;
+
+    constexpr auto Gzip = CompressedFileCache::Encoding::Gzip;
+    constexpr auto Deflate = CompressedFileCache::Encoding::Deflate;
+
+    // Random hex compresses to about half: two 16KB files fit, but not three.
+    constexpr std::size_t MaxBytes = 20 * 1024;
+    constexpr std::size_t MinFileSize = 1024;
+    const std::string dir = FileUtil::createRandomTmpDir();
+    const std::string pathA = dir + "/a.js";
+    const std::string pathB = dir + "/b.js";
+    const std::string pathC = dir + "/c.js";
+    const std::string pathSmall = dir + "/small.js";
+    writeTestFile(pathA, Util::rng::getHexString(16 * 1024));
+    writeTestFile(pathB, Util::rng::getHexString(16 * 1024));
+    writeTestFile(pathC, Util::rng::getHexString(16 * 1024));
+    writeTestFile(pathSmall, Util::rng::getHexString(MinFileSize / 2));
+
+    CompressedFileCache::initialize(true, MaxBytes, MinFileSize, 1024 * 1024, 6);
+    LOK_ASSERT(CompressedFileCache::isEnabled());
+
+    // Too small to bother.
+    const FileUtil::Stat stSmall(pathSmall);
+    LOK_ASSERT(!CompressedFileCache::lookup(pathSmall, stSmall.modifiedTimepoint(),
+                                            stSmall.size(), Gzip));
+    LOK_ASSERT_EQUAL(uint64_t(0), getCompressedFileCacheMetric("file_compression_cache_files"));
+
+    // Served uncompressed, until compressed in the background.
+    const Blob gzipA = waitCompressed(pathA, Gzip);
+    LOK_ASSERT(gzipA != nullptr);
+    LOK_ASSERT(gzipA->size() < std::size_t(16 * 1024));
+    LOK_ASSERT_EQUAL(static_cast<char>(0x1f), (*gzipA)[0]);
+    LOK_ASSERT_EQUAL(static_cast<char>(0x8b), (*gzipA)[1]);
+
+    const Blob deflateA = waitCompressed(pathA, Deflate);
+    LOK_ASSERT(deflateA != nullptr);
+    LOK_ASSERT_EQUAL(static_cast<char>(0x78), (*deflateA)[0]);
+
+    // Hits share the same variant.
+    const FileUtil::Stat stOldA(pathA);
+    LOK_ASSERT(gzipA == CompressedFileCache::lookup(pathA, stOldA.modifiedTimepoint(),
+                                                    stOldA.size(), Gzip));
+    LOK_ASSERT_EQUAL(uint64_t(gzipA->size() + deflateA->size()),
+                     getCompressedFileCacheMetric("file_compression_cache_bytes"));
+
+    // A different modified time or size is another version.
+    LOK_ASSERT(!CompressedFileCache::lookup(
+        pathA, stOldA.modifiedTimepoint() + std::chrono::seconds(1), stOldA.size(), Gzip));
+    LOK_ASSERT(!CompressedFileCache::lookup(pathA, stOldA.modifiedTimepoint(),
+                                            stOldA.size() - 1, Gzip));
+
+    // And so is the rewritten file.
+    writeTestFile(pathA, Util::rng::getHexString(15 * 1024));
+    const FileUtil::Stat stA(pathA);
+    const Blob gzipNewA = waitCompressed(pathA, Gzip);
+    LOK_ASSERT(gzipNewA != nullptr);
+    LOK_ASSERT(gzipNewA != gzipA);
+    LOK_ASSERT_EQUAL(uint64_t(gzipNewA->size()),
+                     getCompressedFileCacheMetric("file_compression_cache_bytes"));
+
+    // Nothing is cached, or served, once shut down.
+    CompressedFileCache::shutdown();
+    LOK_ASSERT(!CompressedFileCache::isEnabled());
+    LOK_ASSERT(!CompressedFileCache::lookup(pathA, stA.modifiedTimepoint(), stA.size(), Gzip));
+    LOK_ASSERT_EQUAL(uint64_t(0), getCompressedFileCacheMetric("file_compression_cache_bytes"));
+
+    // The least recently used is evicted to stay within the budget.
+    CompressedFileCache::initialize(true, MaxBytes, MinFileSize, 1024 * 1024, 6);
+    const uint64_t evictions = getCompressedFileCacheMetric("file_compression_cache_evictions");
+
+    const Blob a = waitCompressed(pathA, Gzip);
+    const Blob b = waitCompressed(pathB, Gzip);
+    LOK_ASSERT(a != nullptr && b != nullptr);
+    LOK_ASSERT_EQUAL(uint64_t(a->size() + b->size()),
+                     getCompressedFileCacheMetric("file_compression_cache_bytes"));
+
+    // Use A, so B is the least recently used.
+    LOK_ASSERT(a ==
+               CompressedFileCache::lookup(pathA, stA.modifiedTimepoint(), stA.size(), Gzip));
+
+    const Blob c = waitCompressed(pathC, Gzip);
+    LOK_ASSERT(c != nullptr);
+    LOK_ASSERT_EQUAL(evictions + 1,
+                     getCompressedFileCacheMetric("file_compression_cache_evictions"));
+    LOK_ASSERT_EQUAL(uint64_t(2), getCompressedFileCacheMetric("file_compression_cache_files"));
+    LOK_ASSERT_EQUAL(uint64_t(a->size() + c->size()),
+                     getCompressedFileCacheMetric("file_compression_cache_bytes"));
+    LOK_ASSERT(getCompressedFileCacheMetric("file_compression_cache_bytes") <= MaxBytes);
+
+    LOK_ASSERT(a ==
+               CompressedFileCache::lookup(pathA, stA.modifiedTimepoint(), stA.size(), Gzip));
+    const FileUtil::Stat stB(pathB);
+    LOK_ASSERT(!CompressedFileCache::lookup(pathB, stB.modifiedTimepoint(), stB.size(), Gzip));
+
+    CompressedFileCache::shutdown();
+    FileUtil::removeFile(dir, true);
+}
+
 CPPUNIT_TEST_SUITE_REGISTRATION(FileServeTests);
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -23,8 +23,11 @@
 
 #include <chrono>
 #include <condition_variable>
+#include <fstream>
+#include <map>
 #include <mutex>
 #include <string>
+#include <thread>
 #include <test/lokassert.hpp>
 
 #if ENABLE_SSL
@@ -66,6 +69,9 @@ class HttpRequestTests final : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testTimeout);
     CPPUNIT_TEST(testOnFinished_Complete);
     CPPUNIT_TEST(testOnFinished_Timeout);
+    CPPUNIT_TEST(testKeepIdleConnection);
+    CPPUNIT_TEST(testSendFileRange);
+    CPPUNIT_TEST(testAsyncDNS);
 
     CPPUNIT_TEST_SUITE_END();
 
@@ -82,6 +88,9 @@ class HttpRequestTests final : public CPPUNIT_NS::TestFixture
     void testTimeout();
     void testOnFinished_Complete();
     void testOnFinished_Timeout();
+    void testKeepIdleConnection();
+    void testSendFileRange();
+    void testAsyncDNS();
 
     static constexpr std::chrono::seconds DefTimeoutSeconds{ 5 };
 
@@ -722,6 +731,252 @@ void HttpRequestTests::testOnFinished_Timeout()
     LOK_ASSERT(httpResponse->state() == http::Response::State::Timeout);
 }
 
+void HttpRequestTests::testKeepIdleConnection()
+{
+    constexpr auto testname = __func__;
+
+    const std::string URL = "/echo/idle";
+
+    http::Request httpRequest(URL);
+
+    auto httpSession = http::Session::create(_localUri);
+    httpSession->setTimeout(DefTimeoutSeconds);
+    httpSession->setKeepIdleConnection(true);
+
+    // The connection is parked once the response has been handled.
+    const auto waitIdle = [&]()
+    {
+        for (int i = 0; i < 100 && !httpSession->hasIdleConnection(); ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        return httpSession->hasIdleConnection();
+    };
+
+    // Each synchronous request polls in its own temporary SocketPoll.
+    int fd = -1;
+    for (int i = 0; i < 3; ++i)
+    {
+        TST_LOG("Sync request #" << i);
+        const std::shared_ptr<const http::Response> httpResponse =
+            httpSession->syncRequest(httpRequest);
+        LOK_ASSERT(httpResponse->state() == http::Response::State::Complete);
+        LOK_ASSERT_EQUAL(std::string("idle"), httpResponse->getBody());
+        LOK_ASSERT(waitIdle());
+
+        if (i == 0)
+            fd = httpSession->getFD();
+        LOK_ASSERT_EQUAL_MESSAGE("Expected to reuse the connection", fd, httpSession->getFD());
+    }
+
+    // And asynchronously from yet another poll.
+    SocketPoll pollThread("AsyncReqPoll");
+    pollThread.startThread();
+
+    std::condition_variable cv;
+    std::mutex mutex;
+    bool finished = false;
+    httpSession->setFinishedHandler(
+        [&](const std::shared_ptr<http::Session>&)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished = true;
+            cv.notify_all();
+        });
+
+    std::unique_lock<std::mutex> lock(mutex);
+    httpSession->asyncRequest(httpRequest, pollThread);
+    cv.wait_for(lock, DefTimeoutSeconds, [&]() { return finished; });
+    lock.unlock();
+
+    LOK_ASSERT_EQUAL_MESSAGE("Timed out waiting for the onFinished handler", true, finished);
+    LOK_ASSERT(httpSession->response()->state() == http::Response::State::Complete);
+    LOK_ASSERT_EQUAL(std::string("idle"), httpSession->response()->getBody());
+    LOK_ASSERT(waitIdle());
+    LOK_ASSERT_EQUAL_MESSAGE("Expected to reuse the connection", fd, httpSession->getFD());
+
+    // Closing it breaks the reference cycle with the socket.
+    httpSession->setKeepIdleConnection(false);
+    LOK_ASSERT(!httpSession->hasIdleConnection());
+    LOK_ASSERT(!httpSession->isConnected());
+    LOK_ASSERT_EQUAL(1L, httpSession.use_count());
+
+    pollThread.joinThread();
+}
+
+void HttpRequestTests::testSendFileRange()
+{
+    constexpr auto testname = __func__;
+
+    // Larger than a socket buffer, to stream it over several polls.
+    const std::string data = Util::rng::getHexString(1024 * 1024);
+    const std::string dir = FileUtil::createRandomTmpDir();
+    const std::string path = dir + "/sendfile.txt";
+    {
+        std::ofstream file(path, std::ios::binary);
+        file.write(data.data(), data.size());
+    }
+
+    const std::string URL = "/file" + path;
+    auto httpSession = http::Session::create(_localUri);
+    httpSession->setTimeout(DefTimeoutSeconds);
+
+    // The connection is kept alive, so each request follows a streamed response.
+    TST_LOG("Requesting the whole file");
+    http::Request httpRequest(URL);
+    std::shared_ptr<const http::Response> httpResponse = httpSession->syncRequest(httpRequest);
+    LOK_ASSERT(httpResponse->state() == http::Response::State::Complete);
+    LOK_ASSERT_EQUAL(http::StatusCode::OK, httpResponse->statusLine().statusCode());
+    LOK_ASSERT_EQUAL(std::string("bytes"), httpResponse->get("Accept-Ranges"));
+    LOK_ASSERT_EQUAL(data.size(), httpResponse->getBody().size());
+    LOK_ASSERT(data == httpResponse->getBody());
+
+    TST_LOG("Requesting a range of the file");
+    http::Request rangeRequest(URL);
+    rangeRequest.set("Range", "bytes=1000-199999");
+    httpResponse = httpSession->syncRequest(rangeRequest);
+    LOK_ASSERT(httpResponse->state() == http::Response::State::Complete);
+    LOK_ASSERT_EQUAL(http::StatusCode::PartialContent, httpResponse->statusLine().statusCode());
+    LOK_ASSERT_EQUAL("bytes 1000-199999/" + std::to_string(data.size()),
+                     httpResponse->get("Content-Range"));
+    LOK_ASSERT(data.substr(1000, 199000) == httpResponse->getBody());
+
+    TST_LOG("Requesting a range past the end of the file");
+    http::Request badRangeRequest(URL);
+    badRangeRequest.set("Range", "bytes=" + std::to_string(data.size()) + '-');
+    httpResponse = httpSession->syncRequest(badRangeRequest);
+    LOK_ASSERT(httpResponse->state() == http::Response::State::Complete);
+    LOK_ASSERT_EQUAL(http::StatusCode::RangeNotSatisfiable,
+                     httpResponse->statusLine().statusCode());
+    LOK_ASSERT_EQUAL("bytes */" + std::to_string(data.size()),
+                     httpResponse->get("Content-Range"));
+    LOK_ASSERT(httpResponse->getBody().empty());
+
+    FileUtil::removeFile(dir, true);
+}
+
+/// Resolves host names without the network, after some latency, counting the lookups
+/// as they complete. Those starting with "bad" fail, the others resolve to the loopback
+/// address.
+class FakeDNS
+{
+    std::mutex _mutex;
+    std::map<std::string, std::chrono::milliseconds> _latencies;
+    std::map<std::string, int> _lookupCounts;
+
+public:
+    void setLatency(const std::string& host, std::chrono::milliseconds latency)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _latencies[host] = latency;
+    }
+
+    int getLookupCount(const std::string& host)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _lookupCounts[host];
+    }
+
+    net::HostEntry lookup(const std::string& host, const std::string& port)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        const std::chrono::milliseconds latency = _latencies[host];
+        lock.unlock();
+
+        std::this_thread::sleep_for(latency);
+
+        lock.lock();
+        ++_lookupCounts[host];
+        lock.unlock();
+
+        if (host.starts_with("bad"))
+            return net::HostEntry(std::string(), nullptr);
+        return net::HostEntry("127.0.0.1", !port.empty() ? port.c_str() : nullptr);
+    }
+};
+
+void HttpRequestTests::testAsyncDNS()
+{
+    constexpr auto testname = __func__;
+
+    FakeDNS fakeDNS;
+    fakeDNS.setLatency("slow.test", std::chrono::milliseconds(1500));
+    fakeDNS.setLatency("fast.test", std::chrono::milliseconds(100));
+    net::setDNSLookup([&fakeDNS](const std::string& host, const std::string& port)
+                      { return fakeDNS.lookup(host, port); });
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool slowDone = false;
+    int fastDone = 0;
+    int fastGood = 0;
+
+    net::AsyncDNS::lookup(
+        "slow.test", std::string(),
+        [&](const net::HostEntry&)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            slowDone = true;
+            cv.notify_all();
+        },
+        []() { return std::string("slow.test"); });
+
+    constexpr int FastLookups = 5;
+    for (int i = 0; i < FastLookups; ++i)
+    {
+        net::AsyncDNS::lookup(
+            "fast.test", std::string(),
+            [&](const net::HostEntry& hostEntry)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ++fastDone;
+                if (hostEntry.good() && hostEntry.resolveHostAddress() == "127.0.0.1")
+                    ++fastGood;
+                cv.notify_all();
+            },
+            []() { return std::string("fast.test"); });
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait_for(lock, DefTimeoutSeconds, [&]() { return fastDone == FastLookups; });
+    LOK_ASSERT_EQUAL(FastLookups, fastDone);
+    LOK_ASSERT_EQUAL(FastLookups, fastGood);
+    LOK_ASSERT_MESSAGE("Expected the slow lookup not to hold up the others", !slowDone);
+    lock.unlock();
+
+    TST_LOG("Concurrent lookups of the same host are coalesced, then cached");
+    LOK_ASSERT_EQUAL(1, fakeDNS.getLookupCount("fast.test"));
+    LOK_ASSERT_EQUAL(std::string("127.0.0.1"), net::resolveAddresses("fast.test").front());
+    LOK_ASSERT_EQUAL(1, fakeDNS.getLookupCount("fast.test"));
+
+    TST_LOG("Failed lookups are cached too");
+    LOK_ASSERT(net::resolveAddresses("bad.test").empty());
+    LOK_ASSERT(net::resolveAddresses("bad.test").empty());
+    LOK_ASSERT_EQUAL(1, fakeDNS.getLookupCount("bad.test"));
+
+    TST_LOG("Expired entries are used while they are refreshed in the background");
+    net::setDNSCacheTTL(std::chrono::seconds(0), std::chrono::seconds(0),
+                        std::chrono::seconds(60));
+    LOK_ASSERT_EQUAL(std::string("127.0.0.1"), net::resolveAddresses("stale.test").front());
+    LOK_ASSERT_EQUAL(1, fakeDNS.getLookupCount("stale.test"));
+    // Far longer than answering from the cache takes, even on a loaded machine.
+    fakeDNS.setLatency("stale.test", std::chrono::seconds(2));
+    LOK_ASSERT_EQUAL(std::string("127.0.0.1"), net::resolveAddresses("stale.test").front());
+    LOK_ASSERT_MESSAGE("Expected the stale entry, not to wait for the refresh",
+                       fakeDNS.getLookupCount("stale.test") == 1);
+    const auto deadline = std::chrono::steady_clock::now() + DefTimeoutSeconds;
+    while (fakeDNS.getLookupCount("stale.test") < 2 && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    LOK_ASSERT_EQUAL(2, fakeDNS.getLookupCount("stale.test"));
+
+    lock.lock();
+    cv.wait_for(lock, DefTimeoutSeconds, [&]() { return slowDone; });
+    LOK_ASSERT(slowDone);
+    lock.unlock();
+
+    net::setDNSCacheTTL(std::chrono::seconds(20), std::chrono::seconds(5),
+                        std::chrono::seconds(60));
+    net::setDNSLookup(nullptr);
+}
+
 CPPUNIT_TEST_SUITE_REGISTRATION(HttpRequestTests);
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
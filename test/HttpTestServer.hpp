@@ -11,6 +11,7 @@
 
 #pragma once
 
+#include <net/HttpHelper.hpp>
 #include <net/HttpRequest.hpp>
 #include <net/Socket.hpp>
 #include <common/Log.hpp>
@@ -116,6 +117,14 @@ private:
             {
                 // Don't send anything back.
             }
+            else if (request.getUrl().starts_with("/file/"))
+            {
+                // /file/<absolute path> streams the file, honouring the Range header.
+                http::Response response(http::StatusCode::OK, fd);
+                HttpHelper::sendFile(socket, request.getUrl().substr(sizeof("/file") - 1),
+                                     response, /*noCache=*/true, std::string(),
+                                     /*headerOnly=*/false, request.get("Range"));
+            }
             else if (request.getUrl().starts_with("/inject"))
             {
                 // /inject/<hex data> sends back the data (in binary form)
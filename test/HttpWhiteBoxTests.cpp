@@ -35,6 +35,7 @@ class HttpWhiteBoxTests : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testRequestParserValidComplete);
     CPPUNIT_TEST(testRequestParserValidIncomplete);
     CPPUNIT_TEST(testClipboardIsOwnFormat);
+    CPPUNIT_TEST(testParseByteRange);
 
     CPPUNIT_TEST_SUITE_END();
 
@@ -46,6 +47,7 @@ class HttpWhiteBoxTests : public CPPUNIT_NS::TestFixture
     void testRequestParserValidComplete();
     void testRequestParserValidIncomplete();
     void testClipboardIsOwnFormat();
+    void testParseByteRange();
 };
 
 void HttpWhiteBoxTests::testStatusLineParserValidComplete()
@@ -249,6 +251,48 @@ PK)x";
     }
 }
 
+void HttpWhiteBoxTests::testParseByteRange()
+{
+    constexpr auto testname = __func__;
+
+    uint64_t first = 0;
+    uint64_t length = 0;
+
+    LOK_ASSERT_EQUAL(http::ByteRange::Partial, http::parseByteRange("bytes=0-99", 1000, first, length));
+    LOK_ASSERT_EQUAL(static_cast<uint64_t>(0), first);
+    LOK_ASSERT_EQUAL(static_cast<uint64_t>(100), length);
+
+    // Open-ended, and past the end.
+    LOK_ASSERT_EQUAL(http::ByteRange::Partial, http::parseByteRange("bytes=900-", 1000, first, length));
+    LOK_ASSERT_EQUAL(static_cast<uint64_t>(900), first);
+    LOK_ASSERT_EQUAL(static_cast<uint64_t>(100), length);
+    LOK_ASSERT_EQUAL(http::ByteRange::Partial,
+                     http::parseByteRange("bytes=990-2000", 1000, first, length));
+    LOK_ASSERT_EQUAL(static_cast<uint64_t>(990), first);
+    LOK_ASSERT_EQUAL(static_cast<uint64_t>(10), length);
+
+    // The last bytes.
+    LOK_ASSERT_EQUAL(http::ByteRange::Partial, http::parseByteRange("bytes=-10", 1000, first, length));
+    LOK_ASSERT_EQUAL(static_cast<uint64_t>(990), first);
+    LOK_ASSERT_EQUAL(static_cast<uint64_t>(10), length);
+    LOK_ASSERT_EQUAL(http::ByteRange::Partial, http::parseByteRange("bytes=-5000", 1000, first, length));
+    LOK_ASSERT_EQUAL(static_cast<uint64_t>(0), first);
+    LOK_ASSERT_EQUAL(static_cast<uint64_t>(1000), length);
+
+    LOK_ASSERT_EQUAL(http::ByteRange::Unsatisfiable,
+                     http::parseByteRange("bytes=1000-", 1000, first, length));
+    LOK_ASSERT_EQUAL(http::ByteRange::Unsatisfiable,
+                     http::parseByteRange("bytes=-0", 1000, first, length));
+
+    // What we serve whole.
+    LOK_ASSERT_EQUAL(http::ByteRange::Whole, http::parseByteRange("", 1000, first, length));
+    LOK_ASSERT_EQUAL(http::ByteRange::Whole, http::parseByteRange("items=0-9", 1000, first, length));
+    LOK_ASSERT_EQUAL(http::ByteRange::Whole,
+                     http::parseByteRange("bytes=0-9,20-29", 1000, first, length));
+    LOK_ASSERT_EQUAL(http::ByteRange::Whole, http::parseByteRange("bytes=9-0", 1000, first, length));
+    LOK_ASSERT_EQUAL(http::ByteRange::Whole, http::parseByteRange("bytes=a-b", 1000, first, length));
+}
+
 CPPUNIT_TEST_SUITE_REGISTRATION(HttpWhiteBoxTests);
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
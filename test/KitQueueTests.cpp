@@ -22,6 +22,9 @@
 
 #include <cppunit/extensions/HelperMacros.h>
 
+#include <chrono>
+#include <random>
+
 /// KitQueue unit-tests.
 class KitQueueTests : public CPPUNIT_NS::TestFixture
 {
@@ -32,10 +35,12 @@ class KitQueueTests : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testTileRecombining);
     CPPUNIT_TEST(testViewOrder);
     CPPUNIT_TEST(testPreviewsDeprioritization);
+    CPPUNIT_TEST(testTileQueueBenchmark);
     CPPUNIT_TEST(testSenderQueue);
     CPPUNIT_TEST(testSenderQueueProgress);
     CPPUNIT_TEST(testSenderQueueTileDeduplication);
     CPPUNIT_TEST(testInvalidateViewCursorDeduplication);
+    CPPUNIT_TEST(testSenderQueueInterleavedDeduplication);
     CPPUNIT_TEST(testCallbackModifiedStatusIsSkipped);
     CPPUNIT_TEST(testCallbackInvalidation);
     CPPUNIT_TEST(testCallbackIndicatorValue);
@@ -48,10 +53,12 @@ class KitQueueTests : public CPPUNIT_NS::TestFixture
     void testTileRecombining();
     void testViewOrder();
     void testPreviewsDeprioritization();
+    void testTileQueueBenchmark();
     void testSenderQueue();
     void testSenderQueueProgress();
     void testSenderQueueTileDeduplication();
     void testInvalidateViewCursorDeduplication();
+    void testSenderQueueInterleavedDeduplication();
     void testCallbackModifiedStatusIsSkipped();
     void testCallbackInvalidation();
     void testCallbackIndicatorValue();
@@ -295,6 +302,178 @@ namespace {
     }
 }
 
+namespace
+{
+/// Scores tiles like Document and ChildSession do: the best of the sessions of the
+/// tile's view, higher on their visible area, around it and at their cursor.
+class SessionsPrioritizer : public TilePrioritizer
+{
+public:
+    struct Session
+    {
+        int _view;
+        Util::Rectangle _visibleArea;
+        Util::Rectangle _cursor;
+    };
+
+    std::vector<Session> _sessions;
+
+    float getTilePriority(const std::chrono::steady_clock::time_point&,
+                          const TileDesc& tile) const override
+    {
+        float maxPrio = std::numeric_limits<float>::min();
+        for (const Session& session : _sessions)
+        {
+            if (session._view != tile.getNormalizedViewId())
+                continue;
+
+            float score = tile.intersects(session._visibleArea) ? 2.0 : 1.0;
+            if (tile.intersects(session._cursor))
+                score *= 2.0;
+
+            const Util::Rectangle r = tile.toAABBox();
+            const Util::Rectangle enlarged =
+                Util::Rectangle::create(r.getLeft() - r.getWidth(), r.getTop() - r.getHeight(),
+                                        r.getRight() + r.getWidth(), r.getBottom() + r.getHeight());
+            if (enlarged.intersects(session._visibleArea))
+                score *= 2.0;
+
+            maxPrio = std::max(maxPrio, score);
+        }
+        return maxPrio;
+    }
+};
+
+/// The tile queue before it was a heap: scores all the tiles on each pop.
+std::vector<TileDesc> popByScanning(std::vector<TileDesc>& queue, const TilePrioritizer& prio)
+{
+    const auto now = std::chrono::steady_clock::now();
+    size_t prioritized = 0;
+    float prioritySoFar = -1000.0;
+    for (size_t i = 0; i < queue.size(); ++i)
+    {
+        const float p = prio.getTilePriority(now, queue[i]);
+        if (p > prioritySoFar)
+        {
+            prioritySoFar = p;
+            prioritized = i;
+        }
+    }
+
+    std::vector<TileDesc> tiles{ queue[prioritized] };
+    queue.erase(queue.begin() + prioritized);
+    for (size_t i = 0; i < queue.size();)
+    {
+        if (tiles[0].canCombine(queue[i]))
+        {
+            tiles.push_back(queue[i]);
+            queue.erase(queue.begin() + i);
+        }
+        else
+            ++i;
+    }
+
+    return tiles;
+}
+} // namespace
+
+void KitQueueTests::testTileQueueBenchmark()
+{
+    constexpr auto testname = __func__;
+
+    // Tens of sessions on a few views, scrolling a long spreadsheet.
+    constexpr int Sessions = 40;
+    constexpr int Views = 8;
+    constexpr int Tiles = 5000;
+    constexpr int TileSize = 3840;
+
+    std::mt19937 random(42);
+    SessionsPrioritizer prio;
+    for (int i = 0; i < Sessions; ++i)
+    {
+        const int y = random() % 400 * TileSize;
+        prio._sessions.push_back({ i % Views, Util::Rectangle(0, y, 8 * TileSize, 4 * TileSize),
+                                   Util::Rectangle(random() % 8 * TileSize, y, 10, 300) });
+    }
+
+    std::vector<TileDesc> tiles;
+    for (int i = 0; i < Tiles; ++i)
+    {
+        tiles.emplace_back(random() % Views, 0, 0, 256, 256, random() % 24 * TileSize,
+                           random() % 400 * TileSize, TileSize, TileSize, -1, 0, -1);
+    }
+
+    const std::vector<SessionsPrioritizer::Session> sessions = prio._sessions;
+    const std::mt19937 moves = random;
+
+    // Move some views while rendering.
+    const auto moveView = [&](int round)
+    {
+        SessionsPrioritizer::Session& session = prio._sessions[round % Sessions];
+        const Util::Rectangle oldArea = session._visibleArea;
+        session._visibleArea = Util::Rectangle(0, random() % 400 * TileSize, 8 * TileSize,
+                                               4 * TileSize);
+        return oldArea;
+    };
+
+    KitQueue queue(prio);
+    std::vector<std::string> popped;
+    auto start = std::chrono::steady_clock::now();
+    for (const TileDesc& tile : tiles)
+        queue.put(tile.serialize("tile"));
+    for (int round = 0; queue.getTileQueueSize() > 0; ++round)
+    {
+        float priority;
+        const TileCombined combined = queue.popTileQueue(priority);
+        popped.push_back(combined.getTiles().size() == 1
+                             ? combined.getTiles()[0].serialize("tile")
+                             : combined.serialize("tilecombine"));
+        if (round % 10 == 0)
+        {
+            const int view = prio._sessions[round % Sessions]._view;
+            const Util::Rectangle oldArea = moveView(round);
+            queue.reprioritizeTiles(view, oldArea);
+            queue.reprioritizeTiles(view, prio._sessions[round % Sessions]._visibleArea);
+        }
+    }
+    const auto heapTime = std::chrono::steady_clock::now() - start;
+
+    // The same, scanning the queue.
+    prio._sessions = sessions;
+    random = moves;
+
+    std::vector<TileDesc> scanQueue;
+    std::vector<std::string> scanned;
+    start = std::chrono::steady_clock::now();
+    for (const TileDesc& tile : tiles)
+    {
+        std::erase(scanQueue, tile);
+        scanQueue.push_back(tile);
+    }
+    for (int round = 0; !scanQueue.empty(); ++round)
+    {
+        const std::vector<TileDesc> combined = popByScanning(scanQueue, prio);
+        scanned.push_back(combined.size() == 1
+                              ? combined[0].serialize("tile")
+                              : TileCombined::create(combined).serialize("tilecombine"));
+        if (round % 10 == 0)
+            moveView(round);
+    }
+    const auto scanTime = std::chrono::steady_clock::now() - start;
+
+    TST_LOG("Rendering " << Tiles << " tiles of " << Sessions << " sessions, in "
+                         << popped.size() << " batches, took "
+                         << std::chrono::duration_cast<std::chrono::milliseconds>(heapTime)
+                         << " with the heap, and "
+                         << std::chrono::duration_cast<std::chrono::milliseconds>(scanTime)
+                         << " scanning the queue");
+
+    // In the same order.
+    LOK_ASSERT_EQUAL(scanned.size(), popped.size());
+    for (size_t i = 0; i < scanned.size(); ++i)
+        LOK_ASSERT_EQUAL(scanned[i], popped[i]);
+}
+
 void KitQueueTests::testSenderQueue()
 {
     constexpr auto testname = __func__;
@@ -494,6 +673,66 @@ void KitQueueTests::testInvalidateViewCursorDeduplication()
     LOK_ASSERT_EQUAL(static_cast<size_t>(0), queue.size());
 }
 
+void KitQueueTests::testSenderQueueInterleavedDeduplication()
+{
+    constexpr auto testname = __func__;
+
+    SenderQueue<std::shared_ptr<Message>> queue;
+
+    std::shared_ptr<Message> item;
+
+    // Enough rounds for the superseded messages to be compacted away.
+    constexpr int Rounds = 200;
+    constexpr int Views = 10;
+    for (int round = 0; round < Rounds; ++round)
+    {
+        for (int view = 0; view < Views; ++view)
+        {
+            queue.enqueue(std::make_shared<Message>(
+                "invalidateviewcursor: { \"viewId\": \"" + std::to_string(view) +
+                    "\", \"rectangle\": \"" + std::to_string(round) + ", 1418, 0, 298\" }",
+                Message::Dir::Out));
+        }
+
+        queue.enqueue(
+            std::make_shared<Message>("setpart: part=" + std::to_string(round), Message::Dir::Out));
+        queue.enqueue(
+            std::make_shared<Message>("message " + std::to_string(round), Message::Dir::Out));
+    }
+
+    LOK_ASSERT_EQUAL(static_cast<size_t>(Rounds + Views + 1), queue.size());
+
+    // The other messages keep their order, the last of each kind is at the end.
+    for (int round = 0; round < Rounds - 1; ++round)
+    {
+        LOK_ASSERT_EQUAL_STR(true, queue.dequeue(item));
+        LOK_ASSERT_EQUAL("message " + std::to_string(round), msgStr(item));
+    }
+
+    for (int view = 0; view < Views; ++view)
+    {
+        LOK_ASSERT_EQUAL_STR(true, queue.dequeue(item));
+        LOK_ASSERT_EQUAL("invalidateviewcursor: { \"viewId\": \"" + std::to_string(view) +
+                             "\", \"rectangle\": \"" + std::to_string(Rounds - 1) +
+                             ", 1418, 0, 298\" }",
+                         msgStr(item));
+    }
+
+    LOK_ASSERT_EQUAL_STR(true, queue.dequeue(item));
+    LOK_ASSERT_EQUAL("setpart: part=" + std::to_string(Rounds - 1), msgStr(item));
+    LOK_ASSERT_EQUAL_STR(true, queue.dequeue(item));
+    LOK_ASSERT_EQUAL("message " + std::to_string(Rounds - 1), msgStr(item));
+    LOK_ASSERT_EQUAL_STR(false, queue.dequeue(item));
+    LOK_ASSERT_EQUAL(static_cast<size_t>(0), queue.size());
+
+    // Still deduplicated once dequeued.
+    queue.enqueue(std::make_shared<Message>("setpart: part=1", Message::Dir::Out));
+    queue.enqueue(std::make_shared<Message>("setpart: part=2", Message::Dir::Out));
+    LOK_ASSERT_EQUAL(static_cast<size_t>(1), queue.size());
+    LOK_ASSERT_EQUAL_STR(true, queue.dequeue(item));
+    LOK_ASSERT_EQUAL(std::string("setpart: part=2"), msgStr(item));
+}
+
 // back-compatible method from before putCallback implementation
 void putCallback(KitQueue &queue, const std::string &str)
 {
@@ -65,6 +65,8 @@ class TileCacheTests : public CPPUNIT_NS::TestFixture
 
     CPPUNIT_TEST(testDesc);
     CPPUNIT_TEST(testSimple);
+    CPPUNIT_TEST(testEviction);
+    CPPUNIT_TEST(testSpeculativeTiles);
     CPPUNIT_TEST(testSimpleCombine);
     CPPUNIT_TEST(testTileSubscription);
     CPPUNIT_TEST(testSize);
@@ -103,6 +105,8 @@ class TileCacheTests : public CPPUNIT_NS::TestFixture
 
     void testDesc();
     void testSimple();
+    void testEviction();
+    void testSpeculativeTiles();
     void testSimpleCombine();
     void testTileSubscription();
     void testSize();
@@ -210,15 +214,24 @@ void TileCacheTests::testDesc()
     LOK_ASSERT_MESSAGE("TileDesc should match, ignoring unimportant fields", pred(descA, descB));
 }
 
-void TileCacheTests::testSimple()
+namespace
 {
-    constexpr auto testname = __func__;
-
-    if (isStandalone())
+/// The TileCache needs the wsd unit, which standalone, the first test to run loads.
+void initWsdUnit()
+{
+    if (isStandalone() && !UnitBase::get(UnitBase::UnitType::Wsd))
     {
         if (!UnitWSD::init(UnitWSD::UnitType::Wsd, ""))
             throw std::runtime_error("Failed to load wsd unit test library.");
     }
+}
+} // namespace
+
+void TileCacheTests::testSimple()
+{
+    constexpr auto testname = __func__;
+
+    initWsdUnit();
 
     // Create TileCache and pretend the file was modified as recently as
     // now, so it discards the cached data.
@@ -261,6 +274,126 @@ void TileCacheTests::testSimple()
     LOK_ASSERT_MESSAGE("found tile when none was expected", !tileData || !tileData->isValid());
 }
 
+void TileCacheTests::testEviction()
+{
+    constexpr auto testname = __func__;
+
+    initWsdUnit();
+
+    for (const std::string policy : { "lru", "visible" })
+    {
+        TileCache tc("doc.ods", std::chrono::system_clock::time_point());
+        tc.setEvictionPolicy(TileCache::createEvictionPolicy(policy));
+        // Only the top-left tile is on screen.
+        tc.setVisibilityCheck([](const TileDesc& tile) { return tile.getTilePosX() == 0; });
+
+        std::vector<TileDesc> tiles;
+        std::vector<char> data = genRandomData(4096);
+        data[0] = 'Z'; // compressed pixels.
+        const auto now = std::chrono::steady_clock::now();
+        for (int i = 0; i < 8; ++i)
+        {
+            tiles.emplace_back(0, 0, 0, 256, 256, i * 3840, 0, 3840, 3840, -1, 0, i + 1);
+            tc.saveTileAndNotify(tiles.back(), data.data(), data.size());
+        }
+
+        // Make the ages distinct, a second apart, the first tile the oldest.
+        for (int i = 0; i < 8; ++i)
+        {
+            Tile tile = tc.lookupTile(tiles[i]);
+            LOK_ASSERT(tile);
+            tile->_lastUsed = now - std::chrono::seconds(8 - i);
+        }
+
+        // Touching the oldest tile makes it the most recently used.
+        if (policy == "lru")
+            LOK_ASSERT(tc.lookupTile(tiles[0]));
+        LOK_ASSERT(!tc.lookupTile(TileDesc(0, 1, 0, 256, 256, 0, 0, 3840, 3840, -1, 0, -1)));
+
+        // Frees more than a quarter of the budget: two tiles.
+        tc.setMaxCacheSize(6 * data.size());
+        LOK_ASSERT_EQUAL(uint64_t(2), tc.getEvictionCount());
+        LOK_ASSERT_EQUAL(uint64_t(1), tc.getMissCount());
+
+        LOK_ASSERT_MESSAGE(policy + " evicted the kept tile", tc.lookupTile(tiles[0]));
+        LOK_ASSERT_MESSAGE(policy + " kept an old tile", !tc.lookupTile(tiles[1]));
+        LOK_ASSERT_MESSAGE(policy + " kept an old tile", !tc.lookupTile(tiles[2]));
+        for (size_t i = 3; i < tiles.size(); ++i)
+            LOK_ASSERT_MESSAGE(policy + " evicted a recent tile", tc.lookupTile(tiles[i]));
+    }
+}
+
+void TileCacheTests::testSpeculativeTiles()
+{
+    constexpr auto testname = __func__;
+
+    // Room for three tiles until they are rendered.
+    SpeculativeTileTracker tracker(3 * SpeculativeTileTracker::EstimatedTileSize,
+                                   std::chrono::seconds(10));
+    const auto now = std::chrono::steady_clock::now();
+
+    std::vector<TileDesc> tiles;
+    for (int i = 0; i < 4; ++i)
+        tiles.emplace_back(0, 0, 0, 256, 256, 0, i * 3840, 3840, 3840, -1, 0, -1);
+
+    LOK_ASSERT(tracker.add(tiles[0], now));
+    LOK_ASSERT_MESSAGE("tracked a tile twice", !tracker.add(tiles[0], now));
+    LOK_ASSERT(tracker.add(tiles[1], now));
+    LOK_ASSERT(tracker.add(tiles[2], now + std::chrono::seconds(5)));
+    LOK_ASSERT_MESSAGE("exceeded the budget", !tracker.hasRoom());
+    LOK_ASSERT(tracker.isRendering(tiles[0]));
+    LOK_ASSERT(!tracker.isRendering(tiles[3]));
+    LOK_ASSERT(!tracker.add(tiles[3], now));
+    LOK_ASSERT_EQUAL(uint64_t(3), tracker.getRequestCount());
+
+    // Rendering small tiles frees some of the budget.
+    tracker.rendered(tiles[0], 1024);
+    tracker.rendered(tiles[1], 1024);
+    LOK_ASSERT(tracker.hasRoom());
+    LOK_ASSERT_EQUAL(2048 + SpeculativeTileTracker::EstimatedTileSize, tracker.getBytes());
+    LOK_ASSERT(!tracker.isRendering(tiles[0]));
+    LOK_ASSERT(tracker.isRendering(tiles[2]));
+
+    // A rendered tile requested from the cache is a hit, an unrendered one a miss.
+    tracker.requested(tiles[0], true);
+    tracker.requested(tiles[2], false);
+    tracker.requested(tiles[3], false);
+    LOK_ASSERT_EQUAL(uint64_t(1), tracker.getHitCount());
+    LOK_ASSERT_EQUAL(uint64_t(1), tracker.getMissCount());
+    LOK_ASSERT_EQUAL(size_t(1), tracker.size());
+    LOK_ASSERT_EQUAL(size_t(1024), tracker.getBytes());
+
+    // Nobody scrolled to the last ones in time; only one was rendered.
+    LOK_ASSERT(tracker.add(tiles[3], now + std::chrono::seconds(5)));
+    LOK_ASSERT(tracker.expire(now + std::chrono::seconds(5)).empty());
+    LOK_ASSERT_EQUAL(size_t(2), tracker.size());
+    LOK_ASSERT(tracker.expire(now + std::chrono::seconds(10)).empty());
+    LOK_ASSERT_EQUAL(size_t(1), tracker.size());
+    const std::vector<TileDesc> unrendered = tracker.expire(now + std::chrono::seconds(15));
+    LOK_ASSERT_EQUAL(size_t(1), unrendered.size());
+    LOK_ASSERT(unrendered[0] == tiles[3]);
+    LOK_ASSERT_EQUAL(size_t(0), tracker.size());
+    LOK_ASSERT_EQUAL(size_t(0), tracker.getBytes());
+    LOK_ASSERT_EQUAL(uint64_t(2), tracker.getExpiredCount());
+
+    // A speculative render is in flight, without subscribers, until done or forgotten.
+    initWsdUnit();
+    TileCache tc("doc.ods", std::chrono::system_clock::time_point());
+    tiles[0].setVersion(1);
+    tc.registerTileBeingRendered(tiles[0], now);
+    tc.registerTileBeingRendered(tiles[1], now);
+    LOK_ASSERT(tc.hasTileBeingRendered(tiles[0], &now));
+    LOK_ASSERT_EQUAL(1, tc.getTileBeingRenderedVersion(tiles[0]));
+
+    const std::vector<char> data = genRandomData(1024);
+    tc.saveTileAndNotify(tiles[0], data.data(), data.size());
+    LOK_ASSERT(!tc.hasTileBeingRendered(tiles[0]));
+    LOK_ASSERT(tc.lookupTile(tiles[0]));
+
+    tc.forgetUnsubscribedTileBeingRendered(tiles[1]);
+    LOK_ASSERT(!tc.hasTileBeingRendered(tiles[1]));
+}
+
 void TileCacheTests::testSimpleCombine()
 {
     const std::string testname = "simpleCombine-";
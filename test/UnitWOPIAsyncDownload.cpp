@@ -0,0 +1,180 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <config.h>
+
+#include "HttpRequest.hpp"
+#include "lokassert.hpp"
+
+#include <WopiTestServer.hpp>
+#include <Log.hpp>
+#include <Unit.hpp>
+#include <UnitHTTP.hpp>
+#include <helpers.hpp>
+#include <wsd/COOLWSD.hpp>
+#include <Poco/Net/HTTPRequest.h>
+
+#include <chrono>
+
+/// Test loading a document that the WOPI host is slow to send.
+/// GetFile sends the headers and half of the body, then stalls.
+/// The load must be held meanwhile, and the client told of the
+/// download progress. Once the rest arrives, the document loads.
+/// When the host drops the connection instead, the load fails.
+class UnitWOPIAsyncDownload : public WopiTestServer
+{
+    STATE_ENUM(Phase, Load, WaitGetFile, StallGetFile, WaitLoadStatus, Done) _phase;
+
+    /// How long to stall GetFile, once the session is added.
+    static constexpr std::chrono::seconds StallDuration = std::chrono::seconds(2);
+
+    /// Whether GetFile drops the connection, rather than completing.
+    const bool _failDownload;
+
+    /// The GetFile socket, while stalled.
+    std::shared_ptr<StreamSocket> _getFileSocket;
+    std::chrono::steady_clock::time_point _stallStart;
+    bool _sessionAdded;
+    bool _downloadProgress;
+
+public:
+    UnitWOPIAsyncDownload(const std::string& name, bool failDownload)
+        : WopiTestServer(name)
+        , _phase(Phase::Load)
+        , _failDownload(failDownload)
+        , _sessionAdded(false)
+        , _downloadProgress(false)
+    {
+    }
+
+    bool handleGetFileRequest(const Poco::Net::HTTPRequest& /*request*/,
+                              std::shared_ptr<StreamSocket>& socket) override
+    {
+        LOK_ASSERT_STATE(_phase, Phase::WaitGetFile);
+        TRANSITION_STATE(_phase, Phase::StallGetFile);
+
+        const std::string& content = getFileContent();
+        LOG_TST("FakeWOPIHost: Response to GetFile: 200 OK, stalling after "
+                << content.size() / 2 << " of " << content.size() << " bytes");
+
+        http::Response httpResponse(http::StatusCode::OK);
+        httpResponse.set("Last-Modified", Util::getHttpTime(getFileLastModifiedTime()));
+        httpResponse.set("Content-Type", "application/octet-stream");
+        httpResponse.setContentLength(content.size());
+        httpResponse.header().setConnectionToken(http::Header::ConnectionToken::Close);
+        socket->send(httpResponse);
+        socket->send(content.substr(0, content.size() / 2));
+
+        _getFileSocket = socket;
+        _stallStart = std::chrono::steady_clock::now();
+        return true;
+    }
+
+    void onDocBrokerAddSession(const std::string&,
+                               const std::shared_ptr<ClientSession>&) override
+    {
+        LOG_TST("Session added while in " << name(_phase));
+        _sessionAdded = true;
+    }
+
+    bool onFilterSendWebSocketMessage(const char* data, const std::size_t len,
+                                      const WSOpCode /* code */, const bool /* flush */,
+                                      int& /*unitReturn*/) override
+    {
+        const std::string message(data, len);
+
+        if (message.starts_with("progress: { \"id\":\"download\""))
+        {
+            LOG_TST("Download progress: " << message);
+            _downloadProgress = true;
+        }
+        else if (message.starts_with("error: cmd=storage kind=loadfailed"))
+        {
+            LOG_TST("Load failed: " << message);
+            LOK_ASSERT_MESSAGE("Unexpected load failure", _failDownload);
+            LOK_ASSERT_STATE(_phase, Phase::WaitLoadStatus);
+
+            TRANSITION_STATE(_phase, Phase::Done);
+            passTest("The load failed with the download");
+        }
+
+        return false;
+    }
+
+    bool onDocumentLoaded(const std::string& message) override
+    {
+        LOG_TST("Doc (" << name(_phase) << "): [" << message << ']');
+        LOK_ASSERT_MESSAGE("Expected the load to fail with the download", !_failDownload);
+
+        // Loading before the download completed means the load wasn't held.
+        LOK_ASSERT_STATE(_phase, Phase::WaitLoadStatus);
+        LOK_ASSERT_MESSAGE("Expected download progress before loading", _downloadProgress);
+
+        TRANSITION_STATE(_phase, Phase::Done);
+        passTest("The load was held until downloaded");
+        return true;
+    }
+
+    void invokeWSDTest() override
+    {
+        switch (_phase)
+        {
+            case Phase::Load:
+            {
+                TRANSITION_STATE(_phase, Phase::WaitGetFile);
+
+                LOG_TST("Load: initWebsocket.");
+                initWebsocket("/wopi/files/0?access_token=anything");
+
+                WSD_CMD("load url=" + getWopiSrc());
+                break;
+            }
+            case Phase::StallGetFile:
+            {
+                // Give the load ample time to go through, were it not held.
+                if (!_sessionAdded ||
+                    std::chrono::steady_clock::now() - _stallStart < StallDuration)
+                    break;
+
+                TRANSITION_STATE(_phase, Phase::WaitLoadStatus);
+
+                // The socket belongs to the poll that handled the request.
+                const std::string& content = getFileContent();
+                std::string rest = _failDownload ? std::string()
+                                                 : content.substr(content.size() / 2);
+                LOG_TST("Resuming GetFile with " << rest.size() << " bytes, then closing");
+                COOLWSD::getWebServerPoll()->addCallback(
+                    [socket = std::move(_getFileSocket), rest = std::move(rest)]()
+                    {
+                        if (!rest.empty())
+                            socket->send(rest);
+                        socket->shutdown();
+                    });
+                break;
+            }
+            case Phase::WaitGetFile:
+            case Phase::WaitLoadStatus:
+            case Phase::Done:
+                break;
+        }
+    }
+};
+
+UnitBase** unit_create_wsd_multi(void)
+{
+    return new UnitBase* [3]
+    {
+        new UnitWOPIAsyncDownload("UnitWOPIAsyncDownload", /*failDownload=*/false),
+        new UnitWOPIAsyncDownload("UnitWOPIAsyncDownloadFail", /*failDownload=*/true), nullptr
+    };
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
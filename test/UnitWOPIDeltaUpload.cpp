@@ -0,0 +1,154 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <config.h>
+
+#include "HttpRequest.hpp"
+#include "lokassert.hpp"
+
+#include <WopiTestServer.hpp>
+#include <Log.hpp>
+#include <Unit.hpp>
+#include <UnitHTTP.hpp>
+#include <helpers.hpp>
+#include <Poco/Net/HTTPRequest.h>
+#include <Poco/Util/LayeredConfiguration.h>
+
+/// Test uploading the delta of a modified document, in chunks, to a host
+/// that supports it. The host asks to resume from the start once.
+class UnitWOPIDeltaUpload : public WopiTestServer
+{
+    STATE_ENUM(Phase, Load, WaitLoadStatus, WaitPutFile, WaitDestroy) _phase;
+
+    /// The chunks of the delta we got, including the final one.
+    std::size_t _chunks;
+    bool _resumed;
+    std::string _originalContent;
+
+public:
+    UnitWOPIDeltaUpload()
+        : WopiTestServer("UnitWOPIDeltaUpload", "non-shape-image.odt")
+        , _phase(Phase::Load)
+        , _chunks(0)
+        , _resumed(false)
+        , _originalContent(getFileContent())
+    {
+    }
+
+    void configure(Poco::Util::LayeredConfiguration& config) override
+    {
+        WopiTestServer::configure(config);
+
+        // Small, to upload the delta in a few chunks.
+        config.setBool("storage.delta_upload[@enable]", true);
+        config.setUInt("storage.delta_upload.chunk_size", 2048);
+    }
+
+    void configCheckFileInfo(const Poco::Net::HTTPRequest& /*request*/,
+                             Poco::JSON::Object::Ptr& fileInfo) override
+    {
+        fileInfo->set("SupportsDeltaUpload", "true");
+    }
+
+    bool handleWopiUpload(const Poco::Net::HTTPRequest& request, Poco::MemoryInputStream& message,
+                          std::shared_ptr<StreamSocket>& socket) override
+    {
+        LOK_ASSERT_STATE(_phase, Phase::WaitPutFile);
+        LOK_ASSERT_EQUAL(std::string("delta"), request.get("X-COOL-WOPI-Upload-Encoding", ""));
+
+        const std::string offset = request.get("X-COOL-WOPI-Upload-Offset");
+        LOG_TST("Delta chunk #" << _chunks << " at " << offset << " of "
+                                << request.get("X-COOL-WOPI-Upload-Length"));
+        LOK_ASSERT(request.getContentLength() <= 2048);
+        ++_chunks;
+
+        if (!_resumed && offset != "0")
+        {
+            // As if we lost what we had.
+            _resumed = true;
+            http::Response httpResponse(http::StatusCode::RangeNotSatisfiable);
+            httpResponse.set("X-COOL-WOPI-Upload-Offset", "0");
+            httpResponse.setContentLength(0);
+            socket->sendAndShutdown(httpResponse);
+            return true;
+        }
+
+        return WopiTestServer::handleWopiUpload(request, message, socket);
+    }
+
+    std::unique_ptr<http::Response>
+    assertPutFileRequest(const Poco::Net::HTTPRequest& request) override
+    {
+        // Only the final chunk.
+        LOK_ASSERT_STATE(_phase, Phase::WaitPutFile);
+        LOK_ASSERT_EQUAL(std::string("true"), request.get("X-COOL-WOPI-IsModifiedByUser"));
+        LOK_ASSERT(_resumed);
+        LOK_ASSERT_MESSAGE("Expected the delta in a few chunks", _chunks > 2);
+
+        TRANSITION_STATE(_phase, Phase::WaitDestroy);
+
+        // Apply it.
+        return nullptr;
+    }
+
+    /// The document is loaded.
+    bool onDocumentLoaded(const std::string& message) override
+    {
+        LOG_TST("onDocumentLoaded: [" << message << ']');
+        LOK_ASSERT_STATE(_phase, Phase::WaitLoadStatus);
+
+        TRANSITION_STATE(_phase, Phase::WaitPutFile);
+
+        WSD_CMD("key type=input char=97 key=0");
+        WSD_CMD("key type=up char=0 key=512");
+        WSD_CMD("closedocument");
+
+        return true;
+    }
+
+    // Wait for clean unloading.
+    void onDocBrokerDestroy(const std::string& docKey) override
+    {
+        LOG_TST("Destroyed dockey [" << docKey << ']');
+        LOK_ASSERT_STATE(_phase, Phase::WaitDestroy);
+
+        // The host has the modified document, from its delta.
+        LOK_ASSERT(getFileContent().starts_with("PK"));
+        LOK_ASSERT(getFileContent() != _originalContent);
+
+        passTest("Uploaded the delta of the document as expected.");
+    }
+
+    void invokeWSDTest() override
+    {
+        switch (_phase)
+        {
+            case Phase::Load:
+            {
+                TRANSITION_STATE(_phase, Phase::WaitLoadStatus);
+
+                LOG_TST("Load: initWebsocket.");
+                initWebsocket("/wopi/files/0?access_token=anything");
+
+                WSD_CMD("load url=" + getWopiSrc());
+                break;
+            }
+            case Phase::WaitLoadStatus:
+            case Phase::WaitPutFile:
+            case Phase::WaitDestroy:
+                break;
+        }
+    }
+};
+
+UnitBase* unit_create_wsd(void) { return new UnitWOPIDeltaUpload(); }
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,186 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <config.h>
+
+#include <test/lokassert.hpp>
+
+#include <random>
+#include <string>
+
+#include <wsd/UploadDelta.hpp>
+
+#include <cppunit/extensions/HelperMacros.h>
+
+/// UploadDelta unit-tests.
+class UploadDeltaTests : public CPPUNIT_NS::TestFixture
+{
+    CPPUNIT_TEST_SUITE(UploadDeltaTests);
+
+    CPPUNIT_TEST(testIdentical);
+    CPPUNIT_TEST(testEdits);
+    CPPUNIT_TEST(testSmall);
+    CPPUNIT_TEST(testWrongBase);
+    CPPUNIT_TEST(testCorrupted);
+    CPPUNIT_TEST(testChunks);
+
+    CPPUNIT_TEST_SUITE_END();
+
+    void testIdentical();
+    void testEdits();
+    void testSmall();
+    void testWrongBase();
+    void testCorrupted();
+    void testChunks();
+};
+
+namespace
+{
+std::string randomData(std::size_t size, unsigned seed)
+{
+    std::mt19937 rng(seed);
+    std::string data(size, '\0');
+    for (char& c : data)
+        c = static_cast<char>(rng());
+
+    return data;
+}
+} // namespace
+
+void UploadDeltaTests::testIdentical()
+{
+    constexpr auto testname = __func__;
+
+    const std::string base = randomData(1024 * 1024, 1);
+    const std::string delta = UploadDelta::compute(base, base);
+
+    // A single copy.
+    LOK_ASSERT_EQUAL(UploadDelta::HeaderSize + 17, delta.size());
+
+    std::string target;
+    LOK_ASSERT(UploadDelta::apply(base, delta, target));
+    LOK_ASSERT(target == base);
+}
+
+void UploadDeltaTests::testEdits()
+{
+    constexpr auto testname = __func__;
+
+    // Modified, shifted, inserted, dropped, as a zip is when one entry changes.
+    const std::string base = randomData(1024 * 1024, 2);
+    const std::string inserted = randomData(5000, 3);
+    const std::string target = base.substr(0, 300000) + "changed" + base.substr(300100, 400000) +
+                               inserted + base.substr(800000, 100000) + base.substr(0, 10000);
+
+    const std::string delta = UploadDelta::compute(base, target);
+    LOK_ASSERT_MESSAGE("Expected the delta to be about what changed",
+                       delta.size() < inserted.size() + 2 * UploadDelta::BlockSize);
+
+    std::string result;
+    LOK_ASSERT(UploadDelta::apply(base, delta, result));
+    LOK_ASSERT(result == target);
+}
+
+void UploadDeltaTests::testSmall()
+{
+    constexpr auto testname = __func__;
+
+    const std::string data = randomData(5000, 4);
+    const std::pair<std::string, std::string> cases[] = {
+        { std::string(), std::string() },
+        { std::string(), data },
+        { data, std::string() },
+        { data.substr(0, 100), data },
+        { data, data.substr(0, 100) },
+        { data, data.substr(1) },
+    };
+
+    for (const auto& [base, target] : cases)
+    {
+        std::string result;
+        LOK_ASSERT(UploadDelta::apply(base, UploadDelta::compute(base, target), result));
+        LOK_ASSERT(result == target);
+    }
+}
+
+void UploadDeltaTests::testWrongBase()
+{
+    constexpr auto testname = __func__;
+
+    std::string base = randomData(100000, 5);
+    const std::string target = base.substr(0, 50000) + "changed" + base.substr(50000);
+    const std::string delta = UploadDelta::compute(base, target);
+
+    // The host has another version.
+    base[10] ^= 1;
+    std::string result;
+    LOK_ASSERT(!UploadDelta::apply(base, delta, result));
+    LOK_ASSERT(!UploadDelta::apply(base.substr(1), delta, result));
+}
+
+void UploadDeltaTests::testCorrupted()
+{
+    constexpr auto testname = __func__;
+
+    const std::string base = randomData(100000, 6);
+    const std::string target = base.substr(0, 50000) + "changed" + base.substr(50000);
+    const std::string delta = UploadDelta::compute(base, target);
+
+    // Never a wrong document, whatever byte is wrong.
+    for (std::size_t i = 0; i < delta.size(); ++i)
+    {
+        std::string corrupted = delta;
+        corrupted[i] ^= 0x5a;
+        std::string result;
+        if (UploadDelta::apply(base, corrupted, result))
+            LOK_ASSERT(result == target);
+    }
+
+    std::string result;
+    LOK_ASSERT(!UploadDelta::apply(base, delta.substr(0, delta.size() - 1), result));
+    LOK_ASSERT(!UploadDelta::apply(base, delta.substr(0, UploadDelta::HeaderSize - 1), result));
+    LOK_ASSERT(!UploadDelta::apply(base, delta + 'I', result));
+}
+
+void UploadDeltaTests::testChunks()
+{
+    constexpr auto testname = __func__;
+
+    UploadDelta::Chunks chunks;
+    LOK_ASSERT(chunks.add("a", 0, 10, "hello"));
+    LOK_ASSERT(!chunks.isComplete());
+
+    // Out of order: resume from what we have.
+    LOK_ASSERT(!chunks.add("a", 3, 10, "lo"));
+    LOK_ASSERT(!chunks.add("a", 8, 10, "ld"));
+    LOK_ASSERT_EQUAL(static_cast<uint64_t>(5), chunks.offset());
+
+    LOK_ASSERT(chunks.add("a", 5, 10, "world"));
+    LOK_ASSERT(chunks.isComplete());
+    LOK_ASSERT_EQUAL(std::string("helloworld"), chunks.take());
+    LOK_ASSERT(!chunks.isComplete());
+
+    // Another upload, or this one again, starts over.
+    LOK_ASSERT(chunks.add("b", 0, 4, "ab"));
+    LOK_ASSERT(!chunks.add("c", 2, 4, "cd"));
+    LOK_ASSERT_EQUAL(static_cast<uint64_t>(0), chunks.offset());
+    LOK_ASSERT(chunks.add("c", 0, 4, "ab"));
+    LOK_ASSERT(chunks.add("c", 0, 4, "ab"));
+    LOK_ASSERT(chunks.add("c", 2, 4, "cd"));
+    LOK_ASSERT_EQUAL(std::string("abcd"), chunks.take());
+
+    // Too much.
+    LOK_ASSERT(!chunks.add("d", 0, 2, "abc"));
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION(UploadDeltaTests);
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
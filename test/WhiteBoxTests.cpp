@@ -22,18 +22,23 @@
 #include <FileUtil.hpp>
 #include <Kit.hpp>
 #include <Protocol.hpp>
+#include <TileCache.hpp>
 #include <TileDesc.hpp>
 #include <Util.hpp>
 #include <JsonUtil.hpp>
 
 #include <common/Message.hpp>
 #include <common/ThreadPool.hpp>
+#include <common/TraceBuffer.hpp>
 #include <wsd/FileServer.hpp>
 #include <net/Buffer.hpp>
 #include <net/NetUtil.hpp>
+#include <net/WebSocketDeflate.hpp>
+#include <net/WebSocketHandler.hpp>
 
 #include <chrono>
 #include <fstream>
+#include <thread>
 
 #include <cppunit/extensions/HelperMacros.h>
 
@@ -52,6 +57,8 @@ class WhiteBoxTests : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testRegexListMatcher_Init);
     CPPUNIT_TEST(testTileDesc);
     CPPUNIT_TEST(testTileData);
+    CPPUNIT_TEST(testClientDeltaTracker);
+    CPPUNIT_TEST(testClientDeltaTrackerSplitPanes);
     CPPUNIT_TEST(testRectanglesIntersect);
     CPPUNIT_TEST(testJson);
     CPPUNIT_TEST(testAnonymization);
@@ -67,6 +74,10 @@ class WhiteBoxTests : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testJsonUtilEscapeJSONValue);
     CPPUNIT_TEST(testFindInVector);
     CPPUNIT_TEST(testThreadPool);
+    CPPUNIT_TEST(testThreadPoolTasks);
+    CPPUNIT_TEST(testWebSocketDeflate);
+    CPPUNIT_TEST(testWebSocketMask);
+    CPPUNIT_TEST(testTraceBuffer);
     CPPUNIT_TEST_SUITE_END();
 
     void testCOOLProtocolFunctions();
@@ -80,6 +91,8 @@ class WhiteBoxTests : public CPPUNIT_NS::TestFixture
     void testRegexListMatcher_Init();
     void testTileDesc();
     void testTileData();
+    void testClientDeltaTracker();
+    void testClientDeltaTrackerSplitPanes();
     void testRectanglesIntersect();
     void testJson();
     void testAnonymization();
@@ -95,6 +108,10 @@ class WhiteBoxTests : public CPPUNIT_NS::TestFixture
     void testJsonUtilEscapeJSONValue();
     void testFindInVector();
     void testThreadPool();
+    void testThreadPoolTasks();
+    void testWebSocketDeflate();
+    void testWebSocketMask();
+    void testTraceBuffer();
 
     size_t waitForThreads(size_t count);
 };
@@ -639,6 +656,158 @@ void WhiteBoxTests::testTileData()
     LOK_ASSERT_EQUAL(data.size(), size_t(9));
     LOK_ASSERT_EQUAL(data._wids.size(), size_t(4));
     LOK_ASSERT_EQUAL(data._wids.back(), unsigned(54));
+
+    // merge the keyframe and the first delta
+    const std::vector<char> keyframe = { 'n', 'e', 'w' };
+    LOK_ASSERT_EQUAL(data.compact(43, 2, keyframe), true);
+    LOK_ASSERT_EQUAL(data.size(), size_t(6));
+    LOK_ASSERT_EQUAL(data._wids.size(), size_t(3));
+    LOK_ASSERT_EQUAL(data._wids.front(), unsigned(44));
+    LOK_ASSERT_EQUAL(data.needsKeyframe(43), true);
+
+    out.clear();
+    LOK_ASSERT_EQUAL(data.appendChangesSince(out, 1), true);
+    LOK_ASSERT_EQUAL(std::string("newbaz"), Util::toString(out));
+
+    out.clear();
+    LOK_ASSERT_EQUAL(data.appendChangesSince(out, 44), true);
+    LOK_ASSERT_EQUAL(std::string("baz"), Util::toString(out));
+
+    // a stale compaction is ignored
+    LOK_ASSERT_EQUAL(data.compact(43, 2, keyframe), false);
+    LOK_ASSERT_EQUAL(data.size(), size_t(6));
+
+    // frames are shared for sending, rather than copied, skipping empty deltas
+    std::vector<Blob> frames;
+    LOK_ASSERT_EQUAL(data.appendChangesSince(frames, 44), true);
+    LOK_ASSERT_EQUAL(size_t(1), frames.size());
+    LOK_ASSERT(frames[0] == data._frames[1]);
+}
+
+void WhiteBoxTests::testClientDeltaTracker()
+{
+    constexpr auto testname = __func__;
+
+    constexpr int tileSize = 3840;
+    const auto tile = [](int column, int row, TileWireId wid, int tileWidth)
+    {
+        TileDesc desc(0, 0, 0, 256, 256, column * tileWidth, row * tileWidth, tileWidth,
+                      tileWidth, -1, 0, -1);
+        desc.setWireId(wid);
+        return desc;
+    };
+
+    ClientDeltaTracker tracker;
+
+    // before we know the view-port we track everything
+    LOK_ASSERT_EQUAL(TileWireId(0), tracker.updateTileSeq(tile(1, 1, 5, tileSize)));
+    LOK_ASSERT_EQUAL(TileWireId(5), tracker.updateTileSeq(tile(1, 1, 7, tileSize)));
+    LOK_ASSERT_EQUAL(TileWireId(0), tracker.updateTileSeq(tile(40, 30, 9, tileSize)));
+    LOK_ASSERT_EQUAL(TileWireId(9), tracker.updateTileSeq(tile(40, 30, 10, tileSize)));
+
+    tracker.resetTileSeq(tile(1, 1, 0, tileSize));
+    LOK_ASSERT_EQUAL(TileWireId(0), tracker.updateTileSeq(tile(1, 1, 8, tileSize)));
+
+    // other zoom levels are separate
+    LOK_ASSERT_EQUAL(TileWireId(0), tracker.updateTileSeq(tile(1, 1, 3, tileSize / 2)));
+    LOK_ASSERT_EQUAL(TileWireId(8), tracker.updateTileSeq(tile(1, 1, 9, tileSize)));
+
+    // off-grid tiles are never tracked
+    TileDesc offGrid(0, 0, 0, 256, 256, 100, 0, tileSize, tileSize, -1, 0, -1);
+    offGrid.setWireId(4);
+    LOK_ASSERT_EQUAL(TileWireId(0), tracker.updateTileSeq(offGrid));
+    LOK_ASSERT_EQUAL(TileWireId(0), tracker.updateTileSeq(offGrid));
+
+    // 4x4 tiles visible, tiles far outside are forgotten
+    tracker.updateViewPort(Util::Rectangle(0, 0, 4 * tileSize, 4 * tileSize));
+    LOK_ASSERT_EQUAL(TileWireId(9), tracker.updateTileSeq(tile(1, 1, 10, tileSize)));
+    LOK_ASSERT_EQUAL(TileWireId(0), tracker.updateTileSeq(tile(40, 30, 11, tileSize)));
+    LOK_ASSERT_EQUAL(TileWireId(0), tracker.updateTileSeq(tile(40, 30, 12, tileSize)));
+
+    // the margin around the view-port is kept
+    LOK_ASSERT_EQUAL(TileWireId(0), tracker.updateTileSeq(tile(5, 5, 13, tileSize)));
+    LOK_ASSERT_EQUAL(TileWireId(13), tracker.updateTileSeq(tile(5, 5, 14, tileSize)));
+
+    // scroll down by a screen: still in the margin
+    tracker.updateViewPort(Util::Rectangle(0, 4 * tileSize, 4 * tileSize, 4 * tileSize));
+    LOK_ASSERT_EQUAL(TileWireId(14), tracker.updateTileSeq(tile(5, 5, 15, tileSize)));
+
+    // scroll far away and back: everything was discarded
+    tracker.updateViewPort(Util::Rectangle(0, 100 * tileSize, 4 * tileSize, 4 * tileSize));
+    tracker.updateViewPort(Util::Rectangle(0, 0, 4 * tileSize, 4 * tileSize));
+    LOK_ASSERT_EQUAL(TileWireId(0), tracker.updateTileSeq(tile(1, 1, 16, tileSize)));
+    LOK_ASSERT_EQUAL(TileWireId(0), tracker.updateTileSeq(tile(5, 5, 17, tileSize)));
+    LOK_ASSERT_EQUAL(TileWireId(16), tracker.updateTileSeq(tile(1, 1, 18, tileSize)));
+}
+
+void WhiteBoxTests::testClientDeltaTrackerSplitPanes()
+{
+    constexpr auto testname = __func__;
+
+    constexpr int tileSize = 3840;
+    const auto tile = [](int column, int row, TileWireId wid)
+    {
+        TileDesc desc(0, 0, 0, 256, 256, column * tileSize, row * tileSize, tileSize, tileSize,
+                      -1, 0, -1);
+        desc.setWireId(wid);
+        return desc;
+    };
+
+    // The panes of a view of 8x8 tiles at @column and @row, with the
+    // first row and column frozen, as ClientSession lays them out.
+    const auto panes = [](int column, int row)
+    {
+        const int x = column * tileSize;
+        const int y = row * tileSize;
+        return std::vector<Util::Rectangle>{
+            Util::Rectangle(0, 0, tileSize, tileSize),
+            Util::Rectangle(x + tileSize, 0, 7 * tileSize, tileSize),
+            Util::Rectangle(0, y + tileSize, tileSize, 7 * tileSize),
+            Util::Rectangle(x + tileSize, y + tileSize, 7 * tileSize, 7 * tileSize)
+        };
+    };
+
+    ClientDeltaTracker tracker;
+
+    // Scrolled far down and right, past what one grid from the origin could hold.
+    tracker.updateViewPorts(panes(300, 20000));
+    for (const TileDesc& visible :
+         { tile(0, 0, 0), tile(305, 0, 0), tile(0, 20005, 0), tile(305, 20005, 0) })
+    {
+        TileDesc first(visible);
+        first.setWireId(10);
+        TileDesc second(visible);
+        second.setWireId(11);
+        LOK_ASSERT_EQUAL(TileWireId(0), tracker.updateTileSeq(first));
+        LOK_ASSERT_EQUAL_MESSAGE("Expected a delta for a visible tile", TileWireId(10),
+                                 tracker.updateTileSeq(second));
+    }
+
+    // Between the panes nothing is tracked.
+    LOK_ASSERT_EQUAL(TileWireId(0), tracker.updateTileSeq(tile(150, 10000, 12)));
+    LOK_ASSERT_EQUAL(TileWireId(0), tracker.updateTileSeq(tile(150, 10000, 13)));
+
+    // Scrolling the bottom-right pane keeps the frozen ones.
+    tracker.updateViewPorts(panes(300, 30000));
+    LOK_ASSERT_EQUAL(TileWireId(11), tracker.updateTileSeq(tile(0, 0, 14)));
+    LOK_ASSERT_EQUAL(TileWireId(11), tracker.updateTileSeq(tile(305, 0, 15)));
+    LOK_ASSERT_EQUAL(TileWireId(0), tracker.updateTileSeq(tile(305, 20005, 16)));
+    LOK_ASSERT_EQUAL(TileWireId(0), tracker.updateTileSeq(tile(305, 30005, 17)));
+    LOK_ASSERT_EQUAL(TileWireId(17), tracker.updateTileSeq(tile(305, 30005, 18)));
+
+    // Back at the top, the panes overlap: a tile in several of them has
+    // its last wire-id, whichever pane it is found in after scrolling.
+    tracker.updateViewPorts(panes(0, 0));
+    LOK_ASSERT_EQUAL(TileWireId(14), tracker.updateTileSeq(tile(0, 0, 19)));
+    LOK_ASSERT_EQUAL(TileWireId(0), tracker.updateTileSeq(tile(2, 2, 20)));
+    LOK_ASSERT_EQUAL(TileWireId(20), tracker.updateTileSeq(tile(2, 2, 21)));
+    tracker.updateViewPorts(panes(0, 8));
+    LOK_ASSERT_EQUAL(TileWireId(21), tracker.updateTileSeq(tile(2, 2, 22)));
+    tracker.updateViewPorts(panes(0, 0));
+    LOK_ASSERT_EQUAL(TileWireId(22), tracker.updateTileSeq(tile(2, 2, 23)));
+
+    tracker.resetTileSeq(tile(2, 2, 0));
+    LOK_ASSERT_EQUAL(TileWireId(0), tracker.updateTileSeq(tile(2, 2, 24)));
 }
 
 void WhiteBoxTests::testRectanglesIntersect()
@@ -899,6 +1068,9 @@ void WhiteBoxTests::testBufferClass()
     LOK_ASSERT(buf.getBlock() != nullptr);
     LOK_ASSERT_EQUAL(0, memcmp(buf.getBlock(), data, buf.size()));
 
+    // A short message doesn't hold on to a large chunk.
+    LOK_ASSERT_EQUAL(Buffer::InitialChunkSize, buf.capacity());
+
     // Erase one char at a time.
     for (std::size_t i = buf.size(); i > 0; --i)
     {
@@ -924,7 +1096,7 @@ void WhiteBoxTests::testBufferClass()
         // Remove half.
         buf.eraseFirst(BlockSize);
         LOK_ASSERT_EQUAL(prevSize + BlockSize, buf.size());
-        LOK_ASSERT_EQUAL(0, memcmp(buf.getBlock() + prevSize, dataLarge.data(), BlockSize));
+        LOK_ASSERT_EQUAL(0, memcmp(buf.data() + prevSize, dataLarge.data(), BlockSize));
     }
 
     LOK_ASSERT_EQUAL(BlockSize * BlockCount, buf.size());
@@ -937,7 +1109,7 @@ void WhiteBoxTests::testBufferClass()
         LOK_ASSERT_EQUAL(BlockSize * 2 * (BlockCount - i), buf.size());
 
         const std::vector<char> dataLarge(BlockSize * 2, 'a' + i); // Block of a single char.
-        LOK_ASSERT_EQUAL(0, memcmp(buf.getBlock(), dataLarge.data(), BlockSize));
+        LOK_ASSERT_EQUAL(0, memcmp(buf.data(), dataLarge.data(), BlockSize));
 
         buf.eraseFirst(BlockSize * 2);
     }
@@ -961,6 +1133,92 @@ void WhiteBoxTests::testBufferClass()
     buf.eraseFirst(buf.size()); // Remove all.
     LOK_ASSERT_EQUAL(0UL, buf.size());
     LOK_ASSERT_EQUAL(true, buf.empty());
+
+    // The chunks grew with the data, and start small again.
+    buf.append(data, sizeof(data));
+    LOK_ASSERT_EQUAL(Buffer::InitialChunkSize, buf.capacity());
+    buf.eraseFirst(buf.size());
+
+    // Shared blobs, between our own data.
+    const std::string digits = "0123456789";
+    const Blob blob = std::make_shared<BlobData>(digits.begin(), digits.end());
+    buf.append("head");
+    buf.appendShared(blob, 2, 6);
+    buf.appendShared(blob);
+    buf.append("tail");
+    LOK_ASSERT_EQUAL(static_cast<std::size_t>(24), buf.size());
+    LOK_ASSERT_EQUAL(true, buf.hasShared());
+    LOK_ASSERT_EQUAL(static_cast<std::size_t>(4), buf.getBlockSize());
+    LOK_ASSERT_EQUAL(0, memcmp(buf.getBlock(), "head", 4));
+
+    struct iovec iov[8];
+    const int count = buf.getIOVec(iov, 8, buf.size());
+    LOK_ASSERT_EQUAL(4, count);
+    std::string gathered;
+    for (int i = 0; i < count; ++i)
+        gathered.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+    LOK_ASSERT_EQUAL(std::string("head2345670123456789tail"), gathered);
+
+    LOK_ASSERT_EQUAL(2, buf.getIOVec(iov, 8, 7));
+    LOK_ASSERT_EQUAL(static_cast<std::size_t>(3), iov[1].iov_len);
+
+    buf.eraseFirst(6); // Into the first blob.
+    LOK_ASSERT_EQUAL(static_cast<std::size_t>(4), buf.getBlockSize());
+    LOK_ASSERT_EQUAL(0, memcmp(buf.getBlock(), "4567", 4));
+
+    buf.eraseFirst(14); // Both blobs.
+    LOK_ASSERT_EQUAL(false, buf.hasShared());
+    LOK_ASSERT_EQUAL(0, memcmp(buf.getBlock(), "tail", 4));
+
+    buf.eraseFirst(buf.size());
+    LOK_ASSERT_EQUAL(true, buf.empty());
+
+    // Small chunks.
+    Buffer chunked(16);
+    std::string expected;
+    for (int i = 0; i < 10; ++i)
+        expected += digits;
+    chunked.append(expected);
+    LOK_ASSERT_EQUAL(expected.size(), chunked.size());
+    LOK_ASSERT_EQUAL(static_cast<std::size_t>(16), chunked.getBlockSize());
+    LOK_ASSERT_EQUAL(7, chunked.getIOVec(iov, 8, chunked.size()));
+
+    chunked.eraseFirst(20); // Into the second chunk.
+    LOK_ASSERT_EQUAL(static_cast<std::size_t>(12), chunked.getBlockSize());
+    LOK_ASSERT_EQUAL(0, memcmp(chunked.getBlock(), "0123", 4));
+    expected.erase(0, 20);
+
+    char* space = chunked.prepareAppend(64);
+    memcpy(space, "read", 4);
+    chunked.commitAppend(4);
+    expected += "read";
+    LOK_ASSERT_EQUAL(expected.size(), chunked.size());
+
+    // Contiguous access moves everything into one chunk.
+    LOK_ASSERT_EQUAL(expected, std::string(chunked.begin(), chunked.end()));
+    LOK_ASSERT_EQUAL(chunked.size(), chunked.getBlockSize());
+    LOK_ASSERT_EQUAL('r', chunked[chunked.size() - 4]);
+
+    // It stays so, while there is room.
+    const char* first = chunked.data();
+    chunked.append("more");
+    expected += "more";
+    LOK_ASSERT(first == chunked.data());
+    LOK_ASSERT_EQUAL(chunked.size(), chunked.getBlockSize());
+
+    chunked.erase(chunked.begin() + 10, chunked.begin() + 20);
+    expected.erase(10, 10);
+    LOK_ASSERT_EQUAL(expected, std::string(chunked.begin(), chunked.end()));
+
+    // Shared blobs are copied, not modified.
+    chunked.appendShared(blob);
+    chunked.data()[chunked.size() - 1] = 'x';
+    LOK_ASSERT_EQUAL(false, chunked.hasShared());
+    LOK_ASSERT_EQUAL(digits, std::string(blob->begin(), blob->end()));
+
+    chunked.clear();
+    LOK_ASSERT_EQUAL(true, chunked.empty());
+    LOK_ASSERT(chunked.getBlock() == nullptr);
 }
 
 void WhiteBoxTests::testStat()
@@ -1299,6 +1557,239 @@ void WhiteBoxTests::testThreadPool()
 //    LOK_ASSERT_EQUAL(size_t(7 + existingUnrelatedThreads), waitForThreads(8 + existingUnrelatedThreads));
 }
 
+void WhiteBoxTests::testThreadPoolTasks()
+{
+    constexpr auto testname = __func__;
+    // coverity[tainted_data_argument : FALSE] - we trust this variable in tests
+    setenv("MAX_CONCURRENCY", "4", 1);
+    ThreadPool pool;
+
+    // A batch completes fully in run().
+    std::atomic<int> done(0);
+    for (int i = 0; i < 100; ++i)
+        pool.pushWork([&done]() { ++done; });
+    pool.run();
+    LOK_ASSERT_EQUAL(100, done.load());
+
+    // Futures complete independently of batches, and carry results and exceptions.
+    std::future<int> answer = pool.submit([]() { return 42; });
+    std::future<void> failure = pool.submit([]() { throw std::runtime_error("expected"); });
+    pool.pushWork([&done]() { ++done; });
+    pool.run();
+    LOK_ASSERT_EQUAL(101, done.load());
+    LOK_ASSERT_EQUAL(42, answer.get());
+    bool thrown = false;
+    try
+    {
+        failure.get();
+    }
+    catch (const std::runtime_error&)
+    {
+        thrown = true;
+    }
+    LOK_ASSERT(thrown);
+
+    // Fire-and-forget tasks are completed when stopping.
+    for (int i = 0; i < 100; ++i)
+        pool.post([&done]() { ++done; });
+    pool.stop();
+    LOK_ASSERT_EQUAL(201, done.load());
+
+    // Without threads, posted tasks run inline.
+    pool.post([&done]() { ++done; });
+    LOK_ASSERT_EQUAL(202, done.load());
+}
+
+void WhiteBoxTests::testWebSocketDeflate()
+{
+    constexpr auto testname = __func__;
+
+    WebSocketDeflate::Params params;
+    LOK_ASSERT_EQUAL(std::string("permessage-deflate"),
+                     WebSocketDeflate::negotiate("permessage-deflate; client_max_window_bits",
+                                                 params));
+    LOK_ASSERT(!params._serverNoContextTakeover);
+    LOK_ASSERT_EQUAL(WebSocketDeflate::MaxWindowBits, params._serverMaxWindowBits);
+
+    // The first acceptable offer wins: we can't compress with 8 window bits.
+    LOK_ASSERT_EQUAL(
+        std::string("permessage-deflate; server_no_context_takeover; server_max_window_bits=10"),
+        WebSocketDeflate::negotiate(
+            "x-webkit-deflate-frame, permessage-deflate; server_max_window_bits=8, "
+            "permessage-deflate; server_no_context_takeover; server_max_window_bits=\"10\"",
+            params));
+    LOK_ASSERT(params._serverNoContextTakeover);
+    LOK_ASSERT_EQUAL(10, params._serverMaxWindowBits);
+
+    LOK_ASSERT(WebSocketDeflate::negotiate("permessage-deflate; unknown", params).empty());
+    LOK_ASSERT(WebSocketDeflate::negotiate("permessage-deflate; server_no_context_takeover; "
+                                           "server_no_context_takeover",
+                                           params)
+                   .empty());
+    LOK_ASSERT(WebSocketDeflate::negotiate("permessage-foo", params).empty());
+
+    // The example of RFC 7692 7.2.3.1.
+    std::unique_ptr<WebSocketDeflate> server = WebSocketDeflate::create(WebSocketDeflate::Params());
+    LOK_ASSERT(server);
+    std::vector<char> inflated;
+    LOK_ASSERT(server->decompress("\xf2\x48\xcd\xc9\xc9\x07\x00", 7, inflated));
+    LOK_ASSERT_EQUAL(std::string("Hello"), std::string(inflated.data(), inflated.size()));
+
+    // A round-trip, through another instance as the client.
+    WebSocketDeflate::initialize(WebSocketDeflate::isEnabled(), 0, WebSocketDeflate::MaxWindowBits,
+                                 Z_BEST_SPEED);
+    std::unique_ptr<WebSocketDeflate> client = WebSocketDeflate::create(WebSocketDeflate::Params());
+    const std::string message =
+        "statechanged: { \"commandName\": \".uno:StyleApply\", \"state\": \"Default Paragraph Style\" }";
+    std::vector<char> compressed;
+    LOK_ASSERT(server->compress(message.data(), message.size(), compressed));
+    const std::size_t firstSize = compressed.size();
+    LOK_ASSERT(client->decompress(compressed.data(), compressed.size(), inflated));
+    LOK_ASSERT_EQUAL(message, std::string(inflated.data(), inflated.size()));
+
+    // The repeated message refers back to the first.
+    LOK_ASSERT(server->compress(message.data(), message.size(), compressed));
+    LOK_ASSERT_MESSAGE("context not taken over", compressed.size() < firstSize / 2);
+    LOK_ASSERT(client->decompress(compressed.data(), compressed.size(), inflated));
+    LOK_ASSERT_EQUAL(message, std::string(inflated.data(), inflated.size()));
+
+    // Large messages are inflated in several chunks.
+    const std::string large = Util::rng::getHexString(256 * 1024);
+    LOK_ASSERT(server->compress(large.data(), large.size(), compressed));
+    LOK_ASSERT(client->decompress(compressed.data(), compressed.size(), inflated));
+    LOK_ASSERT_EQUAL(large, std::string(inflated.data(), inflated.size()));
+
+    // Garbage is rejected.
+    LOK_ASSERT(!client->decompress("\xff\xff\xff\xff", 4, inflated));
+
+    // Small messages are not worth it.
+    WebSocketDeflate::initialize(WebSocketDeflate::isEnabled(), 256,
+                                 WebSocketDeflate::MaxWindowBits, Z_BEST_SPEED);
+    LOK_ASSERT(!server->compress(message.data(), message.size(), compressed));
+}
+
+void WhiteBoxTests::testWebSocketMask()
+{
+    constexpr auto testname = __func__;
+
+    const unsigned char mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+    std::vector<unsigned char> source(100);
+    for (std::size_t i = 0; i < source.size(); ++i)
+        source[i] = i * 7 + 3;
+
+    // Every length around the word sizes, from unaligned sources too.
+    for (std::size_t offset = 0; offset < 4; ++offset)
+    {
+        for (std::size_t len = 0; offset + len <= source.size(); ++len)
+        {
+            std::vector<unsigned char> expected(len);
+            for (std::size_t i = 0; i < len; ++i)
+                expected[i] = source[offset + i] ^ mask[i % 4];
+
+            std::vector<unsigned char> masked(len);
+            WebSocketHandler::applyMask(masked.data(), source.data() + offset, len, mask);
+            LOK_ASSERT_MESSAGE("wrong mask of " + std::to_string(len) + " bytes",
+                               masked == expected);
+
+            std::vector<unsigned char> inPlace(source.begin() + offset,
+                                               source.begin() + offset + len);
+            WebSocketHandler::applyMask(inPlace.data(), inPlace.data(), len, mask);
+            LOK_ASSERT_MESSAGE("wrong mask in place of " + std::to_string(len) + " bytes",
+                               inPlace == expected);
+        }
+    }
+}
+
+void WhiteBoxTests::testTraceBuffer()
+{
+    constexpr auto testname = __func__;
+
+    // Discard what other tests may have recorded.
+    std::string stream;
+    TraceBuffer::drain(stream, 0);
+
+    constexpr int ThreadCount = 3;
+    constexpr int EventCount = 100;
+    const auto start = std::chrono::system_clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < ThreadCount; ++t)
+    {
+        threads.emplace_back(
+            [t, start]()
+            {
+                for (int i = 0; i < EventCount; ++i)
+                {
+                    TraceBuffer::record(i % 2 ? 'X' : 'i', start + std::chrono::microseconds(i),
+                                        std::chrono::microseconds(i % 2 ? 10 : 0), t,
+                                        "event " + std::to_string(i % 5),
+                                        i % 3 ? std::string() : "{\"i\":\"" + std::to_string(i) + "\"}");
+                }
+            });
+    }
+
+    for (std::thread& thread : threads)
+        thread.join();
+
+    // A full ring drops the excess.
+    std::thread overflow(
+        [start]()
+        {
+            for (std::size_t i = 0; i < TraceBuffer::RecordCapacity + 10; ++i)
+                TraceBuffer::record('i', start, std::chrono::microseconds(0), ThreadCount,
+                                    "overflow", std::string());
+        });
+    overflow.join();
+
+    stream.clear();
+    LOK_ASSERT_EQUAL(static_cast<std::size_t>(ThreadCount * EventCount +
+                                              TraceBuffer::RecordCapacity),
+                     TraceBuffer::drain(stream, 42));
+
+    std::vector<int> counts(ThreadCount + 1);
+    uint64_t dropped = 0;
+    const bool complete = TraceBuffer::read(
+        stream.data(), stream.size(),
+        [&](int32_t pid, const TraceBuffer::Record& rec, const std::string& name,
+            const std::string& args)
+        {
+            LOK_ASSERT_EQUAL(42, static_cast<int>(pid));
+            LOK_ASSERT(rec._tid >= 0 && rec._tid <= ThreadCount);
+            const int i = counts[rec._tid]++;
+            if (rec._tid == ThreadCount)
+            {
+                LOK_ASSERT_EQUAL(std::string("overflow"), name);
+                return;
+            }
+
+            // Each thread's events are in order.
+            LOK_ASSERT_EQUAL(i % 2 ? 'X' : 'i', rec._phase);
+            LOK_ASSERT_EQUAL(static_cast<int64_t>(i % 2 ? 10 : 0), rec._duration);
+            LOK_ASSERT_EQUAL(std::chrono::duration_cast<std::chrono::microseconds>(
+                                 start.time_since_epoch())
+                                     .count() +
+                                 i,
+                             rec._timestamp);
+            LOK_ASSERT_EQUAL("event " + std::to_string(i % 5), name);
+            LOK_ASSERT_EQUAL(i % 3 ? std::string() : "{\"i\":\"" + std::to_string(i) + "\"}",
+                             args);
+        },
+        [&](int32_t, uint64_t count) { dropped += count; });
+
+    LOK_ASSERT(complete);
+    for (int t = 0; t < ThreadCount; ++t)
+        LOK_ASSERT_EQUAL(EventCount, counts[t]);
+    LOK_ASSERT_EQUAL(static_cast<int>(TraceBuffer::RecordCapacity), counts[ThreadCount]);
+    LOK_ASSERT_EQUAL(static_cast<uint64_t>(10), dropped);
+
+    // Nothing is left, and a truncated stream is detected.
+    std::string empty;
+    LOK_ASSERT_EQUAL(static_cast<std::size_t>(0), TraceBuffer::drain(empty, 42));
+    LOK_ASSERT(!TraceBuffer::read(
+        stream.data(), stream.size() - 1,
+        [](int32_t, const TraceBuffer::Record&, const std::string&, const std::string&) {},
+        [](int32_t, uint64_t) {}));
+}
+
 CPPUNIT_TEST_SUITE_REGISTRATION(WhiteBoxTests);
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
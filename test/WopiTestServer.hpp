@@ -21,6 +21,8 @@
 #include "StringVector.hpp"
 #include "lokassert.hpp"
 
+#include <wsd/UploadDelta.hpp>
+
 #include <JsonUtil.hpp>
 #include <Poco/URI.h>
 #include <Poco/Util/LayeredConfiguration.h>
@@ -67,9 +69,12 @@ private:
     std::size_t _countGetFile;
     /// The number of rename invocations.
     std::size_t _countPutRelative;
-    /// The number of upload invocations.
+    /// The number of upload invocations, each chunk of a delta counting.
     std::size_t _countPutFile;
 
+    /// The delta being uploaded, when CheckFileInfo has SupportsDeltaUpload.
+    UploadDelta::Chunks _deltaChunks;
+
     /// The default filename when only content is given.
     static constexpr auto DefaultFilename = "hello.txt";
 
@@ -487,15 +492,67 @@ protected:
             LOG_TST("FakeWOPIHost: Forced document upload");
         }
 
-        std::unique_ptr<http::Response> response = assertPutFileRequest(request);
-        if (!response || response->statusLine().statusCategory() ==
-                             http::StatusLine::StatusCodeClass::Successful)
+        const bool isDelta = request.get("X-COOL-WOPI-Upload-Encoding", std::string()) == "delta";
+        std::string delta;
+        if (isDelta)
         {
             const std::streamsize size = request.getContentLength();
-            LOG_TST("FakeWOPIHost: Writing document contents in storage (" << size << "bytes)");
             std::vector<char> buffer(size);
             message.read(buffer.data(), size);
-            setFileContent(Util::toString(buffer));
+
+            const uint64_t offset = std::strtoull(
+                request.get("X-COOL-WOPI-Upload-Offset", "0").c_str(), nullptr, 10);
+            const uint64_t length = std::strtoull(
+                request.get("X-COOL-WOPI-Upload-Length", "0").c_str(), nullptr, 10);
+            const bool added = _deltaChunks.add(request.get("X-COOL-WOPI-Upload-Id", std::string()),
+                                                offset, length, Util::toString(buffer));
+            if (!added || !_deltaChunks.isComplete())
+            {
+                LOG_TST("FakeWOPIHost: " << (added ? "Took" : "Rejected") << " delta chunk of "
+                                         << size << " bytes at " << offset << " of " << length
+                                         << ", have " << _deltaChunks.offset());
+                http::Response httpResponse(added ? http::StatusCode::Accepted
+                                                  : http::StatusCode::RangeNotSatisfiable);
+                httpResponse.set("X-COOL-WOPI-Upload-Offset",
+                                 std::to_string(_deltaChunks.offset()));
+                httpResponse.setContentLength(0);
+                socket->sendAndShutdown(httpResponse);
+                return true;
+            }
+
+            delta = _deltaChunks.take();
+        }
+
+        std::unique_ptr<http::Response> response = assertPutFileRequest(request);
+        if (!response || response->statusLine().statusCategory() ==
+                             http::StatusLine::StatusCodeClass::Successful)
+        {
+            if (isDelta)
+            {
+                std::string content;
+                if (!UploadDelta::apply(getFileContent(), delta, content))
+                {
+                    LOG_TST("FakeWOPIHost: Delta of " << delta.size()
+                                                      << " bytes doesn't apply to the document");
+                    http::Response httpResponse(http::StatusCode::PreconditionFailed);
+                    httpResponse.setContentLength(0);
+                    socket->sendAndShutdown(httpResponse);
+                    return true;
+                }
+
+                LOG_TST("FakeWOPIHost: Writing document contents in storage ("
+                        << content.size() << " bytes from a delta of " << delta.size() << ')');
+                setFileContent(content);
+            }
+            else
+            {
+                const std::streamsize size = request.getContentLength();
+                LOG_TST("FakeWOPIHost: Writing document contents in storage (" << size
+                                                                               << "bytes)");
+                std::vector<char> buffer(size);
+                message.read(buffer.data(), size);
+                setFileContent(Util::toString(buffer));
+            }
         }
 
         const Poco::URI uriReq(request.getURI());
@@ -0,0 +1,180 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Micro-benchmark of the socket Buffer: streams 100MB through it at various
+ * chunk sizes, as the outgoing and incoming data of a socket, and compares
+ * with the std::vector it used to be.
+ */
+
+#include <config.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include <net/Buffer.hpp>
+
+namespace
+{
+constexpr std::size_t StreamSize = 100 * 1024 * 1024;
+
+/// The Buffer before it was chunked: a vector, shuffled down as it is consumed.
+class VectorBuffer
+{
+    std::size_t _offset = 0;
+    std::vector<char> _buffer;
+
+public:
+    std::size_t size() const { return _buffer.size() - _offset; }
+
+    void append(const char* data, std::size_t len)
+    {
+        _buffer.insert(_buffer.end(), data, data + len);
+    }
+
+    char* data() { return _buffer.data() + _offset; }
+
+    int getIOVec(struct iovec* iov, int, std::size_t maxSize)
+    {
+        iov[0].iov_base = data();
+        iov[0].iov_len = std::min(size(), maxSize);
+        return 1;
+    }
+
+    void eraseFirst(std::size_t len)
+    {
+        if (_buffer.size() > 16384 && len < size() && _offset < 16384 * 64 && size() > 512)
+        {
+            _offset += len;
+            return;
+        }
+
+        _buffer.erase(_buffer.begin(), _buffer.begin() + _offset + len);
+        _offset = 0;
+    }
+};
+
+/// Keeps the optimizer from dropping the work.
+unsigned Checksum = 0;
+
+/// Queues messages of @messageSize bytes, writing 64KB at a time with writev()
+/// whenever more than @backlog bytes are queued, like a socket's output.
+/// Returns the throughput in MB/s.
+template <typename Buf> double streamOut(Buf& buf, std::size_t messageSize, std::size_t backlog)
+{
+    const std::vector<char> message(messageSize, 'm');
+    constexpr std::size_t WriteSize = 64 * 1024;
+    struct iovec iov[64];
+
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t sent = 0; sent < StreamSize; sent += messageSize)
+    {
+        buf.append(message.data(), message.size());
+        while (buf.size() > backlog)
+        {
+            std::size_t written = 0;
+            const int count = buf.getIOVec(iov, 64, WriteSize);
+            for (int i = 0; i < count; ++i)
+            {
+                Checksum += static_cast<const char*>(iov[i].iov_base)[0];
+                written += iov[i].iov_len;
+            }
+            buf.eraseFirst(written);
+        }
+    }
+    const auto end = std::chrono::steady_clock::now();
+
+    return StreamSize / (1024. * 1024) / std::chrono::duration<double>(end - start).count();
+}
+
+/// Reads 16KB at a time and consumes whole messages of @messageSize bytes
+/// from the contiguous data, like a socket's input. Returns MB/s.
+double streamIn(Buffer& buf, std::size_t messageSize)
+{
+    constexpr std::size_t ReadSize = 16 * 1024;
+    const std::vector<char> input(ReadSize, 'i');
+
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t received = 0; received < StreamSize; received += ReadSize)
+    {
+        std::memcpy(buf.prepareAppend(ReadSize), input.data(), ReadSize);
+        buf.commitAppend(ReadSize);
+        while (buf.size() >= messageSize)
+        {
+            Checksum += buf.data()[messageSize - 1];
+            buf.eraseFirst(messageSize);
+        }
+    }
+    const auto end = std::chrono::steady_clock::now();
+
+    return StreamSize / (1024. * 1024) / std::chrono::duration<double>(end - start).count();
+}
+
+double streamIn(VectorBuffer& buf, std::size_t messageSize)
+{
+    constexpr std::size_t ReadSize = 16 * 1024;
+    const std::vector<char> input(ReadSize, 'i');
+
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t received = 0; received < StreamSize; received += ReadSize)
+    {
+        char read[ReadSize];
+        std::memcpy(read, input.data(), ReadSize);
+        buf.append(read, ReadSize);
+        while (buf.size() >= messageSize)
+        {
+            Checksum += buf.data()[messageSize - 1];
+            buf.eraseFirst(messageSize);
+        }
+    }
+    const auto end = std::chrono::steady_clock::now();
+
+    return StreamSize / (1024. * 1024) / std::chrono::duration<double>(end - start).count();
+}
+
+void printRow(const std::string& name, std::size_t messageSize, double out, double backlogged,
+              double in)
+{
+    std::cout << std::setw(12) << name << std::setw(10) << messageSize << std::fixed
+              << std::setprecision(0) << std::setw(12) << out << std::setw(12) << backlogged
+              << std::setw(12) << in << '\n';
+}
+} // namespace
+
+// coverity[root_function] : don't warn about uncaught exceptions
+int main(int argc, char** argv)
+{
+    const std::size_t messageSize = argc > 1 ? std::max(std::atoi(argv[1]), 1) : 1000;
+    constexpr std::size_t Backlog = 1024 * 1024;
+
+    std::cout << "Streaming " << StreamSize / (1024 * 1024) << "MB, in MB/s\n";
+    std::cout << std::setw(12) << "chunk" << std::setw(10) << "message" << std::setw(12) << "out"
+              << std::setw(12) << "backlogged" << std::setw(12) << "in" << '\n';
+
+    for (const std::size_t chunkSize : { 4 * 1024, 16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024 })
+    {
+        Buffer out(chunkSize), backlogged(chunkSize), in(chunkSize);
+        printRow(std::to_string(chunkSize), messageSize, streamOut(out, messageSize, 0),
+                 streamOut(backlogged, messageSize, Backlog), streamIn(in, messageSize));
+    }
+
+    VectorBuffer out, backlogged, in;
+    printRow("vector", messageSize, streamOut(out, messageSize, 0),
+             streamOut(backlogged, messageSize, Backlog), streamIn(in, messageSize));
+
+    return Checksum == 42 ? 1 : 0;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
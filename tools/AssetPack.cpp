@@ -0,0 +1,156 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Packs the files the FileServer serves from <root>/browser/dist, with their
+ * gzip and brotli variants, ETags and content types, in the asset pack
+ * that coolwsd maps at startup. Run at install time, after the brotli
+ * variants, if any, are installed.
+ */
+
+#include <config.h>
+#include <config_version.h>
+
+#include <wsd/AssetPack.hpp>
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <sysexits.h>
+
+#include <zlib.h>
+
+namespace
+{
+bool readFile(const std::filesystem::path& path, std::string& data)
+{
+    std::ifstream file(path, std::ios::binary);
+    data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return !file.bad();
+}
+
+/// Compresses @data with gzip, at the best compression as we do it once.
+/// Returns an empty string if it doesn't shrink.
+std::string gzip(const std::string& data)
+{
+    z_stream strm;
+    std::memset(&strm, 0, sizeof(strm));
+    // 16 more window bits for the gzip header and trailer.
+    if (deflateInit2(&strm, Z_BEST_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+        return std::string();
+
+    std::string compressed(deflateBound(&strm, data.size()), '\0');
+    strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    strm.avail_in = data.size();
+    strm.next_out = reinterpret_cast<Bytef*>(compressed.data());
+    strm.avail_out = compressed.size();
+    const int result = deflate(&strm, Z_FINISH);
+    compressed.resize(compressed.size() - strm.avail_out);
+    deflateEnd(&strm);
+
+    if (result != Z_STREAM_END || compressed.size() >= data.size())
+        return std::string();
+
+    return compressed;
+}
+
+/// A strong ETag of @data, so clients revalidate only the files that change.
+std::string etag(const std::string& data)
+{
+    const uLong crc = crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<const Bytef*>(data.data()),
+                            data.size());
+    std::ostringstream oss;
+    oss << '"' << std::hex << crc << '-' << data.size() << '"';
+    return oss.str();
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    if (argc != 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " <file server root> <asset pack>\n";
+        return EX_USAGE;
+    }
+
+    const std::filesystem::path root(argv[1]);
+    const std::filesystem::path dist = root / "browser" / "dist";
+    if (!std::filesystem::is_directory(dist))
+    {
+        std::cerr << dist.string() << " is not a directory\n";
+        return EX_NOINPUT;
+    }
+
+    AssetPack::Builder builder;
+    std::size_t count = 0;
+    std::size_t rawBytes = 0;
+    std::size_t gzipBytes = 0;
+    for (const auto& file : std::filesystem::recursive_directory_iterator(
+             dist, std::filesystem::directory_options::follow_directory_symlink))
+    {
+        if (!file.is_regular_file())
+            continue;
+
+        // Served as the FileServer would: hidden files aren't.
+        const std::string relative = file.path().lexically_relative(root).generic_string();
+        if (relative.find("/.") != std::string::npos)
+            continue;
+
+        // The brotli variants go with their file, if any.
+        std::filesystem::path brotliPath = file.path();
+        if (file.path().extension() == ".br")
+        {
+            if (std::filesystem::exists(brotliPath.replace_extension()))
+                continue;
+            brotliPath.clear();
+        }
+        else
+            brotliPath += ".br";
+
+        std::string raw;
+        std::string brotli;
+        if (!readFile(file.path(), raw) ||
+            (!brotliPath.empty() && std::filesystem::exists(brotliPath) &&
+             !readFile(brotliPath, brotli)))
+        {
+            std::cerr << "Failed to read " << file.path().string() << '\n';
+            return EX_IOERR;
+        }
+
+        // Already compressed.
+        std::string compressed = brotliPath.empty() ? std::string() : gzip(raw);
+
+        const std::string path = '/' + relative;
+        const std::string tag = etag(raw);
+        rawBytes += raw.size();
+        gzipBytes += compressed.empty() ? raw.size() : compressed.size();
+        builder.add(path, AssetPack::getContentType(path), tag, std::move(raw),
+                    std::move(compressed), std::move(brotli));
+        ++count;
+    }
+
+    if (!builder.write(argv[2], COOLWSD_VERSION_HASH))
+    {
+        std::cerr << "Failed to write " << argv[2] << '\n';
+        return EX_CANTCREAT;
+    }
+
+    std::cerr << "Packed " << count << " files of " << rawBytes << " bytes, " << gzipBytes
+              << " with gzip, in " << argv[2] << '\n';
+    return EX_OK;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
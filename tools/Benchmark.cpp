@@ -15,6 +15,9 @@
 #include "config.h"
 
 #include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
 
 #include <common/Png.hpp>
 #include <kit/Delta.hpp>
@@ -33,34 +36,153 @@ public:
             0, 0, 256, 256, loc, 256, 256);
     }
 
-    static void timeRLE(const char *description)
+    /// Returns the throughput in mega-pixels per second.
+    static double megaPixelsPerSecond(size_t pixels, std::chrono::steady_clock::duration elapsed)
     {
-        std::cout << "Benchmark " << description << "\n";
+        const double us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+        return us > 0 ? pixels / us : 0;
+    }
 
-        int deltas = 0;
+    /// RLE, with the row CRCs, of the whole corpus.
+    static double timeRLE()
+    {
+        size_t pixels = 0;
         const auto start = std::chrono::steady_clock::now();
 
         // check we have enough work:
         int maxIters = (50000 + pixmaps.size() - 1) / pixmaps.size();
         for (int it = 0; it < maxIters; ++it)
         {
-//          std::cerr << "iter " << it << "\n";
             for (Pixmap &pix : pixmaps)
             {
-                deltas++;
                 rleBitmap(pix);
+                pixels += 256 * 256;
             }
         }
 
-        const auto end = std::chrono::steady_clock::now();
+        return megaPixelsPerSecond(pixels, std::chrono::steady_clock::now() - start);
+    }
 
-        std::cout << "took: " <<
-            std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms - ";
+    /// Row comparison and diff-run extraction between consecutive pixmaps.
+    static double timeDiff()
+    {
+        TileLocation loc = { 0, 0, 0, 0, 0, 0 };
+        std::vector<std::unique_ptr<DeltaGenerator::DeltaData>> rleData;
+        for (Pixmap &pix : pixmaps)
+            rleData.push_back(std::make_unique<DeltaGenerator::DeltaData>(
+                1 /*wid*/, reinterpret_cast<unsigned char *>(pix.data()),
+                0, 0, 256, 256, loc, 256, 256));
+
+        size_t pixels = 0;
+        std::vector<uint8_t> output;
+        output.reserve(256 * 260 * 4);
+        const auto start = std::chrono::steady_clock::now();
 
-        assert(deltas && "div by zero otherwise");
+        int maxIters = (5000 + rleData.size() - 1) / rleData.size();
+        for (int it = 0; it < maxIters; ++it)
+        {
+            for (size_t i = 0; i < rleData.size(); ++i)
+            {
+                const auto& prev = *rleData[i];
+                const auto& cur = *rleData[(i + 1) % rleData.size()];
+                output.clear();
+                for (int y = 0; y < 256; ++y)
+                {
+                    if (!prev.getRow(y).identical(cur.getRow(y)))
+                        prev.getRow(y).diffRowTo(cur.getRow(y), 256, y, output,
+                                                 LOK_TILEMODE_RGBA);
+                }
+                pixels += 256 * 256;
+            }
+        }
 
-        std::cout << "time/rle: " <<
-            (1.0*std::chrono::duration_cast<std::chrono::microseconds>(end - start).count())/deltas << "us\n";
+        return megaPixelsPerSecond(pixels, std::chrono::steady_clock::now() - start);
+    }
+
+    /// Encode the corpus as the kit does, as keyframes or as deltas of each other.
+    static double timeEncode(bool forceKeyframe)
+    {
+        DeltaGenerator gen;
+        TileLocation loc = { 0, 0, 0, 0, 0, 0 };
+        std::vector<char> output;
+        output.reserve(256 * 260 * 4);
+        TileWireId wid = 0;
+
+        size_t pixels = 0;
+        const auto start = std::chrono::steady_clock::now();
+
+        int maxIters = (5000 + pixmaps.size() - 1) / pixmaps.size();
+        for (int it = 0; it < maxIters; ++it)
+        {
+            for (Pixmap &pix : pixmaps)
+            {
+                output.clear();
+                gen.compressOrDelta(reinterpret_cast<unsigned char *>(pix.data()), 0, 0, 256, 256,
+                                    256, 256, loc, output, ++wid, forceKeyframe, false,
+                                    LOK_TILEMODE_RGBA);
+                pixels += 256 * 256;
+            }
+        }
+
+        return megaPixelsPerSecond(pixels, std::chrono::steady_clock::now() - start);
+    }
+
+    /// Encode the corpus as PNG, with libpng or our own encoder, which also
+    /// returns the compression ratio in @ratio.
+    static double timePng(bool fast, double &ratio)
+    {
+        size_t pixels = 0;
+        size_t compressed = 0;
+        const auto start = std::chrono::steady_clock::now();
+
+        int maxIters = (2000 + pixmaps.size() - 1) / pixmaps.size();
+        for (int it = 0; it < maxIters; ++it)
+        {
+            for (Pixmap &pix : pixmaps)
+            {
+                std::vector<char> output;
+                unsigned char *data = reinterpret_cast<unsigned char *>(pix.data());
+                if (fast)
+                    Png::impl_encodeSubBufferToPNGFast(data, 0, 0, 256, 256, 256, 256, output,
+                                                       LOK_TILEMODE_BGRA);
+                else
+                    Png::impl_encodeSubBufferToPNG(data, 0, 0, 256, 256, 256, 256, output,
+                                                   LOK_TILEMODE_BGRA);
+                pixels += 256 * 256;
+                compressed += output.size();
+            }
+        }
+
+        ratio = compressed ? pixels * 4.0 / compressed : 0;
+        return megaPixelsPerSecond(pixels, std::chrono::steady_clock::now() - start);
+    }
+
+    /// Compress each pixmap with a zstd context of its own, as keyframes used
+    /// to be, or with the reused one of the thread. Returns microseconds per tile.
+    static double timeZstd(bool reuse)
+    {
+        std::vector<char> output(ZSTD_COMPRESSBOUND(256 * 256 * 4));
+        size_t tiles = 0;
+        const auto start = std::chrono::steady_clock::now();
+
+        int maxIters = (5000 + pixmaps.size() - 1) / pixmaps.size();
+        for (int it = 0; it < maxIters; ++it)
+        {
+            for (Pixmap &pix : pixmaps)
+            {
+                ZSTD_CCtx *cctx = reuse ? DeltaGenerator::ZstdContexts::getCCtx() : ZSTD_createCCtx();
+                if (!reuse)
+                    ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel,
+                                           DeltaGenerator::compressionLevel);
+                ZSTD_compress2(cctx, output.data(), output.size(), pix.data(), pix.size());
+                if (!reuse)
+                    ZSTD_freeCCtx(cctx);
+                ++tiles;
+            }
+        }
+
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        return std::chrono::duration<double, std::micro>(elapsed).count() / tiles;
     }
 };
 
@@ -69,15 +191,60 @@ int main (int argc, char **argv)
     for (int i = 1; i < argc; i++)
     {
         uint32_t height, width, rowBytes;
-        pixmaps.push_back(Png::loadPng(argv[i], height, width, rowBytes));
+        Pixmap pix = Png::loadPng(argv[i], height, width, rowBytes);
+        if (width != 256 || height != 256)
+        {
+            std::cerr << "Skipping " << argv[i] << ": not a 256x256 tile\n";
+            continue;
+        }
+        pixmaps.push_back(std::move(pix));
 //        std::cout << "Loaded: " << argv[i] << " " << width << "x" << height << "\n";
     }
 
-    DeltaTests::timeRLE("CPU");
+    if (pixmaps.empty())
+    {
+        std::cerr << "Usage: coolbench <256x256 tile png>...\n";
+        return 1;
+    }
 
     simd::init();
+    simd_deltaInit(simd::HasSSE42, simd::HasAVX2, simd::HasAVX512, simd::HasNEON);
+    const SimdDeltaKernel best = simd_deltaGetKernel();
+
+    std::cout << std::setw(8) << "kernel" << std::setw(12) << "rle MP/s" << std::setw(12)
+              << "diff MP/s" << '\n';
 
-    DeltaTests::timeRLE("SIMD");
+    for (int kernel = 0; kernel < SIMD_DELTA_KERNEL_COUNT; ++kernel)
+    {
+        if (!simd_deltaSetKernel(static_cast<SimdDeltaKernel>(kernel)))
+            continue;
+
+        const double rle = DeltaTests::timeRLE();
+        const double diff = DeltaTests::timeDiff();
+        std::cout << std::setw(8) << simd_deltaKernelName(static_cast<SimdDeltaKernel>(kernel))
+                  << std::fixed << std::setprecision(1) << std::setw(12) << rle << std::setw(12)
+                  << diff << '\n';
+    }
+
+    simd_deltaSetKernel(best);
+
+    std::cout << '\n' << std::setw(16) << "keyframe MP/s" << std::setw(16) << "delta MP/s"
+              << std::setw(16) << "zstd new us" << std::setw(16) << "zstd reused us" << '\n';
+    std::cout << std::fixed << std::setprecision(1) << std::setw(16)
+              << DeltaTests::timeEncode(true) << std::setw(16) << DeltaTests::timeEncode(false)
+              << std::setw(16) << DeltaTests::timeZstd(false) << std::setw(16)
+              << DeltaTests::timeZstd(true) << '\n';
+
+    std::cout << '\n' << std::setw(8) << "png" << std::setw(12) << "MP/s" << std::setw(12)
+              << "ratio" << '\n';
+    for (const bool fast : { false, true })
+    {
+        double ratio = 0;
+        const double mps = DeltaTests::timePng(fast, ratio);
+        std::cout << std::setw(8) << (fast ? "fast" : "libpng") << std::fixed
+                  << std::setprecision(1) << std::setw(12) << mps << std::setw(12) << ratio
+                  << '\n';
+    }
 
     return 0;
 }
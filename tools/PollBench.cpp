@@ -0,0 +1,199 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Benchmark the SocketPoll backends (poll vs. epoll) with many idle
+ * sockets and a small number of active ones, which is what the WSD-wide
+ * polls see with thousands of connected clients.
+ */
+
+#include <config.h>
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+#include <Log.hpp>
+#include <Socket.hpp>
+#include <Unit.hpp>
+#include <Util.hpp>
+
+namespace
+{
+/// Counts and discards everything received.
+class SinkSocketHandler final : public SimpleSocketHandler
+{
+public:
+    explicit SinkSocketHandler(std::size_t& received)
+        : _received(received)
+    {
+    }
+
+private:
+    void onConnect(const std::shared_ptr<StreamSocket>& socket) override { _socket = socket; }
+
+    void handleIncomingMessage(SocketDisposition&) override
+    {
+        std::shared_ptr<StreamSocket> socket = _socket.lock();
+        if (socket)
+        {
+            Buffer& in = socket->getInBuffer();
+            _received += in.size();
+            in.clear();
+        }
+    }
+
+    int getPollEvents(std::chrono::steady_clock::time_point /* now */,
+                      int64_t& /* timeoutMaxMicroS */) override
+    {
+        return POLLIN;
+    }
+
+    void performWrites(std::size_t /* capacity */) override {}
+
+    std::weak_ptr<StreamSocket> _socket;
+    std::size_t& _received;
+};
+
+/// Polls @socketCount sockets, of which @activeCount get a byte each round.
+/// Returns the average time of a round in microseconds, or -1 on failure.
+double benchmark(SocketPoll::PollBackend backend, std::size_t socketCount,
+                 std::size_t activeCount, std::size_t rounds)
+{
+    SocketPoll poll("pollbench");
+    poll.setPollBackend(backend);
+    poll.runOnClientThread();
+
+    std::size_t received = 0;
+    std::vector<int> peers;
+    peers.reserve(socketCount);
+    for (std::size_t i = 0; i < socketCount; ++i)
+    {
+        int pair[2];
+        if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, pair) < 0)
+        {
+            std::cerr << "Failed to create socketpair #" << i << ": " << strerror(errno) << '\n';
+            for (const int fd : peers)
+                ::close(fd);
+            return -1;
+        }
+
+        peers.push_back(pair[1]);
+        poll.insertNewSocket(StreamSocket::create<StreamSocket>(
+            std::string(), pair[0], Socket::Type::Unix, false, HostType::LocalHost,
+            std::make_shared<SinkSocketHandler>(received)));
+    }
+
+    // Pick up the new sockets.
+    poll.poll(std::chrono::microseconds(0));
+
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<std::size_t> pick(0, socketCount - 1);
+
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t round = 0; round < rounds; ++round)
+    {
+        const std::size_t expected = received + activeCount;
+        for (std::size_t i = 0; i < activeCount; ++i)
+        {
+            if (::write(peers[pick(rng)], "x", 1) != 1)
+                std::cerr << "Failed to write to peer: " << strerror(errno) << '\n';
+        }
+
+        while (received < expected)
+            poll.poll(std::chrono::milliseconds(100));
+    }
+    const auto end = std::chrono::steady_clock::now();
+
+    for (const int fd : peers)
+        ::close(fd);
+
+    // Reap the disconnected sockets.
+    poll.poll(std::chrono::microseconds(0));
+    poll.removeSockets();
+
+    return std::chrono::duration<double, std::micro>(end - start).count() / rounds;
+}
+
+/// Make sure we can have two fds per socket.
+bool raiseFdLimit(std::size_t socketCount)
+{
+    struct rlimit rlim;
+    if (::getrlimit(RLIMIT_NOFILE, &rlim) < 0)
+        return false;
+
+    const rlim_t needed = socketCount * 2 + 64;
+    if (rlim.rlim_cur >= needed)
+        return true;
+
+    if (rlim.rlim_max < needed)
+        return false;
+
+    rlim.rlim_cur = needed;
+    return ::setrlimit(RLIMIT_NOFILE, &rlim) == 0;
+}
+} // namespace
+
+namespace Util
+{
+    void alertAllUsers(const std::string& cmd, const std::string& kind)
+    {
+        std::cout << "error: cmd=" << cmd << " kind=" << kind << std::endl;
+    }
+}
+
+// coverity[root_function] : don't warn about uncaught exceptions
+int main(int argc, char** argv)
+{
+    (void)argc;
+    (void)argv;
+
+    if (!UnitWSD::init(UnitWSD::UnitType::Wsd, ""))
+    {
+        throw std::runtime_error("Failed to load wsd unit test library.");
+    }
+
+    Log::initialize("PollBench", "fatal", true, false, std::map<std::string, std::string>(),
+                    false, std::map<std::string, std::string>());
+
+    std::cout << std::setw(8) << "sockets" << std::setw(8) << "active" << std::setw(14)
+              << "poll us/iter" << std::setw(14) << "epoll us/iter" << '\n';
+
+    for (const std::size_t socketCount : { 100, 1000, 10000 })
+    {
+        if (!raiseFdLimit(socketCount))
+        {
+            std::cout << std::setw(8) << socketCount << "  skipped: not enough file descriptors\n";
+            continue;
+        }
+
+        // A busy server has a small fraction of its sockets active at once.
+        const std::size_t activeCount = std::max<std::size_t>(socketCount / 100, 1);
+        const std::size_t rounds = 2000;
+
+        const double pollUs =
+            benchmark(SocketPoll::PollBackend::Poll, socketCount, activeCount, rounds);
+        const double epollUs =
+            benchmark(SocketPoll::PollBackend::Epoll, socketCount, activeCount, rounds);
+
+        std::cout << std::setw(8) << socketCount << std::setw(8) << activeCount << std::fixed
+                  << std::setprecision(1) << std::setw(14) << pollUs << std::setw(14) << epollUs
+                  << '\n';
+    }
+
+    return 0;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
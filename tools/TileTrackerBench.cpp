@@ -0,0 +1,239 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Benchmark the ClientDeltaTracker, which remembers the last wire-id sent
+ * of each tile to a client, against the hash-set it replaced. Replays the
+ * clientvisiblearea and tile requests of a trace file, as recorded for
+ * tools/Replay.hpp, or a synthetic scrolling session without one.
+ */
+
+#include <config.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <Log.hpp>
+#include <Protocol.hpp>
+#include <Rectangle.hpp>
+#include <TileCache.hpp>
+#include <TileDesc.hpp>
+#include <TraceFile.hpp>
+#include <Util.hpp>
+
+namespace
+{
+/// The tracker before it was made a grid: it remembers every tile ever sent.
+class HashSetDeltaTracker final
+{
+    std::unordered_set<TileDesc, TileDescCacheHasher, TileDescCacheCompareEq> _cache;
+
+public:
+    void updateViewPort(const Util::Rectangle&) {}
+
+    TileWireId updateTileSeq(const TileDesc& desc)
+    {
+        auto it = _cache.find(desc);
+        if (it == _cache.end())
+        {
+            _cache.insert(desc);
+            return 0;
+        }
+        const TileWireId curSeq = desc.getWireId();
+        TileWireId last = it->getWireId();
+        // id is not included in the hash.
+        auto pDesc = const_cast<TileDesc*>(&(*it));
+        pDesc->setWireId(curSeq);
+        return last;
+    }
+};
+
+/// A client scrolling or requesting tiles.
+struct Event
+{
+    size_t _session;
+    Util::Rectangle _viewPort;
+    std::vector<TileDesc> _tiles;
+};
+
+/// The requests of the incoming messages of @path.
+std::vector<Event> readTrace(const std::string& path, size_t& sessionCount)
+{
+    std::vector<Event> events;
+    std::unordered_map<std::string, size_t> sessions;
+
+    TraceFileReader reader(path);
+    for (TraceFileRecord rec = reader.getNextRecord();
+         rec.getDir() != TraceFileRecord::Direction::Invalid; rec = reader.getNextRecord())
+    {
+        if (rec.getDir() != TraceFileRecord::Direction::Incoming)
+            continue;
+
+        const std::string firstLine = COOLProtocol::getFirstLine(rec.getPayload());
+        const StringVector tokens = StringVector::tokenize(firstLine);
+        const size_t session =
+            sessions.emplace(rec.getSessionId(), sessions.size()).first->second;
+
+        int x, y, width, height;
+        if (tokens.equals(0, "clientvisiblearea") && tokens.size() >= 5 &&
+            COOLProtocol::getTokenInteger(tokens[1], "x", x) &&
+            COOLProtocol::getTokenInteger(tokens[2], "y", y) &&
+            COOLProtocol::getTokenInteger(tokens[3], "width", width) &&
+            COOLProtocol::getTokenInteger(tokens[4], "height", height))
+        {
+            events.push_back({ session, Util::Rectangle(x, y, width, height), {} });
+        }
+        else if (tokens.equals(0, "tilecombine"))
+        {
+            try
+            {
+                events.push_back({ session, Util::Rectangle(),
+                                   TileCombined::parse(tokens).getTiles() });
+            }
+            catch (const std::exception& ex)
+            {
+                std::cerr << "Skipping invalid tilecombine: " << ex.what() << '\n';
+            }
+        }
+        else if (tokens.equals(0, "tile"))
+        {
+            try
+            {
+                events.push_back({ session, Util::Rectangle(), { TileDesc::parse(tokens) } });
+            }
+            catch (const std::exception& ex)
+            {
+                std::cerr << "Skipping invalid tile: " << ex.what() << '\n';
+            }
+        }
+    }
+
+    sessionCount = sessions.size();
+    return events;
+}
+
+/// One client scrolling a long document down and back up, at two zoom levels,
+/// requesting the tiles of each new view-port.
+std::vector<Event> createScrolling(size_t& sessionCount)
+{
+    std::vector<Event> events;
+
+    // A 1920x1080 pixel view-port, in twips.
+    constexpr int viewWidth = 28800;
+    constexpr int viewHeight = 16200;
+    constexpr int pages = 100;
+
+    for (const int tileSize : { 3840, 1920 })
+    {
+        const int docHeight = pages * 15 * tileSize;
+        const int step = tileSize / 4;
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            for (int i = 0; i <= docHeight / step; ++i)
+            {
+                const int y = (pass == 0 ? i : docHeight / step - i) * step;
+                Event event{ 0, Util::Rectangle(0, y, viewWidth, viewHeight), {} };
+                events.push_back(event);
+
+                event._viewPort = Util::Rectangle();
+                for (int row = y / tileSize; row * tileSize < y + viewHeight; ++row)
+                {
+                    for (int column = 0; column * tileSize < viewWidth; ++column)
+                        event._tiles.emplace_back(0, 0, 0, 256, 256, column * tileSize,
+                                                  row * tileSize, tileSize, tileSize, -1, 0, -1);
+                }
+                events.push_back(std::move(event));
+            }
+        }
+    }
+
+    sessionCount = 1;
+    return events;
+}
+
+/// Replays @events @rounds times, counting the tiles that would need a keyframe.
+/// Returns the average time per tile in nanoseconds.
+template <typename Tracker>
+double replay(const std::vector<Event>& events, size_t sessionCount, size_t rounds,
+              size_t& tileCount, size_t& keyframes)
+{
+    tileCount = 0;
+    keyframes = 0;
+
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t round = 0; round < rounds; ++round)
+    {
+        std::vector<Tracker> trackers(sessionCount);
+        TileWireId wid = 0;
+        for (const Event& event : events)
+        {
+            Tracker& tracker = trackers[event._session];
+            if (event._viewPort.isValid())
+                tracker.updateViewPort(event._viewPort);
+
+            for (TileDesc desc : event._tiles)
+            {
+                desc.setWireId(++wid);
+                if (tracker.updateTileSeq(desc) == 0)
+                    ++keyframes;
+                ++tileCount;
+            }
+        }
+    }
+    const auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::nano>(end - start).count() /
+           std::max<size_t>(tileCount, 1);
+}
+} // namespace
+
+namespace Util
+{
+    void alertAllUsers(const std::string& cmd, const std::string& kind)
+    {
+        std::cout << "error: cmd=" << cmd << " kind=" << kind << std::endl;
+    }
+}
+
+// coverity[root_function] : don't warn about uncaught exceptions
+int main(int argc, char** argv)
+{
+    Log::initialize("TileTrackerBench", "fatal", true, false,
+                    std::map<std::string, std::string>(), false,
+                    std::map<std::string, std::string>());
+
+    size_t sessionCount = 0;
+    const std::vector<Event> events =
+        argc > 1 ? readTrace(argv[1], sessionCount) : createScrolling(sessionCount);
+    const size_t rounds = argc > 2 ? std::max(std::atoi(argv[2]), 1) : 10;
+
+    std::cout << events.size() << " events of " << sessionCount << " sessions, " << rounds
+              << " rounds\n";
+    std::cout << std::setw(10) << "tracker" << std::setw(14) << "tiles" << std::setw(14)
+              << "keyframes" << std::setw(12) << "ns/tile" << '\n';
+
+    size_t tileCount, keyframes;
+    double ns = replay<HashSetDeltaTracker>(events, sessionCount, rounds, tileCount, keyframes);
+    std::cout << std::setw(10) << "hash-set" << std::setw(14) << tileCount << std::setw(14)
+              << keyframes << std::fixed << std::setprecision(1) << std::setw(12) << ns << '\n';
+
+    ns = replay<ClientDeltaTracker>(events, sessionCount, rounds, tileCount, keyframes);
+    std::cout << std::setw(10) << "grid" << std::setw(14) << tileCount << std::setw(14)
+              << keyframes << std::fixed << std::setprecision(1) << std::setw(12) << ns << '\n';
+
+    return 0;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
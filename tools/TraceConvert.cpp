@@ -0,0 +1,126 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Converts the binary Trace Events buffered by the Kit processes, when
+ * trace_event.binary is set, into the Chrome Trace Event JSON format,
+ * which can be loaded alongside the JSON file written by coolwsd.
+ */
+
+#include <config.h>
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <sysexits.h>
+
+#include <common/TraceBuffer.hpp>
+
+namespace
+{
+/// Escapes @value for a JSON string.
+std::string escape(const std::string& value)
+{
+    std::string result;
+    result.reserve(value.size());
+    for (const char c : value)
+    {
+        if (c == '"' || c == '\\')
+        {
+            result += '\\';
+            result += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", c);
+            result += code;
+        }
+        else
+            result += c;
+    }
+
+    return result;
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    if (argc != 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " <binary trace file> <JSON output file>\n";
+        return EX_USAGE;
+    }
+
+    std::ifstream input(argv[1], std::ios::binary);
+    const std::string data((std::istreambuf_iterator<char>(input)),
+                           std::istreambuf_iterator<char>());
+    if (!input.good() && !input.eof())
+    {
+        std::cerr << "Failed to read " << argv[1] << '\n';
+        return EX_NOINPUT;
+    }
+
+    if (data.size() < sizeof(TraceBuffer::Magic) ||
+        std::memcmp(data.data(), TraceBuffer::Magic, sizeof(TraceBuffer::Magic)) != 0)
+    {
+        std::cerr << argv[1] << " is not a binary trace file\n";
+        return EX_DATAERR;
+    }
+
+    std::ofstream output(argv[2]);
+    output << "[\n";
+
+    bool first = true;
+    std::size_t events = 0;
+    uint64_t dropped = 0;
+    const bool complete = TraceBuffer::read(
+        data.data() + sizeof(TraceBuffer::Magic), data.size() - sizeof(TraceBuffer::Magic),
+        [&](int32_t pid, const TraceBuffer::Record& rec, const std::string& name,
+            const std::string& args)
+        {
+            if (!first)
+                output << ",\n";
+            first = false;
+
+            output << "{\"name\":\"" << escape(name) << "\",\"ph\":\"" << rec._phase
+                   << "\",\"ts\":" << rec._timestamp;
+            if (rec._phase == 'X')
+                output << ",\"dur\":" << rec._duration;
+            output << ",\"pid\":" << pid << ",\"tid\":" << rec._tid;
+            if (!args.empty())
+                output << ",\"args\":" << args;
+            output << '}';
+            ++events;
+        },
+        [&](int32_t pid, uint64_t count)
+        {
+            std::cerr << "Process " << pid << " dropped " << count << " events\n";
+            dropped += count;
+        });
+
+    output << "\n]\n";
+    output.close();
+
+    std::cerr << "Converted " << events << " events, " << dropped << " dropped\n";
+    if (!complete)
+    {
+        std::cerr << argv[1] << " is truncated or corrupted\n";
+        return EX_DATAERR;
+    }
+
+    return output.good() ? EX_OK : EX_IOERR;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -958,6 +958,20 @@ void Admin::addBytes(const std::string& docKey, uint64_t sent, uint64_t recv)
     addCallback([this, docKey, sent, recv] { _model.addBytes(docKey, sent, recv); });
 }
 
+void Admin::setDocTileCacheStats(const std::string& docKey, uint64_t hits, uint64_t misses,
+                                 uint64_t evictions)
+{
+    addCallback([this, docKey, hits, misses, evictions]
+                { _model.setDocTileCacheStats(docKey, hits, misses, evictions); });
+}
+
+void Admin::setDocSpeculativeTileStats(const std::string& docKey, uint64_t requests,
+                                       uint64_t hits)
+{
+    addCallback([this, docKey, requests, hits]
+                { _model.setDocSpeculativeTileStats(docKey, requests, hits); });
+}
+
 void Admin::setViewLoadDuration(const std::string& docKey, const std::string& sessionId, std::chrono::milliseconds viewLoadDuration)
 {
     addCallback([this, docKey, sessionId, viewLoadDuration]{ _model.setViewLoadDuration(docKey, sessionId, viewLoadDuration); });
@@ -973,6 +987,13 @@ void Admin::setDocWopiUploadDuration(const std::string& docKey, const std::chron
     addCallback([this, docKey, uploadDuration]{ _model.setDocWopiUploadDuration(docKey, uploadDuration); });
 }
 
+void Admin::setDocUploadedBytes(const std::string& docKey, uint64_t uploadedBytes,
+                                uint64_t documentBytes)
+{
+    addCallback([this, docKey, uploadedBytes, documentBytes]
+                { _model.setDocUploadedBytes(docKey, uploadedBytes, documentBytes); });
+}
+
 void Admin::addErrorExitCounters(unsigned segFaultCount, unsigned killedCount,
                                  unsigned oomKilledCount)
 {
@@ -146,6 +146,9 @@ public:
 
     void updateLastActivityTime(const std::string& docKey);
     void addBytes(const std::string& docKey, uint64_t sent, uint64_t recv);
+    void setDocTileCacheStats(const std::string& docKey, uint64_t hits, uint64_t misses,
+                              uint64_t evictions);
+    void setDocSpeculativeTileStats(const std::string& docKey, uint64_t requests, uint64_t hits);
 
     void dumpState(std::ostream& os) const override;
 
@@ -168,6 +171,8 @@ public:
     void setViewLoadDuration(const std::string& docKey, const std::string& sessionId, std::chrono::milliseconds viewLoadDuration);
     void setDocWopiDownloadDuration(const std::string& docKey, std::chrono::milliseconds wopiDownloadDuration);
     void setDocWopiUploadDuration(const std::string& docKey, const std::chrono::milliseconds uploadDuration);
+    void setDocUploadedBytes(const std::string& docKey, uint64_t uploadedBytes,
+                             uint64_t documentBytes);
     void addErrorExitCounters(unsigned segFaultCount, unsigned killedCount,
                               unsigned oomKilledCount);
     void addLostKitsTerminated(unsigned lostKitsTerminated);
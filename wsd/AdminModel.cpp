@@ -27,9 +27,12 @@
 #include <Unit.hpp>
 #include <Util.hpp>
 #include <common/ConfigUtil.hpp>
+#include <net/CompressedFileCache.hpp>
+#include <net/WebSocketDeflate.hpp>
 #include <net/WebSocketHandler.hpp>
 #include <wsd/COOLWSD.hpp>
 #include <wsd/Exceptions.hpp>
+#include <wsd/wopi/StorageConnectionManager.hpp>
 
 #include <fnmatch.h>
 #include <dirent.h>
@@ -501,6 +504,26 @@ void AdminModel::addBytes(const std::string& docKey, uint64_t sent, uint64_t rec
     _recvBytesTotal += recv;
 }
 
+void AdminModel::setDocTileCacheStats(const std::string& docKey, uint64_t hits, uint64_t misses,
+                                      uint64_t evictions)
+{
+    ASSERT_CORRECT_THREAD_OWNER(_owner);
+
+    auto doc = _documents.find(docKey);
+    if (doc != _documents.end())
+        doc->second->setTileCacheStats(hits, misses, evictions);
+}
+
+void AdminModel::setDocSpeculativeTileStats(const std::string& docKey, uint64_t requests,
+                                            uint64_t hits)
+{
+    ASSERT_CORRECT_THREAD_OWNER(_owner);
+
+    auto doc = _documents.find(docKey);
+    if (doc != _documents.end())
+        doc->second->setSpeculativeTileStats(requests, hits);
+}
+
 void AdminModel::modificationAlert(const std::string& docKey, pid_t pid, bool value)
 {
     ASSERT_CORRECT_THREAD_OWNER(_owner);
@@ -918,6 +941,14 @@ void AdminModel::setDocWopiUploadDuration(const std::string& docKey, const std::
         it->second->setWopiUploadDuration(wopiUploadDuration);
 }
 
+void AdminModel::setDocUploadedBytes(const std::string& docKey, uint64_t uploadedBytes,
+                                     uint64_t documentBytes)
+{
+    auto it = _documents.find(docKey);
+    if (it != _documents.end())
+        it->second->setUploadedBytes(uploadedBytes, documentBytes);
+}
+
 void AdminModel::addErrorExitCounters(unsigned segFaultCount, unsigned killedCount,
                                       unsigned oomKilledCount)
 {
@@ -1223,6 +1254,22 @@ void AdminModel::getMetrics(std::ostringstream &oss)
     oss << std::endl;
     PrintDocActExpMetrics(oss, "view_load_duration", "milliseconds", docStats._viewLoadDuration);
 
+    oss << std::endl;
+    const uint64_t handshakes = StorageConnectionManager::getHandshakeCount();
+    oss << "storage_connection_pool_hits " << StorageConnectionManager::getPoolHitCount() << "\n";
+    oss << "storage_connection_pool_misses " << StorageConnectionManager::getPoolMissCount() << "\n";
+    oss << "storage_connection_pool_idle " << StorageConnectionManager::getIdleConnectionCount() << "\n";
+    oss << "storage_tls_handshakes " << handshakes << "\n";
+    oss << "storage_tls_handshakes_resumed " << StorageConnectionManager::getResumedHandshakeCount() << "\n";
+    oss << "storage_tls_handshake_average_milliseconds "
+        << (handshakes ? StorageConnectionManager::getHandshakeDuration().count() / 1000. / handshakes : 0) << "\n";
+
+    oss << std::endl;
+    WebSocketDeflate::printMetrics(oss);
+
+    oss << std::endl;
+    CompressedFileCache::printMetrics(oss);
+
     oss << std::endl;
     oss << "error_storage_space_low " << StorageSpaceLowException::count << "\n";
     oss << "error_storage_connection " << StorageConnectionException::count << "\n";
@@ -1257,6 +1304,13 @@ void AdminModel::getMetrics(std::ostringstream &oss)
         oss << "doc_idle_time_seconds" << suffix << doc.getIdleTime() << "\n";
         oss << "doc_download_time_seconds" << suffix << ((double)doc.getWopiDownloadDuration().count() / 1000) << "\n";
         oss << "doc_upload_time_seconds" << suffix << ((double)doc.getWopiUploadDuration().count() / 1000) << "\n";
+        oss << "doc_uploaded_bytes" << suffix << doc.getUploadedBytes() << "\n";
+        oss << "doc_uploaded_document_bytes" << suffix << doc.getUploadedDocumentBytes() << "\n";
+        oss << "doc_tile_cache_hits" << suffix << doc.getTileCacheHits() << "\n";
+        oss << "doc_tile_cache_misses" << suffix << doc.getTileCacheMisses() << "\n";
+        oss << "doc_tile_cache_evictions" << suffix << doc.getTileCacheEvictions() << "\n";
+        oss << "doc_speculative_tiles" << suffix << doc.getSpeculativeTileRequests() << "\n";
+        oss << "doc_speculative_tile_hits" << suffix << doc.getSpeculativeTileHits() << "\n";
         oss << std::endl;
     }
 }
@@ -175,8 +175,15 @@ public:
         , _end(0)
         , _sentBytes(0)
         , _recvBytes(0)
+        , _tileCacheHits(0)
+        , _tileCacheMisses(0)
+        , _tileCacheEvictions(0)
+        , _speculativeTileRequests(0)
+        , _speculativeTileHits(0)
         , _wopiDownloadDuration(0)
         , _wopiUploadDuration(0)
+        , _uploadedBytes(0)
+        , _uploadedDocumentBytes(0)
         , _procSMaps(nullptr)
         , _lastTimeSMapsRead(0)
         , _isModified(false)
@@ -244,11 +251,34 @@ public:
     std::time_t getOpenTime() const { return isExpired() ? _end - _start : getElapsedTime(); }
     uint64_t getSentBytes() const { return _sentBytes; }
     uint64_t getRecvBytes() const { return _recvBytes; }
+    void setTileCacheStats(uint64_t hits, uint64_t misses, uint64_t evictions)
+    {
+        _tileCacheHits = hits;
+        _tileCacheMisses = misses;
+        _tileCacheEvictions = evictions;
+    }
+    uint64_t getTileCacheHits() const { return _tileCacheHits; }
+    uint64_t getTileCacheMisses() const { return _tileCacheMisses; }
+    uint64_t getTileCacheEvictions() const { return _tileCacheEvictions; }
+    void setSpeculativeTileStats(uint64_t requests, uint64_t hits)
+    {
+        _speculativeTileRequests = requests;
+        _speculativeTileHits = hits;
+    }
+    uint64_t getSpeculativeTileRequests() const { return _speculativeTileRequests; }
+    uint64_t getSpeculativeTileHits() const { return _speculativeTileHits; }
     void setViewLoadDuration(const std::string& sessionId, std::chrono::milliseconds viewLoadDuration);
     void setWopiDownloadDuration(std::chrono::milliseconds wopiDownloadDuration) { _wopiDownloadDuration = wopiDownloadDuration; }
     std::chrono::milliseconds getWopiDownloadDuration() const { return _wopiDownloadDuration; }
     void setWopiUploadDuration(const std::chrono::milliseconds wopiUploadDuration) { _wopiUploadDuration = wopiUploadDuration; }
     std::chrono::milliseconds getWopiUploadDuration() const { return _wopiUploadDuration; }
+    void setUploadedBytes(uint64_t uploadedBytes, uint64_t documentBytes)
+    {
+        _uploadedBytes = uploadedBytes;
+        _uploadedDocumentBytes = documentBytes;
+    }
+    uint64_t getUploadedBytes() const { return _uploadedBytes; }
+    uint64_t getUploadedDocumentBytes() const { return _uploadedDocumentBytes; }
     void setProcSMapsFD(const int smapsFD) { _procSMaps = fdopen(smapsFD, "r"); }
     bool hasMemDirtyChanged() const { return _hasMemDirtyChanged; }
     void setMemDirtyChanged(bool changeStatus) { _hasMemDirtyChanged = changeStatus; }
@@ -285,10 +315,19 @@ private:
     /// Total bytes sent and recv'd by this document.
     uint64_t _sentBytes, _recvBytes;
 
+    /// Tile cache lookups and evictions of this document.
+    uint64_t _tileCacheHits, _tileCacheMisses, _tileCacheEvictions;
+
+    /// Tiles rendered ahead of the clients scrolling, and how many they requested.
+    uint64_t _speculativeTileRequests, _speculativeTileHits;
+
     //Download/upload duration from/to storage for this document
     std::chrono::milliseconds _wopiDownloadDuration;
     std::chrono::milliseconds _wopiUploadDuration;
 
+    /// Bytes sent to storage by the uploads, and the size of the documents they uploaded.
+    uint64_t _uploadedBytes, _uploadedDocumentBytes;
+
     FILE* _procSMaps;
     std::time_t _lastTimeSMapsRead;
 
@@ -402,6 +441,10 @@ public:
 
     void addBytes(const std::string& docKey, uint64_t sent, uint64_t recv);
 
+    void setDocTileCacheStats(const std::string& docKey, uint64_t hits, uint64_t misses,
+                              uint64_t evictions);
+    void setDocSpeculativeTileStats(const std::string& docKey, uint64_t requests, uint64_t hits);
+
     uint64_t getSentBytesTotal() { return _sentBytesTotal; }
     uint64_t getRecvBytesTotal() { return _recvBytesTotal; }
 
@@ -414,6 +457,8 @@ public:
     void setViewLoadDuration(const std::string& docKey, const std::string& sessionId, std::chrono::milliseconds viewLoadDuration);
     void setDocWopiDownloadDuration(const std::string& docKey, std::chrono::milliseconds wopiDownloadDuration);
     void setDocWopiUploadDuration(const std::string& docKey, const std::chrono::milliseconds wopiUploadDuration);
+    void setDocUploadedBytes(const std::string& docKey, uint64_t uploadedBytes,
+                             uint64_t documentBytes);
     void addErrorExitCounters(unsigned segFaultCount, unsigned killedCount,
                               unsigned oomKilledCount);
     void setForKitPid(pid_t pid) { _forKitPid = pid; }
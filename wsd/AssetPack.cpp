@@ -0,0 +1,251 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <config.h>
+
+#include "AssetPack.hpp"
+
+#include <common/Log.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+void AssetPack::Builder::add(const std::string& path, const std::string& contentType,
+                             const std::string& etag, std::string raw, std::string gzip,
+                             std::string brotli)
+{
+    _files.push_back(File{ path, contentType, etag, std::move(raw), std::move(gzip),
+                           std::move(brotli) });
+}
+
+bool AssetPack::Builder::write(const std::string& path, const std::string& version)
+{
+    if (version.size() >= sizeof(Header::_version))
+        return false;
+
+    std::sort(_files.begin(), _files.end(),
+              [](const File& lhs, const File& rhs) { return lhs._path < rhs._path; });
+
+    Header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header._magic, Magic, sizeof(Magic));
+    std::memcpy(header._version, version.data(), version.size());
+    header._count = _files.size();
+
+    // The data follows the entries, in the order they refer to it.
+    uint64_t offset = sizeof(Header) + _files.size() * sizeof(Entry);
+    const auto place = [&offset](const std::string& data)
+    {
+        const Span span{ offset, data.size() };
+        offset += data.size();
+        return span;
+    };
+
+    std::vector<Entry> entries;
+    entries.reserve(_files.size());
+    for (const File& file : _files)
+    {
+        Entry entry;
+        entry._path = place(file._path);
+        entry._contentType = place(file._contentType);
+        entry._etag = place(file._etag);
+        entry._raw = place(file._raw);
+        entry._gzip = place(file._gzip);
+        entry._brotli = place(file._brotli);
+        entries.push_back(entry);
+    }
+
+    // Running instances map the pack: replace it whole, rather than truncating
+    // it under them, and never leave a partial one behind.
+    const std::string tmpPath = path + ".tmp";
+    const int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        LOG_SYS("Failed to create the asset pack [" << tmpPath << ']');
+        return false;
+    }
+
+    const auto writeAll = [fd](const void* buffer, std::size_t size)
+    {
+        const char* data = static_cast<const char*>(buffer);
+        while (size > 0)
+        {
+            const ssize_t written = ::write(fd, data, size);
+            if (written < 0 && errno == EINTR)
+                continue;
+
+            if (written <= 0)
+                return false;
+
+            data += written;
+            size -= written;
+        }
+
+        return true;
+    };
+
+    bool good = writeAll(&header, sizeof(header)) &&
+                writeAll(entries.data(), entries.size() * sizeof(Entry));
+    for (const File& file : _files)
+    {
+        for (const std::string* data :
+             { &file._path, &file._contentType, &file._etag, &file._raw, &file._gzip, &file._brotli })
+            good = good && writeAll(data->data(), data->size());
+    }
+
+    good = good && ::fsync(fd) == 0;
+    good = ::close(fd) == 0 && good;
+    if (!good || ::rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        LOG_SYS("Failed to write the asset pack [" << path << ']');
+        ::unlink(tmpPath.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+std::unique_ptr<AssetPack> AssetPack::open(const std::string& path, const std::string& version)
+{
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        LOG_INF("No asset pack at [" << path << ']');
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(Header)))
+    {
+        LOG_WRN("Asset pack [" << path << "] is truncated");
+        ::close(fd);
+        return nullptr;
+    }
+
+    // The mapping outlives the descriptor.
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+    {
+        LOG_SYS("Failed to map the asset pack [" << path << ']');
+        return nullptr;
+    }
+
+    std::unique_ptr<AssetPack> pack(new AssetPack(static_cast<const char*>(data), st.st_size));
+
+    Header header;
+    std::memcpy(&header, pack->_data, sizeof(header));
+    if (std::memcmp(header._magic, Magic, sizeof(Magic)) != 0)
+    {
+        LOG_WRN("[" << path << "] is not an asset pack");
+        return nullptr;
+    }
+
+    if (version.size() >= sizeof(header._version) ||
+        std::memcmp(header._version, version.c_str(), version.size() + 1) != 0)
+    {
+        LOG_WRN("Asset pack [" << path << "] was built for version "
+                               << std::string(header._version, strnlen(header._version,
+                                                                       sizeof(header._version)))
+                               << ", not " << version << ", ignoring it");
+        return nullptr;
+    }
+
+    if (header._count > (pack->_size - sizeof(Header)) / sizeof(Entry))
+    {
+        LOG_WRN("Asset pack [" << path << "] is truncated");
+        return nullptr;
+    }
+
+    // Check it all once, so the lookups needn't.
+    const Entry* entries = reinterpret_cast<const Entry*>(pack->_data + sizeof(Header));
+    for (std::size_t i = 0; i < header._count; ++i)
+    {
+        const Entry& entry = entries[i];
+        for (const Span* span : { &entry._path, &entry._contentType, &entry._etag, &entry._raw,
+                                  &entry._gzip, &entry._brotli })
+        {
+            if (span->_offset > pack->_size || span->_size > pack->_size - span->_offset)
+            {
+                LOG_WRN("Asset pack [" << path << "] is corrupted");
+                return nullptr;
+            }
+        }
+
+        if (i > 0 && pack->view(entries[i - 1]._path) >= pack->view(entry._path))
+        {
+            LOG_WRN("Asset pack [" << path << "] is not sorted");
+            return nullptr;
+        }
+    }
+
+    pack->_entries = entries;
+    pack->_count = header._count;
+
+    LOG_INF("Mapped asset pack [" << path << "] of " << pack->_count << " files, "
+                                  << pack->_size << " bytes");
+    return pack;
+}
+
+AssetPack::AssetPack(const char* data, std::size_t size)
+    : _data(data)
+    , _size(size)
+    , _entries(nullptr)
+    , _count(0)
+{
+}
+
+AssetPack::~AssetPack() { munmap(const_cast<char*>(_data), _size); }
+
+bool AssetPack::find(std::string_view path, Asset& asset) const
+{
+    const Entry* end = _entries + _count;
+    const Entry* it = std::lower_bound(_entries, end, path,
+                                       [this](const Entry& entry, std::string_view value)
+                                       { return view(entry._path) < value; });
+    if (it == end || view(it->_path) != path)
+        return false;
+
+    asset._contentType = view(it->_contentType);
+    asset._etag = view(it->_etag);
+    asset._raw = view(it->_raw);
+    asset._gzip = view(it->_gzip);
+    asset._brotli = view(it->_brotli);
+    return true;
+}
+
+std::string AssetPack::getContentType(std::string_view path)
+{
+    const std::size_t extPoint = path.find_last_of('.');
+    const std::string_view fileType =
+        extPoint == std::string_view::npos ? std::string_view() : path.substr(extPoint + 1);
+    if (fileType == "js")
+        return "application/javascript";
+    if (fileType == "css")
+        return "text/css";
+    if (fileType == "html")
+        return "text/html";
+    if (fileType == "png")
+        return "image/png";
+    if (fileType == "svg")
+        return "image/svg+xml";
+    if (fileType == "wasm")
+        return "application/wasm";
+    return "text/plain";
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
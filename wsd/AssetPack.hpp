@@ -0,0 +1,123 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// The files served by the FileServer, packed at install time, by
+/// coolassetpack, in a single file that we map read-only: the pages are
+/// then shared by all the instances on the host, and nothing is read or
+/// compressed at startup.
+///
+/// The pack starts with a Header, followed by the Entries sorted by path,
+/// then by the data they refer to. It is in the byte order of the machine
+/// that built it, and only valid for the version it was built by.
+class AssetPack
+{
+public:
+    /// The start of a pack.
+    static constexpr char Magic[8] = { 'C', 'O', 'O', 'L', 'P', 'A', 'K', '1' };
+
+    /// Where some data is in the pack.
+    struct Span
+    {
+        uint64_t _offset;
+        uint64_t _size;
+    };
+
+    struct Header
+    {
+        char _magic[sizeof(Magic)];
+        char _version[32]; ///< COOLWSD_VERSION_HASH, nul-padded.
+        uint64_t _count; ///< Of Entries.
+    };
+
+    struct Entry
+    {
+        Span _path; ///< As requested, e.g. /browser/dist/bundle.js.
+        Span _contentType;
+        Span _etag; ///< Quoted.
+        Span _raw;
+        Span _gzip; ///< Empty if not worth it.
+        Span _brotli; ///< Empty if not installed.
+    };
+
+    /// A file in the pack, pointing into the mapping.
+    struct Asset
+    {
+        std::string_view _contentType;
+        std::string_view _etag;
+        std::string_view _raw;
+        std::string_view _gzip;
+        std::string_view _brotli;
+    };
+
+    /// Collects the files, to write them in a pack.
+    class Builder
+    {
+    public:
+        void add(const std::string& path, const std::string& contentType, const std::string& etag,
+                 std::string raw, std::string gzip, std::string brotli);
+
+        /// Writes the pack to @path for @version. Returns false on failure.
+        bool write(const std::string& path, const std::string& version);
+
+    private:
+        struct File
+        {
+            std::string _path;
+            std::string _contentType;
+            std::string _etag;
+            std::string _raw;
+            std::string _gzip;
+            std::string _brotli;
+        };
+
+        std::vector<File> _files;
+    };
+
+    /// Maps the pack at @path, built for @version.
+    /// Returns nullptr if it is missing, stale or corrupted.
+    static std::unique_ptr<AssetPack> open(const std::string& path, const std::string& version);
+
+    ~AssetPack();
+
+    /// Looks up the file at @path. Returns false if it isn't in the pack.
+    bool find(std::string_view path, Asset& asset) const;
+
+    std::size_t count() const { return _count; }
+
+    std::size_t size() const { return _size; }
+
+    /// The Content-Type we serve a file of @path as.
+    static std::string getContentType(std::string_view path);
+
+private:
+    AssetPack(const char* data, std::size_t size);
+
+    std::string_view view(const Span& span) const
+    {
+        return std::string_view(_data + span._offset, span._size);
+    }
+
+    const char* const _data;
+    const std::size_t _size;
+    const Entry* _entries;
+    std::size_t _count;
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
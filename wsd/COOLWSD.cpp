@@ -106,6 +106,7 @@
 #include <common/FileUtil.hpp>
 #include <common/JailUtil.hpp>
 #include <common/Watchdog.hpp>
+#include <common/TraceBuffer.hpp>
 #include <Log.hpp>
 #include <MobileApp.hpp>
 #include <Protocol.hpp>
@@ -121,6 +122,8 @@
 
 #include <common/SigUtil.hpp>
 #include <net/AsyncDNS.hpp>
+#include <net/CompressedFileCache.hpp>
+#include <net/WebSocketDeflate.hpp>
 
 #include <ServerSocket.hpp>
 
@@ -380,6 +383,15 @@ void COOLWSD::writeTraceEventRecording(const std::string &recording)
     writeTraceEventRecording(recording.data(), recording.length());
 }
 
+void COOLWSD::writeTraceBufferRecording(const char *data, std::size_t nbytes)
+{
+    static std::mutex traceBufferFileMutex;
+
+    std::unique_lock<std::mutex> lock(traceBufferFileMutex);
+
+    fwrite(data, nbytes, 1, COOLWSD::TraceBufferFile);
+}
+
 void COOLWSD::checkSessionLimitsAndWarnClients()
 {
 #if !MOBILEAPP
@@ -778,6 +790,7 @@ bool COOLWSD::EnableTraceEventLogging = false;
 bool COOLWSD::EnableAccessibility = false;
 bool COOLWSD::EnableMountNamespaces= false;
 FILE *COOLWSD::TraceEventFile = NULL;
+FILE *COOLWSD::TraceBufferFile = NULL;
 std::string COOLWSD::LogLevel = "trace";
 std::string COOLWSD::LogLevelStartup = "trace";
 std::string COOLWSD::LogDisabledAreas = "Socket,WebSocket,Admin,Pixel";
@@ -1512,6 +1525,24 @@ void COOLWSD::innerInitialize(Poco::Util::Application& self)
                         getpid(), (long) Util::getThreadId());
             }
         }
+
+        // The Kit processes buffer theirs in binary, converted offline by cooltraceconvert.
+        if (ConfigUtil::getConfigValue<bool>(conf, "trace_event.binary", false))
+        {
+            const std::string traceBufferFile = traceEventFile + ".bin";
+            LOG_INF("Binary Trace Event file is " << traceBufferFile << '.');
+            TraceBufferFile = fopen(traceBufferFile.c_str(), "w");
+            if (TraceBufferFile != NULL)
+            {
+                if (fcntl(fileno(TraceBufferFile), F_SETFD, FD_CLOEXEC) == -1)
+                {
+                    fclose(TraceBufferFile);
+                    TraceBufferFile = NULL;
+                }
+                else
+                    fwrite(TraceBuffer::Magic, sizeof(TraceBuffer::Magic), 1, TraceBufferFile);
+            }
+        }
     }
 
     // Check deprecated settings.
@@ -1855,7 +1886,7 @@ void COOLWSD::innerInitialize(Poco::Util::Application& self)
 
     FileUtil::registerFileSystemForDiskSpaceChecks(ChildRoot);
 
-    int threads = std::max<int>(std::thread::hardware_concurrency(), 1);
+    int threads = Util::getCpuCount();
     int maxConcurrency = ConfigUtil::getConfigValue<int>(conf, "per_document.max_concurrency", 4);
 
     if (maxConcurrency > 16)
@@ -2115,13 +2146,39 @@ void COOLWSD::innerInitialize(Poco::Util::Application& self)
 
     LOG_TRC("Initialize FileServerRequestHandler");
     COOLWSD::FileRequestHandler =
-        std::make_unique<FileServerRequestHandler>(COOLWSD::FileServerRoot);
+        std::make_unique<FileServerRequestHandler>(
+            COOLWSD::FileServerRoot,
+            ConfigUtil::getConfigValue<std::string>("file_server_asset_pack", ""));
 #endif
 
     WebServerPoll = std::make_unique<TerminatingPoll>("websrv_poll");
 
 #if !MOBILEAPP
-    net::AsyncDNS::startAsyncDNS();
+    net::setDNSCacheTTL(
+        std::chrono::seconds(ConfigUtil::getConfigValue<int>(conf, "net.dns.cache_ttl_secs", 20)),
+        std::chrono::seconds(
+            ConfigUtil::getConfigValue<int>(conf, "net.dns.negative_cache_ttl_secs", 5)),
+        std::chrono::seconds(ConfigUtil::getConfigValue<int>(conf, "net.dns.stale_ttl_secs", 60)));
+    net::AsyncDNS::startAsyncDNS(std::max(
+        ConfigUtil::getConfigValue<int>(conf, "net.dns.resolver_threads",
+                                        net::AsyncDNS::DefaultThreadCount),
+        1));
+
+    WebSocketDeflate::initialize(
+        ConfigUtil::getConfigValue<bool>(conf, "net.websocket_compression[@enable]", true),
+        ConfigUtil::getConfigValue<int>(conf, "net.websocket_compression.min_size", 256),
+        ConfigUtil::getConfigValue<int>(conf, "net.websocket_compression.window_bits",
+                                        WebSocketDeflate::MaxWindowBits),
+        ConfigUtil::getConfigValue<int>(conf, "net.websocket_compression.level", Z_BEST_SPEED));
+
+    CompressedFileCache::initialize(
+        ConfigUtil::getConfigValue<bool>(conf, "net.file_compression[@enable]", true),
+        ConfigUtil::getConfigValue<std::size_t>(conf, "net.file_compression.max_bytes",
+                                                64 * 1024 * 1024),
+        ConfigUtil::getConfigValue<std::size_t>(conf, "net.file_compression.min_file_size", 1024),
+        ConfigUtil::getConfigValue<std::size_t>(conf, "net.file_compression.max_file_size",
+                                                16 * 1024 * 1024),
+        ConfigUtil::getConfigValue<int>(conf, "net.file_compression.level", 6));
 
     LOG_TRC("Initialize StorageConnectionManager");
     StorageConnectionManager::initialize();
@@ -2129,6 +2186,13 @@ void COOLWSD::innerInitialize(Poco::Util::Application& self)
 
     PrisonerPoll = std::make_unique<PrisonPoll>();
 
+    // The server-wide polls can hold thousands of sockets, where epoll scales better.
+    if (ConfigUtil::getConfigValue<bool>(conf, "net.epoll", false))
+    {
+        WebServerPoll->setPollBackend(SocketPoll::PollBackend::Epoll);
+        PrisonerPoll->setPollBackend(SocketPoll::PollBackend::Epoll);
+    }
+
     Server = std::make_unique<COOLWSDServer>();
 
     LOG_TRC("Initialize StorageBase");
@@ -3373,6 +3437,9 @@ public:
         os << '\n';
         net::AsyncDNS::dumpState(os);
 
+        os << '\n';
+        CompressedFileCache::dumpState(os);
+
         os << '\n';
         COOLWSD::SavedClipboards->dumpState(os);
 #endif
@@ -3837,6 +3904,11 @@ int COOLWSD::innerMain()
             waitMicroS /= 4;
         }
 
+#if !MOBILEAPP
+        // The idle storage connections sit outside of any poll.
+        waitMicroS = std::min(waitMicroS, StorageConnectionManager::expireIdleConnections());
+#endif
+
         mainWait.poll(waitMicroS);
 
         // Wake the prisoner poll to spawn some children, if necessary.
@@ -3978,6 +4050,12 @@ int COOLWSD::innerMain()
         TraceEventFile = NULL;
     }
 
+    if (TraceBufferFile != NULL)
+    {
+        fclose(TraceBufferFile);
+        TraceBufferFile = NULL;
+    }
+
 #if !MOBILEAPP
     if (!Util::isKitInProcess())
     {
@@ -4006,6 +4084,7 @@ int COOLWSD::innerMain()
 
 #if !MOBILEAPP
     net::AsyncDNS::stopAsyncDNS();
+    CompressedFileCache::shutdown();
 #endif
 
     SigUtil::addActivity("async DNS stopped");
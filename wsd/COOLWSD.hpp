@@ -91,6 +91,9 @@ public:
     static FILE *TraceEventFile;
     static void writeTraceEventRecording(const char *data, std::size_t nbytes);
     static void writeTraceEventRecording(const std::string &recording);
+    /// The binary Trace Events of the Kit processes, for cooltraceconvert.
+    static FILE *TraceBufferFile;
+    static void writeTraceBufferRecording(const char *data, std::size_t nbytes);
     static std::string LogLevel;
     static std::string LogLevelStartup;
     static std::string LogDisabledAreas;
@@ -2032,7 +2032,9 @@ bool ClientRequestDispatcher::handlePostRequest(const RequestDetails& requestDet
 
             try
             {
-                HttpHelper::sendFile(socket, filePath.toString(), response);
+                // Not compressed: the file is removed as soon as it is sent.
+                HttpHelper::sendFile(socket, filePath.toString(), response, false,
+                                     std::string(), false, request.get("Range", std::string()));
             }
             catch (const Poco::Exception& exc)
             {
@@ -22,6 +22,7 @@
 #include <memory>
 #include <unordered_map>
 #include <cctype>
+#include <cstdlib>
 
 #include <Poco/Base64Decoder.h>
 #include <Poco/Net/HTTPResponse.h>
@@ -66,6 +67,9 @@ void logSyntaxErrorDetails(const StringVector& tokens, const std::string& firstL
 {
     LOG_WRN("Invalid syntax for '" << tokens[0] << "' message: [" << firstLine << ']');
 }
+
+/// Visible areas sent further apart are not part of the same scroll.
+constexpr std::chrono::milliseconds ScrollGap(500);
 }
 
 ClientSession::ClientSession(
@@ -84,6 +88,8 @@ ClientSession::ClientSession(
     _lastStateTime(std::chrono::steady_clock::now()),
     _keyEvents(1),
     _clientVisibleArea(0, 0, 0, 0),
+    _scrollSpeedX(0),
+    _scrollSpeedY(0),
     _splitX(0),
     _splitY(0),
     _clientSelectedPart(-1),
@@ -970,8 +976,27 @@ bool ClientSession::_handleInput(const char *buffer, int length)
                 height = 0;
             }
 
-            _clientVisibleArea = Util::Rectangle(x, y, width, height);
-            return forwardToChild(std::string(buffer, length), docBroker);
+            const Util::Rectangle area(x, y, width, height);
+            updateScrollSpeed(area, std::chrono::steady_clock::now());
+            _clientVisibleArea = area;
+
+            // Frozen panes show the top and left of the document too,
+            // which we track apart from where the client scrolled to.
+            std::vector<Util::Rectangle> panes;
+            for (const SplitPaneName pane :
+                 { TOPLEFT_PANE, TOPRIGHT_PANE, BOTTOMLEFT_PANE, BOTTOMRIGHT_PANE })
+            {
+                if (isSplitPane(pane))
+                    panes.push_back(getNormalizedVisiblePaneArea(pane));
+            }
+            _tracker.updateViewPorts(panes);
+
+            const bool result = forwardToChild(std::string(buffer, length), docBroker);
+
+            // Get the Kit started on where the client is going next.
+            docBroker->requestSpeculativeTiles(client_from_this());
+
+            return result;
         }
     }
     else if (tokens.equals(0, "setclientpart"))
@@ -1872,10 +1897,16 @@ void ClientSession::writeQueuedMessages(std::size_t capacity)
         while (capacity > wrote && _senderQueue.dequeue(item) && item)
         {
             const std::vector<char>& data = item->data();
-            const auto size = data.size();
+            auto size = data.size();
             assert(size && "Zero-sized messages must never be queued for sending.");
 
-            if (item->isBinary())
+            if (!item->blobs().empty())
+            {
+                Session::sendSharedBinaryFrame(data.data(), size, item->blobs());
+                for (const Blob& blob : item->blobs())
+                    size += blob->size();
+            }
+            else if (item->isBinary())
             {
                 Session::sendBinaryFrame(data.data(), size);
             }
@@ -3128,6 +3159,68 @@ void ClientSession::handleTileInvalidation(const std::string& message,
     }
 }
 
+void ClientSession::updateScrollSpeed(const Util::Rectangle& area,
+                                      std::chrono::steady_clock::time_point now)
+{
+    const double elapsedMs =
+        std::chrono::duration<double, std::milli>(now - _visibleAreaTime).count();
+    _visibleAreaTime = now;
+
+    // Resizing or zooming doesn't tell where the client is going.
+    if (!_clientVisibleArea.hasSurface() || area.getWidth() != _clientVisibleArea.getWidth() ||
+        area.getHeight() != _clientVisibleArea.getHeight() || elapsedMs <= 0 ||
+        elapsedMs > ScrollGap.count())
+    {
+        _scrollSpeedX = 0;
+        _scrollSpeedY = 0;
+        return;
+    }
+
+    // Average with the previous estimate, to smooth out the jitter of the messages.
+    const double speedX = (area.getLeft() - _clientVisibleArea.getLeft()) / elapsedMs;
+    const double speedY = (area.getTop() - _clientVisibleArea.getTop()) / elapsedMs;
+    _scrollSpeedX = (_scrollSpeedX + speedX) / 2;
+    _scrollSpeedY = (_scrollSpeedY + speedY) / 2;
+}
+
+std::vector<TileDesc> ClientSession::getPredictedTiles(std::chrono::milliseconds lookahead,
+                                                       std::chrono::steady_clock::time_point now) const
+{
+    std::vector<TileDesc> tiles;
+    if (_tileWidthPixel == 0 || _tileHeightPixel == 0 || _tileWidthTwips == 0 ||
+        _tileHeightTwips == 0 || (_clientSelectedPart == -1 && !_isTextDocument))
+        return tiles;
+
+    // Not scrolling, or stopped.
+    if ((_scrollSpeedX == 0 && _scrollSpeedY == 0) || now - _visibleAreaTime > ScrollGap)
+        return tiles;
+
+    // Where the scrollable pane is going, at least a quarter of a tile away.
+    const int offsetX = _scrollSpeedX * lookahead.count();
+    const int offsetY = _scrollSpeedY * lookahead.count();
+    if (std::abs(offsetX) < _tileWidthTwips / 4 && std::abs(offsetY) < _tileHeightTwips / 4)
+        return tiles;
+
+    const Util::Rectangle pane = getNormalizedVisiblePaneArea(BOTTOMRIGHT_PANE);
+    const int left = std::max(pane.getLeft() + offsetX, 0);
+    const int top = std::max(pane.getTop() + offsetY, 0);
+    const int right = pane.getRight() + offsetX;
+    const int bottom = pane.getBottom() + offsetY;
+
+    const int part = _isTextDocument ? 0 : _clientSelectedPart;
+    for (int row = top / _tileHeightTwips; row * _tileHeightTwips < bottom; ++row)
+    {
+        for (int column = left / _tileWidthTwips; column * _tileWidthTwips < right; ++column)
+        {
+            tiles.emplace_back(getCanonicalViewId(), part, _clientSelectedMode, _tileWidthPixel,
+                               _tileHeightPixel, column * _tileWidthTwips, row * _tileHeightTwips,
+                               _tileWidthTwips, _tileHeightTwips, -1, 0, -1);
+        }
+    }
+
+    return tiles;
+}
+
 bool ClientSession::isSplitPane(const SplitPaneName paneName) const
 {
     if (paneName == BOTTOMRIGHT_PANE)
@@ -119,28 +119,25 @@ public:
         else
             header = desc.serialize("delta:", "\n");
 
-        // FIXME: performance - optimize away this copy ...
-        std::vector<char> output;
-
-        // copy in the header
-        output.resize(header.size());
-        std::memcpy(output.data(), header.data(), header.size());
-
-        bool hasContent = tile->appendChangesSince(output, tile->isPng() ? 0 : lastSentId);
+        // The frames are immutable: share rather than copy them all the way to the socket.
+        std::vector<Blob> frames;
+        bool hasContent = tile->appendChangesSince(frames, tile->isPng() ? 0 : lastSentId);
         LOG_TRC("Sending tile message: " << header << " lastSendId " << lastSentId << " content " << hasContent);
-        return sendBinaryFrame(output.data(), output.size());
+        if (isCloseFrame())
+            return false;
+
+        enqueueSendMessage(std::make_shared<Message>(header, std::move(frames), Message::Dir::Out));
+        return true;
     }
 
+    /// Send a binary message of header and a cached, immutable, blob.
     bool sendBlob(const std::string &header, const Blob &blob)
     {
-        // FIXME: performance - optimize away this copy ...
-        std::vector<char> output;
-
-        output.resize(header.size() + blob->size());
-        std::memcpy(output.data(), header.data(), header.size());
-        std::memcpy(output.data() + header.size(), blob->data(), blob->size());
+        if (isCloseFrame())
+            return false;
 
-        return sendBinaryFrame(output.data(), output.size());
+        enqueueSendMessage(std::make_shared<Message>(header, std::vector<Blob>{ blob }, Message::Dir::Out));
+        return true;
     }
 
     bool sendTextFrame(const char* buffer, const int length) override
@@ -212,6 +209,11 @@ public:
     /// Returns the normalized visible area of a given split-pane.
     Util::Rectangle getNormalizedVisiblePaneArea(const SplitPaneName) const;
 
+    /// The tiles the client would see after scrolling for @lookahead more,
+    /// at its current speed, or none if it isn't scrolling.
+    std::vector<TileDesc> getPredictedTiles(std::chrono::milliseconds lookahead,
+                                            std::chrono::steady_clock::time_point now) const;
+
     int getTileWidthInTwips() const { return _tileWidthTwips; }
     int getTileHeightInTwips() const { return _tileHeightTwips; }
 
@@ -351,6 +353,9 @@ private:
 
     bool isTileInsideVisibleArea(const TileDesc& tile) const;
 
+    /// Estimates the scrolling speed from the move of the visible area to @area.
+    void updateScrollSpeed(const Util::Rectangle& area, std::chrono::steady_clock::time_point now);
+
     /// If this session is read-only because of failed lock, try to unlock and make it read-write.
     bool attemptLock(const std::shared_ptr<DocumentBroker>& docBroker);
 
@@ -392,6 +397,13 @@ private:
     /// Visible area of the client
     Util::Rectangle _clientVisibleArea;
 
+    /// The scrolling speed of the client, in twips per millisecond.
+    double _scrollSpeedX;
+    double _scrollSpeedY;
+
+    /// When the client last sent its visible area.
+    std::chrono::steady_clock::time_point _visibleAreaTime;
+
     /// Split position that defines the current split panes
     int _splitX;
     int _splitY;
@@ -184,6 +184,8 @@ DocumentBroker::DocumentBroker(ChildType type, const std::string& uri, const Poc
                        "per_document.min_time_between_saves_ms", 500)))
     , _storageManager(std::chrono::milliseconds(
           ConfigUtil::getConfigValueNonZero<int>("per_document.min_time_between_uploads_ms", 5000)))
+    , _speculativeTilesLookahead(ConfigUtil::getConfigValue<int>(
+          "per_document.speculative_tiles.lookahead_ms", 500))
     , _isModified(false)
     , _cursorPosX(0)
     , _cursorPosY(0)
@@ -197,6 +199,8 @@ DocumentBroker::DocumentBroker(ChildType type, const std::string& uri, const Poc
     , _debugRenderedTileCount(0)
     , _loadDuration(0)
     , _wopiDownloadDuration(0)
+    , _asyncDownloadInProgress(false)
+    , _asyncDownloadPercent(0)
     , _configId(configId)
     , _mobileAppDocId(mobileAppDocId)
     , _alwaysSaveOnExit(ConfigUtil::getConfigValue<bool>("per_document.always_save_on_exit", false))
@@ -409,7 +413,10 @@ void DocumentBroker::pollThread()
         // a tile's data is ~8k, a 4k screen is ~256 256x256 tiles -
         // so double that - 4Mb per view.
         if (_tileCache)
+        {
+            _tileCache->applyCompactedTiles();
             _tileCache->setMaxCacheSize(8 * 1024 * 256 * 2 * _sessions.size());
+        }
 
         if (isInteractive())
         {
@@ -427,6 +434,10 @@ void DocumentBroker::pollThread()
             continue;
         }
 
+        // Loading only starts once downloaded, and the download has its own timeout.
+        if (isAsyncDownloading())
+            loadDeadline = now + std::chrono::seconds(limit_load_secs);
+
         if (!isLoaded() && (limit_load_secs > 0) && (now > loadDeadline))
         {
             LOG_ERR("Doc [" << _docKey << "] is taking too long to load. Will kill process ["
@@ -485,6 +496,20 @@ void DocumentBroker::pollThread()
 
             // send change since last notification.
             _admin.addBytes(getDocKey(), deltaSent, deltaRecv);
+
+            if (_tileCache)
+                _admin.setDocTileCacheStats(getDocKey(), _tileCache->getHitCount(),
+                                            _tileCache->getMissCount(),
+                                            _tileCache->getEvictionCount());
+
+            if (_speculativeTiles)
+            {
+                for (const TileDesc& tile : _speculativeTiles->expire(now))
+                    _tileCache->forgetUnsubscribedTileBeingRendered(tile);
+                _admin.setDocSpeculativeTileStats(getDocKey(),
+                                                  _speculativeTiles->getRequestCount(),
+                                                  _speculativeTiles->getHitCount());
+            }
         }
 
         if (_storage && !_lockStateUpdateRequest && _lockCtx->needsRefresh(now))
@@ -876,6 +901,9 @@ DocumentBroker::~DocumentBroker()
     // Do this early - to avoid operating on _childProcess from two threads.
     _poll->joinThread();
 
+    // Before the poll, which the storage may still post to, when computing an upload delta.
+    _storage.reset();
+
     for (const auto& sessionIt : _sessions)
     {
         if (sessionIt.second->isLive())
@@ -1144,11 +1172,14 @@ bool DocumentBroker::download(
 
     // Let's download the document now, if not downloaded.
     std::chrono::milliseconds getFileCallDurationMs = std::chrono::milliseconds::zero();
-    if (!_storage->isDownloaded())
+    if (!_storage->isDownloaded() && !isAsyncDownloading())
     {
         const Authorization auth =
             session ? session->getAuthorization() : Authorization::create(uriPublic);
-        if (!doDownloadDocument(auth, templateSource, fileInfo.getFilename(),
+
+        // Ahead of the first session, download without holding up our poll.
+        if ((session || !startAsyncDownload(auth, templateSource, fileInfo.getFilename())) &&
+            !doDownloadDocument(auth, templateSource, fileInfo.getFilename(),
                                 getFileCallDurationMs))
         {
             LOG_DBG("Failed to download or process downloaded document");
@@ -1160,11 +1191,12 @@ bool DocumentBroker::download(
     COOLWSD::dumpNewSessionTrace(getJailId(), sessionId, _uriOrig, _storage->getRootFilePath());
 
     // Since document has been loaded, send the stats if its WOPI
+    // (or once downloaded, when still downloading).
     if (wopiStorage != nullptr)
     {
         // Add the time taken to load the file from storage and to check file info.
         _wopiDownloadDuration += getFileCallDurationMs + checkFileInfoCallDurationMs;
-        if (session)
+        if (session && !isAsyncDownloading())
         {
             const auto downloadSecs = _wopiDownloadDuration.count() / 1000.;
             const std::string msg =
@@ -1248,6 +1280,116 @@ bool DocumentBroker::doDownloadDocument(const Authorization& auth,
     getFileCallDurationMs = std::chrono::duration_cast<std::chrono::milliseconds>(
         std::chrono::steady_clock::now() - start);
 
+    return processDownloadedDocument(localPath, templateSource, filename);
+}
+
+bool DocumentBroker::startAsyncDownload(const Authorization& auth,
+                                        const std::string& templateSource,
+                                        const std::string& filename)
+{
+    assert(_storage && !_storage->isDownloaded() && !isAsyncDownloading());
+
+    LOG_DBG("Download file asynchronously for docKey [" << _docKey << ']');
+    const auto start = std::chrono::steady_clock::now();
+
+    // Set first, as failures can be reported right away.
+    _asyncDownloadInProgress = true;
+    _asyncDownloadPercent = 0;
+    const bool started = _storage->downloadStorageFileToLocalAsync(
+        auth, *_lockCtx, templateSource, *_poll,
+        [this](int64_t received, int64_t expected) { reportDownloadProgress(received, expected); },
+        [this, start, templateSource, filename](const StorageBase::AsyncDownload& asyncDownload)
+        { handleAsyncDownload(asyncDownload, start, templateSource, filename); });
+
+    if (!started)
+        _asyncDownloadInProgress = false;
+
+    return started;
+}
+
+void DocumentBroker::reportDownloadProgress(int64_t received, int64_t expected)
+{
+    if (expected <= 0)
+        return;
+
+    // Whole percents are enough, and spare the clients.
+    const int percent = std::min<int64_t>(100, received * 100 / expected);
+    if (percent == _asyncDownloadPercent)
+        return;
+
+    _asyncDownloadPercent = percent;
+    LOG_TRC("Downloaded " << received << " of " << expected << " bytes of [" << _docKey << ']');
+    broadcastMessage("progress: { \"id\":\"download\", \"value\":" + std::to_string(percent) +
+                     " }");
+}
+
+void DocumentBroker::handleAsyncDownload(const StorageBase::AsyncDownload& asyncDownload,
+                                         std::chrono::steady_clock::time_point start,
+                                         const std::string& templateSource,
+                                         const std::string& filename)
+{
+    ASSERT_CORRECT_THREAD();
+
+    const StorageBase::DownloadResult& result = asyncDownload.result();
+    switch (asyncDownload.state())
+    {
+        case StorageBase::AsyncDownload::State::Running:
+            LOG_TRC("Async download of [" << _docKey << "] is in progress");
+            return;
+
+        case StorageBase::AsyncDownload::State::Complete:
+        {
+            _asyncDownloadInProgress = false;
+
+            const auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start);
+            LOG_DBG("Async download of [" << _docKey << "] completed in " << duration);
+
+            if (!processDownloadedDocument(result.getLocalPath(), templateSource, filename))
+                break;
+
+            _wopiDownloadDuration += duration;
+#if !MOBILEAPP
+            _admin.setDocWopiDownloadDuration(_docKey, _wopiDownloadDuration);
+            const std::string stats =
+                "stats: wopiloadduration " + std::to_string(_wopiDownloadDuration.count() / 1000.);
+            broadcastMessage(stats);
+#endif
+
+            // Load the views that asked meanwhile, right away from our poll.
+            for (const auto& [weakSession, message] :
+                 std::exchange(_loadsAwaitingDownload, {}))
+            {
+                const std::shared_ptr<ClientSession> session = weakSession.lock();
+                if (session)
+                    forwardToChild(session, message);
+            }
+
+            return;
+        }
+
+        case StorageBase::AsyncDownload::State::None:
+        case StorageBase::AsyncDownload::State::Error:
+            _asyncDownloadInProgress = false;
+            break;
+    }
+
+    LOG_ERR("Failed to download [" << _docKey << "]: " << result.getReason());
+    _loadsAwaitingDownload.clear();
+    if (result.getResult() == StorageBase::DownloadResult::Result::DISKFULL)
+        alertAllUsers("internal", "diskfull");
+    else
+        broadcastMessage("error: cmd=storage kind=loadfailed");
+
+    stop("loadfailed");
+}
+
+bool DocumentBroker::processDownloadedDocument(const std::string& localPathIn,
+                                               const std::string& templateSource,
+                                               const std::string& filename)
+{
+    std::string localPath = localPathIn;
+
     _docState.setStatus(DocumentState::Status::Loading); // Done downloading.
 
 #if !MOBILEAPP
@@ -1300,6 +1442,29 @@ bool DocumentBroker::doDownloadDocument(const Authorization& auth,
     _tileCache = std::make_unique<TileCache>(_storage->getUri().toString(),
                                              _saveManager.getLastModifiedTime(), dontUseCache);
     _tileCache->setThreadOwner(std::this_thread::get_id());
+    _tileCache->setEvictionPolicy(TileCache::createEvictionPolicy(
+        ConfigUtil::getConfigValue<std::string>("per_document.tile_cache_eviction", "lru")));
+    _tileCache->setVisibilityCheck(
+        [this](const TileDesc& tile)
+        {
+            for (const auto& it : _sessions)
+            {
+                const std::shared_ptr<ClientSession>& session = it.second;
+                if (session->getCanonicalViewId() == tile.getNormalizedViewId() &&
+                    session->isTileInsideVisibleArea(tile))
+                    return true;
+            }
+            return false;
+        });
+
+    if (ConfigUtil::getConfigValue<bool>("per_document.speculative_tiles[@enable]", true))
+    {
+        // Forget the predictions the clients didn't follow after a while.
+        _speculativeTiles = std::make_unique<SpeculativeTileTracker>(
+            ConfigUtil::getConfigValue<std::size_t>("per_document.speculative_tiles.max_bytes",
+                                                    1024 * 1024),
+            std::chrono::seconds(10));
+    }
 
     return true;
 }
@@ -2740,6 +2905,9 @@ void DocumentBroker::handleUploadToStorageSuccessful(const StorageBase::UploadRe
     WopiStorage* wopiStorage = dynamic_cast<WopiStorage*>(_storage.get());
     if (wopiStorage != nullptr)
         _admin.setDocWopiUploadDuration(_docKey, wopiStorage->getWopiSaveDuration());
+
+    _admin.setDocUploadedBytes(_docKey, _storage->getUploadedBytes(),
+                               _storage->getUploadedDocumentBytes());
 #endif
 
     if (!_uploadRequest->isSaveAs() && !_uploadRequest->isRename())
@@ -4277,6 +4445,17 @@ bool DocumentBroker::handleInput(const std::shared_ptr<Message>& message)
                                                       message->size() - firstLine.size() - 1);
             }
         }
+        else if (message->firstTokenMatches("tracebuffer:"))
+        {
+            LOG_CHECK_RET(message->tokens().size() == 1, false);
+            if (COOLWSD::TraceBufferFile != NULL)
+            {
+                const auto& firstLine = message->firstLine();
+                if (firstLine.size() < message->size())
+                    COOLWSD::writeTraceBufferRecording(message->data().data() + firstLine.size() + 1,
+                                                       message->size() - firstLine.size() - 1);
+            }
+        }
 #if ENABLE_DEBUG
         else if (message->firstTokenMatches("unitresult:"))
         {
@@ -4325,7 +4504,11 @@ void DocumentBroker::handleTileRequest(const StringVector &tokens, bool forceKey
         session->resetTileSeq(tile);
     }
 
+    auto now = std::chrono::steady_clock::now();
+    const bool speculative = isRenderingSpeculatively(tile, now);
     Tile cachedTile = _tileCache->lookupTile(tile);
+    if (_speculativeTiles)
+        _speculativeTiles->requested(tile, cachedTile && cachedTile->isValid());
     if (cachedTile && cachedTile->isValid())
     {
         if (tile.getWireId() == 0)
@@ -4338,7 +4521,15 @@ void DocumentBroker::handleTileRequest(const StringVector &tokens, bool forceKey
     if (!cachedTile || cachedTile->tooLarge())
         tile.forceKeyframe();
 
-    auto now = std::chrono::steady_clock::now();
+    if (speculative)
+    {
+        // Wait for it rather than render it twice, but not until the Kit is idle.
+        tile.setVersion(tileCache().getTileBeingRenderedVersion(tile));
+        tileCache().subscribeToTileRendering(tile, session, now);
+        _childProcess->sendTextFrame(TileCombined(tile).serialize("prioritizetiles"));
+        return;
+    }
+
     tileCache().subscribeToTileRendering(tile, session, now);
 
     // Forward to child to render.
@@ -4359,6 +4550,52 @@ void DocumentBroker::sendTileCombine(const TileCombined& newTileCombined)
     _childProcess->sendTextFrame(req);
 }
 
+void DocumentBroker::requestSpeculativeTiles(const std::shared_ptr<ClientSession>& session)
+{
+    ASSERT_CORRECT_THREAD();
+
+    if (!_speculativeTiles || !hasTileCache() || !_childProcess)
+        return;
+
+    const auto now = std::chrono::steady_clock::now();
+    for (const TileDesc& tile : _speculativeTiles->expire(now))
+        _tileCache->forgetUnsubscribedTileBeingRendered(tile);
+
+    std::vector<TileDesc> tiles;
+    for (TileDesc& tile : session->getPredictedTiles(_speculativeTilesLookahead, now))
+    {
+        if (!_speculativeTiles->hasRoom())
+            break;
+
+        const Tile cachedTile = _tileCache->peekTile(tile);
+        if ((cachedTile && cachedTile->isValid()) || _tileCache->hasTileBeingRendered(tile, &now) ||
+            !_speculativeTiles->add(tile, now))
+            continue;
+
+        tile.setVersion(++_tileVersion);
+        if (!cachedTile || cachedTile->tooLarge())
+            tile.forceKeyframe();
+        // So that a client requesting it meanwhile waits for this render.
+        _tileCache->registerTileBeingRendered(tile, now);
+        tiles.push_back(tile);
+    }
+
+    if (tiles.empty())
+        return;
+
+    // The Kit renders these only when it has nothing else to do.
+    const std::string req = TileCombined::create(tiles).serialize("speculativetiles");
+    LOG_TRC("Requesting the tiles session " << session->getId() << " scrolls towards: " << req);
+    _childProcess->sendTextFrame(req);
+}
+
+bool DocumentBroker::isRenderingSpeculatively(const TileDesc& tile,
+                                              const std::chrono::steady_clock::time_point& now) const
+{
+    return _speculativeTiles && _speculativeTiles->isRendering(tile) &&
+           _tileCache->hasTileBeingRendered(tile, &now);
+}
+
 void DocumentBroker::handleTileCombinedRequest(TileCombined& tileCombined, bool forceKeyframe,
                                                const std::shared_ptr<ClientSession>& session)
 {
@@ -4377,6 +4614,7 @@ void DocumentBroker::handleTileCombinedRequest(TileCombined& tileCombined, bool
     // Check which newly requested tiles need rendering.
     const auto now = std::chrono::steady_clock::now();
     std::vector<TileDesc> tilesNeedsRendering;
+    std::vector<TileDesc> tilesSpeculative;
     bool hasOldWireId = false;
     for (auto& tile : tileCombined.getTiles())
     {
@@ -4397,15 +4635,27 @@ void DocumentBroker::handleTileCombinedRequest(TileCombined& tileCombined, bool
             hasOldWireId = true;
         }
 
+        const bool speculative = isRenderingSpeculatively(tile, now);
         Tile cachedTile = _tileCache->lookupTile(tile);
+        if (_speculativeTiles)
+            _speculativeTiles->requested(tile, cachedTile && cachedTile->isValid());
         bool tooLarge = cachedTile && cachedTile->tooLarge();
         if(!cachedTile || !cachedTile->isValid() || tooLarge)
         {
             if (!cachedTile || tooLarge)
                 tile.forceKeyframe();
+            if (speculative)
+            {
+                // Wait for the render in flight rather than render it twice:
+                // with its version, so that it isn't requested again either.
+                tile.setVersion(tileCache().getTileBeingRenderedVersion(tile));
+                tileCache().subscribeToTileRendering(tile, session, now);
+                tilesSpeculative.push_back(tile);
+                continue;
+            }
+            tileCache().subscribeToTileRendering(tile, session, now);
             tilesNeedsRendering.push_back(tile);
             _debugRenderedTileCount++;
-            tileCache().subscribeToTileRendering(tile, session, now);
         }
     }
     if (hasOldWireId)
@@ -4415,6 +4665,14 @@ void DocumentBroker::handleTileCombinedRequest(TileCombined& tileCombined, bool
     if (!tilesNeedsRendering.empty())
         sendTileCombine(TileCombined::create(tilesNeedsRendering));
 
+    // The Kit would otherwise render these only when it has nothing else to do.
+    if (!tilesSpeculative.empty())
+    {
+        const std::string req = TileCombined::create(tilesSpeculative).serialize("prioritizetiles");
+        LOG_TRC("Some of the tiles are being rendered speculatively. Prioritizing: " << req);
+        _childProcess->sendTextFrame(req);
+    }
+
     // Accumulate tiles
     std::deque<TileDesc>& requestedTiles = session->getRequestedTiles();
     if (requestedTiles.empty())
@@ -4689,6 +4947,8 @@ void DocumentBroker::handleTileResponse(const std::shared_ptr<Message>& message)
             const std::size_t offset = firstLine.size() + 1;
 
             tileCache().saveTileAndNotify(tile, buffer + offset, length - offset);
+            if (_speculativeTiles)
+                _speculativeTiles->rendered(tile, length - offset);
         }
         else
         {
@@ -4721,6 +4981,8 @@ void DocumentBroker::handleTileCombinedResponse(const std::shared_ptr<Message>&
             for (const auto& tile : tileCombined.getTiles())
             {
                 tileCache().saveTileAndNotify(tile, buffer + offset, tile.getImgSize());
+                if (_speculativeTiles)
+                    _speculativeTiles->rendered(tile, tile.getImgSize());
                 offset += tile.getImgSize();
             }
         }
@@ -4815,6 +5077,14 @@ bool DocumentBroker::forwardToChild(const std::shared_ptr<ClientSession>& sessio
         return false;
     }
 
+    // Hold the loading of the views until the document is downloaded.
+    if (isAsyncDownloading() && message.starts_with("load "))
+    {
+        LOG_DBG("Loading session [" << session->getId() << "] once the document is downloaded");
+        _loadsAwaitingDownload.emplace_back(session, message);
+        return true;
+    }
+
     // Ignore userinactive, useractive message until document is loaded
     if (!isLoaded() && (message == "userinactive" || message == "useractive"))
     {
@@ -5256,6 +5526,9 @@ void DocumentBroker::dumpState(std::ostream& os)
     if (_tileCache)
         _tileCache->dumpState(os);
 
+    if (_speculativeTiles)
+        _speculativeTiles->dumpState(os);
+
     _poll->dumpState(os);
 
 #if !MOBILEAPP
@@ -51,6 +51,7 @@ class CheckFileInfo;
 class DocumentBroker;
 class LockContext;
 class PresetsInstallTask;
+class SpeculativeTileTracker;
 class TileCache;
 class Message;
 
@@ -346,6 +347,9 @@ public:
 
     bool isAsyncUploading() const;
 
+    /// True while the document is being downloaded without blocking our poll.
+    bool isAsyncDownloading() const { return _asyncDownloadInProgress; }
+
     Poco::URI getPublicUri() const { return _uriPublic; }
     const std::string& getJailId() const { return _jailId; }
     const std::string& getDocKey() const { return _docKey; }
@@ -420,6 +424,11 @@ public:
                                    const std::shared_ptr<ClientSession>& session);
     void sendRequestedTiles(const std::shared_ptr<ClientSession>& session);
     void sendTileCombine(const TileCombined& tileCombined);
+    /// Asks the Kit to render, when idle, the tiles @session is scrolling towards.
+    void requestSpeculativeTiles(const std::shared_ptr<ClientSession>& session);
+    /// Whether @tile is requested speculatively and its render still in flight.
+    bool isRenderingSpeculatively(const TileDesc& tile,
+                                  const std::chrono::steady_clock::time_point& now) const;
 
     enum ClipboardRequest {
         CLIP_REQUEST_SET,
@@ -616,6 +625,24 @@ private:
                             const std::string& filename,
                             std::chrono::milliseconds& getFileCallDurationMs);
 
+    /// Starts downloading the document without blocking, when the storage supports it.
+    /// The views loading meanwhile wait for it to complete.
+    bool startAsyncDownload(const Authorization& auth, const std::string& templateSource,
+                            const std::string& filename);
+
+    /// Handles the progress and the result of the asynchronous download.
+    void handleAsyncDownload(const StorageBase::AsyncDownload& asyncDownload,
+                             std::chrono::steady_clock::time_point start,
+                             const std::string& templateSource, const std::string& filename);
+
+    /// Tells the clients how much of the document has been downloaded.
+    void reportDownloadProgress(int64_t received, int64_t expected);
+
+    /// Post-download processing of the document at @localPath, in the jail.
+    bool processDownloadedDocument(const std::string& localPath,
+                                   const std::string& templateSource,
+                                   const std::string& filename);
+
 #if !MOBILEAPP
     /// Updates the Session with the wopiFileInfo given.
     /// Returns the templateSource, if any.
@@ -1683,6 +1710,10 @@ private:
 #endif
 
     std::unique_ptr<TileCache> _tileCache;
+    /// The tiles rendered ahead of the clients scrolling, if enabled.
+    std::unique_ptr<SpeculativeTileTracker> _speculativeTiles;
+    /// How far ahead of the clients scrolling to render.
+    std::chrono::milliseconds _speculativeTilesLookahead;
     std::atomic<bool> _isModified;
     int _cursorPosX;
     int _cursorPosY;
@@ -1714,6 +1745,13 @@ private:
     std::chrono::milliseconds _loadDuration;
     std::chrono::milliseconds _wopiDownloadDuration;
 
+    /// Set while the document is being downloaded asynchronously.
+    bool _asyncDownloadInProgress;
+    /// The percentage of the download last reported to the clients.
+    int _asyncDownloadPercent;
+    /// The load requests of the views, held until the download is complete.
+    std::vector<std::pair<std::weak_ptr<ClientSession>, std::string>> _loadsAwaitingDownload;
+
     /// Unique DocBroker ID for tracing and debugging.
     static std::atomic<unsigned> DocBrokerId;
 
@@ -21,6 +21,7 @@
 #include "HttpRequest.hpp"
 #include "RequestDetails.hpp"
 #include "ServerURL.hpp"
+#include "UploadDelta.hpp"
 #include <Common.hpp>
 #include <Crypto.hpp>
 #include <Log.hpp>
@@ -83,6 +84,7 @@ using Poco::Net::NameValueCollection;
 using Poco::Util::Application;
 
 std::map<std::string, std::pair<std::string, std::string>> FileServerRequestHandler::FileHash;
+std::unique_ptr<AssetPack> FileServerRequestHandler::Assets;
 
 // We have files that are at least 2.5 MB already.
 // WASM files are in the order of 30 MB, however,
@@ -220,8 +222,20 @@ std::string stringifyBoolFromConfig(const Poco::Util::LayeredConfiguration& conf
 
 } // namespace
 
-FileServerRequestHandler::FileServerRequestHandler(const std::string& root)
+FileServerRequestHandler::FileServerRequestHandler(const std::string& root,
+                                                   const std::string& assetPackPath)
 {
+    // Map the files packed at install time, if we can.
+    if (!assetPackPath.empty())
+    {
+        Assets = AssetPack::open(assetPackPath, COOLWSD_VERSION_HASH);
+        if (Assets)
+            return;
+
+        LOG_WRN("Not serving from the asset pack [" << assetPackPath
+                                                    << "], reading the files from " << root);
+    }
+
     // Read all files that we can serve into memory and compress them.
     // cool files
     try
@@ -238,6 +252,7 @@ FileServerRequestHandler::~FileServerRequestHandler()
 {
     // Clean cached files.
     FileHash.clear();
+    Assets.reset();
 }
 
 bool FileServerRequestHandler::isAdminLoggedIn(const Poco::Net::HTTPRequest& request,
@@ -333,6 +348,9 @@ bool FileServerRequestHandler::isAdminLoggedIn(const HTTPRequest& request, http:
             // Last modified time of the file
             std::chrono::system_clock::time_point fileLastModifiedTime;
 
+            // The delta being uploaded
+            UploadDelta::Chunks deltaChunks;
+
             enum class COOLStatusCode
             {
                 DocChanged = 1010  // Document changed externally in storage
@@ -490,6 +508,7 @@ bool FileServerRequestHandler::isAdminLoggedIn(const HTTPRequest& request, http:
             fileInfo->set("PostMessageOrigin", postMessageOrigin);
             fileInfo->set("LastModifiedTime", localFile->getLastModifiedTime());
             fileInfo->set("EnableOwnerTermination", "true");
+            fileInfo->set("SupportsDeltaUpload", "true");
 
             std::ostringstream jsonStream;
             fileInfo->stringify(jsonStream);
@@ -546,6 +565,42 @@ bool FileServerRequestHandler::isAdminLoggedIn(const HTTPRequest& request, http:
             std::streamsize size = request.getContentLength();
             std::vector<char> buffer(size);
             message.read(buffer.data(), size);
+
+            if (request.get("X-COOL-WOPI-Upload-Encoding", std::string()) == "delta")
+            {
+                // Put the chunks of the delta together, then apply it.
+                const uint64_t offset = std::strtoull(
+                    request.get("X-COOL-WOPI-Upload-Offset", "0").c_str(), nullptr, 10);
+                const uint64_t length = std::strtoull(
+                    request.get("X-COOL-WOPI-Upload-Length", "0").c_str(), nullptr, 10);
+                const bool added = localFile->deltaChunks.add(
+                    request.get("X-COOL-WOPI-Upload-Id", std::string()), offset, length,
+                    std::string_view(buffer.data(), size));
+                if (!added || !localFile->deltaChunks.isComplete())
+                {
+                    http::Response httpResponse(added ? http::StatusCode::Accepted
+                                                      : http::StatusCode::RangeNotSatisfiable);
+                    httpResponse.set("X-COOL-WOPI-Upload-Offset",
+                                     std::to_string(localFile->deltaChunks.offset()));
+                    httpResponse.setContentLength(0);
+                    socket->send(httpResponse);
+                    return;
+                }
+
+                std::string content;
+                if (!UploadDelta::apply(readFileToString(localFile->localPath),
+                                        localFile->deltaChunks.take(), content))
+                {
+                    http::Response httpResponse(http::StatusCode::PreconditionFailed);
+                    httpResponse.setContentLength(0);
+                    socket->send(httpResponse);
+                    return;
+                }
+
+                buffer.assign(content.begin(), content.end());
+                size = content.size();
+            }
+
             localFile->fileLastModifiedTime = std::chrono::system_clock::now();
 
             std::ofstream outfile;
@@ -945,8 +1000,7 @@ void FileServerRequestHandler::handleRequest(const HTTPRequest& request,
         }
 
         // Is this a file we read at startup - if not; it's not for serving.
-        if (FileHash.find(relPath) == FileHash.end() &&
-            FileHash.find(relPath + ".br") == FileHash.end())
+        if (!hasFile(relPath) && !hasFile(relPath + ".br"))
         {
             throw Poco::FileNotFoundException("Invalid URI request (hash): [" +
                                               requestUri.toString() + "].");
@@ -1010,32 +1064,40 @@ void FileServerRequestHandler::handleRequest(const HTTPRequest& request,
                 throw Poco::FileNotFoundException("Invalid file.");
 
             const std::string fileType = endPoint.substr(extPoint + 1);
-            std::string mimeType;
-            if (fileType == "js")
-                mimeType = "application/javascript";
-            else if (fileType == "css")
-                mimeType = "text/css";
-            else if (fileType == "html")
-                mimeType = "text/html";
-            else if (fileType == "png")
-                mimeType = "image/png";
-            else if (fileType == "svg")
-                mimeType = "image/svg+xml";
+            std::string mimeType = AssetPack::getContentType(endPoint);
 #if !MOBILEAPP
-            else if (fileType == "wasm" &&
-                     COOLWSD::WASMState != COOLWSD::WASMActivationState::Disabled)
-                mimeType = "application/wasm";
-#endif // !MOBILEAPP
-            else
+            if (fileType == "wasm" &&
+                COOLWSD::WASMState == COOLWSD::WASMActivationState::Disabled)
+                mimeType = "text/plain";
+#else
+            if (fileType == "wasm")
                 mimeType = "text/plain";
+#endif // !MOBILEAPP
 
             response.setContentType(std::move(mimeType));
 
+            // Each encoding is another representation, with its own content and ETag.
+            std::string_view content;
+            std::string_view contentEncoding;
+            if (request.hasToken("Accept-Encoding", "br") &&
+                !(content = getBrotliFile(relPath)).empty())
+                contentEncoding = "br";
+            else if (request.hasToken("Accept-Encoding", "gzip") &&
+                     !(content = getCompressedFile(relPath)).empty())
+                contentEncoding = "gzip";
+            else
+                content = getUncompressedFile(relPath);
+
+            // Files from the asset pack have their own, so only those that change revalidate.
+            const std::string_view packedETag = getETag(relPath);
+            const std::string etag = HttpHelper::getEncodedETag(
+                packedETag.empty() ? etagString : std::string(packedETag), contentEncoding);
+
             auto it = request.find("If-None-Match");
             if (it != request.end())
             {
                 // if ETags match avoid re-sending the file.
-                if (!noCache && it->second == etagString)
+                if (!noCache && it->second == etag)
                 {
                     // TESTME: harder ... - do we even want ETag support ?
                     std::ostringstream oss;
@@ -1061,7 +1123,6 @@ void FileServerRequestHandler::handleRequest(const HTTPRequest& request,
             }
 #endif // !MOBILEAPP
 
-            const bool brotli = request.hasToken("Accept-Encoding", "br");
 #if ENABLE_DEBUG
             if (std::getenv("COOL_SERVE_FROM_FS"))
             {
@@ -1069,49 +1130,39 @@ void FileServerRequestHandler::handleRequest(const HTTPRequest& request,
                 // Avoids having to restart cool everytime you make a change in cool
                 std::string filePath =
                     Poco::Path(COOLWSD::FileServerRoot, relPath).absolute().toString();
-                if (brotli && FileUtil::Stat(filePath + ".br").exists())
+                if (request.hasToken("Accept-Encoding", "br") &&
+                    FileUtil::Stat(filePath + ".br").exists())
                 {
                     filePath += ".br";
                     response.set("Content-Encoding", "br");
+                    HttpHelper::sendFile(socket, filePath, response, noCache);
+                    return;
                 }
 
-                HttpHelper::sendFile(socket, filePath, response, noCache);
+                HttpHelper::sendFile(socket, filePath, response, noCache,
+                                     request.get("Accept-Encoding", std::string()));
                 return;
             }
 #endif
 
-            bool compressed = false;
-            const std::string* content;
-            if (brotli && FileHash.find(relPath + ".br") != FileHash.end())
-            {
-                compressed = true;
-                response.set("Content-Encoding", "br");
-                content = getUncompressedFile(relPath + ".br");
-            }
-            else if (request.hasToken("Accept-Encoding", "gzip"))
-            {
-                compressed = true;
-                response.set("Content-Encoding", "gzip");
-                content = getCompressedFile(relPath);
-            }
-            else
-                content = getUncompressedFile(relPath);
-
-            response.add("Content-Length", std::to_string(content->size()));
+            if (!contentEncoding.empty())
+                response.set("Content-Encoding", std::string(contentEncoding));
+            response.set("Vary", "Accept-Encoding");
+            response.add("Content-Length", std::to_string(content.size()));
 
             if (!noCache)
             {
                 // 60 * 60 * 24 * 128 (days) = 11059200
                 response.set("Cache-Control", "max-age=11059200");
-                response.set("ETag", etagString);
+                response.set("ETag", etag);
             }
             response.add("X-Content-Type-Options", "nosniff");
 
-            LOG_TRC('#' << socket->getFD() << ": Sending " << (!compressed ? "un" : "")
+            LOG_TRC('#' << socket->getFD() << ": Sending " << (contentEncoding.empty() ? "un" : "")
                         << "compressed : file [" << relPath << "]: " << response.header());
 
             socket->send(response);
-            socket->send(*content);
+            socket->send(content.data(), content.size());
         }
     }
     catch (const Poco::Net::NotAuthenticatedException& exc)
@@ -1311,16 +1362,77 @@ void FileServerRequestHandler::readDirToHash(const std::string &basePath, const
                             << filesRead);
 }
 
-const std::string *FileServerRequestHandler::getCompressedFile(const std::string &path)
+namespace
+{
+/// Looks up @path in @assets, as readDirToHash would have read it.
+bool findAsset(const AssetPack& assets, const std::string& path, AssetPack::Asset& asset)
 {
-    // If a compressed version is not available, return the original uncompressed data.
-    const auto& pair = FileHash[path];
-    return pair.second.empty() ? &pair.first : &pair.second;
+#if !MOBILEAPP
+    if (COOLWSD::WASMState == COOLWSD::WASMActivationState::Disabled &&
+        path.substr(0, path.rfind('/')).find("wasm") != std::string::npos)
+        return false;
+#endif // !MOBILEAPP
+
+    return assets.find(path, asset);
+}
+} // namespace
+
+bool FileServerRequestHandler::hasFile(const std::string& path)
+{
+    AssetPack::Asset asset;
+    if (Assets)
+        return findAsset(*Assets, path, asset);
+
+    return FileHash.find(path) != FileHash.end();
+}
+
+std::string_view FileServerRequestHandler::getCompressedFile(const std::string &path)
+{
+    AssetPack::Asset asset;
+    if (Assets)
+    {
+        findAsset(*Assets, path, asset);
+        return asset._gzip;
+    }
+
+    const auto it = FileHash.find(path);
+    return it != FileHash.end() ? std::string_view(it->second.second) : std::string_view();
+}
+
+std::string_view FileServerRequestHandler::getUncompressedFile(const std::string &path)
+{
+    AssetPack::Asset asset;
+    if (Assets)
+    {
+        findAsset(*Assets, path, asset);
+        return asset._raw;
+    }
+
+    return FileHash[path].first;
+}
+
+std::string_view FileServerRequestHandler::getBrotliFile(const std::string& path)
+{
+    AssetPack::Asset asset;
+    if (Assets)
+    {
+        // Packed with their file, unless it has none.
+        if (findAsset(*Assets, path, asset))
+            return asset._brotli;
+        findAsset(*Assets, path + ".br", asset);
+        return asset._raw;
+    }
+
+    const auto it = FileHash.find(path + ".br");
+    return it != FileHash.end() ? std::string_view(it->second.first) : std::string_view();
 }
 
-const std::string *FileServerRequestHandler::getUncompressedFile(const std::string &path)
+std::string_view FileServerRequestHandler::getETag(const std::string& path)
 {
-    return &FileHash[path].first;
+    AssetPack::Asset asset;
+    if (Assets)
+        findAsset(*Assets, path, asset);
+    return asset._etag;
 }
 
 std::string FileServerRequestHandler::getRequestPathname(const HTTPRequest& request,
@@ -1598,7 +1710,7 @@ FileServerRequestHandler::ResourceAccessDetails FileServerRequestHandler::prepro
     // Is this a file we read at startup - if not; it's not for serving.
     const std::string relPath = getRequestPathname(request, requestDetails);
     LOG_DBG("Preprocessing file: " << relPath);
-    std::string preprocess = *getUncompressedFile(relPath);
+    std::string preprocess(getUncompressedFile(relPath));
 
     // We need to pass certain parameters from the cool html GET URI
     // to the embedded document URI. Here we extract those params
@@ -1997,7 +2109,7 @@ void FileServerRequestHandler::preprocessWelcomeFile(const HTTPRequest& request,
 {
     const std::string relPath = getRequestPathname(request, requestDetails);
     LOG_DBG("Preprocessing file: " << relPath);
-    std::string templateWelcome = *getUncompressedFile(relPath);
+    std::string templateWelcome(getUncompressedFile(relPath));
 
     HTMLForm form(request, message);
     std::string uiTheme = form.get("ui_theme", "");
@@ -2264,7 +2376,7 @@ void FileServerRequestHandler::preprocessIntegratorAdminFile(const HTTPRequest&
 
     const std::string relPath = getRequestPathname(request, requestDetails);
     LOG_DBG("Preprocessing file: " << relPath);
-    std::string adminFile = *getUncompressedFile(relPath);
+    std::string adminFile(getUncompressedFile(relPath));
 
     HTMLForm form(request, message);
     const UserRequestVars urv(request, form);
@@ -2372,10 +2484,10 @@ void FileServerRequestHandler::preprocessAdminFile(const HTTPRequest& request,
 
     const std::string relPath = getRequestPathname(request, requestDetails);
     LOG_DBG("Preprocessing file: " << relPath);
-    std::string adminFile = *getUncompressedFile(relPath);
+    std::string adminFile(getUncompressedFile(relPath));
     const std::string templatePath =
         Poco::Path(relPath).setFileName("admintemplate.html").toString();
-    std::string templateFile = *getUncompressedFile(templatePath);
+    std::string templateFile(getUncompressedFile(templatePath));
 
     const std::string escapedJwtToken = Uri::encode(jwtToken, "'");
     Poco::replaceInPlace(templateFile, std::string("%JWT_TOKEN%"), escapedJwtToken);
@@ -2383,7 +2495,7 @@ void FileServerRequestHandler::preprocessAdminFile(const HTTPRequest& request,
         relPath == "/browser/dist/admin/adminClusterOverviewAbout.html")
     {
         std::string bodyPath = Poco::Path(relPath).setFileName("adminClusterBody.html").toString();
-        std::string bodyFile = *getUncompressedFile(bodyPath);
+        std::string bodyFile(getUncompressedFile(bodyPath));
         Poco::replaceInPlace(templateFile, std::string("<!--%BODY%-->"), bodyFile);
         Poco::replaceInPlace(templateFile, std::string("<!--%MAIN_CONTENT%-->"), adminFile);
         Poco::replaceInPlace(templateFile, std::string("%ROUTE_TOKEN%"), COOLWSD::RouteToken);
@@ -2391,7 +2503,7 @@ void FileServerRequestHandler::preprocessAdminFile(const HTTPRequest& request,
     else
     {
         std::string bodyPath = Poco::Path(relPath).setFileName("adminBody.html").toString();
-        std::string bodyFile = *getUncompressedFile(bodyPath);
+        std::string bodyFile(getUncompressedFile(bodyPath));
         Poco::replaceInPlace(templateFile, std::string("<!--%BODY%-->"), bodyFile);
         Poco::replaceInPlace(templateFile, std::string("<!--%MAIN_CONTENT%-->"),
                              adminFile); // Now template has the main content..
@@ -11,13 +11,16 @@
 
 #pragma once
 
+#include <AssetPack.hpp>
 #include <COOLWSD.hpp>
 #include <ConfigUtil.hpp>
 #include <HttpRequest.hpp>
 #include <Poco/Net/PartHandler.h>
 #include <Socket.hpp>
 
+#include <memory>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 
 class RequestDetails;
@@ -169,7 +172,9 @@ private:
     static std::string cssVarsToStyle(const std::string& cssVars);
 
 public:
-    FileServerRequestHandler(const std::string& root);
+    /// Serves the files of @root from the asset pack at @assetPackPath,
+    /// if any and valid, otherwise reads them all into memory.
+    FileServerRequestHandler(const std::string& root, const std::string& assetPackPath);
     ~FileServerRequestHandler();
 
     /// Evaluate if the cookie exists and returns it when it does.
@@ -190,9 +195,19 @@ public:
 
     static void readDirToHash(const std::string &basePath, const std::string &path, const std::string &prefix = std::string());
 
-    static const std::string *getCompressedFile(const std::string &path);
+    /// True if we serve the file at @path.
+    static bool hasFile(const std::string& path);
 
-    static const std::string *getUncompressedFile(const std::string &path);
+    /// The gzip variant, or an empty view if there is none.
+    static std::string_view getCompressedFile(const std::string &path);
+
+    static std::string_view getUncompressedFile(const std::string &path);
+
+    /// The brotli variant, or an empty view if there is none.
+    static std::string_view getBrotliFile(const std::string& path);
+
+    /// The ETag of the file from the asset pack, or an empty view to use the version.
+    static std::string_view getETag(const std::string& path);
 
     /// If configured and necessary, sets the HSTS headers.
     static void hstsHeaders([[maybe_unused]] http::Response& response)
@@ -215,6 +230,8 @@ public:
 
 private:
     static std::map<std::string, std::pair<std::string, std::string>> FileHash;
+    /// When set, we serve from it, and FileHash is empty.
+    static std::unique_ptr<AssetPack> Assets;
     static void sendError(http::StatusCode errorCode, const Poco::Net::HTTPRequest& request,
                           const std::shared_ptr<StreamSocket>& socket,
                           const std::string& shortMessage, const std::string& longMessage,
@@ -18,14 +18,23 @@
 
 #include <deque>
 #include <mutex>
+#include <string>
+#include <unordered_map>
 
 /// A queue of data to send to certain Session's WS.
+/// Messages that are superseded by a newer one, such as a tile or the cursor of
+/// a view, are deduplicated: the old one is dropped and the new one appended.
+/// To do so in constant time, the last queued message of each kind is indexed,
+/// and dropped ones are left in the queue as empty tombstones, skipped later.
 template <typename Item>
 class SenderQueue final
 {
 public:
 
     SenderQueue()
+        : _popped(0)
+        , _size(0)
+        , _tombstones(0)
     {
     }
 
@@ -33,10 +42,20 @@ public:
     {
         std::unique_lock<std::mutex> lock(_mutex);
 
-        if (!SigUtil::getTerminationFlag() && deduplicate(item))
-            _queue.push_back(item);
+        if (!SigUtil::getTerminationFlag())
+        {
+            std::string key = getDeduplicationKey(item);
+            if (!key.empty())
+                deduplicate(key, item);
+
+            _queue.push_back({ item, std::move(key) });
+            ++_size;
+
+            if (_tombstones > MinTombstonesToCompact && _tombstones > _size)
+                compact();
+        }
 
-        return _queue.size();
+        return _size;
     }
 
     /// Dequeue an item if we have one - @returns true if we do, else false.
@@ -51,10 +70,27 @@ public:
 
         std::unique_lock<std::mutex> lock(_mutex);
 
-        if (!_queue.empty())
+        while (!_queue.empty())
         {
-            item = _queue.front();
+            Slot slot = std::move(_queue.front());
             _queue.pop_front();
+            ++_popped;
+
+            if (!slot._item)
+            {
+                --_tombstones;
+                continue;
+            }
+
+            if (!slot._key.empty())
+            {
+                const auto it = _index.find(slot._key);
+                if (it != _index.end() && it->second == _popped - 1)
+                    _index.erase(it);
+            }
+
+            --_size;
+            item = std::move(slot._item);
             return true;
         }
 
@@ -64,121 +100,113 @@ public:
     size_t size() const
     {
         std::lock_guard<std::mutex> lock(_mutex);
-        return _queue.size();
+        return _size;
     }
 
     void dumpState(std::ostream& os)
     {
-        os << "\n\t\tqueue size " << _queue.size() << '\n';
         std::lock_guard<std::mutex> lock(_mutex);
-        for (const Item &item : _queue)
+        os << "\n\t\tqueue size " << _size << " (" << _tombstones << " dropped)\n";
+        for (const Slot& slot : _queue)
         {
-            os << "\t\t\ttype: " << (item->isBinary() ? "binary\n" : "text\n");
-            os << "\t\t\t" << item->abbr() << '\n';
+            if (!slot._item)
+                continue;
+            os << "\t\t\ttype: " << (slot._item->isBinary() ? "binary\n" : "text\n");
+            os << "\t\t\t" << slot._item->abbr() << '\n';
         }
     }
 
 private:
-    /// Deduplicate messages based on the new one.
-    /// Returns true if the new message should be
-    /// enqueued, otherwise false.
-    bool deduplicate(const Item& item)
+    /// Returns the key of the messages that @item supersedes, if any, else empty.
+    static std::string getDeduplicationKey(const Item& item)
     {
-        // Deduplicate messages based on the incoming one.
         const std::string command = item->firstToken();
         if (command == "tile:")
         {
-            // Remove previous identical tile, if any, and use most recent (incoming).
-            const TileDesc newTile = TileDesc::parse(item->firstLine());
-            uint32_t newTilePosHash = newTile.equalityHash();
-            // store a hash of position for this tile.
-            item->setHash(newTilePosHash);
-
-            const auto& pos = std::find_if(_queue.begin(), _queue.end(),
-                                           [&newTile, newTilePosHash](const queue_item_t& cur)
-                {
-                    if (!cur->firstTokenMatches("tile:"))
-                        return false;
-                    if (newTilePosHash != cur->getHash()) // eliminate N^2 parsing
-                        return false;
-                    if (newTile != TileDesc::parse(cur->firstLine()))
-                    {
-                        LOG_TRC("Ununusal - tile " << newTile.serialize() << " has quality "
-                                " hash collision with " << cur->firstLine() << " of " << newTilePosHash);
-                        return false;
-                    }
-                    return true;
-                });
-
-            if (pos != _queue.end())
-                _queue.erase(pos);
+            // The same tile, with any other content; checked on a hash collision.
+            const TileDesc tile = TileDesc::parse(item->firstLine());
+            return command + std::to_string(tile.equalityHash());
         }
-        else if (command == "invalidatecursor:" ||
-                 command == "setpart:")
+
+        if (command == "invalidatecursor:" || command == "setpart:")
+            return command;
+
+        if (command == "progress:")
         {
-            // Remove previous identical entries of this command,
-            // if any, and use most recent (incoming).
-            const auto& pos = std::find_if(_queue.begin(), _queue.end(),
-                [&command](const queue_item_t& cur)
-                {
-                    return cur->firstTokenMatches(command);
-                });
-
-            if (pos != _queue.end())
-                _queue.erase(pos);
+            // Only the progress values.
+            static const std::string setvalueTag = "\"id\":\"setvalue\"";
+            return item->contains(setvalueTag) ? command + setvalueTag : std::string();
         }
-        else if (command == "progress:")
+
+        if (command == "invalidateviewcursor:")
         {
-            // find other progress commands with similar content
-            static const std::string setvalueTag = "\"id\":\"setvalue\"";
-            if (item->contains(setvalueTag))
-            {
-                const auto& pos = std::find_if(_queue.begin(), _queue.end(),
-                                               [&command](const queue_item_t& cur)
-                {
-                    return cur->firstTokenMatches(command) &&
-                           cur->contains(setvalueTag);
-                });
-
-                if (pos != _queue.end())
-                    _queue.erase(pos);
-            }
+            // The cursor of the same view.
+            Poco::JSON::Object::Ptr json;
+            if (JsonUtil::parseJSON(item->jsonString(), json))
+                return command + json->get("viewId").toString();
         }
-        else if (command == "invalidateviewcursor:")
+
+        return std::string();
+    }
+
+    /// Drops the last queued message with @key, superseded by @item,
+    /// and indexes @item, about to be appended, instead.
+    void deduplicate(const std::string& key, const Item& item)
+    {
+        const std::size_t position = _popped + _queue.size();
+        const auto [it, inserted] = _index.try_emplace(key, position);
+        if (inserted)
+            return;
+
+        Slot& slot = _queue[it->second - _popped];
+        it->second = position;
+        if (item->firstTokenMatches("tile:") &&
+            TileDesc::parse(item->firstLine()) != TileDesc::parse(slot._item->firstLine()))
         {
-            // Remove previous cursor invalidation for same view,
-            // if any, and use most recent (incoming).
-            const std::string newMsg = item->jsonString();
-            Poco::JSON::Parser newParser;
-            const Poco::Dynamic::Var newResult = newParser.parse(newMsg);
-            const auto& newJson = newResult.extract<Poco::JSON::Object::Ptr>();
-            const std::string viewId = newJson->get("viewId").toString();
-            const auto& pos = std::find_if(_queue.begin(), _queue.end(),
-                [command, viewId](const queue_item_t& cur)
-                {
-                    if (cur->firstTokenMatches(command))
-                    {
-                        const std::string msg = cur->jsonString();
-                        Poco::JSON::Parser parser;
-                        const Poco::Dynamic::Var result = parser.parse(msg);
-                        const auto& json = result.extract<Poco::JSON::Object::Ptr>();
-                        return viewId == json->get("viewId").toString();
-                    }
-
-                    return false;
-                });
-
-            if (pos != _queue.end())
-                _queue.erase(pos);
+            LOG_TRC("Ununusal - tile " << item->firstLine() << " has quality hash collision with "
+                                       << slot._item->firstLine());
+            return;
         }
 
-        return true;
+        slot._item = Item();
+        slot._key.clear();
+        --_size;
+        ++_tombstones;
+    }
+
+    /// Removes the tombstones, when they outnumber the items.
+    void compact()
+    {
+        std::erase_if(_queue, [](const Slot& slot) { return !slot._item; });
+        _tombstones = 0;
+        _popped = 0;
+
+        _index.clear();
+        for (std::size_t position = 0; position < _queue.size(); ++position)
+        {
+            if (!_queue[position]._key.empty())
+                _index[_queue[position]._key] = position;
+        }
     }
 
 private:
+    /// Don't compact small queues.
+    static constexpr std::size_t MinTombstonesToCompact = 64;
+
+    struct Slot
+    {
+        Item _item; ///< Empty once superseded.
+        std::string _key; ///< The deduplication key, if any.
+    };
+
     mutable std::mutex _mutex;
-    std::deque<Item> _queue;
-    typedef typename std::deque<Item>::value_type queue_item_t;
+    std::deque<Slot> _queue;
+    /// The position of the last queued message of each key, counted
+    /// from the first message ever queued, so popping doesn't change it.
+    std::unordered_map<std::string, std::size_t> _index;
+    std::size_t _popped; ///< The number of slots popped from the front.
+    std::size_t _size; ///< The number of items, without the tombstones.
+    std::size_t _tombstones;
 };
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
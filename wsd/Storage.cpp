@@ -11,6 +11,7 @@
 
 #include <config.h>
 
+#include <algorithm>
 #include <chrono>
 #include <memory>
 #include <string>
@@ -40,6 +41,7 @@
 #include <NetUtil.hpp>
 #include <Storage.hpp>
 #include <Unit.hpp>
+#include <UploadDelta.hpp>
 #include <Util.hpp>
 #include <common/ConfigUtil.hpp>
 #include <common/FileUtil.hpp>
@@ -57,6 +59,9 @@
 #endif // IOS
 
 bool StorageBase::FilesystemEnabled;
+bool StorageBase::DeltaUploadEnabled;
+std::size_t StorageBase::DeltaUploadChunkSize;
+std::size_t StorageBase::DeltaUploadMaxFileSize;
 
 #if !MOBILEAPP
 
@@ -94,6 +99,17 @@ void StorageBase::initialize()
     const auto& app = Poco::Util::Application::instance();
     FilesystemEnabled = app.config().getBool("storage.filesystem[@allow]", false);
 
+    DeltaUploadEnabled = app.config().getBool("storage.delta_upload[@enable]", true);
+    DeltaUploadChunkSize =
+        std::max(app.config().getUInt64("storage.delta_upload.chunk_size", 1024 * 1024),
+                 static_cast<uint64_t>(UploadDelta::BlockSize));
+    DeltaUploadMaxFileSize =
+        app.config().getUInt64("storage.delta_upload.max_file_size", 64 * 1024 * 1024);
+    LOG_INF("Delta upload is " << (DeltaUploadEnabled ? "enabled" : "disabled")
+                               << ", in chunks of " << DeltaUploadChunkSize
+                               << " bytes, for files of up to " << DeltaUploadMaxFileSize
+                               << " bytes");
+
     //parse wopi.storage.host only when there is no storage.wopi.alias_groups entry in config
     if (!app.config().has("storage.wopi.alias_groups"))
     {
@@ -108,6 +124,7 @@ void StorageBase::initialize()
 
 #else // !MOBILEAPP
     FilesystemEnabled = true;
+    DeltaUploadEnabled = false;
 #endif // MOBILEAPP
 }
 
@@ -383,6 +400,7 @@ std::size_t LocalStorage::uploadLocalFileToStorageAsync(
 
         const FileUtil::Stat stat(path);
         size = stat.size();
+        addUploadedBytes(size, size);
 
         // update its fileinfo object. This is used later to check if someone else changed the
         // document while we are/were editing it
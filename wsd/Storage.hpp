@@ -266,6 +266,37 @@ public:
     /// The state of an asynchronous Upload request.
     using AsyncUpload = AsyncRequest<UploadResult>;
 
+    /// Represents the download request result: the local path of the
+    /// document, or a reason message, for errors.
+    class DownloadResult final
+    {
+    public:
+        STATE_ENUM(Result,
+                   OK = 0, ///< Downloaded successfully
+                   DISKFULL, ///< Not enough space for the document.
+                   FAILED);
+
+        DownloadResult(Result result, std::string localPathOrReason)
+            : _result(result)
+            , _localPathOrReason(std::move(localPathOrReason))
+        {
+        }
+
+        Result getResult() const { return _result; }
+
+        /// The path of the document for the kit, once downloaded.
+        const std::string& getLocalPath() const { return _localPathOrReason; }
+
+        const std::string& getReason() const { return _localPathOrReason; }
+
+    private:
+        Result _result;
+        std::string _localPathOrReason;
+    };
+
+    /// The state of an asynchronous Download request.
+    using AsyncDownload = AsyncRequest<DownloadResult>;
+
     STATE_ENUM(LockState,
                LOCK, ///< Lock the document.
                UNLOCK, ///< Unlock the document .
@@ -331,6 +362,8 @@ public:
         , _fileInfo(/*size=*/0, /*filename=*/std::string(), /*ownerId=*/"cool",
                     /*modifiledTime=*/std::string())
         , _isDownloaded(false)
+        , _uploadedBytes(0)
+        , _uploadedDocumentBytes(0)
     {
         setUri(uri);
         LOG_DBG("Storage ctor: " << COOLWSD::anonymizeUrl(_uri.toString()));
@@ -388,6 +421,13 @@ public:
 
     std::string getFileExtension() const { return Poco::Path(_fileInfo.getFilename()).getExtension(); }
 
+    /// The bytes sent to the storage by the successful uploads.
+    uint64_t getUploadedBytes() const { return _uploadedBytes; }
+
+    /// The size of the documents of the successful uploads, which is what
+    /// uploading them whole would have sent.
+    uint64_t getUploadedDocumentBytes() const { return _uploadedDocumentBytes; }
+
     /// Update the locking state (check-in/out) of the associated file synchronously.
     virtual LockUpdateResult updateLockState(const Authorization& auth, LockContext& lockCtx,
                                              LockState lock, const Attributes& attribs) = 0;
@@ -406,6 +446,26 @@ public:
     virtual std::string downloadStorageFileToLocal(const Authorization& auth, LockContext& lockCtx,
                                                    const std::string& templateUri) = 0;
 
+    /// The asynchronous download progress callback function, with the bytes
+    /// received so far and the expected size, or -1 when unknown.
+    using DownloadProgressCallback = std::function<void(int64_t received, int64_t expected)>;
+
+    /// The asynchronous download completion callback function.
+    using AsyncDownloadCallback = std::function<void(const AsyncDownload&)>;
+
+    /// Copies the file locally without blocking, driven by @socketPoll, from
+    /// which the callbacks are invoked.
+    /// Returns false, without invoking them, if unsupported: use
+    /// downloadStorageFileToLocal() instead.
+    virtual bool downloadStorageFileToLocalAsync(
+        const Authorization& /*auth*/, LockContext& /*lockCtx*/,
+        const std::string& /*templateUri*/, SocketPoll& /*socketPoll*/,
+        const DownloadProgressCallback& /*progressCallback*/,
+        const AsyncDownloadCallback& /*asyncDownloadCallback*/)
+    {
+        return false;
+    }
+
     /// The asynchronous upload completion callback function.
     using AsyncUploadCallback = std::function<void(const AsyncUpload&)>;
 
@@ -484,6 +544,20 @@ protected:
     /// Returns the root path of the jail directory of docs.
     std::string getLocalRootPath() const;
 
+    /// Counts a successful upload of @sent bytes, of a document of @size bytes.
+    void addUploadedBytes(uint64_t sent, uint64_t size)
+    {
+        _uploadedBytes += sent;
+        _uploadedDocumentBytes += size;
+    }
+
+    /// Whether to upload only what changed, to the storages that support it.
+    static bool DeltaUploadEnabled;
+    /// The most bytes of a delta we send in a request.
+    static std::size_t DeltaUploadChunkSize;
+    /// The largest document we upload only the changes of.
+    static std::size_t DeltaUploadMaxFileSize;
+
 private:
     Poco::URI _uri;
     const std::string _localStorePath;
@@ -492,6 +566,8 @@ private:
     std::string _jailedFilePathAnonym;
     FileInfo _fileInfo;
     bool _isDownloaded;
+    uint64_t _uploadedBytes;
+    uint64_t _uploadedDocumentBytes;
 
     static bool FilesystemEnabled;
 };
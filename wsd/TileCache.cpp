@@ -13,12 +13,14 @@
 
 #include "TileCache.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <climits>
 #include <cstddef>
 #include <cstdio>
 #include <iomanip>
 #include <iostream>
+#include <limits>
 #include <memory>
 #include <sstream>
 #include <string>
@@ -32,15 +34,74 @@
 #include <Unit.hpp>
 #include <Util.hpp>
 #include <common/FileUtil.hpp>
+#include <common/ThreadPool.hpp>
+#include <kit/Delta.hpp>
 
 using namespace COOLProtocol;
 
+namespace
+{
+/// Merge delta chains of this many deltas into a keyframe.
+constexpr size_t CompactDeltaCount = 8;
+/// Or once the deltas are this large, well before TileData::tooLarge().
+constexpr size_t CompactDeltaBytes = 48 * 1024;
+
+/// Shared by all documents, as compaction is infrequent and can wait.
+ThreadPool& getCompactionPool()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+/// Evicts the least recently used tiles first.
+class LruEvictionPolicy final : public TileCache::EvictionPolicy
+{
+public:
+    const char* name() const override { return "lru"; }
+
+    double keepScore(const TileDesc& /* desc */, const TileData& tile, bool /* visible */,
+                     std::chrono::steady_clock::time_point now) const override
+    {
+        return -std::chrono::duration<double>(now - tile._lastUsed).count();
+    }
+};
+
+/// Weighs what a tile would cost to get back against the memory it takes:
+/// keeps the on-screen, expensive to render keyframes, and evicts the
+/// deep delta chains, that we would rather replace by a keyframe, first.
+class VisibleCostEvictionPolicy final : public TileCache::EvictionPolicy
+{
+public:
+    const char* name() const override { return "visible"; }
+
+    bool needsVisibility() const override { return true; }
+
+    double keepScore(const TileDesc& /* desc */, const TileData& tile, bool visible,
+                     std::chrono::steady_clock::time_point now) const override
+    {
+        double value = 1.0 + tile._renderCost.count();
+        if (visible)
+            value *= 16;
+        value /= 1 + tile.deltaCount();
+
+        const double age = std::chrono::duration<double>(now - tile._lastUsed).count();
+        return value / ((1 + age) * std::max<size_t>(tile.size(), 1));
+    }
+};
+} // namespace
+
 TileCache::TileCache(std::string docURL, const std::chrono::system_clock::time_point& modifiedTime,
                      bool dontCache)
     : _docURL(std::move(docURL))
     , _dontCache(dontCache)
     , _cacheSize(0)
     , _maxCacheSize(1024 * 1024)
+    , _evictionPolicy(createEvictionPolicy("lru"))
+    , _hits(0)
+    , _misses(0)
+    , _evictions(0)
+    , _compactions(0)
+    , _compacted(std::make_shared<CompactedTiles>())
 {
 #ifndef BUILDING_TESTS
     LOG_INF("TileCache ctor for uri [" << COOLWSD::anonymizeUrl(_docURL) <<
@@ -161,6 +222,36 @@ void TileCache::forgetTileBeingRendered(const TileDesc &descForKitReply,
                 " waiting for ver " << tileBeingRendered->getVersion() << " but have " << descForKitReply.getVersion());
 }
 
+void TileCache::registerTileBeingRendered(const TileDesc& tile,
+                                          const std::chrono::steady_clock::time_point& now)
+{
+    ASSERT_CORRECT_THREAD_OWNER(_owner);
+
+    std::shared_ptr<TileBeingRendered> tileBeingRendered = findTileBeingRendered(tile);
+    if (tileBeingRendered)
+    {
+        // A stale render we are re-issuing: wait for the new one.
+        tileBeingRendered->setVersion(tile.getVersion());
+        return;
+    }
+
+    LOG_TRC("Rendering tile " << tile.debugName() << " ver=" << tile.getVersion()
+                              << " without subscribers");
+    _tilesBeingRendered[tile] = std::make_shared<TileBeingRendered>(tile, now);
+}
+
+void TileCache::forgetUnsubscribedTileBeingRendered(const TileDesc& tile)
+{
+    ASSERT_CORRECT_THREAD_OWNER(_owner);
+
+    const auto it = _tilesBeingRendered.find(tile);
+    if (it != _tilesBeingRendered.end() && it->second->getSubscribers().empty())
+    {
+        LOG_TRC("Forgetting unsubscribed tile " << tile.debugName());
+        _tilesBeingRendered.erase(it);
+    }
+}
+
 int TileCache::getTileBeingRenderedVersion(const TileDesc& tile)
 {
     std::shared_ptr<TileBeingRendered> tileBeingRendered = findTileBeingRendered(tile);
@@ -173,6 +264,13 @@ Tile TileCache::lookupTile(const TileDesc& tile)
         return Tile();
 
     Tile ret = findTile(tile);
+    if (ret)
+    {
+        ++_hits;
+        ret->_lastUsed = std::chrono::steady_clock::now();
+    }
+    else
+        ++_misses;
 
     UnitWSD::get().lookupTile(tile.getPart(), tile.getEditMode(),
                               tile.getWidth(), tile.getHeight(),
@@ -193,6 +291,8 @@ void TileCache::saveTileAndNotify(const TileDesc& desc, const char *data, const
     // Ignore if we can't save the tile, things will work anyway, but slower.
     // An error indication is supposed to be sent to all users in that case.
     Tile tile = saveDataToCache(desc, data, size);
+    if (tile && tileBeingRendered && TileData::isKeyframe(data, size))
+        tile->_renderCost = tileBeingRendered->getElapsedTimeMs();
     if (!_dontCache)
         LOG_TRC("Saved cache tile: " << cacheFileName(desc) << " of size " << size << " bytes");
     else
@@ -520,6 +620,11 @@ Tile TileCache::saveDataToCache(const TileDesc &desc, const char *data, const si
     {
         LOG_TRC("append blob to " << desc.serialize() << " of size " << size);
         _cacheSize += tile->appendBlob(desc.getWireId(), data, size);
+        tile->_lastUsed = std::chrono::steady_clock::now();
+
+        if (!tile->_compacting && tile->_hasKeyframe && !tile->isPng() &&
+            (tile->deltaCount() >= CompactDeltaCount || tile->deltaSize() > CompactDeltaBytes))
+            compactTile(desc, tile);
     }
 
     return tile;
@@ -542,6 +647,92 @@ void TileCache::assertCacheSize()
 #endif
 }
 
+void TileCache::compactTile(const TileDesc& desc, const Tile& tile)
+{
+    LOG_TRC("Compacting " << tile->deltaCount() << " deltas of size " << tile->deltaSize()
+                          << " of " << desc.serialize());
+    tile->_compacting = true;
+
+    CompactedTile compacted{ desc, tile->_wids.front(), tile->_wids.size(), {} };
+    // The frames are immutable, so we can share rather than copy them.
+    std::vector<Blob> frames;
+    tile->appendChangesSince(frames, 0);
+    std::shared_ptr<CompactedTiles> results = _compacted;
+    getCompactionPool().post(
+        [compacted = std::move(compacted), frames = std::move(frames), results]() mutable
+        {
+            BlobData deltas;
+            for (const Blob& frame : frames)
+                deltas.insert(deltas.end(), frame->begin(), frame->end());
+
+            if (!DeltaGenerator::compactDeltas(deltas.data(), deltas.size(),
+                                               compacted._desc.getWidth(),
+                                               compacted._desc.getHeight(),
+                                               compacted._keyframe))
+                compacted._keyframe.clear();
+
+            std::lock_guard<std::mutex> lock(results->_mutex);
+            results->_tiles.push_back(std::move(compacted));
+        });
+}
+
+void TileCache::applyCompactedTiles()
+{
+    ASSERT_CORRECT_THREAD_OWNER(_owner);
+
+    std::vector<CompactedTile> tiles;
+    {
+        std::lock_guard<std::mutex> lock(_compacted->_mutex);
+        tiles.swap(_compacted->_tiles);
+    }
+
+    for (const CompactedTile& compacted : tiles)
+    {
+        auto it = _cache.find(compacted._desc);
+        if (it == _cache.end() || !it->second)
+            continue; // evicted in the meantime.
+
+        const Tile& tile = it->second;
+        tile->_compacting = false;
+        if (compacted._keyframe.empty())
+        {
+            LOG_DBG("Failed to compact deltas of " << compacted._desc.serialize());
+            continue;
+        }
+
+        // A new keyframe in the meantime leaves nothing to do.
+        const size_t oldSize = itemCacheSize(tile);
+        if (!tile->compact(compacted._firstWid, compacted._count, compacted._keyframe))
+            continue;
+
+        LOG_TRC("Compacted " << compacted._count - 1 << " deltas of "
+                             << compacted._desc.serialize() << " into a keyframe of size "
+                             << compacted._keyframe.size() << ", " << tile->deltaCount()
+                             << " deltas remain");
+        _cacheSize = _cacheSize - oldSize + itemCacheSize(tile);
+        ++_compactions;
+    }
+
+    assertCacheSize();
+}
+
+std::unique_ptr<TileCache::EvictionPolicy> TileCache::createEvictionPolicy(const std::string& name)
+{
+    if (name == "visible")
+        return std::make_unique<VisibleCostEvictionPolicy>();
+
+    if (name != "lru")
+        LOG_WRN("Unknown tile cache eviction policy [" << name << "], using lru");
+    return std::make_unique<LruEvictionPolicy>();
+}
+
+void TileCache::setEvictionPolicy(std::unique_ptr<EvictionPolicy> policy)
+{
+    assert(policy);
+    LOG_DBG("Tile cache eviction policy: " << policy->name());
+    _evictionPolicy = std::move(policy);
+}
+
 void TileCache::ensureCacheSize()
 {
     assertCacheSize();
@@ -550,68 +741,66 @@ void TileCache::ensureCacheSize()
         return;
 
     LOG_TRC("Cleaning tile cache of size " << _cacheSize << " vs. " << _maxCacheSize <<
-            " with " << _cache.size() << " entries");
+            " with " << _cache.size() << " entries using " << _evictionPolicy->name() <<
+            " eviction");
 
-    struct WidSize {
-        TileWireId _wid;
-        size_t     _size;
-        WidSize(TileWireId w, size_t s) : _wid(w), _size(s) {}
-    };
-    std::vector<WidSize> wids;
-    wids.reserve(_cache.size());
+    TileWireId minWid = std::numeric_limits<TileWireId>::max();
+    TileWireId maxWid = 0;
     for (const auto& it : _cache)
-        wids.emplace_back(it.first.getWireId(), itemCacheSize(it.second));
-
-    std::sort(wids.begin(), wids.end(),
-              [](const WidSize &a, const WidSize &b) { return a._wid < b._wid; });
-
-    // FIXME: should we just take a wid 25% into the list ?
-    TileWireId maxToRemove = wids.front()._wid;
+    {
+        minWid = std::min(minWid, it.first.getWireId());
+        maxWid = std::max(maxWid, it.first.getWireId());
+    }
 
     // do we have (the very rare) WID wrap-around
-    if (wids.back()._wid - wids.front()._wid > 256 * 256 * 256)
-    {
-        maxToRemove = wids.back()._wid;
+    const bool wrapAround = maxWid - minWid > 256 * 256 * 256;
+    if (wrapAround)
         LOG_TRC("Rare wid wrap-around detected, clear tile cache");
-    }
-    else
+
+    struct Candidate
+    {
+        double _score;
+        size_t _size;
+        decltype(_cache)::iterator _it;
+    };
+    std::vector<Candidate> candidates;
+    candidates.reserve(_cache.size());
+
+    const auto now = std::chrono::steady_clock::now();
+    const bool needsVisibility = _evictionPolicy->needsVisibility() && _isVisible;
+    for (auto it = _cache.begin(); it != _cache.end(); ++it)
     {
-        // calculate which wid to start at.
-        size_t total = 0;
-        for (const auto &it : wids)
+        auto rit = _tilesBeingRendered.find(it->first);
+        if (rit != _tilesBeingRendered.end())
         {
-            total += it._size;
-            maxToRemove = it._wid;
-            if (total > _maxCacheSize / 4)
-                break;
+            // avoid getting a delta instead of a keyframe at the bottom.
+            LOG_TRC("skip cleaning tile we are waiting on: " << it->first.serialize() <<
+                    " which has " << rit->second->getSubscribers().size() << " waiting");
+            continue;
         }
+
+        const bool visible = needsVisibility && _isVisible(it->first);
+        candidates.push_back(
+            { _evictionPolicy->keepScore(it->first, *it->second, visible, now),
+              itemCacheSize(it->second), it });
     }
-    LOG_TRC("cleaning up to wid " << maxToRemove << " between " <<
-            wids.front()._wid << " and " << wids.back()._wid);
 
-    for (auto it = _cache.begin(); it != _cache.end();)
+    std::sort(candidates.begin(), candidates.end(),
+              [](const Candidate& a, const Candidate& b) { return a._score < b._score; });
+
+    // free a quarter of the budget, or everything on wrap-around.
+    size_t freed = 0;
+    for (const Candidate& candidate : candidates)
     {
-        if (it->first.getWireId() <= maxToRemove)
-        {
-            auto rit = _tilesBeingRendered.find(it->first);
-            if (rit != _tilesBeingRendered.end())
-            {
-                // avoid getting a delta instead of a keyframe at the bottom.
-                LOG_TRC("skip cleaning tile we are waiting on: " << it->first.serialize() <<
-                        " which has " << rit->second->getSubscribers().size() << " waiting");
-                ++it;
-            }
-            else
-            {
-                LOG_TRC("cleaned out tile: " << it->first.serialize());
-                _cacheSize -= itemCacheSize(it->second);
-                it = _cache.erase(it);
-            }
-        }
-        else
-        {
-            ++it;
-        }
+        if (!wrapAround && freed > _maxCacheSize / 4)
+            break;
+
+        LOG_TRC("cleaned out tile: " << candidate._it->first.serialize() << " score "
+                                     << candidate._score);
+        freed += candidate._size;
+        _cacheSize -= candidate._size;
+        _cache.erase(candidate._it);
+        ++_evictions;
     }
 
     LOG_TRC("Cache is now of size " << _cacheSize << " and " <<
@@ -656,12 +845,15 @@ void TileCache::dumpState(std::ostream& os)
     os << "\n  TileCache:";
     os << "\n    num: " << _cache.size() << ", size: " << _cacheSize << " (" << _maxCacheSize
        << ") bytes\n";
+    os << "    eviction: " << _evictionPolicy->name() << ", hits: " << _hits
+       << ", misses: " << _misses << ", evictions: " << _evictions
+       << ", compactions: " << _compactions << '\n';
     size_t totalSize = 0;
     size_t totalCapacity = 0;
     for (const auto& it : _cache)
     {
         totalSize += it.second->size();
-        totalCapacity += it.second->data().capacity();
+        totalCapacity += it.second->capacity();
         os << "    " << std::setw(4) << it.first.getWireId() << '\t' << std::setw(6)
            << it.second->size() << " bytes" << "\t'" << it.first.serialize() << " ";
         it.second->dumpState(os);
@@ -698,4 +890,71 @@ void TileCache::dumpState(std::ostream& os)
         it.second->dumpState(os);
 }
 
+bool SpeculativeTileTracker::add(const TileDesc& tile, std::chrono::steady_clock::time_point now)
+{
+    if (!hasRoom() || !_tiles.emplace(tile, Entry{ now, 0 }).second)
+        return false;
+
+    _bytes += EstimatedTileSize;
+    ++_requests;
+    return true;
+}
+
+void SpeculativeTileTracker::rendered(const TileDesc& tile, size_t size)
+{
+    const auto it = _tiles.find(tile);
+    if (it == _tiles.end() || it->second._size || !size)
+        return;
+
+    _bytes = _bytes - EstimatedTileSize + size;
+    it->second._size = size;
+}
+
+void SpeculativeTileTracker::requested(const TileDesc& tile, bool cached)
+{
+    const auto it = _tiles.find(tile);
+    if (it == _tiles.end())
+        return;
+
+    if (cached && it->second._size)
+        ++_hits;
+    else
+        ++_misses;
+
+    _bytes -= entrySize(it->second);
+    _tiles.erase(it);
+}
+
+std::vector<TileDesc> SpeculativeTileTracker::expire(std::chrono::steady_clock::time_point now)
+{
+    std::vector<TileDesc> unrendered;
+    for (auto it = _tiles.begin(); it != _tiles.end();)
+    {
+        if (now - it->second._requested < _expiry)
+        {
+            ++it;
+            continue;
+        }
+
+        ++_expired;
+        if (!it->second._size)
+            unrendered.push_back(it->first);
+        _bytes -= entrySize(it->second);
+        it = _tiles.erase(it);
+    }
+
+    return unrendered;
+}
+
+void SpeculativeTileTracker::dumpState(std::ostream& os) const
+{
+    os << "  speculative tiles: " << _tiles.size() << ", " << _bytes << " of " << _maxBytes
+       << " bytes, requested: " << _requests << ", hits: " << _hits << ", misses: " << _misses
+       << ", expired: " << _expired;
+    if (_requests)
+        os << ", hit rate: " << std::fixed << std::setprecision(1) << 100.0 * _hits / _requests
+           << '%';
+    os << '\n';
+}
+
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
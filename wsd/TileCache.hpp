@@ -11,12 +11,17 @@
 
 #pragma once
 
+#include <algorithm>
+#include <chrono>
+#include <functional>
 #include <iosfwd>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include <Rectangle.hpp>
 
@@ -66,6 +71,11 @@ struct TileDescCacheHasher final
 struct TileData
 {
     TileData(TileWireId start, const char *data, const size_t size)
+        : _hasKeyframe(false)
+        , _compacting(false)
+        , _lastUsed(std::chrono::steady_clock::now())
+        , _renderCost(0)
+        , _size(0)
     {
         appendBlob(start, data, size);
     }
@@ -80,8 +90,9 @@ struct TileData
         {
             LOG_TRC("received key-frame - clearing tile");
             _wids.clear();
-            _offsets.clear();
-            _deltas.clear();
+            _frames.clear();
+            _size = 0;
+            _hasKeyframe = true;
         }
         else
         {
@@ -92,17 +103,18 @@ struct TileData
             // delta messages if there is no keyframe, that causes some
             // content, at least in Impress documents, to not render.
             if (!_wids.size())
+            {
                 LOG_DBG("no underlying keyframe!");
+                _hasKeyframe = false;
+            }
         }
 
-        size_t oldSize = size();
-
         // If we have an empty delta at the end - then just
         // bump the associated wid. There is no risk to sending
         // an empty delta twice.x
         if (dataSize == 1 && // just a 'D'
-            _offsets.size() > 1 &&
-            _offsets.back() == _deltas.size())
+            _frames.size() > 1 &&
+            _frames.back()->empty())
         {
             LOG_TRC("received empty delta - bumping wid from " << _wids.back() << " to " << id);
             _wids.back() = id;
@@ -110,12 +122,8 @@ struct TileData
         else
         {
             _wids.push_back(id);
-            _offsets.push_back(_deltas.size());
-            if (dataSize > 1)
-            {
-                _deltas.resize(oldSize + dataSize - 1);
-                std::memcpy(_deltas.data() + oldSize, data + 1, dataSize - 1);
-            }
+            _frames.push_back(std::make_shared<BlobData>(data + 1, data + dataSize));
+            _size += dataSize - 1;
         }
 
         // FIXME: possible race - should store a seq. from the invalidation(s) ?
@@ -128,14 +136,32 @@ struct TileData
     bool tooLarge() const
     {
         // keyframe gets a free size pass
-        if (_offsets.size() <= 1)
+        if (_frames.size() <= 1)
             return false;
-        size_t deltaSize = size() - _offsets[1];
-        return deltaSize > 128 * 1024; // deltas should be cumulatively small.
+        return deltaSize() > 128 * 1024; // deltas should be cumulatively small.
+    }
+
+    /// Replace the keyframe and the deltas up to the @count-th wid, if they
+    /// are still the ones starting at @firstWid, by the equivalent @keyframe.
+    bool compact(TileWireId firstWid, size_t count, const std::vector<char>& keyframe)
+    {
+        if (count < 2 || _wids.size() < count || _wids[0] != firstWid || !_hasKeyframe)
+            return false;
+
+        for (size_t i = 0; i < count; ++i)
+            _size -= _frames[i]->size();
+        _size += keyframe.size();
+
+        // the keyframe takes the wid of the last delta merged into it.
+        _wids.erase(_wids.begin(), _wids.begin() + count - 1);
+        _frames.erase(_frames.begin() + 1, _frames.begin() + count);
+        _frames[0] = std::make_shared<BlobData>(keyframe);
+
+        return true;
     }
 
-    bool isPng() const { return (_deltas.size() > 1 &&
-                                 _deltas[0] == (char)0x89); }
+    bool isPng() const { return (_size > 1 && !_frames[0]->empty() &&
+                                 (*_frames[0])[0] == (char)0x89); }
 
     static bool isKeyframe(const char *data, size_t dataSize)
     {
@@ -146,19 +172,38 @@ struct TileData
     bool isValid() const { return _valid; }
     void invalidate() { _valid = false; }
 
+    /// Number of deltas stacked on the keyframe.
+    size_t deltaCount() const { return _wids.empty() ? 0 : _wids.size() - 1; }
+
+    /// Bytes of deltas stacked on the keyframe.
+    size_t deltaSize() const { return _frames.size() <= 1 ? 0 : size() - _frames[0]->size(); }
+
     bool _valid; // not true - waiting for a new tile if in view.
+    /// False if deltas arrived without their keyframe.
+    bool _hasKeyframe;
+    /// Whether the delta chain is being merged into a keyframe in the background.
+    bool _compacting;
+    /// When we last stored or served this tile, for eviction.
+    std::chrono::steady_clock::time_point _lastUsed;
+    /// How long the last keyframe took to render.
+    std::chrono::milliseconds _renderCost;
     std::vector<TileWireId> _wids;
-    std::vector<size_t> _offsets; // offset of the start of data
-    BlobData _deltas; // first item is a key-frame, followed by deltas at _offsets
+    /// The key-frame, followed by the deltas of each of _wids. Never modified
+    /// once stored, so they can be shared with the sockets sending them.
+    std::vector<Blob> _frames;
+    size_t _size;
 
     size_t size() const
     {
-        return _deltas.size();
+        return _size;
     }
 
-    const BlobData &data() const
+    size_t capacity() const
     {
-        return _deltas;
+        size_t capacity = 0;
+        for (const Blob& frame : _frames)
+            capacity += frame->capacity();
+        return capacity;
     }
 
     /// if we send changes since this seq - do we need to first send the keyframe ?
@@ -169,32 +214,28 @@ struct TileData
 
     bool appendChangesSince(std::vector<char> &output, TileWireId since)
     {
-        size_t i;
-        for (i = 0; since != 0 && i < _wids.size() && _wids[i] <= since; ++i);
+        size_t i = findChangesSince(since);
+        if (i >= _wids.size())
+            return false;
+
+        for (; i < _frames.size(); ++i)
+            output.insert(output.end(), _frames[i]->begin(), _frames[i]->end());
+        return true;
+    }
 
+    /// As above, but sharing the frames instead of copying them.
+    bool appendChangesSince(std::vector<Blob> &output, TileWireId since)
+    {
+        size_t i = findChangesSince(since);
         if (i >= _wids.size())
-        {
-            // We don't throttle delta sending - yet the code thinks we do still.
-            // We just send all the deltas we have on top of the keyframe.
-            // LOG_WRN("odd outcome - requested for a later id " << since <<
-            //        " than the last known: " << ((_wids.size() > 0) ? _wids.back() : -1));
             return false;
-        }
-        else
+
+        for (; i < _frames.size(); ++i)
         {
-            size_t offset = _offsets[i];
-            if (i != _offsets.size() - 1)
-                LOG_TRC("appending from " << i << " to " << (_offsets.size() - 1) <<
-                        " from wid: " << _wids[i] << " to wid: " << since <<
-                        " from offset: " << offset << " to " << _deltas.size());
-
-            size_t extra = _deltas.size() - offset;
-            size_t dest = output.size();
-            output.resize(output.size() + extra);
-
-            std::memcpy(output.data() + dest, _deltas.data() + offset, extra);
-            return true;
+            if (!_frames[i]->empty())
+                output.push_back(_frames[i]);
         }
+        return true;
     }
 
     void dumpState(std::ostream& os)
@@ -205,11 +246,31 @@ struct TileData
             os << "deltas: ";
             for (size_t i = 0; i < _wids.size(); ++i)
             {
-                os << i << ": " << _wids[i] << " -> " << _offsets[i] << ' ';
+                os << i << ": " << _wids[i] << " -> " << _frames[i]->size() << ' ';
             }
             os << (tooLarge() ? "too-large " : "");
         }
     }
+
+private:
+    /// The index of the first frame to send to bring a client at @since up
+    /// to date, or the number of frames if it has them all.
+    size_t findChangesSince(TileWireId since) const
+    {
+        size_t i;
+        for (i = 0; since != 0 && i < _wids.size() && _wids[i] <= since; ++i);
+
+        // We don't throttle delta sending - yet the code thinks we do still.
+        // We just send all the deltas we have on top of the keyframe.
+        // if (i >= _wids.size())
+        //     LOG_WRN("odd outcome - requested for a later id " << since <<
+        //             " than the last known: " << ((_wids.size() > 0) ? _wids.back() : -1));
+        if (i + 1 < _wids.size())
+            LOG_TRC("appending from " << i << " to " << (_wids.size() - 1) <<
+                    " from wid: " << _wids[i] << " to wid: " << since);
+
+        return i;
+    }
 };
 using Tile = std::shared_ptr<TileData>;
 
@@ -221,6 +282,25 @@ class TileCache
     std::shared_ptr<TileBeingRendered> findTileBeingRendered(const TileDesc& tile);
 
 public:
+    /// Decides which tiles to drop when the cache is over its budget.
+    class EvictionPolicy
+    {
+    public:
+        virtual ~EvictionPolicy() = default;
+
+        virtual const char* name() const = 0;
+
+        /// Whether keepScore() needs to know if tiles are on someone's screen.
+        virtual bool needsVisibility() const { return false; }
+
+        /// How much we would like to keep @tile: the lowest scores are evicted first.
+        virtual double keepScore(const TileDesc& desc, const TileData& tile, bool visible,
+                                 std::chrono::steady_clock::time_point now) const = 0;
+    };
+
+    /// Creates the "lru" or the "visible" (visibility-aware, cost-weighted) policy.
+    static std::unique_ptr<EvictionPolicy> createEvictionPolicy(const std::string& name);
+
     /// When the docURL is a non-file:// url, the timestamp has to be provided by the caller.
     /// For file:// url's, it's ignored.
     /// When it is missing for non-file:// url, it is assumed the document must be read, and no cached value used.
@@ -245,6 +325,9 @@ public:
     /// Find the tile with this description
     Tile lookupTile(const TileDesc& tile);
 
+    /// Find the tile without counting it as a use, eg. to decide whether to render it.
+    Tile peekTile(const TileDesc& tile) { return _dontCache ? Tile() : findTile(tile); }
+
     void saveTileAndNotify(const TileDesc& tile, const char* data, size_t size);
 
     enum StreamType {
@@ -278,6 +361,14 @@ public:
     void forgetTileBeingRendered(const TileDesc& descForKitReply,
                                  const std::shared_ptr<TileCache::TileBeingRendered>& tileBeingRendered);
 
+    /// Marks @tile, requested without any client waiting for it, as being
+    /// rendered, so that the clients requesting it meanwhile subscribe to it.
+    void registerTileBeingRendered(const TileDesc& tile,
+                                   const std::chrono::steady_clock::time_point& now);
+
+    /// Forget @tile being rendered if nobody subscribed to it.
+    void forgetUnsubscribedTileBeingRendered(const TileDesc& tile);
+
     size_t countTilesBeingRenderedForSession(const std::shared_ptr<ClientSession>& session,
                                              const std::chrono::steady_clock::time_point& now);
     bool hasTileBeingRendered(const TileDesc& tileDesc, const std::chrono::steady_clock::time_point *now = nullptr) const;
@@ -290,6 +381,23 @@ public:
     /// Get the current memory use.
     size_t getMemorySize() const { return _cacheSize; }
 
+    /// Replace the eviction policy, LRU by default.
+    void setEvictionPolicy(std::unique_ptr<EvictionPolicy> policy);
+
+    /// Set how to tell whether a tile is in any client's visible area.
+    void setVisibilityCheck(std::function<bool(const TileDesc&)> isVisible)
+    {
+        _isVisible = std::move(isVisible);
+    }
+
+    uint64_t getHitCount() const { return _hits; }
+    uint64_t getMissCount() const { return _misses; }
+    uint64_t getEvictionCount() const { return _evictions; }
+    uint64_t getCompactionCount() const { return _compactions; }
+
+    /// Install the keyframes merged from delta chains in the background.
+    void applyCompactedTiles();
+
     // Debugging bits ...
     void dumpState(std::ostream& os);
     void setThreadOwner(const std::thread::id& id) { _owner = id; }
@@ -314,6 +422,9 @@ private:
                                int width, int height, int normalizedViewId);
 
     Tile saveDataToCache(const TileDesc& desc, const char* data, size_t size);
+
+    /// Merge the delta chain of @tile into a keyframe on a worker thread.
+    void compactTile(const TileDesc& desc, const Tile& tile);
     void saveDataToStreamCache(StreamType type, const std::string& fileName, const char* data,
                                size_t size);
 
@@ -329,6 +440,32 @@ private:
     /// Maximum (high watermark) size of the tilecache in bytes
     size_t _maxCacheSize;
 
+    std::unique_ptr<EvictionPolicy> _evictionPolicy;
+    std::function<bool(const TileDesc&)> _isVisible;
+
+    /// Tile lookup and eviction statistics.
+    uint64_t _hits;
+    uint64_t _misses;
+    uint64_t _evictions;
+    uint64_t _compactions;
+
+    /// A delta chain merged into a keyframe.
+    struct CompactedTile
+    {
+        TileDesc _desc;
+        TileWireId _firstWid;
+        size_t _count;
+        std::vector<char> _keyframe; ///< Empty on failure.
+    };
+
+    /// Filled by the compaction threads, emptied by applyCompactedTiles().
+    struct CompactedTiles
+    {
+        std::mutex _mutex;
+        std::vector<CompactedTile> _tiles;
+    };
+    std::shared_ptr<CompactedTiles> _compacted;
+
     // FIXME: should we have a tile-desc to WID map instead and a simpler lookup ?
     std::unordered_map<TileDesc, Tile,
                        TileDescCacheHasher,
@@ -345,47 +482,357 @@ private:
 /// Tracks view-port area tiles to track which we last
 /// sent to avoid re-sending an existing delta causing grief
 class ClientDeltaTracker final {
+    /// The wire-ids last sent of the tiles of one area, in a dense grid.
+    struct Grid
+    {
+        int _left;
+        int _top;
+        int _columns;
+        int _rows;
+        std::vector<TileWireId> _wids;
+
+        Grid()
+            : _left(0)
+            , _top(0)
+            , _columns(0)
+            , _rows(0)
+        {
+        }
+
+        bool contains(int column, int row) const
+        {
+            return column >= _left && column < _left + _columns && row >= _top &&
+                   row < _top + _rows;
+        }
+
+        TileWireId& at(int column, int row)
+        {
+            return _wids[(row - _top) * _columns + (column - _left)];
+        }
+
+        /// Move the grid, keeping the wire-ids of the tiles still in it.
+        void resize(int left, int top, int columns, int rows)
+        {
+            std::vector<TileWireId> wids(columns * rows, 0);
+            const int fromColumn = std::max(left, _left);
+            const int toColumn = std::min(left + columns, _left + _columns);
+            for (int row = std::max(top, _top); row < std::min(top + rows, _top + _rows); ++row)
+            {
+                for (int column = fromColumn; column < toColumn; ++column)
+                    wids[(row - top) * columns + (column - left)] = at(column, row);
+            }
+
+            _left = left;
+            _top = top;
+            _columns = columns;
+            _rows = rows;
+            _wids.swap(wids);
+        }
+    };
+
+    /// The tiles of one view, part and zoom level, in a grid per visible
+    /// area (a pane, with frozen rows or columns), with a margin around it.
+    /// Grids may overlap: each tile in several has the same wire-id in all
+    /// of them, or 0 in those that took it in since.
+    struct Layer
+    {
+        int _normalizedViewId;
+        int _part;
+        int _mode;
+        int _width;
+        int _height;
+        int _tileWidth;
+        int _tileHeight;
+        std::vector<Grid> _grids;
+
+        explicit Layer(const TileDesc& desc)
+            : _normalizedViewId(desc.getNormalizedViewId())
+            , _part(desc.getPart())
+            , _mode(desc.getEditMode())
+            , _width(desc.getWidth())
+            , _height(desc.getHeight())
+            , _tileWidth(desc.getTileWidth())
+            , _tileHeight(desc.getTileHeight())
+        {
+        }
+
+        bool matches(const TileDesc& desc) const
+        {
+            return _tileWidth == desc.getTileWidth() && _tileHeight == desc.getTileHeight() &&
+                   _part == desc.getPart() && _mode == desc.getEditMode() &&
+                   _width == desc.getWidth() && _height == desc.getHeight() &&
+                   _normalizedViewId == desc.getNormalizedViewId();
+        }
+
+        bool contains(int column, int row) const
+        {
+            return std::any_of(_grids.begin(), _grids.end(),
+                               [column, row](const Grid& grid)
+                               { return grid.contains(column, row); });
+        }
+    };
+
+    /// Most recently used first.
+    std::vector<Layer> _layers;
+    /// The areas the client shows, in twips, if known.
+    std::vector<Util::Rectangle> _viewPorts;
+
 public:
-    // FIXME: could be a simple 2d TileWireId array for better packing.
-    std::unordered_set<TileDesc,
-                       TileDescCacheHasher,
-                       TileDescCacheCompareEq> _cache;
+    /// How many parts and zoom levels we remember.
+    static constexpr size_t MaxLayers = 8;
+    /// The most tiles we keep for a layer, over all its grids.
+    static constexpr int MaxTiles = 64 * 1024;
+
     ClientDeltaTracker() {
     }
 
-    // FIXME: only need to store this for the current viewports
-    void updateViewPort( /* ... */ )
+    /// Re-center the grids on the new visible area, forgetting the tiles that
+    /// left it: they will get a keyframe when they are sent next time.
+    void updateViewPort(const Util::Rectangle& viewPort)
     {
-        // copy the set to another while filtering I guess.
+        updateViewPorts(std::vector<Util::Rectangle>{ viewPort });
+    }
+
+    /// As updateViewPort(), for the panes shown at once, with frozen rows
+    /// or columns. Each is tracked apart, so that those far apart, the
+    /// frozen top and the bottom of a long sheet, don't need the tiles
+    /// in-between to be tracked.
+    void updateViewPorts(const std::vector<Util::Rectangle>& viewPorts)
+    {
+        _viewPorts.clear();
+        for (const Util::Rectangle& viewPort : viewPorts)
+        {
+            if (viewPort.hasSurface())
+                _viewPorts.push_back(viewPort);
+        }
+
+        for (Layer& layer : _layers)
+            fitViewPorts(layer);
     }
 
     /// return wire-id of last tile sent - or 0 if not present
     /// update last-tile sent wire-id to curSeq if found.
     TileWireId updateTileSeq(const TileDesc &desc)
     {
-        auto it = _cache.find(desc);
-        if (it == _cache.end())
-        {
-            _cache.insert(desc);
+        int column, row;
+        Layer* layer = findLayer(desc, true, column, row);
+        if (!layer)
             return 0;
+
+        TileWireId last = 0;
+        for (Grid& grid : layer->_grids)
+        {
+            if (grid.contains(column, row))
+            {
+                TileWireId& wid = grid.at(column, row);
+                last = std::max(last, wid);
+                wid = desc.getWireId();
+            }
         }
-        const TileWireId curSeq = desc.getWireId();
-        TileWireId last = it->getWireId();
-        // id is not included in the hash.
-        auto pDesc = const_cast<TileDesc *>(&(*it));
-        pDesc->setWireId(curSeq);
+
         return last;
     }
 
     void resetTileSeq(const TileDesc &desc)
     {
-        auto it = _cache.find(desc);
-        if (it == _cache.end())
+        int column, row;
+        Layer* layer = findLayer(desc, false, column, row);
+        if (!layer)
             return;
-        // id is not included in the hash.
-        auto pDesc = const_cast<TileDesc *>(&(*it));
-        pDesc->setWireId(0);
+
+        for (Grid& grid : layer->_grids)
+        {
+            if (grid.contains(column, row))
+                grid.at(column, row) = 0;
+        }
+    }
+
+private:
+    bool hasViewPort() const { return !_viewPorts.empty(); }
+
+    /// Lays the grids of @layer over the view-ports.
+    void fitViewPorts(Layer& layer) const
+    {
+        layer._grids.resize(_viewPorts.size());
+        const int maxTiles = MaxTiles / std::max<int>(_viewPorts.size(), 1);
+        for (size_t i = 0; i < _viewPorts.size(); ++i)
+        {
+            Grid& grid = layer._grids[i];
+            int left, top, columns, rows;
+            getViewPortGrid(layer, _viewPorts[i], maxTiles, left, top, columns, rows);
+            if (left != grid._left || top != grid._top || columns != grid._columns ||
+                rows != grid._rows)
+                grid.resize(left, top, columns, rows);
+        }
     }
+
+    /// The tiles of @layer in @viewPort, with a margin of half its size around it,
+    /// at most @maxTiles of them, from its top-left.
+    static void getViewPortGrid(const Layer& layer, const Util::Rectangle& viewPort,
+                                int maxTiles, int& left, int& top, int& columns, int& rows)
+    {
+        const int tileWidth = layer._tileWidth;
+        const int tileHeight = layer._tileHeight;
+        left = std::max(viewPort.getLeft(), 0) / tileWidth;
+        top = std::max(viewPort.getTop(), 0) / tileHeight;
+        columns = (std::max<int64_t>(viewPort.getRight(), 0) + tileWidth - 1) / tileWidth - left;
+        rows = (std::max<int64_t>(viewPort.getBottom(), 0) + tileHeight - 1) / tileHeight - top;
+
+        const int marginX = std::max(columns / 2, 2);
+        const int marginY = std::max(rows / 2, 2);
+        if (int64_t(columns + 2 * marginX) * (rows + 2 * marginY) <= maxTiles)
+        {
+            columns += 2 * marginX;
+            rows += 2 * marginY;
+            left -= marginX;
+            top -= marginY;
+        }
+
+        if (left < 0)
+        {
+            columns += left;
+            left = 0;
+        }
+        if (top < 0)
+        {
+            rows += top;
+            top = 0;
+        }
+
+        columns = std::min(columns, maxTiles);
+        rows = std::min(rows, maxTiles / std::max(columns, 1));
+    }
+
+    /// Find the layer tracking @desc, at @column and @row in it,
+    /// adding the layer, or growing its grid, if @create.
+    Layer* findLayer(const TileDesc& desc, bool create, int& column, int& row)
+    {
+        // Off-grid tiles aren't tracked, so they always get a keyframe.
+        const int tileWidth = desc.getTileWidth();
+        const int tileHeight = desc.getTileHeight();
+        if (tileWidth <= 0 || tileHeight <= 0 || desc.getTilePosX() < 0 ||
+            desc.getTilePosY() < 0 || desc.getTilePosX() % tileWidth ||
+            desc.getTilePosY() % tileHeight)
+            return nullptr;
+
+        column = desc.getTilePosX() / tileWidth;
+        row = desc.getTilePosY() / tileHeight;
+
+        auto it = std::find_if(_layers.begin(), _layers.end(),
+                               [&desc](const Layer& layer) { return layer.matches(desc); });
+        if (it == _layers.end())
+        {
+            if (!create)
+                return nullptr;
+
+            if (_layers.size() >= MaxLayers)
+                _layers.pop_back();
+            _layers.emplace(_layers.begin(), desc);
+            fitViewPorts(_layers.front());
+        }
+        else if (it != _layers.begin())
+            std::rotate(_layers.begin(), it, it + 1);
+
+        Layer& layer = _layers.front();
+        if (!layer.contains(column, row))
+        {
+            // Without a view-port, grow to fit what the client asks for.
+            if (!create || hasViewPort())
+                return nullptr;
+
+            if (layer._grids.empty())
+                layer._grids.emplace_back();
+
+            Grid& grid = layer._grids.front();
+            const int left = std::min(grid._columns ? grid._left : column, column);
+            const int top = std::min(grid._rows ? grid._top : row, row);
+            const int right = std::max(grid._left + grid._columns, column + 1);
+            const int bottom = std::max(grid._top + grid._rows, row + 1);
+            if (int64_t(right - left) * (bottom - top) > MaxTiles)
+                return nullptr;
+
+            grid.resize(left, top, right - left, bottom - top);
+        }
+
+        return &layer;
+    }
+};
+
+/// Tracks the tiles rendered ahead of the clients scrolling to them, within
+/// a memory budget, and how many of them the clients went on to request.
+class SpeculativeTileTracker final
+{
+    struct Entry
+    {
+        std::chrono::steady_clock::time_point _requested;
+        size_t _size; ///< Zero until rendered.
+    };
+
+    std::unordered_map<TileDesc, Entry, TileDescCacheHasher, TileDescCacheCompareEq> _tiles;
+
+    const size_t _maxBytes;
+    const std::chrono::milliseconds _expiry;
+    /// The size of the tracked tiles, estimated until they are rendered.
+    size_t _bytes;
+
+    uint64_t _requests;
+    uint64_t _hits;
+    uint64_t _misses;
+    uint64_t _expired;
+
+    static size_t entrySize(const Entry& entry)
+    {
+        return entry._size ? entry._size : EstimatedTileSize;
+    }
+
+public:
+    /// What we expect a tile to take until it is rendered.
+    static constexpr size_t EstimatedTileSize = 16 * 1024;
+
+    SpeculativeTileTracker(size_t maxBytes, std::chrono::milliseconds expiry)
+        : _maxBytes(maxBytes)
+        , _expiry(expiry)
+        , _bytes(0)
+        , _requests(0)
+        , _hits(0)
+        , _misses(0)
+        , _expired(0)
+    {
+    }
+
+    /// Whether another tile fits in the budget.
+    bool hasRoom() const { return _bytes + EstimatedTileSize <= _maxBytes; }
+
+    /// Starts tracking @tile, requested speculatively, unless it already is
+    /// or it doesn't fit in the budget.
+    bool add(const TileDesc& tile, std::chrono::steady_clock::time_point now);
+
+    /// A speculative or requested @tile was rendered, in @size bytes.
+    void rendered(const TileDesc& tile, size_t size);
+
+    /// A client requested @tile, which is up-to-date in the cache if @cached.
+    /// A hit if it was rendered speculatively, a miss if it wasn't in time.
+    void requested(const TileDesc& tile, bool cached);
+
+    /// Whether @tile was requested speculatively and is not rendered yet.
+    bool isRendering(const TileDesc& tile) const
+    {
+        const auto it = _tiles.find(tile);
+        return it != _tiles.end() && !it->second._size;
+    }
+
+    /// Forgets the tiles nobody requested in time.
+    /// @return The ones of them that were never rendered.
+    std::vector<TileDesc> expire(std::chrono::steady_clock::time_point now);
+
+    size_t size() const { return _tiles.size(); }
+    size_t getBytes() const { return _bytes; }
+    uint64_t getRequestCount() const { return _requests; }
+    uint64_t getHitCount() const { return _hits; }
+    uint64_t getMissCount() const { return _misses; }
+    uint64_t getExpiredCount() const { return _expired; }
+
+    void dumpState(std::ostream& os) const;
 };
 
 inline std::ostream& operator<< (std::ostream& os, const Tile& tile)
@@ -394,7 +841,7 @@ inline std::ostream& operator<< (std::ostream& os, const Tile& tile)
         os << "nullptr";
     else
         os << "keyframe id " << tile->_wids[0] <<
-            " size: " << tile->_deltas.size() <<
+            " size: " << tile->size() <<
             " deltas: " << (tile->_wids.size() - 1);
     return os;
 }
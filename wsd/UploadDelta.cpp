@@ -0,0 +1,289 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <config.h>
+
+#include "UploadDelta.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
+#include <zlib.h>
+
+namespace
+{
+uint32_t crc(std::string_view data)
+{
+    uLong value = crc32(0L, Z_NULL, 0);
+    while (!data.empty())
+    {
+        // zlib takes 32-bit lengths.
+        const std::size_t size = std::min<std::size_t>(data.size(), 1U << 30);
+        value = crc32(value, reinterpret_cast<const Bytef*>(data.data()), size);
+        data.remove_prefix(size);
+    }
+
+    return value;
+}
+
+void putUInt(std::string& out, uint64_t value, std::size_t bytes)
+{
+    for (std::size_t i = 0; i < bytes; ++i)
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+}
+
+/// Reads @bytes at @pos into @value, moving @pos past them.
+bool getUInt(std::string_view in, std::size_t& pos, std::size_t bytes, uint64_t& value)
+{
+    if (in.size() < bytes || pos > in.size() - bytes)
+        return false;
+
+    value = 0;
+    for (std::size_t i = 0; i < bytes; ++i)
+        value |= static_cast<uint64_t>(static_cast<uint8_t>(in[pos + i])) << (8 * i);
+
+    pos += bytes;
+    return true;
+}
+
+/// The weak checksum of rsync, which rolls a byte at a time.
+class RollingChecksum
+{
+public:
+    explicit RollingChecksum(std::string_view block)
+        : _a(0)
+        , _b(0)
+        , _size(block.size())
+    {
+        for (std::size_t i = 0; i < block.size(); ++i)
+        {
+            const uint8_t c = block[i];
+            _a += c;
+            _b += (block.size() - i) * c;
+        }
+    }
+
+    uint32_t value() const { return (_a & 0xffff) | (_b << 16); }
+
+    /// Drops @out, the first byte of the block, and appends @in.
+    void roll(uint8_t out, uint8_t in)
+    {
+        _a += in - out;
+        _b += _a - _size * out;
+    }
+
+private:
+    uint32_t _a;
+    uint32_t _b;
+    uint32_t _size;
+};
+
+/// Writes the operations, merging adjacent copies.
+class Encoder
+{
+public:
+    Encoder(std::string& delta, std::string_view target)
+        : _delta(delta)
+        , _target(target)
+        , _copyOffset(0)
+        , _copyLength(0)
+    {
+    }
+
+    void copy(uint64_t offset, uint64_t length)
+    {
+        if (_copyLength > 0 && _copyOffset + _copyLength == offset)
+        {
+            _copyLength += length;
+            return;
+        }
+
+        flush();
+        _copyOffset = offset;
+        _copyLength = length;
+    }
+
+    /// Inserts the bytes of the target from @start to @end.
+    void insert(std::size_t start, std::size_t end)
+    {
+        if (start == end)
+            return;
+
+        flush();
+        _delta.push_back('I');
+        putUInt(_delta, end - start, 8);
+        _delta.append(_target.substr(start, end - start));
+    }
+
+    void flush()
+    {
+        if (_copyLength == 0)
+            return;
+
+        _delta.push_back('C');
+        putUInt(_delta, _copyOffset, 8);
+        putUInt(_delta, _copyLength, 8);
+        _copyLength = 0;
+    }
+
+private:
+    std::string& _delta;
+    const std::string_view _target;
+    uint64_t _copyOffset;
+    uint64_t _copyLength;
+};
+} // namespace
+
+std::string UploadDelta::compute(std::string_view base, std::string_view target)
+{
+    std::string delta(Magic, sizeof(Magic));
+    putUInt(delta, base.size(), 8);
+    putUInt(delta, crc(base), 4);
+    putUInt(delta, target.size(), 8);
+    putUInt(delta, crc(target), 4);
+
+    // The first block of each checksum: the others rarely differ.
+    std::unordered_map<uint32_t, std::size_t> blocks;
+    blocks.reserve(base.size() / BlockSize);
+    for (std::size_t offset = 0; offset + BlockSize <= base.size(); offset += BlockSize)
+        blocks.emplace(RollingChecksum(base.substr(offset, BlockSize)).value(), offset);
+
+    Encoder encoder(delta, target);
+    std::size_t literal = 0; // Where the bytes not found in the base start.
+    std::size_t pos = 0;
+    if (!blocks.empty() && target.size() >= BlockSize)
+    {
+        RollingChecksum sum(target.substr(0, BlockSize));
+        for (;;)
+        {
+            const auto it = blocks.find(sum.value());
+            if (it != blocks.end() &&
+                std::memcmp(base.data() + it->second, target.data() + pos, BlockSize) == 0)
+            {
+                // Extend the match both ways, as far as they agree.
+                std::size_t offset = it->second;
+                std::size_t length = BlockSize;
+                while (pos > literal && offset > 0 && base[offset - 1] == target[pos - 1])
+                {
+                    --pos;
+                    --offset;
+                    ++length;
+                }
+
+                while (pos + length < target.size() && offset + length < base.size() &&
+                       base[offset + length] == target[pos + length])
+                    ++length;
+
+                encoder.insert(literal, pos);
+                encoder.copy(offset, length);
+                pos += length;
+                literal = pos;
+                if (pos + BlockSize > target.size())
+                    break;
+
+                sum = RollingChecksum(target.substr(pos, BlockSize));
+                continue;
+            }
+
+            if (pos + BlockSize >= target.size())
+                break;
+
+            sum.roll(target[pos], target[pos + BlockSize]);
+            ++pos;
+        }
+    }
+
+    encoder.insert(literal, target.size());
+    encoder.flush();
+    return delta;
+}
+
+bool UploadDelta::apply(std::string_view base, std::string_view delta, std::string& target)
+{
+    if (delta.size() < HeaderSize || std::memcmp(delta.data(), Magic, sizeof(Magic)) != 0)
+        return false;
+
+    std::size_t pos = sizeof(Magic);
+    uint64_t baseSize = 0;
+    uint64_t baseCrc = 0;
+    uint64_t targetSize = 0;
+    uint64_t targetCrc = 0;
+    getUInt(delta, pos, 8, baseSize);
+    getUInt(delta, pos, 4, baseCrc);
+    getUInt(delta, pos, 8, targetSize);
+    getUInt(delta, pos, 4, targetCrc);
+    if (baseSize != base.size() || baseCrc != crc(base))
+        return false;
+
+    // Not trusting the size until the CRC matches.
+    target.clear();
+    target.reserve(std::min<uint64_t>(targetSize, base.size() + delta.size()));
+    while (pos < delta.size())
+    {
+        const char op = delta[pos++];
+        uint64_t offset = 0;
+        uint64_t length = 0;
+        if (op == 'C')
+        {
+            if (!getUInt(delta, pos, 8, offset) || !getUInt(delta, pos, 8, length) ||
+                offset > base.size() || length > base.size() - offset)
+                return false;
+
+            if (length > targetSize - target.size())
+                return false;
+
+            target.append(base.substr(offset, length));
+        }
+        else if (op == 'I')
+        {
+            if (!getUInt(delta, pos, 8, length) || length > delta.size() - pos ||
+                length > targetSize - target.size())
+                return false;
+
+            target.append(delta.substr(pos, length));
+            pos += length;
+        }
+        else
+            return false;
+    }
+
+    return target.size() == targetSize && crc(target) == targetCrc;
+}
+
+bool UploadDelta::Chunks::add(const std::string& id, uint64_t offset, uint64_t length,
+                              std::string_view data)
+{
+    if (id != _id || length != _length || offset == 0)
+    {
+        // Another upload, or this one again: start over.
+        _id = id;
+        _length = length;
+        _data.clear();
+    }
+
+    if (offset != _data.size() || data.size() > _length - offset)
+        return false;
+
+    _data.append(data);
+    return true;
+}
+
+std::string UploadDelta::Chunks::take()
+{
+    std::string data = std::move(_data);
+    _data.clear();
+    _id.clear();
+    _length = 0;
+    return data;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
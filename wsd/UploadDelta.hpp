@@ -0,0 +1,79 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * Copyright the Collabora Online contributors.
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/// A binary delta of a document against the version of it we last uploaded,
+/// for the storages that apply it, so that autosaving a large document in
+/// which little changed doesn't upload it all again.
+///
+/// As rsync does, the blocks of the base are indexed by a weak checksum,
+/// which rolls over the target a byte at a time to find them wherever they
+/// moved to. The delta is a header, with the size and CRC-32 of the base and
+/// of the target, followed by the operations building the target:
+///   'C' <offset> <length>: copies @length bytes at @offset in the base.
+///   'I' <length> <bytes>: inserts the @length bytes that follow.
+/// Sizes and offsets are 64-bit, CRCs 32-bit, little-endian, as it goes over
+/// the wire.
+class UploadDelta
+{
+public:
+    /// The start of a delta.
+    static constexpr char Magic[8] = { 'C', 'O', 'O', 'L', 'D', 'L', 'T', '1' };
+
+    /// Magic, base size and CRC, target size and CRC.
+    static constexpr std::size_t HeaderSize = sizeof(Magic) + 2 * (8 + 4);
+
+    /// Of the base. Smaller finds more of it, for a larger index.
+    static constexpr std::size_t BlockSize = 2048;
+
+    /// Returns the delta turning @base into @target.
+    static std::string compute(std::string_view base, std::string_view target);
+
+    /// Applies @delta to @base, into @target.
+    /// Returns false if @delta is corrupted, or isn't against @base.
+    static bool apply(std::string_view base, std::string_view delta, std::string& target);
+
+    /// Reassembles a delta uploaded in chunks, on the hosts we test with.
+    class Chunks
+    {
+    public:
+        Chunks()
+            : _length(0)
+        {
+        }
+
+        /// Appends @data, sent at @offset of the @length bytes of the upload @id,
+        /// starting over at offset 0. Returns false if it doesn't follow what we
+        /// have: the sender then resumes from offset().
+        bool add(const std::string& id, uint64_t offset, uint64_t length, std::string_view data);
+
+        /// The bytes we have of the upload.
+        uint64_t offset() const { return _data.size(); }
+
+        bool isComplete() const { return !_id.empty() && _data.size() == _length; }
+
+        /// Returns the complete delta, and forgets it.
+        std::string take();
+
+    private:
+        std::string _id;
+        uint64_t _length;
+        std::string _data;
+    };
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -45,12 +45,16 @@
 #include <Poco/Net/NameValueCollection.h>
 #include <Poco/Net/SSLManager.h>
 
+#include <atomic>
 #include <cassert>
 
 #include <Poco/Exception.h>
 #include <Poco/URI.h>
 
+#include <map>
+#include <mutex>
 #include <string>
+#include <vector>
 
 bool StorageConnectionManager::SSLAsScheme = true;
 bool StorageConnectionManager::SSLEnabled = false;
@@ -93,6 +97,246 @@ void initHttpRequest(Poco::Net::HTTPRequest& request, const Poco::URI& uri,
     request.set("X-COOL-WOPI-ServerId", Util::getProcessIdentifier());
 }
 
+/// Idle keep-alive connections to the storage servers, for reuse by later
+/// requests to the same host, to save the TCP and TLS handshakes.
+/// The sessions keep them out of any poll while idle, see
+/// http::Session::setKeepIdleConnection(), so any poll can reuse them.
+class ConnectionPool
+{
+    struct IdleSession
+    {
+        std::shared_ptr<http::Session> _session;
+        std::chrono::steady_clock::time_point _since;
+    };
+
+    /// The idle sessions by protocol, host and port, the most recent last.
+    std::map<std::string, std::vector<IdleSession>> _idleSessions;
+    std::size_t _idleCount;
+    std::mutex _mutex;
+
+    const std::size_t _maxIdle;
+    const std::size_t _maxIdlePerHost;
+    const std::chrono::seconds _idleTimeout;
+
+    std::atomic<uint64_t> _hits;
+    std::atomic<uint64_t> _misses;
+    std::atomic<uint64_t> _handshakes;
+    std::atomic<uint64_t> _resumedHandshakes;
+    std::atomic<uint64_t> _handshakeMicroseconds;
+
+public:
+    ConnectionPool()
+        : _idleCount(0)
+        , _maxIdle(ConfigUtil::getConfigValue<int>("storage.connection_pool.max_idle", 64))
+        , _maxIdlePerHost(
+              ConfigUtil::getConfigValue<int>("storage.connection_pool.max_idle_per_host", 8))
+        , _idleTimeout(
+              ConfigUtil::getConfigValue<int>("storage.connection_pool.idle_timeout_secs", 4))
+        , _hits(0)
+        , _misses(0)
+        , _handshakes(0)
+        , _resumedHandshakes(0)
+        , _handshakeMicroseconds(0)
+    {
+        LOG_INF("Keeping up to " << _maxIdle << " idle storage connections, " << _maxIdlePerHost
+                                 << " per host, for " << _idleTimeout);
+    }
+
+    ~ConnectionPool()
+    {
+        for (auto& pair : _idleSessions)
+        {
+            for (IdleSession& idle : pair.second)
+                idle._session->setKeepIdleConnection(false);
+        }
+    }
+
+    static ConnectionPool& get()
+    {
+        static ConnectionPool pool;
+        return pool;
+    }
+
+    bool isEnabled() const { return _maxIdle > 0 && _maxIdlePerHost > 0; }
+
+    /// Returns an idle session to @key, if we have one that is still open.
+    std::shared_ptr<http::Session> acquire(const std::string& key)
+    {
+        std::shared_ptr<http::Session> session;
+        std::vector<std::shared_ptr<http::Session>> expired;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            expire(expired);
+
+            const auto it = _idleSessions.find(key);
+            if (it != _idleSessions.end())
+            {
+                std::vector<IdleSession>& sessions = it->second;
+                for (auto idle = sessions.rbegin(); idle != sessions.rend(); ++idle)
+                {
+                    // Those just released may not be out of their poll yet.
+                    if (idle->_session->hasIdleConnection())
+                    {
+                        session = std::move(idle->_session);
+                        sessions.erase(std::next(idle).base());
+                        --_idleCount;
+                        break;
+                    }
+                }
+            }
+        }
+
+        close(expired);
+
+        if (session)
+        {
+            ++_hits;
+            LOG_TRC("Reusing an idle connection #" << session->getFD() << " to " << key);
+
+            // Don't call back the previous user. Not done on release, as
+            // that may be from within these very callbacks.
+            session->setFinishedHandler(nullptr);
+            session->setConnectFailHandler(nullptr);
+        }
+        else
+            ++_misses;
+
+        return session;
+    }
+
+    /// Keeps @session idle, if its last request completed and left it open,
+    /// or closes it.
+    void release(std::shared_ptr<http::Session> session, const std::string& key)
+    {
+        bool resumed = false;
+        const std::chrono::microseconds handshake = session->takeHandshakeDuration(resumed);
+        if (handshake > std::chrono::microseconds::zero())
+        {
+            ++_handshakes;
+            if (resumed)
+                ++_resumedHandshakes;
+            _handshakeMicroseconds += handshake.count();
+        }
+
+        const std::shared_ptr<http::Response>& response = session->response();
+        if (!response || response->state() != http::Response::State::Complete ||
+            !session->isConnected())
+        {
+            // Unused, failed, or still in flight: it can't be kept.
+            session->setKeepIdleConnection(false);
+            return;
+        }
+
+        std::vector<std::shared_ptr<http::Session>> expired;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            expire(expired);
+
+            std::vector<IdleSession>& sessions = _idleSessions[key];
+            sessions.push_back({ std::move(session), std::chrono::steady_clock::now() });
+            ++_idleCount;
+
+            if (sessions.size() > _maxIdlePerHost)
+                evict(sessions, sessions.begin(), expired);
+
+            if (_idleCount > _maxIdle)
+                evictOldest(expired);
+        }
+
+        close(expired);
+    }
+
+    /// Closes the connections idle for too long, even without new requests.
+    /// Returns the time until the next one is, if any.
+    std::chrono::microseconds expireIdle()
+    {
+        auto next = std::chrono::microseconds::max();
+        std::vector<std::shared_ptr<http::Session>> expired;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            expire(expired);
+
+            const auto now = std::chrono::steady_clock::now();
+            for (const auto& pair : _idleSessions)
+            {
+                // Never empty after expire(), the oldest first.
+                next = std::min(next, std::chrono::duration_cast<std::chrono::microseconds>(
+                                          pair.second.front()._since + _idleTimeout - now));
+            }
+        }
+
+        close(expired);
+        return next;
+    }
+
+    uint64_t getHitCount() const { return _hits; }
+    uint64_t getMissCount() const { return _misses; }
+    uint64_t getHandshakeCount() const { return _handshakes; }
+    uint64_t getResumedHandshakeCount() const { return _resumedHandshakes; }
+    std::chrono::microseconds getHandshakeDuration() const
+    {
+        return std::chrono::microseconds(_handshakeMicroseconds);
+    }
+
+    std::size_t getIdleCount()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _idleCount;
+    }
+
+private:
+    void evict(std::vector<IdleSession>& sessions, std::vector<IdleSession>::iterator it,
+               std::vector<std::shared_ptr<http::Session>>& evicted)
+    {
+        evicted.push_back(std::move(it->_session));
+        sessions.erase(it);
+        --_idleCount;
+    }
+
+    void evictOldest(std::vector<std::shared_ptr<http::Session>>& evicted)
+    {
+        std::vector<IdleSession>* oldest = nullptr;
+        for (auto& pair : _idleSessions)
+        {
+            if (!pair.second.empty() &&
+                (!oldest || pair.second.front()._since < oldest->front()._since))
+                oldest = &pair.second;
+        }
+
+        if (oldest)
+            evict(*oldest, oldest->begin(), evicted);
+    }
+
+    /// Moves the sessions idle for too long to @expired.
+    void expire(std::vector<std::shared_ptr<http::Session>>& expired)
+    {
+        const auto deadline = std::chrono::steady_clock::now() - _idleTimeout;
+        for (auto it = _idleSessions.begin(); it != _idleSessions.end();)
+        {
+            std::vector<IdleSession>& sessions = it->second;
+            while (!sessions.empty() && sessions.front()._since < deadline)
+                evict(sessions, sessions.begin(), expired);
+
+            if (sessions.empty())
+                it = _idleSessions.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    /// Closes the connections of sessions we no longer keep.
+    /// Not under the lock, as it may destroy them.
+    static void close(std::vector<std::shared_ptr<http::Session>>& sessions)
+    {
+        for (std::shared_ptr<http::Session>& session : sessions)
+        {
+            LOG_TRC("Closing idle connection #" << session->getFD() << " to "
+                                                << session->host());
+            session->setKeepIdleConnection(false);
+        }
+    }
+};
+
 } // namespace
 
 http::Request StorageConnectionManager::createHttpRequest(const Poco::URI& uri,
@@ -134,9 +378,6 @@ StorageConnectionManager::getHttpSession(const Poco::URI& uri, std::chrono::seco
     const auto protocol =
         useSSL ? http::Session::Protocol::HttpSsl : http::Session::Protocol::HttpUnencrypted;
 
-    // Create the session.
-    auto httpSession = http::Session::create(uri.getHost(), protocol, uri.getPort());
-
     if (timeout == std::chrono::seconds::zero())
     {
         CONFIG_STATIC const std::chrono::seconds defTimeout = std::chrono::seconds(
@@ -144,9 +385,68 @@ StorageConnectionManager::getHttpSession(const Poco::URI& uri, std::chrono::seco
         timeout = defTimeout;
     }
 
+    ConnectionPool& pool = ConnectionPool::get();
+    if (!pool.isEnabled())
+    {
+        auto httpSession = http::Session::create(uri.getHost(), protocol, uri.getPort());
+        httpSession->setTimeout(timeout);
+        return httpSession;
+    }
+
+    std::string key = std::string(useSSL ? "https://" : "http://") + uri.getHost() + ':' +
+                      std::to_string(uri.getPort());
+
+    // Reuse an idle session, or create the session.
+    std::shared_ptr<http::Session> httpSession = pool.acquire(key);
+    if (!httpSession)
+    {
+        httpSession = http::Session::create(uri.getHost(), protocol, uri.getPort());
+        httpSession->setKeepIdleConnection(true);
+    }
+
     httpSession->setTimeout(timeout);
 
-    return httpSession;
+    // Hand it back to the pool once our caller is done with it.
+    // The session itself, as seen by shared_from_this(), outlives this.
+    http::Session* const session = httpSession.get();
+    return std::shared_ptr<http::Session>(
+        session, [httpSession = std::move(httpSession), key = std::move(key)](http::Session*) mutable
+        { ConnectionPool::get().release(std::move(httpSession), key); });
+}
+
+std::chrono::microseconds StorageConnectionManager::expireIdleConnections()
+{
+    return ConnectionPool::get().expireIdle();
+}
+
+uint64_t StorageConnectionManager::getPoolHitCount()
+{
+    return ConnectionPool::get().getHitCount();
+}
+
+uint64_t StorageConnectionManager::getPoolMissCount()
+{
+    return ConnectionPool::get().getMissCount();
+}
+
+std::size_t StorageConnectionManager::getIdleConnectionCount()
+{
+    return ConnectionPool::get().getIdleCount();
+}
+
+uint64_t StorageConnectionManager::getHandshakeCount()
+{
+    return ConnectionPool::get().getHandshakeCount();
+}
+
+uint64_t StorageConnectionManager::getResumedHandshakeCount()
+{
+    return ConnectionPool::get().getResumedHandshakeCount();
+}
+
+std::chrono::microseconds StorageConnectionManager::getHandshakeDuration()
+{
+    return ConnectionPool::get().getHandshakeDuration();
 }
 
 void StorageConnectionManager::initialize()
@@ -16,6 +16,7 @@
 #include <net/HttpRequest.hpp>
 
 #include <chrono>
+#include <cstdint>
 #include <memory>
 #include <string>
 
@@ -41,7 +42,9 @@ public:
         return scm;
     }
 
-    /// Create an http::Session from a URI.
+    /// Create an http::Session from a URI, or reuse an idle one to the same
+    /// host, from the pool of keep-alive connections, if there is one.
+    /// The session returns to the pool once released.
     /// The configured timeout (net.connection_timeout_secs) is used when 0 is given.
     static std::shared_ptr<http::Session>
     getHttpSession(const Poco::URI& uri,
@@ -52,6 +55,21 @@ public:
 
     static void initialize();
 
+    /// Closes the idle connections of the pool that timed out. Returns
+    /// the time until the next one does, to call again by then.
+    static std::chrono::microseconds expireIdleConnections();
+
+    /// The number of sessions reused from the pool, and created instead.
+    static uint64_t getPoolHitCount();
+    static uint64_t getPoolMissCount();
+    /// The number of idle connections in the pool.
+    static std::size_t getIdleConnectionCount();
+    /// The number of TLS handshakes, and of those that resumed a session.
+    static uint64_t getHandshakeCount();
+    static uint64_t getResumedHandshakeCount();
+    /// The total time spent connecting and in TLS handshakes.
+    static std::chrono::microseconds getHandshakeDuration();
+
 private:
     StorageConnectionManager() = default;
 
@@ -23,10 +23,12 @@
 #include <NetUtil.hpp>
 #include <ProofKey.hpp>
 #include <Unit.hpp>
+#include <UploadDelta.hpp>
 #include <Util.hpp>
 #include <common/Anonymizer.hpp>
 #include <common/FileUtil.hpp>
 #include <common/JsonUtil.hpp>
+#include <common/ThreadPool.hpp>
 #include <common/TraceEvent.hpp>
 #include <common/Uri.hpp>
 #include <wopi/StorageConnectionManager.hpp>
@@ -45,10 +47,15 @@
 #include <Poco/StreamCopier.h>
 #include <Poco/URI.h>
 
+#include <algorithm>
 #include <cassert>
 #include <chrono>
+#include <cstdlib>
+#include <limits>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <utility>
 
 bool isTemplate(const std::string& filename)
 {
@@ -65,6 +72,13 @@ bool isTemplate(const std::string& filename)
 namespace
 {
 
+/// Shared by all documents, to compute the deltas to upload off their poll threads.
+ThreadPool& getDeltaPool()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
 static void addStorageDebugCookie(Poco::Net::HTTPRequest& request)
 {
     (void)request;
@@ -176,6 +190,8 @@ void WopiStorage::handleWOPIFileInfo(const WOPIFileInfo& wopiFileInfo, LockConte
     if (wopiFileInfo.getSupportsLocks())
         lockCtx.initSupportsLocks();
 
+    _supportsDeltaUpload = DeltaUploadEnabled && wopiFileInfo.getSupportsDeltaUpload();
+
     // If FileUrl is set, we use it for GetFile.
     _fileUrl = wopiFileInfo.getFileUrl();
 }
@@ -263,6 +279,7 @@ WopiStorage::WOPIFileInfo::WOPIFileInfo(const FileInfo& fileInfo, Poco::JSON::Ob
     JsonUtil::findJSONValue(object, "HideUserList", _hideUserList);
     JsonUtil::findJSONValue(object, "SupportsLocks", _supportsLocks);
     JsonUtil::findJSONValue(object, "SupportsRename", _supportsRename);
+    JsonUtil::findJSONValue(object, "SupportsDeltaUpload", _supportsDeltaUpload);
     JsonUtil::findJSONValue(object, "UserCanRename", _userCanRename);
     JsonUtil::findJSONValue(object, "BreadcrumbDocName", _breadcrumbDocName);
     JsonUtil::findJSONValue(object, "FileUrl", _fileUrl);
@@ -622,15 +639,214 @@ std::string WopiStorage::downloadStorageFileToLocal(const Authorization& auth,
     }
 }
 
-std::string WopiStorage::downloadDocument(const Poco::URI& uriObject, const std::string& uriAnonym,
-                                          const Authorization& auth, unsigned redirectLimit)
+bool WopiStorage::downloadStorageFileToLocalAsync(
+    const Authorization& auth, LockContext& /*lockCtx*/, const std::string& templateUri,
+    SocketPoll& socketPoll, const DownloadProgressCallback& progressCallback,
+    const AsyncDownloadCallback& asyncDownloadCallback)
+{
+    auto profileZone = std::make_shared<ProfileZone>(
+        std::string("WopiStorage::downloadStorageFileToLocalAsync"),
+        std::map<std::string, std::string>({ { "url", _fileUrl } }));
+
+    if (_downloadHttpSession)
+    {
+        LOG_WRN("Download is already in progress.");
+        asyncDownloadCallback(
+            AsyncDownload(AsyncDownload::State::Error,
+                          DownloadResult(DownloadResult::Result::FAILED, "Already in progress.")));
+        return true;
+    }
+
+    // The same sources as downloadStorageFileToLocal(), tried in turn.
+    auto sources = std::make_shared<std::vector<std::pair<Poco::URI, std::string>>>();
+    try
+    {
+        if (!templateUri.empty())
+        {
+            LOG_INF("WOPI::GetFile template source: " << COOLWSD::anonymizeUrl(templateUri));
+            sources->emplace_back(Poco::URI(templateUri), COOLWSD::anonymizeUrl(templateUri));
+        }
+        else
+        {
+            if (!_fileUrl.empty())
+                sources->emplace_back(Poco::URI(_fileUrl), COOLWSD::anonymizeUrl(_fileUrl));
+
+            Poco::URI uriObject(getUri());
+            uriObject.setPath(uriObject.getPath() + "/contents");
+            auth.authorizeURI(uriObject);
+
+            Poco::URI uriObjectAnonym(getUri());
+            uriObjectAnonym.setPath(COOLWSD::anonymizeUrl(uriObjectAnonym.getPath()) +
+                                    "/contents");
+            sources->emplace_back(uriObject, uriObjectAnonym.toString());
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        LOG_ERR("Cannot download document from invalid WOPI URI: " << ex.what());
+        asyncDownloadCallback(
+            AsyncDownload(AsyncDownload::State::Error,
+                          DownloadResult(DownloadResult::Result::FAILED, "Invalid URI.")));
+        return true;
+    }
+
+    // Try the next source when one fails, unless we are out of space.
+    auto onDone = std::make_shared<std::function<void(std::size_t, const DownloadResult&)>>();
+    *onDone = [this, sources, auth, &socketPoll, progressCallback, asyncDownloadCallback,
+               profileZone, weakOnDone = std::weak_ptr(onDone)](std::size_t index,
+                                                                const DownloadResult& result)
+    {
+        const auto next = weakOnDone.lock();
+        if (result.getResult() == DownloadResult::Result::FAILED &&
+            index + 1 < sources->size() && next)
+        {
+            LOG_ERR("Could not download document from [" << (*sources)[index].second
+                                                          << "]. Will use ["
+                                                          << (*sources)[index + 1].second
+                                                          << "]. Error: " << result.getReason());
+            asyncDownloadDocument((*sources)[index + 1].first, (*sources)[index + 1].second, auth,
+                                  HTTP_REDIRECTION_LIMIT, socketPoll, progressCallback,
+                                  [index, next](const DownloadResult& nextResult)
+                                  { (*next)(index + 1, nextResult); });
+            return;
+        }
+
+        profileZone->end();
+        if (result.getResult() == DownloadResult::Result::OK)
+            asyncDownloadCallback(AsyncDownload(AsyncDownload::State::Complete, result));
+        else
+            asyncDownloadCallback(AsyncDownload(AsyncDownload::State::Error, result));
+    };
+
+    // Notify client via callback that the request is in progress...
+    asyncDownloadCallback(AsyncDownload(AsyncDownload::State::Running,
+                                        DownloadResult(DownloadResult::Result::OK, std::string())));
+
+    LOG_INF("WOPI::GetFile asynchronously using: " << sources->front().second);
+    asyncDownloadDocument(sources->front().first, sources->front().second, auth,
+                          HTTP_REDIRECTION_LIMIT, socketPoll, progressCallback,
+                          [onDone](const DownloadResult& result) { (*onDone)(0, result); });
+    return true;
+}
+
+void WopiStorage::asyncDownloadDocument(const Poco::URI& uriObject, const std::string& uriAnonym,
+                                        const Authorization& auth, unsigned redirectLimit,
+                                        SocketPoll& socketPoll,
+                                        const DownloadProgressCallback& progressCallback,
+                                        const std::function<void(const DownloadResult&)>& onDone)
 {
     const auto startTime = std::chrono::steady_clock::now();
-    std::shared_ptr<http::Session> httpSession =
-        StorageConnectionManager::getHttpSession(uriObject);
+    try
+    {
+        prepareDownloadPath();
+    }
+    catch (const StorageSpaceLowException& ex)
+    {
+        onDone(DownloadResult(DownloadResult::Result::DISKFULL, ex.what()));
+        return;
+    }
+    catch (const std::exception& ex)
+    {
+        onDone(DownloadResult(DownloadResult::Result::FAILED, ex.what()));
+        return;
+    }
+
+    assert(!_downloadHttpSession && "Unexpected to have a download http::session");
+    _downloadHttpSession = StorageConnectionManager::getHttpSession(uriObject);
 
     http::Request httpRequest = initHttpRequest(uriObject, auth);
 
+    LOG_TRC("Downloading asynchronously from [" << uriAnonym << "] to [" << getRootFilePath()
+                                                << "]: " << httpRequest.header());
+
+    http::Session::FinishedCallback finishedCallback =
+        [this, startTime, uriAnonym, auth, redirectLimit, &socketPoll, progressCallback,
+         onDone](const std::shared_ptr<http::Session>& httpSession)
+    {
+        // Retire.
+        _downloadHttpSession.reset();
+
+        assert(httpSession && "Expected a valid http::Session");
+        const std::shared_ptr<const http::Response> httpResponse = httpSession->response();
+        if (httpResponse->state() != http::Response::State::Complete)
+        {
+            LOG_ERR("WOPI::GetFile [" << uriAnonym
+                                      << "] failed: " << http::Response::name(httpResponse->state()));
+            onDone(DownloadResult(DownloadResult::Result::FAILED,
+                                  "WOPI::GetFile [" + uriAnonym + "] failed: " +
+                                      http::Response::name(httpResponse->state())));
+            return;
+        }
+
+        const http::StatusCode statusCode = httpResponse->statusLine().statusCode();
+        if (statusCode == http::StatusCode::OK)
+        {
+            LOG_TRC("WOPI::GetFile response header for URI [" << uriAnonym << "]:\n"
+                                                              << httpResponse->header());
+
+            std::string subjectHash;
+            const std::string wopiCert = httpSession->getSslCert(subjectHash);
+            const std::string localPath = completeDownload(
+                uriAnonym,
+                std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - startTime),
+                wopiCert, subjectHash);
+            onDone(DownloadResult(DownloadResult::Result::OK, localPath));
+        }
+        else if (statusCode == http::StatusCode::MovedPermanently ||
+                 statusCode == http::StatusCode::Found ||
+                 statusCode == http::StatusCode::TemporaryRedirect ||
+                 statusCode == http::StatusCode::PermanentRedirect)
+        {
+            if (!redirectLimit)
+            {
+                onDone(DownloadResult(DownloadResult::Result::FAILED,
+                                      "WOPI::GetFile [" + uriAnonym +
+                                          "] failed: redirected too many times"));
+                return;
+            }
+
+            const std::string& location = httpResponse->get("Location");
+            LOG_TRC("WOPI::GetFile redirect to URI [" << COOLWSD::anonymizeUrl(location) << ']');
+            try
+            {
+                asyncDownloadDocument(Poco::URI(location), uriAnonym, auth, redirectLimit - 1,
+                                      socketPoll, progressCallback, onDone);
+            }
+            catch (const std::exception& ex)
+            {
+                onDone(DownloadResult(DownloadResult::Result::FAILED,
+                                      "WOPI::GetFile [" + uriAnonym +
+                                          "] failed to redirect: " + ex.what()));
+            }
+        }
+        else
+        {
+            LOG_ERR("WOPI::GetFile [" << uriAnonym
+                                      << "] failed with Status Code: " << statusCode);
+            onDone(DownloadResult(DownloadResult::Result::FAILED,
+                                  "WOPI::GetFile [" + uriAnonym +
+                                      "] failed: " + httpResponse->getBody()));
+        }
+    };
+
+    _downloadHttpSession->setFinishedHandler(std::move(finishedCallback));
+
+    _downloadHttpSession->setConnectFailHandler(
+        [this, uriAnonym, onDone](const std::shared_ptr<http::Session>& /* httpSession */)
+        {
+            _downloadHttpSession.reset();
+            LOG_ERR("Cannot connect to [" << uriAnonym << "] for downloading.");
+            onDone(DownloadResult(DownloadResult::Result::FAILED, "Connection failed."));
+        });
+
+    // Make the request, streaming the body to disk.
+    _downloadHttpSession->asyncDownload(httpRequest, getRootFilePath(), socketPoll,
+                                        progressCallback);
+}
+
+void WopiStorage::prepareDownloadPath()
+{
     setRootFilePath(Poco::Path(getLocalRootPath(), getFileInfo().getFilename()).toString());
     setRootFilePathAnonym(COOLWSD::anonymizeUrl(getRootFilePath()));
 
@@ -643,6 +859,18 @@ std::string WopiStorage::downloadDocument(const Poco::URI& uriObject, const std:
     {
         throw StorageSpaceLowException("Low disk space for " + getRootFilePathAnonym());
     }
+}
+
+std::string WopiStorage::downloadDocument(const Poco::URI& uriObject, const std::string& uriAnonym,
+                                          const Authorization& auth, unsigned redirectLimit)
+{
+    const auto startTime = std::chrono::steady_clock::now();
+    std::shared_ptr<http::Session> httpSession =
+        StorageConnectionManager::getHttpSession(uriObject);
+
+    http::Request httpRequest = initHttpRequest(uriObject, auth);
+
+    prepareDownloadPath();
 
     LOG_TRC("Downloading from [" << uriAnonym << "] to [" << getRootFilePath()
                                  << "]: " << httpRequest.header());
@@ -697,11 +925,18 @@ std::string WopiStorage::downloadDocument(const Poco::URI& uriObject, const std:
                                          "] failed: " + responseString);
     }
 
-    // Successful
+    return completeDownload(uriAnonym, diff, wopiCert, subjectHash);
+}
+
+std::string WopiStorage::completeDownload(const std::string& uriAnonym,
+                                          std::chrono::milliseconds duration,
+                                          const std::string& wopiCert,
+                                          const std::string& subjectHash)
+{
     const FileUtil::Stat fileStat(getRootFilePath());
     const std::size_t filesize = (fileStat.good() ? fileStat.size() : 0);
     LOG_INF("WOPI::GetFile downloaded " << filesize << " bytes from [" << uriAnonym << "] -> "
-                                        << getRootFilePathAnonym() << " in " << diff);
+                                        << getRootFilePathAnonym() << " in " << duration);
 
     if (!wopiCert.empty() && !subjectHash.empty())
     {
@@ -738,6 +973,71 @@ std::string WopiStorage::downloadDocument(const Poco::URI& uriObject, const std:
         return Poco::Path(getJailPath(), getFileInfo().getFilename()).toString();
 }
 
+WopiStorage::~WopiStorage()
+{
+    if (_deltaComputation)
+    {
+        // Not to post the delta back to us.
+        std::lock_guard<std::mutex> lock(_deltaComputation->_mutex);
+        _deltaComputation->_socketPoll = nullptr;
+    }
+}
+
+void WopiStorage::keepUploadedFile(const std::string& filePath)
+{
+    const std::string uploadedPath = getRootFilePathUploaded();
+    FileUtil::removeFile(uploadedPath);
+
+    // The uploaded file is replaced, rather than modified, by the next save.
+    try
+    {
+        if (::link(filePath.c_str(), uploadedPath.c_str()) == 0)
+            return;
+
+        FileUtil::copyFileTo(filePath, uploadedPath);
+    }
+    catch (const Poco::Exception& exc)
+    {
+        // We upload the whole document without it.
+        LOG_WRN("Failed to keep [" << COOLWSD::anonymizeUrl(filePath)
+                                   << "] to upload the deltas against: " << exc.displayText());
+    }
+}
+
+void WopiStorage::setPutFileHeaders(http::Header& httpHeader, const Attributes& attribs) const
+{
+    httpHeader.set("X-WOPI-Override", "PUT");
+    httpHeader.set("X-COOL-WOPI-IsModifiedByUser", attribs.isUserModified() ? "true" : "false");
+    httpHeader.set("X-COOL-WOPI-IsAutosave", attribs.isAutosave() ? "true" : "false");
+    httpHeader.set("X-COOL-WOPI-IsExitSave", attribs.isExitSave() ? "true" : "false");
+    if (isLegacyServer())
+    {
+        httpHeader.set("X-LOOL-WOPI-IsModifiedByUser",
+                       attribs.isUserModified() ? "true" : "false");
+        httpHeader.set("X-LOOL-WOPI-IsAutosave", attribs.isAutosave() ? "true" : "false");
+        httpHeader.set("X-LOOL-WOPI-IsExitSave", attribs.isExitSave() ? "true" : "false");
+    }
+
+    if (attribs.isExitSave()) {
+        // Don't maintain the socket if we are exiting.
+        httpHeader.setConnectionToken(http::Header::ConnectionToken::Close);
+    }
+    if (!attribs.getExtendedData().empty())
+    {
+        httpHeader.set("X-COOL-WOPI-ExtendedData", attribs.getExtendedData());
+        if (isLegacyServer())
+            httpHeader.set("X-LOOL-WOPI-ExtendedData", attribs.getExtendedData());
+    }
+
+    if (!attribs.isForced() && isLastModifiedTimeSafe())
+    {
+        // Request WOPI host to not overwrite if timestamps mismatch
+        httpHeader.set("X-COOL-WOPI-Timestamp", getLastModifiedTime());
+        if (isLegacyServer())
+            httpHeader.set("X-LOOL-WOPI-Timestamp", getLastModifiedTime());
+    }
+}
+
 std::size_t WopiStorage::uploadLocalFileToStorageAsync(
     const Authorization& auth, LockContext& lockCtx, const std::string& saveAsPath,
     const std::string& saveAsFilename, const bool isRename, const Attributes& attribs,
@@ -750,7 +1050,7 @@ std::size_t WopiStorage::uploadLocalFileToStorageAsync(
     // TODO: Check if this URI has write permission (canWrite = true)
 
     //TODO: replace with state machine.
-    if (_uploadHttpSession)
+    if (_uploadHttpSession || _deltaComputation)
     {
         LOG_WRN("Upload is already in progress.");
         asyncUploadCallback(
@@ -775,6 +1075,10 @@ std::size_t WopiStorage::uploadLocalFileToStorageAsync(
 
     const std::size_t size = (fileStat.good() ? fileStat.size() : 0);
 
+    if (!isSaveAs && !isRename &&
+        uploadDeltaAsync(auth, lockCtx, attribs, socketPoll, asyncUploadCallback))
+        return size;
+
     Poco::URI uriObject(getUri());
     uriObject.setPath(isSaveAs || isRename ? uriObject.getPath()
                                            : uriObject.getPath() + "/contents");
@@ -805,37 +1109,7 @@ std::size_t WopiStorage::uploadLocalFileToStorageAsync(
         if (!isSaveAs && !isRename)
         {
             // normal save
-            httpHeader.set("X-WOPI-Override", "PUT");
-            httpHeader.set("X-COOL-WOPI-IsModifiedByUser",
-                           attribs.isUserModified() ? "true" : "false");
-            httpHeader.set("X-COOL-WOPI-IsAutosave", attribs.isAutosave() ? "true" : "false");
-            httpHeader.set("X-COOL-WOPI-IsExitSave", attribs.isExitSave() ? "true" : "false");
-            if (isLegacyServer())
-            {
-                httpHeader.set("X-LOOL-WOPI-IsModifiedByUser",
-                               attribs.isUserModified() ? "true" : "false");
-                httpHeader.set("X-LOOL-WOPI-IsAutosave", attribs.isAutosave() ? "true" : "false");
-                httpHeader.set("X-LOOL-WOPI-IsExitSave", attribs.isExitSave() ? "true" : "false");
-            }
-
-            if (attribs.isExitSave()) {
-                // Don't maintain the socket if we are exiting.
-                httpHeader.setConnectionToken(http::Header::ConnectionToken::Close);
-            }
-            if (!attribs.getExtendedData().empty())
-            {
-                httpHeader.set("X-COOL-WOPI-ExtendedData", attribs.getExtendedData());
-                if (isLegacyServer())
-                    httpHeader.set("X-LOOL-WOPI-ExtendedData", attribs.getExtendedData());
-            }
-
-            if (!attribs.isForced() && isLastModifiedTimeSafe())
-            {
-                // Request WOPI host to not overwrite if timestamps mismatch
-                httpHeader.set("X-COOL-WOPI-Timestamp", getLastModifiedTime());
-                if (isLegacyServer())
-                    httpHeader.set("X-LOOL-WOPI-Timestamp", getLastModifiedTime());
-            }
+            setPutFileHeaders(httpHeader, attribs);
         }
         else
         {
@@ -896,6 +1170,16 @@ std::size_t WopiStorage::uploadLocalFileToStorageAsync(
             const StorageBase::UploadResult res =
                 handleUploadToStorageResponse(details, httpResponse->getBody());
 
+            if (res.getResult() == UploadResult::Result::OK)
+            {
+                addUploadedBytes(size, size);
+                if (_supportsDeltaUpload && !isSaveAs && !isRename)
+                {
+                    _deltaUpload.reset();
+                    keepUploadedFile(getRootFilePathUploading());
+                }
+            }
+
             // Fire the callback to our client (DocBroker, typically).
             asyncUploadCallback(AsyncUpload(AsyncUpload::State::Complete, res));
         };
@@ -939,6 +1223,317 @@ std::size_t WopiStorage::uploadLocalFileToStorageAsync(
     return 0;
 }
 
+bool WopiStorage::uploadDeltaAsync(const Authorization& auth, LockContext& lockCtx,
+                                   const Attributes& attribs, SocketPoll& socketPoll,
+                                   const AsyncUploadCallback& asyncUploadCallback)
+{
+    if (std::exchange(_uploadWhole, false) || !_supportsDeltaUpload)
+        return false;
+
+    const std::string filePath = getRootFilePathUploading();
+    const FileUtil::Stat fileStat(filePath);
+    if (_deltaUpload && _deltaUpload->_fileSize == fileStat.size() &&
+        _deltaUpload->_fileModifiedTime == fileStat.modifiedTimepoint())
+    {
+        LOG_INF("WOPI::PutFile resuming the upload of the delta of ["
+                << COOLWSD::anonymizeUrl(filePath) << "] at " << _deltaUpload->_offset << " of "
+                << _deltaUpload->_delta.size() << " bytes");
+    }
+    else
+    {
+        _deltaUpload.reset();
+
+        // Until the first upload, the host has the document as we downloaded it.
+        const std::string basePath = FileUtil::Stat(getRootFilePathUploaded()).exists()
+                                         ? getRootFilePathUploaded()
+                                         : getRootFilePath();
+        const std::size_t maxSize =
+            std::min<std::size_t>(DeltaUploadMaxFileSize, std::numeric_limits<int>::max());
+        const FileUtil::Stat baseStat(basePath);
+        if (baseStat.bad() || fileStat.size() > maxSize || baseStat.size() > maxSize)
+        {
+            LOG_DBG("WOPI::PutFile uploading [" << COOLWSD::anonymizeUrl(filePath)
+                                                << "] whole, without a base for its delta");
+            return false;
+        }
+
+        // Notify client via callback that the request is in progress...
+        asyncUploadCallback(
+            AsyncUpload(AsyncUpload::State::Running, UploadResult(UploadResult::Result::OK)));
+
+        // Reading and hashing both documents takes a while, so we do it off the
+        // poll thread, and upload the delta once it's posted back.
+        _deltaComputation = std::make_shared<DeltaComputation>(&socketPoll);
+        getDeltaPool().post(
+            [this, computation = _deltaComputation, basePath, baseSize = baseStat.size(),
+             filePath, fileSize = fileStat.size(),
+             fileModifiedTime = fileStat.modifiedTimepoint(), maxSize, auth, &lockCtx, attribs,
+             asyncUploadCallback]()
+            {
+                std::string base;
+                std::string target;
+                std::string delta;
+                if (FileUtil::readFile(basePath, base, maxSize) ==
+                        static_cast<ssize_t>(baseSize) &&
+                    FileUtil::readFile(filePath, target, maxSize) ==
+                        static_cast<ssize_t>(fileSize))
+                {
+                    delta = UploadDelta::compute(base, target);
+                    LOG_DBG("WOPI::PutFile delta of [" << COOLWSD::anonymizeUrl(filePath)
+                                                       << "] is " << delta.size() << " bytes for "
+                                                       << target.size());
+
+                    // Not worth the host applying it.
+                    if (delta.size() > target.size() * 9 / 10)
+                        delta.clear();
+                }
+                else
+                {
+                    LOG_WRN("Failed to read [" << COOLWSD::anonymizeUrl(filePath)
+                                               << "] to upload its delta, uploading it whole");
+                }
+
+                std::lock_guard<std::mutex> lock(computation->_mutex);
+                if (!computation->_socketPoll)
+                    return;
+
+                SocketPoll& socketPoll = *computation->_socketPoll;
+                socketPoll.addCallback(
+                    [this, computation, delta = std::move(delta), fileModifiedTime, fileSize,
+                     auth, &lockCtx, attribs, &socketPoll, asyncUploadCallback]() mutable
+                    {
+                        {
+                            // We may be gone, with the poll still running the callbacks.
+                            std::lock_guard<std::mutex> pollLock(computation->_mutex);
+                            if (!computation->_socketPoll)
+                                return;
+                        }
+
+                        uploadComputedDelta(std::move(delta), fileModifiedTime, fileSize, auth, lockCtx,
+                                            attribs, socketPoll, asyncUploadCallback);
+                    });
+            });
+
+        return true;
+    }
+
+    _deltaUpload->_startTime = std::chrono::steady_clock::now();
+
+    // Notify client via callback that the request is in progress...
+    asyncUploadCallback(
+        AsyncUpload(AsyncUpload::State::Running, UploadResult(UploadResult::Result::OK)));
+
+    uploadDeltaChunk(auth, lockCtx, attribs, socketPoll, asyncUploadCallback);
+    return true;
+}
+
+void WopiStorage::uploadComputedDelta(std::string delta,
+                                      std::chrono::system_clock::time_point fileModifiedTime,
+                                      std::size_t fileSize, const Authorization& auth,
+                                      LockContext& lockCtx, const Attributes& attribs,
+                                      SocketPoll& socketPoll,
+                                      const AsyncUploadCallback& asyncUploadCallback)
+{
+    _deltaComputation.reset();
+
+    if (delta.empty())
+    {
+        _uploadWhole = true;
+        uploadLocalFileToStorageAsync(auth, lockCtx, std::string(), std::string(),
+                                      /*isRename=*/false, attribs, socketPoll,
+                                      asyncUploadCallback);
+        return;
+    }
+
+    _deltaUpload = std::make_unique<DeltaUpload>(
+        DeltaUpload{ Util::rng::getHexString(16), std::move(delta), fileModifiedTime, fileSize, 0,
+                     0, 0, std::chrono::steady_clock::now() });
+    uploadDeltaChunk(auth, lockCtx, attribs, socketPoll, asyncUploadCallback);
+}
+
+void WopiStorage::uploadDeltaChunk(const Authorization& auth, LockContext& lockCtx,
+                                   const Attributes& attribs, SocketPoll& socketPoll,
+                                   const AsyncUploadCallback& asyncUploadCallback)
+{
+    assert(_deltaUpload && "Expected a delta to upload");
+    const std::size_t total = _deltaUpload->_delta.size();
+    const std::size_t offset = _deltaUpload->_offset;
+    const std::size_t length = std::min(DeltaUploadChunkSize, total - offset);
+
+    Poco::URI uriObject(getUri());
+    uriObject.setPath(uriObject.getPath() + "/contents");
+    auth.authorizeURI(uriObject);
+
+    const std::string uriAnonym = COOLWSD::anonymizeUrl(uriObject.toString());
+    LOG_INF("WOPI::PutFile uploading bytes " << offset << " to " << offset + length << " of the "
+                                             << total << " bytes delta of the "
+                                             << _deltaUpload->_fileSize
+                                             << " bytes document to URI via WOPI [" << uriAnonym
+                                             << ']');
+
+    try
+    {
+        assert(!_uploadHttpSession && "Unexpected to have an upload http::session");
+        _uploadHttpSession = StorageConnectionManager::getHttpSession(uriObject);
+
+        http::Request httpRequest = initHttpRequest(uriObject, auth);
+        httpRequest.setVerb(http::Request::VERB_POST);
+
+        http::Header& httpHeader = httpRequest.header();
+        if (lockCtx.supportsLocks())
+            httpHeader.set("X-WOPI-Lock", lockCtx.lockToken());
+
+        setPutFileHeaders(httpHeader, attribs);
+
+        // The host resumes from, or reports, the offset, until the last
+        // chunk, which it applies to the document as it has it.
+        httpHeader.set("X-COOL-WOPI-Upload-Encoding", "delta");
+        httpHeader.set("X-COOL-WOPI-Upload-Id", _deltaUpload->_id);
+        httpHeader.set("X-COOL-WOPI-Upload-Offset", std::to_string(offset));
+        httpHeader.set("X-COOL-WOPI-Upload-Length", std::to_string(total));
+
+        httpRequest.setBody(_deltaUpload->_delta.substr(offset, length),
+                            "application/octet-stream");
+
+        http::Session::FinishedCallback finishedCallback =
+            [this, auth, &lockCtx, attribs, &socketPoll, asyncUploadCallback, uriAnonym, offset,
+             length](const std::shared_ptr<http::Session>& httpSession)
+        {
+            // Retire.
+            _uploadHttpSession.reset();
+
+            assert(httpSession && "Expected a valid http::Session");
+            const std::shared_ptr<const http::Response> httpResponse = httpSession->response();
+            const http::StatusCode statusCode = httpResponse->statusLine().statusCode();
+
+            assert(_deltaUpload && "Expected a delta being uploaded");
+            const std::size_t deltaSize = _deltaUpload->_delta.size();
+            const std::string hostOffsetHeader = httpResponse->get("X-COOL-WOPI-Upload-Offset");
+            const std::size_t hostOffset =
+                hostOffsetHeader.empty() ? offset + length
+                                         : std::strtoull(hostOffsetHeader.c_str(), nullptr, 10);
+
+            _wopiSaveDuration = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - _deltaUpload->_startTime);
+
+            // The host has all of the delta, but took it without a final response.
+            const bool complete =
+                statusCode == http::StatusCode::Accepted && hostOffset == deltaSize;
+            if (complete)
+                LOG_WRN("WOPI::PutFile host took all of the " << deltaSize
+                                                              << " bytes delta, as complete");
+
+            if (!complete && (statusCode == http::StatusCode::Accepted ||
+                              statusCode == http::StatusCode::RangeNotSatisfiable))
+            {
+                // Took the chunk, or wants the delta from another offset.
+                if (statusCode == http::StatusCode::Accepted)
+                    _deltaUpload->_sent += length;
+
+                if (hostOffset < deltaSize &&
+                    (statusCode == http::StatusCode::Accepted ? hostOffset > offset
+                                                              : ++_deltaUpload->_resumes <= 3))
+                {
+                    LOG_TRC("WOPI::PutFile host has " << hostOffset << " of the " << deltaSize
+                                                      << " bytes delta");
+                    _deltaUpload->_offset = hostOffset;
+                    uploadDeltaChunk(auth, lockCtx, attribs, socketPoll, asyncUploadCallback);
+                    return;
+                }
+
+                LOG_WRN("WOPI::PutFile host is at " << hostOffset << " of the " << deltaSize
+                                                    << " bytes delta, after " << offset
+                                                    << ", uploading the document whole");
+            }
+            else if (statusCode == http::StatusCode::PreconditionFailed)
+            {
+                // The host doesn't have the version we have the delta against.
+                LOG_WRN("WOPI::PutFile host can't apply the delta to its document, uploading "
+                        "the document whole");
+            }
+            else if (statusCode == http::StatusCode::BadRequest ||
+                     statusCode == http::StatusCode::UnsupportedMediaType ||
+                     statusCode == http::StatusCode::NotImplemented ||
+                     (statusCode == http::StatusCode::OK && offset + length < deltaSize))
+            {
+                LOG_WRN("WOPI::PutFile host doesn't take deltas after all: "
+                        << statusCode << ", uploading the documents whole from now on");
+                _supportsDeltaUpload = false;
+            }
+            else
+            {
+                if (statusCode == http::StatusCode::OK || complete)
+                    _deltaUpload->_sent += length;
+
+                const std::size_t size = _deltaUpload->_fileSize;
+                WopiUploadDetails details = { COOLWSD::anonymizeUrl(getRootFilePathUploading()),
+                                              uriAnonym,
+                                              httpResponse->statusLine().reasonPhrase(),
+                                              complete ? http::StatusCode::OK : statusCode,
+                                              size,
+                                              /*isSaveAs=*/false,
+                                              /*isRename=*/false };
+
+                const StorageBase::UploadResult res =
+                    handleUploadToStorageResponse(details, httpResponse->getBody());
+                if (res.getResult() == UploadResult::Result::OK)
+                {
+                    LOG_INF("WOPI::PutFile uploaded the " << size << " bytes document as "
+                                                          << _deltaUpload->_sent
+                                                          << " bytes of delta");
+                    addUploadedBytes(_deltaUpload->_sent, size);
+                    _deltaUpload.reset();
+                    keepUploadedFile(getRootFilePathUploading());
+                }
+                else if (httpResponse->statusLine().statusCategory() !=
+                         http::StatusLine::StatusCodeClass::Server_Error)
+                {
+                    // Only resume after the host failed: it may not want it.
+                    _deltaUpload.reset();
+                }
+
+                // Fire the callback to our client (DocBroker, typically).
+                asyncUploadCallback(AsyncUpload(AsyncUpload::State::Complete, res));
+                return;
+            }
+
+            _deltaUpload.reset();
+            _uploadWhole = true;
+            uploadLocalFileToStorageAsync(auth, lockCtx, std::string(), std::string(),
+                                          /*isRename=*/false, attribs, socketPoll,
+                                          asyncUploadCallback);
+        };
+
+        _uploadHttpSession->setFinishedHandler(std::move(finishedCallback));
+
+        LOG_DBG("WOPI::PutFile async delta upload request: " << httpRequest.header().toString());
+
+        _uploadHttpSession->setConnectFailHandler(
+            [asyncUploadCallback](const std::shared_ptr<http::Session>& /* httpSession */)
+            {
+                // The delta is kept, to resume.
+                LOG_ERR("Cannot connect for uploading to wopi storage.");
+                asyncUploadCallback(
+                    AsyncUpload(AsyncUpload::State::Error,
+                                UploadResult(UploadResult::Result::FAILED, "Connection failed.")));
+            });
+
+        // Make the request.
+        _uploadHttpSession->asyncRequest(httpRequest, socketPoll);
+        return;
+    }
+    catch (const std::exception& ex)
+    {
+        LOG_ERR("WOPI::PutFile cannot upload the delta to WOPI storage uri ["
+                << uriAnonym << "]. Error: " << ex.what());
+        _uploadHttpSession.reset();
+        _deltaUpload.reset();
+    }
+
+    asyncUploadCallback(AsyncUpload(
+        AsyncUpload::State::Error, UploadResult(UploadResult::Result::FAILED, "Internal error.")));
+}
+
 StorageBase::UploadResult
 WopiStorage::handleUploadToStorageResponse(const WopiUploadDetails& details,
                                            std::string responseString)
@@ -25,6 +25,7 @@
 
 #include <chrono>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 
@@ -85,6 +86,7 @@ public:
         bool getEnableShare() const { return _enableShare; }
         bool getSupportsRename() const { return _supportsRename; }
         bool getSupportsLocks() const { return _supportsLocks; }
+        bool getSupportsDeltaUpload() const { return _supportsDeltaUpload; }
         bool getUserCanRename() const { return _userCanRename; }
         bool getUserCanOnlyComment() const { return _userCanOnlyComment; }
 
@@ -174,6 +176,8 @@ public:
         bool _supportsLocks = false;
         /// If WOPI host supports rename
         bool _supportsRename = false;
+        /// If WOPI host applies the deltas we upload, rather than the whole document
+        bool _supportsDeltaUpload = false;
         /// If user is allowed to rename the document
         bool _userCanRename = false;
         /// If user is considered as admin on the integrator side
@@ -189,6 +193,8 @@ public:
                 const std::string& jailPath)
         : StorageBase(uri, localStorePath, jailPath)
         , _wopiSaveDuration(std::chrono::milliseconds::zero())
+        , _supportsDeltaUpload(false)
+        , _uploadWhole(false)
         , _utf7Converter("UTF-8", "UTF-7")
         , _legacyServer(ConfigUtil::getConfigValue<bool>("storage.wopi.is_legacy_server", false))
     {
@@ -197,6 +203,8 @@ public:
                 << COOLWSD::anonymizeUrl(uri.toString()) << "], legacy server: " << _legacyServer);
     }
 
+    ~WopiStorage() override;
+
     /// Signifies if the server is legacy or not, based on the headers
     /// it sent us on first contact.
     bool isLegacyServer() const { return _legacyServer; }
@@ -220,6 +228,11 @@ public:
     std::string downloadStorageFileToLocal(const Authorization& auth, LockContext& lockCtx,
                                            const std::string& templateUri) override;
 
+    bool downloadStorageFileToLocalAsync(const Authorization& auth, LockContext& lockCtx,
+                                         const std::string& templateUri, SocketPoll& socketPoll,
+                                         const DownloadProgressCallback& progressCallback,
+                                         const AsyncDownloadCallback& asyncDownloadCallback) override;
+
     std::size_t
     uploadLocalFileToStorageAsync(const Authorization& auth, LockContext& lockCtx,
                                   const std::string& saveAsPath, const std::string& saveAsFilename,
@@ -267,6 +280,81 @@ private:
     std::string downloadDocument(const Poco::URI& uriObject, const std::string& uriAnonym,
                                  const Authorization& auth, unsigned redirectLimit);
 
+    /// Download the document from the given URI without blocking, following
+    /// redirects, and calls @onDone with the result, from @socketPoll.
+    void asyncDownloadDocument(const Poco::URI& uriObject, const std::string& uriAnonym,
+                               const Authorization& auth, unsigned redirectLimit,
+                               SocketPoll& socketPoll,
+                               const DownloadProgressCallback& progressCallback,
+                               const std::function<void(const DownloadResult&)>& onDone);
+
+    /// Sets the local path to download to, creating its directory.
+    /// Throws StorageSpaceLowException when the disk is almost full.
+    void prepareDownloadPath();
+
+    /// Logs the download, installs the certificate of the WOPI host for
+    /// the kit, and returns the jailed path of the document.
+    std::string completeDownload(const std::string& uriAnonym,
+                                 std::chrono::milliseconds duration, const std::string& wopiCert,
+                                 const std::string& subjectHash);
+
+    /// Sets the headers of PutFile, other than the lock.
+    void setPutFileHeaders(http::Header& httpHeader, const Attributes& attribs) const;
+
+    /// The copy of the document as the host has it, which we upload the deltas against.
+    /// Only kept once uploaded: until then, the host has the document we downloaded.
+    std::string getRootFilePathUploaded() const { return getRootFilePath() + ".uploaded"; }
+
+    /// Keeps @filePath, just uploaded, as the base of the next delta.
+    void keepUploadedFile(const std::string& filePath);
+
+    /// Starts, or resumes, uploading the delta of the document, in chunks.
+    /// Returns false, without invoking the callback, to upload it whole.
+    bool uploadDeltaAsync(const Authorization& auth, LockContext& lockCtx,
+                          const Attributes& attribs, SocketPoll& socketPoll,
+                          const AsyncUploadCallback& asyncUploadCallback);
+
+    /// Starts uploading the @delta, computed off the poll thread, of the document
+    /// as it was modified at @fileModifiedTime, or the document whole, when empty.
+    void uploadComputedDelta(std::string delta,
+                             std::chrono::system_clock::time_point fileModifiedTime,
+                             std::size_t fileSize, const Authorization& auth,
+                             LockContext& lockCtx, const Attributes& attribs,
+                             SocketPoll& socketPoll,
+                             const AsyncUploadCallback& asyncUploadCallback);
+
+    /// Sends the next chunk of the delta, and the rest once it's taken.
+    void uploadDeltaChunk(const Authorization& auth, LockContext& lockCtx,
+                          const Attributes& attribs, SocketPoll& socketPoll,
+                          const AsyncUploadCallback& asyncUploadCallback);
+
+    /// A delta being uploaded in chunks, kept after a failure to resume it.
+    struct DeltaUpload
+    {
+        std::string _id; ///< For the host to put the chunks together.
+        std::string _delta;
+        /// Of the document it's the delta of.
+        std::chrono::system_clock::time_point _fileModifiedTime;
+        std::size_t _fileSize;
+        std::size_t _offset; ///< Up to which the host has the delta.
+        std::size_t _sent; ///< The bytes of the chunks the host took.
+        unsigned _resumes; ///< From where the host asked, rather than where we were.
+        std::chrono::steady_clock::time_point _startTime;
+    };
+
+    /// A delta being computed, which is posted back to @_socketPoll,
+    /// unless we are gone by then.
+    struct DeltaComputation
+    {
+        explicit DeltaComputation(SocketPoll* socketPoll)
+            : _socketPoll(socketPoll)
+        {
+        }
+
+        std::mutex _mutex;
+        SocketPoll* _socketPoll;
+    };
+
 private:
     /// A URl provided by the WOPI host to use for GetFile.
     std::string _fileUrl;
@@ -277,6 +365,21 @@ private:
     /// The http::Session used for uploading asynchronously.
     std::shared_ptr<http::Session> _uploadHttpSession;
 
+    /// If WOPI host applies the deltas we upload, until it fails to.
+    bool _supportsDeltaUpload;
+
+    /// The delta being uploaded, or that failed to.
+    std::unique_ptr<DeltaUpload> _deltaUpload;
+
+    /// The delta being computed, before it's uploaded.
+    std::shared_ptr<DeltaComputation> _deltaComputation;
+
+    /// To upload the document whole next, as the host didn't take its delta.
+    bool _uploadWhole;
+
+    /// The http::Session used for downloading asynchronously.
+    std::shared_ptr<http::Session> _downloadHttpSession;
+
     /// The http::Session used for locking asynchronously.
     std::shared_ptr<http::Session> _lockHttpSession;
 